@@ -0,0 +1,308 @@
+#include <fmt/core.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "aabb.h"
+#include "benchmark_table.h"
+#include "bvh.h"
+#include "camera.h"
+#include "random/perlin_noise.h"
+
+// compares the median-split BVH the engine used to build with the binned SAH
+// one on a terrain mesh: the build time and the cost of frustum and ray
+// queries, usage: bvh-benchmark [grid size] [number of rays]
+
+// the builds take seconds, the queries milliseconds
+constexpr int kBuildRepetitions = 1;
+constexpr int kQueryRepetitions = 5;
+const BenchmarkTable kBuildTable(kBuildRepetitions, "triangles");
+const BenchmarkTable kQueryTable(kQueryRepetitions, "queries");
+constexpr float kTerrainHeight = 64;
+
+struct Vertex {
+  glm::vec3 position;
+};
+
+// the BVH before the binned SAH build: the longest axis of each node is
+// sorted by the triangle centroids and split in half, down to leaves of 4096
+// triangles, and the nodes are allocated one by one
+namespace median_split {
+
+constexpr uint32_t kMinTrianglesInNode = 1 << 12;
+
+struct Node {
+  AABB aabb;
+  uint32_t split_axis = -1;
+  std::unique_ptr<Node> left = nullptr, right = nullptr;
+  uint32_t *triangle_indices;
+  uint32_t num_triangles;
+};
+
+class Tree {
+ public:
+  Tree(const Vertex *vertices, const glm::uvec3 *triangles,
+       uint32_t num_triangles)
+      : vertices_(vertices), triangles_(triangles) {
+    triangle_indices_.resize(num_triangles);
+    for (uint32_t i = 0; i < num_triangles; i++) triangle_indices_[i] = i;
+    root_ = Build(triangle_indices_.data(), num_triangles);
+  }
+
+  // visitor(const Node*) is called for every leaf intersecting the frustum
+  template <typename Visitor>
+  void Search(const Frustum &frustum, Visitor visitor) const {
+    Search(root_.get(), frustum, visitor);
+  }
+
+  // the closest hit, the near child first
+  RayHit Intersect(const Ray &ray) const {
+    RayHit hit;
+    hit.t = ray.t_max;
+    Intersect(root_.get(), ray, 1.0f / ray.direction, &hit);
+    return hit;
+  }
+
+ private:
+  std::unique_ptr<Node> Build(uint32_t *triangle_indices,
+                              uint32_t num_triangles) {
+    auto node = std::make_unique<Node>();
+    node->aabb.min = glm::vec3(INFINITY);
+    node->aabb.max = glm::vec3(-INFINITY);
+    for (uint32_t i = 0; i < num_triangles; i++) {
+      for (int j = 0; j < 3; j++) {
+        glm::vec3 p = vertices_[triangles_[triangle_indices[i]][j]].position;
+        node->aabb.min = glm::min(node->aabb.min, p);
+        node->aabb.max = glm::max(node->aabb.max, p);
+      }
+    }
+    node->triangle_indices = triangle_indices;
+    node->num_triangles = num_triangles;
+    if (num_triangles <= kMinTrianglesInNode) return node;
+
+    glm::vec3 range = node->aabb.max - node->aabb.min;
+    node->split_axis = 0;
+    for (int i = 1; i <= 2; i++) {
+      if (range[i] > range[node->split_axis]) node->split_axis = i;
+    }
+    uint32_t axis = node->split_axis;
+    std::sort(triangle_indices, triangle_indices + num_triangles,
+              [&](uint32_t a, uint32_t b) {
+                return Centroid(a)[axis] < Centroid(b)[axis];
+              });
+
+    node->left = Build(triangle_indices, num_triangles / 2);
+    node->right = Build(triangle_indices + num_triangles / 2,
+                        (num_triangles + 1) / 2);
+    return node;
+  }
+
+  glm::vec3 Centroid(uint32_t id) const {
+    const glm::uvec3 &triangle = triangles_[id];
+    return (vertices_[triangle[0]].position + vertices_[triangle[1]].position +
+            vertices_[triangle[2]].position) /
+           3.0f;
+  }
+
+  template <typename Visitor>
+  static void Search(const Node *node, const Frustum &frustum,
+                     Visitor &visitor) {
+    if (!node->aabb.IsOnFrustum(frustum)) return;
+    if (node->split_axis == -1) {
+      visitor(node);
+    } else {
+      Search(node->left.get(), frustum, visitor);
+      Search(node->right.get(), frustum, visitor);
+    }
+  }
+
+  void Intersect(const Node *node, const Ray &ray, glm::vec3 inv_direction,
+                 RayHit *hit) const {
+    float t_entry = ray.t_min, t_exit = hit->t;
+    for (int k = 0; k < 3; k++) {
+      float t0 = (node->aabb.min[k] - ray.origin[k]) * inv_direction[k];
+      float t1 = (node->aabb.max[k] - ray.origin[k]) * inv_direction[k];
+      t_entry = std::max(t_entry, std::min(t0, t1));
+      t_exit = std::min(t_exit, std::max(t0, t1));
+    }
+    if (t_entry > t_exit) return;
+
+    if (node->split_axis != -1) {
+      bool right_first = ray.direction[node->split_axis] < 0;
+      const Node *first = right_first ? node->right.get() : node->left.get();
+      const Node *second = right_first ? node->left.get() : node->right.get();
+      Intersect(first, ray, inv_direction, hit);
+      Intersect(second, ray, inv_direction, hit);
+      return;
+    }
+
+    // Moller-Trumbore, one triangle at a time
+    for (uint32_t i = 0; i < node->num_triangles; i++) {
+      uint32_t id = node->triangle_indices[i];
+      glm::vec3 p0 = vertices_[triangles_[id][0]].position;
+      glm::vec3 e1 = vertices_[triangles_[id][1]].position - p0;
+      glm::vec3 e2 = vertices_[triangles_[id][2]].position - p0;
+      glm::vec3 p = glm::cross(ray.direction, e2);
+      float det = glm::dot(e1, p);
+      if (std::abs(det) <= 1e-12f) continue;
+      float inv_det = 1.0f / det;
+      glm::vec3 s = ray.origin - p0;
+      glm::vec3 q = glm::cross(s, e1);
+      float u = glm::dot(s, p) * inv_det;
+      float v = glm::dot(ray.direction, q) * inv_det;
+      float t = glm::dot(e2, q) * inv_det;
+      if (u >= 0 && v >= 0 && u + v <= 1 && t > ray.t_min && t < hit->t) {
+        *hit = {t, u, v, id};
+      }
+    }
+  }
+
+  const Vertex *vertices_;
+  const glm::uvec3 *triangles_;
+  std::unique_ptr<Node> root_;
+  std::vector<uint32_t> triangle_indices_;
+};
+
+}  // namespace median_split
+
+// a heightfield of (size + 1)^2 vertices from 8 octaves of Perlin noise, two
+// triangles per cell
+void GenerateTerrain(uint32_t size, std::vector<Vertex> *vertices,
+                     std::vector<glm::uvec3> *triangles) {
+  PerlinNoise noise(256, 0);
+  std::vector<float> heights((size + 1) * (size + 1));
+  noise.Turbulent(glm::vec2(0), glm::vec2(8.0f / size), 0.5f, size + 1,
+                  size + 1, 8, heights.data());
+
+  vertices->resize(heights.size());
+  for (uint32_t y = 0; y <= size; y++) {
+    for (uint32_t x = 0; x <= size; x++) {
+      uint32_t i = y * (size + 1) + x;
+      (*vertices)[i].position = glm::vec3(x, heights[i] * kTerrainHeight, y);
+    }
+  }
+  triangles->clear();
+  triangles->reserve(2 * size * size);
+  for (uint32_t y = 0; y < size; y++) {
+    for (uint32_t x = 0; x < size; x++) {
+      uint32_t i = y * (size + 1) + x, j = i + size + 1;
+      triangles->emplace_back(i, j, i + 1);
+      triangles->emplace_back(i + 1, j, j + 1);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t size = argc > 1 ? std::stoul(argv[1]) : 1024;
+  uint32_t num_rays = argc > 2 ? std::stoul(argv[2]) : 1 << 12;
+
+  std::vector<Vertex> vertices;
+  std::vector<glm::uvec3> triangles;
+  GenerateTerrain(size, &vertices, &triangles);
+  uint32_t num_triangles = triangles.size();
+  fmt::print("terrain {}x{}, {} triangles, {} threads\n", size, size,
+             num_triangles, std::thread::hardware_concurrency());
+
+  // build
+  std::unique_ptr<median_split::Tree> old_bvh;
+  std::unique_ptr<BVH<Vertex>> new_bvh;
+  fmt::print("build:\n");
+  double baseline = kBuildTable.Measure([&]() {
+    old_bvh = std::make_unique<median_split::Tree>(
+        vertices.data(), triangles.data(), num_triangles);
+  });
+  kBuildTable.PrintRow("median split", baseline, baseline, num_triangles);
+  double milliseconds = kBuildTable.Measure([&]() {
+    new_bvh = std::make_unique<BVH<Vertex>>(vertices.data(), triangles.data(),
+                                            num_triangles);
+  });
+  kBuildTable.PrintRow("binned SAH", milliseconds, baseline, num_triangles);
+  fmt::print("  {} nodes, SAH cost {:.2f}\n", new_bvh->nodes().size(),
+             new_bvh->SAHCost());
+
+  // frustums of a camera walking over the terrain, looking ahead and down
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> coordinate(0, size);
+  std::uniform_real_distribution<float> angle(0, 2 * glm::pi<float>());
+  constexpr uint32_t kNumFrustums = 64;
+  std::vector<Frustum> frustums;
+  for (uint32_t i = 0; i < kNumFrustums; i++) {
+    glm::vec3 eye(coordinate(rng), 2 * kTerrainHeight, coordinate(rng));
+    float yaw = angle(rng);
+    glm::vec3 target =
+        eye + glm::vec3(std::cos(yaw), -0.5f, std::sin(yaw)) * 100.0f;
+    frustums.push_back(Frustum::FromViewProjectionMatrix(
+        glm::perspective(glm::radians(60.0f), 16.0f / 9, 0.1f, size * 0.25f) *
+        glm::lookAt(eye, target, glm::vec3(0, 1, 0))));
+  }
+
+  fmt::print("frustum search, {} frustums:\n", kNumFrustums);
+  uint64_t old_triangles = 0, new_triangles = 0;
+  baseline = kQueryTable.Measure([&]() {
+    old_triangles = 0;
+    for (const auto &frustum : frustums) {
+      old_bvh->Search(frustum, [&](const median_split::Node *leaf) {
+        old_triangles += leaf->num_triangles;
+      });
+    }
+  });
+  kQueryTable.PrintRow("median split", baseline, baseline, kNumFrustums);
+  milliseconds = kQueryTable.Measure([&]() {
+    new_triangles = 0;
+    for (const auto &frustum : frustums) {
+      new_bvh->Search(frustum, [&](const BVHNode *leaf) {
+        new_triangles += leaf->num_triangles;
+      });
+    }
+  });
+  kQueryTable.PrintRow("binned SAH", milliseconds, baseline, kNumFrustums);
+  fmt::print("  triangles in the visible leaves: {} and {}\n",
+             old_triangles / kNumFrustums, new_triangles / kNumFrustums);
+
+  // rays from above to random points, at grazing to steep angles
+  std::uniform_real_distribution<float> slope(0.1f, 1);
+  std::vector<Ray> rays;
+  for (uint32_t i = 0; i < num_rays; i++) {
+    glm::vec3 origin(coordinate(rng), 2 * kTerrainHeight, coordinate(rng));
+    float yaw = angle(rng);
+    rays.emplace_back(origin,
+                      glm::vec3(std::cos(yaw), -slope(rng), std::sin(yaw)));
+  }
+
+  fmt::print("closest ray hits, {} rays:\n", num_rays);
+  std::vector<RayHit> old_hits(num_rays), new_hits(num_rays);
+  baseline = kQueryTable.Measure([&]() {
+    for (uint32_t i = 0; i < num_rays; i++) {
+      old_hits[i] = old_bvh->Intersect(rays[i]);
+    }
+  });
+  kQueryTable.PrintRow("median split", baseline, baseline, num_rays);
+  milliseconds = kQueryTable.Measure([&]() {
+    for (uint32_t i = 0; i < num_rays; i++) {
+      new_hits[i] = new_bvh->Intersect(vertices.data(), triangles.data(),
+                                       rays[i]);
+    }
+  });
+  kQueryTable.PrintRow("binned SAH", milliseconds, baseline, num_rays);
+
+  uint32_t num_hits = 0, num_mismatches = 0;
+  for (uint32_t i = 0; i < num_rays; i++) {
+    num_hits += new_hits[i].hit();
+    bool same = old_hits[i].hit() == new_hits[i].hit() &&
+                (!new_hits[i].hit() ||
+                 std::abs(old_hits[i].t - new_hits[i].t) <=
+                     1e-4f * std::max(1.0f, new_hits[i].t));
+    num_mismatches += !same;
+  }
+  fmt::print("  {} hits, {} different from the median split BVH\n", num_hits,
+             num_mismatches);
+  return num_mismatches == 0 ? 0 : 1;
+}
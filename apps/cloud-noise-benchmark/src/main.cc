@@ -0,0 +1,109 @@
+#include <fmt/core.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "benchmark_table.h"
+#include "clouds/cloud_noise.h"
+#include "cpu_features.h"
+#include "fnv_hash.h"
+
+// times the scalar and AVX2 paths of the cloud noise and validates the
+// volumes: bitwise identical, and seamless across their borders, usage:
+// cloud-noise-benchmark [perlin-worley size] [worley size] [weather size]
+
+constexpr int kRepetitions = 3;
+const BenchmarkTable kTable(kRepetitions, "texels");
+// the seams may differ from the rest by this much before they show
+constexpr double kMaxSeamRatio = 1.25;
+
+// of all the levels
+uint64_t Checksum(const cloud_noise::Volume &volume) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (const auto &level : volume.levels) {
+    FNVHash(&hash, level.data(), level.size());
+  }
+  return hash;
+}
+
+// the mean difference of the neighbours across the border of level 0 over
+// the one between the others, per axis, 1 when the volume tiles
+double SeamRatio(const cloud_noise::Volume &volume, int axis) {
+  uint32_t size[3] = {volume.width, volume.height, volume.depth};
+  if (size[axis] < 3) return 1;
+  const std::vector<uint8_t> &texels = volume.levels[0];
+  auto at = [&](uint32_t x, uint32_t y, uint32_t z, int c) {
+    return int32_t(texels[((size_t(z) * size[1] + y) * size[0] + x) * 4 + c]);
+  };
+  double sums[2] = {}, counts[2] = {};
+  for (uint32_t z = 0; z < size[2]; z++) {
+    for (uint32_t y = 0; y < size[1]; y++) {
+      for (uint32_t x = 0; x < size[0]; x++) {
+        uint32_t p[3] = {x, y, z};
+        bool seam = p[axis] == 0;
+        p[axis] = seam ? size[axis] - 1 : p[axis] - 1;
+        for (int c = 0; c < 4; c++) {
+          sums[seam] += std::abs(at(x, y, z, c) - at(p[0], p[1], p[2], c));
+        }
+        counts[seam] += 4;
+      }
+    }
+  }
+  double interior = sums[0] / counts[0], seam = sums[1] / counts[1];
+  return interior > 0 ? seam / interior : 1;
+}
+
+// times the volume with and without AVX2, returns whether both are the same
+// and tile
+bool Run(const std::string &name,
+         const std::function<cloud_noise::Volume()> &generate) {
+  cloud_noise::Volume volumes[2];
+  double milliseconds[2];
+  for (bool avx2 : {false, true}) {
+    cpu_features::SetAVX2Enabled(avx2);
+    milliseconds[avx2] = kTable.Measure([&]() { volumes[avx2] = generate(); });
+  }
+  cpu_features::SetAVX2Enabled(true);
+
+  const cloud_noise::Volume &volume = volumes[0];
+  size_t num_texels = size_t(volume.width) * volume.height * volume.depth;
+  fmt::print("{} {}x{}x{}, {} levels:\n", name, volume.width, volume.height,
+             volume.depth, volume.num_levels());
+  kTable.PrintRow("scalar", milliseconds[0], milliseconds[0], num_texels);
+  if (cpu_features::AVX2Supported()) {
+    kTable.PrintRow("AVX2", milliseconds[1], milliseconds[0], num_texels);
+  }
+
+  bool identical = volumes[0].levels == volumes[1].levels;
+  bool tiles = true;
+  fmt::print("  checksum {:016x}, AVX2 {}, seams", Checksum(volume),
+             identical ? "identical" : "DIFFERENT");
+  for (int axis = 0; axis < 3; axis++) {
+    double ratio = SeamRatio(volume, axis);
+    tiles &= ratio < kMaxSeamRatio;
+    fmt::print(" {}: {:.3f}", "xyz"[axis], ratio);
+  }
+  fmt::print(" {}\n", tiles ? "tileable" : "NOT TILEABLE");
+  return identical && tiles;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t perlin_worley_size = argc > 1 ? std::stoul(argv[1]) : 128;
+  uint32_t worley_size = argc > 2 ? std::stoul(argv[2]) : 32;
+  uint32_t weather_size = argc > 3 ? std::stoul(argv[3]) : 1024;
+
+  bool all_valid = true;
+  all_valid &= Run("PerlinWorley", [&]() {
+    return cloud_noise::PerlinWorley(perlin_worley_size);
+  });
+  all_valid &=
+      Run("Worley", [&]() { return cloud_noise::Worley(worley_size); });
+  all_valid &= Run("Weather", [&]() {
+    return cloud_noise::Weather(weather_size, 0.8f);
+  });
+  return all_valid ? 0 : 1;
+}
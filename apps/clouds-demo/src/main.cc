@@ -97,7 +97,7 @@ void Init(uint32_t width, uint32_t height) {
       std::make_unique<AmbientLight>(glm::vec3(0.04)));
 
   oit_render_quad_ptr.reset(new OITRenderQuad(width, height));
-  clouds_ptr.reset(new Clouds(width, height));
+  clouds_ptr.reset(new Clouds(width, height, "resources/cache/clouds.noise"));
 
   controller.reset(new Controller(camera_ptr.get(), oit_render_quad_ptr.get(),
                                   clouds_ptr.get(), width, height, window));
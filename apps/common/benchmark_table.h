@@ -0,0 +1,60 @@
+#ifndef APPS_COMMON_BENCHMARK_TABLE_H_
+#define APPS_COMMON_BENCHMARK_TABLE_H_
+
+#include <fmt/core.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <string>
+
+// the timing and the rows of the tables printed by the benchmark apps, e.g.
+//   name    1.234 ms    5.67 Munits/s    8.9x
+class BenchmarkTable {
+ public:
+  // unit names what is counted, e.g. "boxes" for millions of boxes per second
+  BenchmarkTable(int num_repetitions, const std::string &unit)
+      : num_repetitions_(num_repetitions), unit_(unit) {}
+
+  // the fastest of num_repetitions runs, in milliseconds
+  double Measure(const std::function<void()> &f) const {
+    double best = INFINITY;
+    for (int i = 0; i < num_repetitions_; i++) {
+      auto start = std::chrono::steady_clock::now();
+      f();
+      std::chrono::duration<double, std::milli> duration =
+          std::chrono::steady_clock::now() - start;
+      best = std::min(best, duration.count());
+    }
+    return best;
+  }
+
+  // the time and the throughput of count units, and the speedup over the
+  // baseline in milliseconds
+  void PrintRow(const std::string &name, double milliseconds, double baseline,
+                size_t count) const {
+    PrintTime(name, milliseconds, count);
+    fmt::print("{:>9.1f}x\n", baseline / milliseconds);
+  }
+
+  // without a baseline
+  void PrintRow(const std::string &name, double milliseconds,
+                size_t count) const {
+    PrintTime(name, milliseconds, count);
+    fmt::print("\n");
+  }
+
+ private:
+  void PrintTime(const std::string &name, double milliseconds,
+                 size_t count) const {
+    fmt::print("  {:<28}{:>10.3f} ms{:>10.2f} M{}/s", name, milliseconds,
+               count / milliseconds * 1e-3, unit_);
+  }
+
+  int num_repetitions_;
+  std::string unit_;
+};
+
+#endif
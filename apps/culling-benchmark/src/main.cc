@@ -0,0 +1,187 @@
+#include <fmt/core.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "aabb.h"
+#include "batch_culling.h"
+#include "benchmark_table.h"
+#include "camera.h"
+#include "cpu_features.h"
+#include "obb.h"
+
+// compares the batch culling kernels with the per-object AABB / OBB methods,
+// usage: culling-benchmark [number of boxes]
+
+constexpr int kRepetitions = 10;
+const BenchmarkTable kTable(kRepetitions, "boxes");
+
+// runs the kernel with the scalar and, if supported, the AVX2 version,
+// returns whether both masks equal the expected one
+bool CompareBatch(const std::function<void(std::vector<uint32_t> *)> &kernel,
+                  const std::vector<uint32_t> &expected, double baseline,
+                  uint32_t num_boxes) {
+  bool equal = true;
+  for (bool avx2 : {false, true}) {
+    if (avx2 && !cpu_features::AVX2Supported()) {
+      fmt::print("  {:<20}not supported by this CPU\n", "batch AVX2");
+      continue;
+    }
+    cpu_features::SetAVX2Enabled(avx2);
+    std::vector<uint32_t> mask;
+    double milliseconds = kTable.Measure([&]() { kernel(&mask); });
+    kTable.PrintRow(avx2 ? "batch AVX2" : "batch scalar", milliseconds,
+                    baseline, num_boxes);
+    equal = equal && mask == expected;
+  }
+  cpu_features::SetAVX2Enabled(true);
+  return equal;
+}
+
+std::vector<uint32_t> ToMask(const std::vector<bool> &results) {
+  std::vector<uint32_t> mask((results.size() + 31) / 32, 0);
+  for (size_t i = 0; i < results.size(); i++) {
+    mask[i / 32] |= uint32_t(results[i]) << (i % 32);
+  }
+  return mask;
+}
+
+glm::mat3 RandomRotation(std::mt19937 &rng) {
+  std::uniform_real_distribution<float> angle(0, 2 * glm::pi<float>());
+  std::uniform_real_distribution<float> component(-1, 1);
+  glm::vec3 axis(component(rng), component(rng), component(rng));
+  if (glm::dot(axis, axis) < 1e-6f) axis = glm::vec3(0, 1, 0);
+  return glm::mat3(glm::rotate(glm::mat4(1), angle(rng), axis));
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t num_boxes = argc > 1 ? std::stoul(argv[1]) : 1 << 20;
+
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> position(-500, 500);
+  std::uniform_real_distribution<float> size(0.1f, 20);
+  std::uniform_real_distribution<float> scale(0.5f, 2);
+
+  std::vector<AABB> aabbs(num_boxes);
+  std::vector<glm::mat4> transforms(num_boxes);
+  std::vector<OBB> obbs(num_boxes);
+  batch_culling::AABBArrays aabb_arrays;
+  batch_culling::OBBArrays obb_arrays;
+  aabb_arrays.Resize(num_boxes);
+  obb_arrays.Resize(num_boxes);
+  for (uint32_t i = 0; i < num_boxes; i++) {
+    glm::vec3 min(position(rng), position(rng), position(rng));
+    aabbs[i] = AABB(min, min + glm::vec3(size(rng), size(rng), size(rng)));
+    aabb_arrays.Set(i, aabbs[i]);
+
+    glm::mat4 transform = glm::mat4(RandomRotation(rng)) * scale(rng);
+    transform[3] = glm::vec4(position(rng), position(rng), position(rng), 1);
+    transforms[i] = transform;
+
+    obbs[i] = OBB(aabbs[i]);
+    obbs[i].set_rotation(RandomRotation(rng));
+    obb_arrays.Set(i, obbs[i]);
+  }
+
+  fmt::print("{} boxes, AVX2 {}\n", num_boxes,
+             cpu_features::AVX2Supported() ? "supported" : "not supported");
+  bool all_equal = true;
+
+  // frustum test, a camera looking into the box cloud from its side
+  {
+    Frustum frustum = Frustum::FromViewProjectionMatrix(
+        glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 500.0f) *
+        glm::lookAt(glm::vec3(0, 0, -600), glm::vec3(0), glm::vec3(0, 1, 0)));
+    std::vector<bool> results(num_boxes);
+    double baseline = kTable.Measure([&]() {
+      for (uint32_t i = 0; i < num_boxes; i++) {
+        results[i] = aabbs[i].IsOnFrustum(frustum);
+      }
+    });
+    fmt::print("frustum test:\n");
+    kTable.PrintRow("AABB::IsOnFrustum", baseline, baseline, num_boxes);
+    bool equal = CompareBatch(
+        [&](std::vector<uint32_t> *mask) {
+          batch_culling::IsOnFrustum(frustum, aabb_arrays, mask);
+        },
+        ToMask(results), baseline, num_boxes);
+    fmt::print("  results {}\n", equal ? "identical" : "DIFFERENT");
+    all_equal = all_equal && equal;
+  }
+
+  // AABB transform, Arvo's method gives the same bounds up to rounding
+  {
+    std::vector<AABB> results(num_boxes);
+    double baseline = kTable.Measure([&]() {
+      for (uint32_t i = 0; i < num_boxes; i++) {
+        results[i] = aabbs[i].Transform(transforms[i]);
+      }
+    });
+    fmt::print("AABB transform:\n");
+    kTable.PrintRow("AABB::Transform", baseline, baseline, num_boxes);
+    batch_culling::AABBArrays transformed[2];
+    for (bool avx2 : {false, true}) {
+      if (avx2 && !cpu_features::AVX2Supported()) continue;
+      cpu_features::SetAVX2Enabled(avx2);
+      double milliseconds = kTable.Measure([&]() {
+        batch_culling::Transform(transforms.data(), aabb_arrays,
+                                 &transformed[avx2]);
+      });
+      kTable.PrintRow(avx2 ? "batch AVX2" : "batch scalar", milliseconds,
+                      baseline, num_boxes);
+    }
+    cpu_features::SetAVX2Enabled(true);
+
+    float max_error = 0;
+    bool equal = true;
+    for (uint32_t i = 0; i < num_boxes; i++) {
+      AABB aabb = transformed[0].Get(i);
+      for (int k = 0; k < 3; k++) {
+        max_error = std::max({max_error,
+                              std::abs(aabb.min[k] - results[i].min[k]),
+                              std::abs(aabb.max[k] - results[i].max[k])});
+      }
+      if (cpu_features::AVX2Supported()) {
+        AABB avx2_aabb = transformed[1].Get(i);
+        for (int k = 0; k < 3; k++) {
+          equal = equal && avx2_aabb.min[k] == aabb.min[k] &&
+                  avx2_aabb.max[k] == aabb.max[k];
+        }
+      }
+    }
+    fmt::print("  scalar and AVX2 {}, max difference to 8 corners: {:e}\n",
+               equal ? "identical" : "DIFFERENT", max_error);
+    all_equal = all_equal && equal;
+  }
+
+  // OBB test, a shadow cascade sized OBB in the middle of the box cloud
+  {
+    OBB cascade(AABB(glm::vec3(-200, -100, -300), glm::vec3(200, 100, 300)));
+    cascade.set_rotation(RandomRotation(rng));
+    constexpr float kEpsilon = 1e-6f;
+    std::vector<bool> results(num_boxes);
+    double baseline = kTable.Measure([&]() {
+      for (uint32_t i = 0; i < num_boxes; i++) {
+        results[i] = cascade.IntersectsOBB(obbs[i], kEpsilon);
+      }
+    });
+    fmt::print("OBB test:\n");
+    kTable.PrintRow("OBB::IntersectsOBB", baseline, baseline, num_boxes);
+    bool equal = CompareBatch(
+        [&](std::vector<uint32_t> *mask) {
+          batch_culling::IntersectsOBB(cascade, obb_arrays, kEpsilon, mask);
+        },
+        ToMask(results), baseline, num_boxes);
+    fmt::print("  results {}\n", equal ? "identical" : "DIFFERENT");
+    all_equal = all_equal && equal;
+  }
+
+  return all_equal ? 0 : 1;
+}
@@ -1,12 +1,47 @@
+#include <fmt/core.h>
+
+#include <chrono>
 #include <glm/gtc/matrix_transform.hpp>
+#include <string>
 
 #include "terrain/perlin_noise_terrain_generator.h"
 
-int main() {
+// usage: grass-demo-generate-terrain [size] [subdivision size] [--no-obj]
+int main(int argc, char *argv[]) {
+  int size = 256, subdiv_size = 256;
+  bool export_obj = true;
+  int num_numbers = 0;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--no-obj") {
+      export_obj = false;
+    } else if (num_numbers++ == 0) {
+      size = subdiv_size = std::stoi(arg);
+    } else {
+      subdiv_size = std::stoi(arg);
+    }
+  }
+
   glm::mat4 transform =
       glm::translate(glm::scale(glm::mat4(1), glm::vec3(128, 32, 128)),
                      glm::vec3(-0.5, 0, -0.5));
-  auto terrain_generator =
-      std::make_unique<PerlinNoiseTerrainGenerator>(256, 256, 0.5, transform);
-  terrain_generator->ExportToOBJ("resources/terrain/sample.obj");
-}
\ No newline at end of file
+  auto terrain_generator = std::make_unique<PerlinNoiseTerrainGenerator>(
+      size, subdiv_size, 0.5, transform);
+
+  auto start = std::chrono::steady_clock::now();
+  auto elapsed = [&]() {
+    std::chrono::duration<double, std::milli> duration =
+        std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    return duration.count();
+  };
+  terrain_generator->heights();
+  fmt::print(stderr, "[info] {}^2 heights in {:.1f} ms\n", size + 1,
+             elapsed());
+  terrain_generator->ExportHeightfield("resources/terrain/sample.heightfield");
+  fmt::print(stderr, "[info] heightfield exported in {:.1f} ms\n", elapsed());
+  if (export_obj) {
+    terrain_generator->ExportToOBJ("resources/terrain/sample.obj");
+    fmt::print(stderr, "[info] OBJ exported in {:.1f} ms\n", elapsed());
+  }
+}
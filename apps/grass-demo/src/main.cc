@@ -8,17 +8,21 @@
 #include <fmt/core.h>
 #include <imgui.h>
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
+#include <random>
 
 #include "controller/sightseeing_controller.h"
 #include "grass/grassland.h"
 #include "skybox.h"
+#include "terrain/cdlod_terrain.h"
 #include "tone_mapping/aces.h"
 
 std::unique_ptr<Camera> camera_ptr;
 std::unique_ptr<LightSources> light_sources_ptr;
 std::unique_ptr<Grassland> grassland_ptr;
+std::unique_ptr<CDLODTerrain> terrain_ptr;
 std::unique_ptr<PostProcesses> post_processes_ptr;
 std::unique_ptr<Skybox> skybox_ptr;
 std::unique_ptr<SightseeingController> controller;
@@ -38,9 +42,40 @@ void ImGuiInit(uint32_t width, uint32_t height) {
   io.Fonts->Build();
 }
 
+// casts random rays straight down onto the terrain, like placing props
+void BenchmarkRays() {
+  constexpr uint32_t kNumRays = 1 << 16;
+  AABB aabb = grassland_ptr->terrain_aabb();
+  std::mt19937 rd;
+  std::uniform_real_distribution<float> uniform(0, 1);
+  std::vector<Ray> rays(kNumRays);
+  for (auto &ray : rays) {
+    glm::vec3 origin =
+        glm::mix(aabb.min, aabb.max, glm::vec3(uniform(rd), 1, uniform(rd)));
+    ray = Ray(origin + glm::vec3(0, 1, 0), glm::vec3(0, -1, 0));
+  }
+
+  std::vector<RayHit> hits(kNumRays);
+  double start = glfwGetTime();
+  grassland_ptr->Intersect(rays.data(), kNumRays, hits.data());
+  double duration = glfwGetTime() - start;
+  auto num_hits = std::count_if(hits.begin(), hits.end(),
+                                [](const RayHit &hit) { return hit.hit(); });
+  fmt::print(stderr,
+             "[info] {} rays against the terrain in {:.1f} ms, {:.2f} Mrays/s, "
+             "{} hits\n",
+             kNumRays, duration * 1e3, kNumRays / duration * 1e-6, num_hits);
+}
+
 void ImGuiWindow() {
+  ImGui::Begin("Panel");
+  if (ImGui::Button("Benchmark rays")) BenchmarkRays();
+  ImGui::End();
+
   camera_ptr->ImGuiWindow();
   post_processes_ptr->ImGuiWindow();
+  grassland_ptr->ImGuiWindow();
+  terrain_ptr->ImGuiWindow();
 }
 
 void Init(uint32_t width, uint32_t height) {
@@ -76,6 +111,9 @@ void Init(uint32_t width, uint32_t height) {
   skybox_ptr = std::make_unique<Skybox>("resources/skyboxes/cloud");
   grassland_ptr = std::make_unique<Grassland>("resources/terrain/sample.obj",
                                               "resources/distortion.png");
+  // both written by grass-demo-generate-terrain
+  terrain_ptr =
+      std::make_unique<CDLODTerrain>("resources/terrain/sample.heightfield");
 
   controller.reset(
       new SightseeingController(camera_ptr.get(), width, height, window));
@@ -118,6 +156,7 @@ int main(int argc, char *argv[]) {
     glClearColor(0, 0, 0, 1);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     skybox_ptr->Draw(camera_ptr.get());
+    terrain_ptr->Draw(camera_ptr.get(), light_sources_ptr.get());
     grassland_ptr->Draw(camera_ptr.get(), light_sources_ptr.get(),
                         current_time);
     post_processes_ptr->fbo()->Unbind();
@@ -0,0 +1,106 @@
+#include <fmt/core.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark_table.h"
+#include "terrain/heightfield.h"
+#include "terrain/perlin_noise_terrain_generator.h"
+
+// compares the Heightfield queries with evaluating the noise of the terrain
+// generator, usage: heightfield-benchmark [terrain size] [number of queries]
+
+constexpr int kRepetitions = 5;
+const BenchmarkTable kTable(kRepetitions, "queries");
+
+int main(int argc, char *argv[]) {
+  int size = argc > 1 ? std::stoi(argv[1]) : 1024;
+  uint32_t num_queries = argc > 2 ? std::stoul(argv[2]) : 1 << 20;
+
+  // as grass-demo-generate-terrain
+  glm::mat4 transform =
+      glm::translate(glm::scale(glm::mat4(1), glm::vec3(128, 32, 128)),
+                     glm::vec3(-0.5, 0, -0.5));
+  PerlinNoiseTerrainGenerator generator(size, size, 0.5, transform);
+  auto start = std::chrono::steady_clock::now();
+  Heightfield heightfield(size, generator.heights().data(), transform);
+  std::chrono::duration<double, std::milli> build_duration =
+      std::chrono::steady_clock::now() - start;
+  fmt::print("{}^2 terrain, built in {:.1f} ms, {} queries\n", size,
+             build_duration.count(), num_queries);
+
+  // in the world, and in [0, 1]^2 for the generator; the clustered points
+  // are scattered around a random center per kClusterSize, like props
+  constexpr uint32_t kClusterSize = 1024;
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  std::vector<glm::vec2> points(num_queries), xzs(num_queries),
+      clustered_xzs(num_queries);
+  glm::vec2 center;
+  for (uint32_t i = 0; i < num_queries; i++) {
+    points[i] = glm::vec2(uniform(rng), uniform(rng));
+    glm::vec4 world = transform * glm::vec4(points[i].x, 0, points[i].y, 1);
+    xzs[i] = glm::vec2(world.x, world.z);
+    if (i % kClusterSize == 0) center = xzs[i];
+    clustered_xzs[i] = center + glm::vec2(uniform(rng), uniform(rng)) * 4.0f;
+  }
+
+  std::vector<double> noise(num_queries);
+  double baseline = kTable.Measure([&]() {
+    for (uint32_t i = 0; i < num_queries; i++) {
+      noise[i] = generator.get_height(points[i].x, points[i].y);
+    }
+  });
+  kTable.PrintRow("get_height", baseline, baseline, num_queries);
+
+  std::vector<float> heights(num_queries);
+  std::vector<glm::vec3> normals(num_queries);
+  for (auto interpolation : {Heightfield::Interpolation::kBilinear,
+                             Heightfield::Interpolation::kTriangle}) {
+    bool bilinear = interpolation == Heightfield::Interpolation::kBilinear;
+    fmt::print("{}:\n", bilinear ? "bilinear" : "triangle");
+    // a row per query, against get_height
+    auto row = [&](const std::string &name, const std::function<void()> &f) {
+      kTable.PrintRow(name, kTable.Measure(f), baseline, num_queries);
+    };
+    row("Height", [&]() {
+      for (uint32_t i = 0; i < num_queries; i++) {
+        heights[i] = heightfield.Height(xzs[i], interpolation);
+      }
+    });
+    row("Normal", [&]() {
+      for (uint32_t i = 0; i < num_queries; i++) {
+        normals[i] = heightfield.Normal(xzs[i], interpolation);
+      }
+    });
+    row("Query, heights", [&]() {
+      heightfield.Query(xzs.data(), num_queries, heights.data(), nullptr,
+                        interpolation);
+    });
+    row("Query, heights and normals", [&]() {
+      heightfield.Query(xzs.data(), num_queries, heights.data(),
+                        normals.data(), interpolation);
+    });
+    std::vector<float> clustered_heights(num_queries);
+    row("Query, clustered heights", [&]() {
+      heightfield.Query(clustered_xzs.data(), num_queries,
+                        clustered_heights.data(), nullptr, interpolation);
+    });
+
+    // the noise is the height before the transform
+    double max_error = 0;
+    for (uint32_t i = 0; i < num_queries; i++) {
+      double height = (heights[i] - transform[3].y) / transform[1].y;
+      max_error = std::max(max_error, std::abs(height - noise[i]));
+    }
+    fmt::print("  max difference to get_height: {:e}\n", max_error);
+  }
+}
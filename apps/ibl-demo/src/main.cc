@@ -98,6 +98,7 @@ void ImGuiWindow() {
   camera_ptr->ImGuiWindow();
   light_sources_ptr->ImGuiWindow(camera_ptr.get());
   post_processes_ptr->ImGuiWindow();
+  multi_draw_indirect->ImGuiWindow();
 
   post_processes_ptr->Enable(1, enable_smaa);
 }
@@ -182,6 +183,14 @@ int main(int argc, char *argv[]) {
 
     glfwPollEvents();
 
+    // the point light shadows are packed before culling for them
+    light_sources_ptr->UpdateShadowAtlas(
+        camera_ptr.get(), multi_draw_indirect->static_casters_version());
+    // cull once for the camera and all shadow views
+    multi_draw_indirect->ComputeVisibility(
+        camera_ptr.get(), light_sources_ptr.get(),
+        {{model_ptr.get(), {{-1, 0, glm::mat4(1), glm::vec4(0)}}}});
+
     light_sources_ptr->DrawDepthForShadow(
         [](int32_t directional_index, int32_t point_index) {
           multi_draw_indirect->DrawDepthForShadow(
@@ -210,6 +219,8 @@ int main(int argc, char *argv[]) {
 
     post_processes_ptr->Draw(nullptr);
 
+    multi_draw_indirect->EndFrame();
+
     ImGui_ImplGlfw_NewFrame();
     ImGui_ImplOpenGL3_NewFrame();
     ImGui::NewFrame();
@@ -0,0 +1,118 @@
+#include <fmt/core.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "aabb.h"
+#include "benchmark_table.h"
+#include "instance_bvh.h"
+
+// times InstanceBVH::Update() while a number of instances move every frame,
+// and checks that the refitted top level answers like a new one, usage:
+// instance-bvh-benchmark [number of instances]
+
+constexpr int kRepetitions = 1;
+const BenchmarkTable kTable(kRepetitions, "instances");
+constexpr uint32_t kNumMeshes = 16;
+// per row, a multiple of the rebuild check interval
+constexpr uint32_t kNumFrames = 4 * InstanceBVH::kRebuildCheckInterval;
+constexpr float kWorldSize = 2000;
+
+struct Scene {
+  std::vector<AABB> aabbs;
+  std::vector<uint32_t> mesh_to_geometry, instance_to_mesh;
+  std::vector<glm::mat4> model_matrices, transforms;
+
+  InstanceBVH::Arrays arrays() const {
+    return {&aabbs, &mesh_to_geometry, &instance_to_mesh, &model_matrices,
+            &transforms};
+  }
+};
+
+glm::mat4 RandomModelMatrix(std::mt19937 &rng) {
+  std::uniform_real_distribution<float> position(0, kWorldSize);
+  std::uniform_real_distribution<float> angle(0, 2 * glm::pi<float>());
+  glm::mat4 translation = glm::translate(
+      glm::mat4(1), glm::vec3(position(rng), position(rng), position(rng)));
+  return glm::rotate(translation, angle(rng), glm::vec3(0, 1, 0));
+}
+
+// whether both trees return the same instances for the same boxes
+bool SameResults(const InstanceBVH &a, const InstanceBVH &b,
+                 std::mt19937 &rng) {
+  std::uniform_real_distribution<float> position(0, kWorldSize);
+  for (int i = 0; i < 64; i++) {
+    glm::vec3 min(position(rng), position(rng), position(rng));
+    AABB box(min, min + glm::vec3(100));
+    std::vector<uint32_t> results[2] = {a.Search(box), b.Search(box)};
+    for (auto &result : results) std::sort(result.begin(), result.end());
+    if (results[0] != results[1]) return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t num_instances = argc > 1 ? std::stoul(argv[1]) : 100000;
+
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> size(0.5f, 10);
+  Scene scene;
+  for (uint32_t i = 0; i < kNumMeshes; i++) {
+    glm::vec3 extents(size(rng), size(rng), size(rng));
+    scene.aabbs.emplace_back(-extents, extents);
+    scene.mesh_to_geometry.push_back(0);
+  }
+  std::uniform_int_distribution<uint32_t> mesh(0, kNumMeshes - 1);
+  for (uint32_t i = 0; i < num_instances; i++) {
+    scene.instance_to_mesh.push_back(mesh(rng));
+    scene.model_matrices.push_back(RandomModelMatrix(rng));
+    scene.transforms.push_back(glm::mat4(1));
+  }
+
+  // the queries of these tests never reach the bottom levels
+  InstanceBVH bvh({}, scene.arrays());
+  bvh.Update();
+  fmt::print("{} instances, build {:.3f} ms, {} nodes\n", num_instances,
+             bvh.update_milliseconds(), bvh.top_level()->nodes().size());
+
+  fmt::print("update, {} frames each:\n", kNumFrames);
+  std::uniform_int_distribution<uint32_t> instance(0, num_instances - 1);
+  std::uniform_real_distribution<float> step(-1, 1);
+  bool all_same = true;
+  for (uint32_t num_moved :
+       {100u, 1000u, 10000u, num_instances / 2, num_instances}) {
+    num_moved = std::min(num_moved, num_instances);
+    double total = 0, slowest = 0;
+    uint32_t num_rebuilt_subtrees = 0;
+    for (uint32_t frame = 0; frame < kNumFrames; frame++) {
+      for (uint32_t i = 0; i < num_moved; i++) {
+        uint32_t moved = num_moved == num_instances ? i : instance(rng);
+        scene.model_matrices[moved] =
+            glm::translate(glm::mat4(1), glm::vec3(step(rng), 0, step(rng))) *
+            scene.model_matrices[moved];
+        bvh.MarkMoved(moved);
+      }
+      bvh.Update();
+      total += bvh.update_milliseconds();
+      slowest = std::max(slowest, bvh.update_milliseconds());
+      num_rebuilt_subtrees += bvh.num_rebuilt_subtrees();
+    }
+
+    InstanceBVH rebuilt({}, scene.arrays());
+    rebuilt.Update();
+    bool same = SameResults(bvh, rebuilt, rng);
+    all_same = all_same && same;
+    kTable.PrintRow(fmt::format("{} moved", num_moved), total / kNumFrames,
+                    num_moved);
+    fmt::print("    slowest {:.3f} ms, {} subtrees rebuilt, {}\n", slowest,
+               num_rebuilt_subtrees,
+               same ? "same as a new build" : "DIFFERENT from a new build");
+  }
+  return all_same ? 0 : 1;
+}
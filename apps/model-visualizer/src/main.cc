@@ -66,6 +66,7 @@ int enable_ssao = 0;
 int enable_smaa = 0;
 int enable_bloom = 0;
 int enable_moving_shadow = 0;
+int enable_occlusion_culling = 0;
 
 GLFWwindow *window;
 
@@ -102,14 +103,20 @@ void ImGuiWindow() {
   ImGui::ListBox("Enable Bloom", &enable_bloom, choices, IM_ARRAYSIZE(choices));
   ImGui::ListBox("Enable Moving Shadow", &enable_moving_shadow, choices,
                  IM_ARRAYSIZE(choices));
+  ImGui::ListBox("Enable Occlusion Culling", &enable_occlusion_culling,
+                 choices, IM_ARRAYSIZE(choices));
   ImGui::End();
 
   camera_ptr->ImGuiWindow();
   light_sources_ptr->ImGuiWindow(camera_ptr.get());
   post_processes_ptr->ImGuiWindow();
+  multi_draw_indirect->ImGuiWindow();
 
   post_processes_ptr->Enable(0, enable_bloom);
   post_processes_ptr->Enable(2, enable_smaa);
+  multi_draw_indirect->set_hi_z_buffer(
+      enable_occlusion_culling ? deferred_shading_render_quad_ptr->hi_z_buffer()
+                               : nullptr);
 }
 
 void Init(uint32_t width, uint32_t height) {
@@ -211,6 +218,14 @@ int main(int argc, char *argv[]) {
 
     MovingShadow(current_time);
 
+    // the point light shadows are packed before culling for them
+    light_sources_ptr->UpdateShadowAtlas(
+        camera_ptr.get(), multi_draw_indirect->static_casters_version());
+    // cull once for the camera and all shadow views
+    multi_draw_indirect->ComputeVisibility(
+        camera_ptr.get(), light_sources_ptr.get(),
+        {{model_ptr.get(), {{-1, 0, glm::mat4(1), glm::vec4(0)}}}});
+
     // draw depth map first
     light_sources_ptr->DrawDepthForShadow(
         [](int32_t directional_index, int32_t point_index) {
@@ -239,6 +254,8 @@ int main(int argc, char *argv[]) {
 
     post_processes_ptr->Draw(nullptr);
 
+    multi_draw_indirect->EndFrame();
+
     ImGui_ImplGlfw_NewFrame();
     ImGui_ImplOpenGL3_NewFrame();
     ImGui::NewFrame();
@@ -0,0 +1,329 @@
+#include <fmt/core.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <glm/glm.hpp>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "benchmark_table.h"
+#include "cpu_features.h"
+#include "random/perlin_noise.h"
+
+// compares the per-point double Perlin noise the engine used to have and the
+// one it has now with the batched float one, usage:
+// noise-benchmark [number of samples]
+
+constexpr int kRepetitions = 5;
+const BenchmarkTable kTable(kRepetitions, "samples");
+constexpr uint32_t kDepth = 6;
+
+// PerlinNoise before it was rewritten without allocations: the weights of
+// the 8 corners and of the lerps between them are returned in vectors, the
+// permutation table is the same for the same size and seed
+namespace calc_weights {
+
+class PerlinNoise {
+ public:
+  PerlinNoise(int perm_size, int seed) : PERM_SIZE(perm_size) {
+    static std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int> dis(0, perm_size - 1);
+    auto dice = std::bind(dis, engine);
+    perm_random_.resize(perm_size << 1);
+    for (int i = 0; i < perm_random_.size(); i++) {
+      perm_random_[i] = dice();
+    }
+  }
+
+  double Noise(double x, double y, double z) const {
+    using std::ignore;
+    std::vector<double> xyzw;
+    std::tie(ignore, ignore, ignore, xyzw) = CalcWeights(x, y, z);
+    return xyzw[0];
+  }
+
+  double Noise(glm::vec3 position) const {
+    return Noise(position.x, position.y, position.z);
+  }
+
+  glm::vec3 DerivativeNoise(double x, double y, double z) const {
+    glm::vec3 ans;
+    std::vector<double> w, xw, xyw, xyzw;
+    std::tie(w, xw, xyw, xyzw) = CalcWeights(x, y, z);
+    double dx = x - floor(x), dy = y - floor(y), dz = z - floor(z);
+    {
+      // x
+      std::vector<double> dxw(4), dxyw(2), dxyzw(1);
+      for (int i = 0; i < 4; i++) dxw[i] = (w[i + 4] - w[i]) * DerivativeF(dx);
+      for (int i = 0; i < 2; i++)
+        dxyw[i] = dxw[i] * (1 - F(dy)) + dxw[i + 2] * F(dy);
+      for (int i = 0; i < 1; i++)
+        dxyzw[i] = dxyw[i] * (1 - F(dz)) + dxyw[i + 1] * F(dz);
+      ans.x = dxyzw[0];
+    }
+    {
+      // y
+      std::vector<double> dxyw(2), dxyzw(1);
+      for (int i = 0; i < 2; i++)
+        dxyw[i] = (xw[i + 2] - xw[i]) * DerivativeF(dy);
+      for (int i = 0; i < 1; i++)
+        dxyzw[i] = dxyw[i] * (1 - F(dz)) + dxyw[i + 1] * F(dz);
+      ans.y = dxyzw[0];
+    }
+    {
+      // z
+      std::vector<double> dxyzw(1);
+      for (int i = 0; i < 1; i++)
+        dxyzw[i] = (xyw[i + 1] - xyw[i]) * DerivativeF(dz);
+      ans.z = dxyzw[0];
+    }
+    return ans;
+  }
+
+  double Turbulent(glm::vec3 position, uint32_t depth) const {
+    if (depth == 0) throw std::invalid_argument("");
+    double weight = 1;
+    double scale = 1;
+    double total_weight = 0;
+    double res = 0;
+    for (int i = 0; i < depth; i++) {
+      res += Noise(position * float(scale)) * weight;
+      total_weight += weight;
+      weight *= 0.5;
+      scale *= 2;
+    }
+    res /= total_weight;
+    return res;
+  }
+
+ private:
+  using WeightsType = std::tuple<std::vector<double>, std::vector<double>,
+                                 std::vector<double>, std::vector<double>>;
+
+  static double F(double x) {
+    return 6 * pow(x, 5) - 15 * pow(x, 4) + 10 * pow(x, 3);
+  }
+
+  static double DerivativeF(double x) {
+    return 30 * pow(x, 4) - 60 * pow(x, 3) + 30 * pow(x, 2);
+  }
+
+  WeightsType CalcWeights(double x, double y, double z) const {
+    static auto lerp = [](double a, double b, double t) -> double {
+      return a * (1 - t) + b * t;
+    };
+    std::vector<double> w(8), xw(4), xyw(2), xyzw(1);
+    int ix = floor(x), iy = floor(y), iz = floor(z);
+    double dx = x - ix, dy = y - iy, dz = z - iz;
+    for (int i = 0; i < 8; i++) {
+      int nix = ix + !!(i & 4);
+      int niy = iy + !!(i & 2);
+      int niz = iz + !!(i & 1);
+      double ndx = dx - !!(i & 4);
+      double ndy = dy - !!(i & 2);
+      double ndz = dz - !!(i & 1);
+      w[i] = Grad(nix, niy, niz, ndx, ndy, ndz);
+    }
+    double wdx = F(dx), wdy = F(dy), wdz = F(dz);
+    for (int i = 0; i < 4; i++) xw[i] = lerp(w[i], w[i + 4], wdx);
+    for (int i = 0; i < 2; i++) xyw[i] = lerp(xw[i], xw[i + 2], wdy);
+    xyzw[0] = lerp(xyw[0], xyw[1], wdz);
+    return WeightsType(w, xw, xyw, xyzw);
+  }
+
+  double Grad(int x, int y, int z, double dx, double dy, double dz) const {
+    x &= PERM_SIZE - 1;
+    y &= PERM_SIZE - 1;
+    z &= PERM_SIZE - 1;
+    int h = perm_random_[perm_random_[perm_random_[x] + y] + z] & 15;
+    double u = h < 8 || h == 12 || h == 13 ? dx : dy;
+    double v = h < 4 || h == 12 || h == 13 ? dy : dz;
+    return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+  }
+
+  const int PERM_SIZE;
+  std::vector<int> perm_random_;
+};
+
+}  // namespace calc_weights
+
+// runs the kernel with the scalar and, if supported, the AVX2 version, the
+// outputs of the scalar one are kept in scalar, returns whether the AVX2 ones
+// are bitwise identical to them
+bool CompareBatch(const std::function<void()> &kernel,
+                  const std::function<std::vector<float>()> &outputs,
+                  double baseline, uint32_t num_samples) {
+  std::vector<float> scalar;
+  bool equal = true;
+  for (bool avx2 : {false, true}) {
+    if (avx2 && !cpu_features::AVX2Supported()) {
+      fmt::print("  {:<24}not supported by this CPU\n", "batch AVX2");
+      continue;
+    }
+    cpu_features::SetAVX2Enabled(avx2);
+    double milliseconds = kTable.Measure(kernel);
+    kTable.PrintRow(avx2 ? "batch AVX2" : "batch scalar", milliseconds,
+                    baseline, num_samples);
+    std::vector<float> result = outputs();
+    if (!avx2) {
+      scalar = std::move(result);
+    } else {
+      equal = std::memcmp(scalar.data(), result.data(),
+                          scalar.size() * sizeof(float)) == 0;
+    }
+  }
+  cpu_features::SetAVX2Enabled(true);
+  return equal;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t num_samples = argc > 1 ? std::stoul(argv[1]) : 1 << 20;
+
+  PerlinNoise noise(1024, 0);
+  calc_weights::PerlinNoise old_noise(1024, 0);
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> position(-300, 300);
+  std::vector<float> xs(num_samples), ys(num_samples), zs(num_samples);
+  for (uint32_t i = 0; i < num_samples; i++) {
+    xs[i] = position(rng);
+    ys[i] = position(rng);
+    zs[i] = position(rng);
+  }
+
+  fmt::print("{} samples, AVX2 {}\n", num_samples,
+             cpu_features::AVX2Supported() ? "supported" : "not supported");
+  bool all_equal = true;
+
+  // values
+  {
+    std::vector<double> old_results(num_samples), results(num_samples);
+    double baseline = kTable.Measure([&]() {
+      for (uint32_t i = 0; i < num_samples; i++) {
+        old_results[i] = old_noise.Noise(xs[i], ys[i], zs[i]);
+      }
+    });
+    double milliseconds = kTable.Measure([&]() {
+      for (uint32_t i = 0; i < num_samples; i++) {
+        results[i] = noise.Noise(xs[i], ys[i], zs[i]);
+      }
+    });
+    fmt::print("noise:\n");
+    kTable.PrintRow("CalcWeights Noise", baseline, baseline, num_samples);
+    kTable.PrintRow("PerlinNoise::Noise", milliseconds, baseline,
+                    num_samples);
+    double old_error = 0;
+    for (uint32_t i = 0; i < num_samples; i++) {
+      old_error = std::max(old_error, std::abs(results[i] - old_results[i]));
+    }
+    std::vector<float> values(num_samples);
+    bool equal = CompareBatch(
+        [&]() {
+          noise.Noise(xs.data(), ys.data(), zs.data(), values.data(),
+                      num_samples);
+        },
+        [&]() { return values; }, baseline, num_samples);
+    double max_error = 0;
+    for (uint32_t i = 0; i < num_samples; i++) {
+      max_error = std::max(max_error, std::abs(values[i] - results[i]));
+    }
+    fmt::print(
+        "  max difference to CalcWeights: double {:e}\n"
+        "  scalar and AVX2 {}, max difference to double: {:e}\n",
+        old_error, equal ? "identical" : "DIFFERENT", max_error);
+    all_equal = all_equal && equal;
+  }
+
+  // values and gradients
+  {
+    std::vector<glm::vec3> old_results(num_samples), results(num_samples);
+    double baseline = kTable.Measure([&]() {
+      for (uint32_t i = 0; i < num_samples; i++) {
+        old_results[i] = old_noise.DerivativeNoise(xs[i], ys[i], zs[i]);
+      }
+    });
+    double milliseconds = kTable.Measure([&]() {
+      for (uint32_t i = 0; i < num_samples; i++) {
+        results[i] = noise.DerivativeNoise(xs[i], ys[i], zs[i]);
+      }
+    });
+    fmt::print("noise and gradient:\n");
+    kTable.PrintRow("CalcWeights DerivativeNoise", baseline, baseline,
+                    num_samples);
+    kTable.PrintRow("DerivativeNoise", milliseconds, baseline, num_samples);
+    float old_error = 0;
+    for (uint32_t i = 0; i < num_samples; i++) {
+      glm::vec3 error = glm::abs(results[i] - old_results[i]);
+      old_error = std::max({old_error, error.x, error.y, error.z});
+    }
+    std::vector<float> values(num_samples);
+    std::vector<glm::vec3> gradients(num_samples);
+    bool equal = CompareBatch(
+        [&]() {
+          noise.NoiseAndGradient(xs.data(), ys.data(), zs.data(),
+                                 values.data(), gradients.data(),
+                                 num_samples);
+        },
+        [&]() {
+          std::vector<float> outputs = values;
+          for (auto gradient : gradients) {
+            outputs.insert(outputs.end(), {gradient.x, gradient.y, gradient.z});
+          }
+          return outputs;
+        },
+        baseline, num_samples);
+    float max_error = 0;
+    for (uint32_t i = 0; i < num_samples; i++) {
+      glm::vec3 error = glm::abs(gradients[i] - results[i]);
+      max_error = std::max({max_error, error.x, error.y, error.z});
+    }
+    // the old gradient only differentiated the fade curves, not the corner
+    // values, so it differs from the analytic one
+    fmt::print(
+        "  max difference to the CalcWeights approximation: double {:e}\n"
+        "  scalar and AVX2 {}, max difference to double: {:e}\n",
+        old_error, equal ? "identical" : "DIFFERENT", max_error);
+    all_equal = all_equal && equal;
+  }
+
+  // fBm on a square grid, as the terrain generator samples it
+  {
+    uint32_t width = std::max(1u, uint32_t(std::sqrt(double(num_samples))));
+    uint32_t num_points = width * width;
+    glm::vec2 origin(-12.3f, 4.5f), step(0.01f);
+    std::vector<double> old_results(num_points), results(num_points);
+    auto turbulent = [&](const auto &noise, std::vector<double> *results) {
+      for (uint32_t j = 0; j < width; j++) {
+        for (uint32_t i = 0; i < width; i++) {
+          glm::vec3 point(origin.x + i * step.x, origin.y + j * step.y, 0.5f);
+          (*results)[j * width + i] = noise.Turbulent(point, kDepth);
+        }
+      }
+    };
+    double baseline =
+        kTable.Measure([&]() { turbulent(old_noise, &old_results); });
+    double double_milliseconds =
+        kTable.Measure([&]() { turbulent(noise, &results); });
+    fmt::print("turbulent, {} octaves:\n", kDepth);
+    kTable.PrintRow("CalcWeights Turbulent", baseline, baseline, num_points);
+    kTable.PrintRow("PerlinNoise::Turbulent", double_milliseconds, baseline,
+                    num_points);
+    std::vector<float> grid(num_points);
+    double milliseconds = kTable.Measure([&]() {
+      noise.Turbulent(origin, step, 0.5f, width, width, kDepth, grid.data());
+    });
+    kTable.PrintRow("grid", milliseconds, baseline, num_points);
+    double max_error = 0;
+    for (uint32_t i = 0; i < num_points; i++) {
+      max_error = std::max(max_error, std::abs(grid[i] - results[i]));
+    }
+    fmt::print("  max difference to Turbulent: {:e}\n", max_error);
+  }
+
+  return all_equal ? 0 : 1;
+}
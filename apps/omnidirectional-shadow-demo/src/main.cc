@@ -125,6 +125,7 @@ void ImGuiWindow() {
   camera_ptr->ImGuiWindow();
   light_sources_ptr->ImGuiWindow(camera_ptr.get());
   post_processes_ptr->ImGuiWindow();
+  multi_draw_indirect->ImGuiWindow();
 
   post_processes_ptr->Enable(0, enable_bloom);
   post_processes_ptr->Enable(2, enable_smaa);
@@ -276,6 +277,13 @@ void RenderLoop() {
     auto [render_target_params, render_target_params_lights] =
         UpdateObjectsAndLights(current_time);
 
+    // the point light shadows are packed before culling for them
+    light_sources_ptr->UpdateShadowAtlas(
+        camera_ptr.get(), multi_draw_indirect->static_casters_version());
+    // cull once for the camera and all shadow views
+    multi_draw_indirect->ComputeVisibility(
+        camera_ptr.get(), light_sources_ptr.get(), render_target_params);
+
     // draw depth map first
     light_sources_ptr->DrawDepthForShadow([&](int32_t directional_index,
                                               int32_t point_index) {
@@ -304,6 +312,8 @@ void RenderLoop() {
 
     post_processes_ptr->Draw(nullptr);
 
+    multi_draw_indirect->EndFrame();
+
     ImGui_ImplGlfw_NewFrame();
     ImGui_ImplOpenGL3_NewFrame();
     ImGui::NewFrame();
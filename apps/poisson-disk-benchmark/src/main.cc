@@ -0,0 +1,199 @@
+#include <fmt/core.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark_table.h"
+#include "random/poisson_disk_generator.h"
+
+// times the Poisson disk generators and validates their points: no 2 of them
+// closer than the radius, and how much room is left for more,
+// usage: poisson-disk-benchmark [number of points]
+
+constexpr int kRepetitions = 3;
+const BenchmarkTable kTable(kRepetitions, "points");
+constexpr uint32_t kNumProbes = 1 << 16;
+
+// the points sorted into cells of the radius, so that the ones within the
+// radius of a point are in the 3^N cells around it
+template <int N>
+class PointIndex {
+ public:
+  using Vec = glm::vec<N, float>;
+
+  PointIndex(const std::vector<Vec> &points, Vec extent, float radius)
+      : points_(points), radius_(radius) {
+    size_t num_cells = 1;
+    for (int i = 0; i < N; i++) {
+      size_[i] = std::max(1, int32_t(std::ceil(extent[i] / radius)));
+      num_cells *= size_[i];
+    }
+    // counting sort by cell
+    begins_.resize(num_cells + 1, 0);
+    for (const Vec &p : points) begins_[Index(Cell(p)) + 1]++;
+    for (size_t i = 0; i < num_cells; i++) begins_[i + 1] += begins_[i];
+    std::vector<uint32_t> ends(begins_.begin(), begins_.end() - 1);
+    indices_.resize(points.size());
+    for (uint32_t i = 0; i < points.size(); i++) {
+      indices_[ends[Index(Cell(points[i]))]++] = i;
+    }
+  }
+
+  // the distance of the closest other point within the radius, or infinity
+  float ClosestWithin(Vec p, int64_t skip = -1) const {
+    float closest = INFINITY;
+    glm::vec<N, int32_t> center = Cell(p);
+    int32_t num_neighbours = 1;
+    for (int i = 0; i < N; i++) num_neighbours *= 3;
+    for (int32_t o = 0; o < num_neighbours; o++) {
+      bool inside = true;
+      glm::vec<N, int32_t> neighbour;
+      for (int i = 0, rest = o; i < N; i++, rest /= 3) {
+        neighbour[i] = center[i] + rest % 3 - 1;
+        inside &= 0 <= neighbour[i] && neighbour[i] < size_[i];
+      }
+      if (!inside) continue;
+      size_t index = Index(neighbour);
+      for (uint32_t j = begins_[index]; j < begins_[index + 1]; j++) {
+        if (indices_[j] == skip) continue;
+        closest = std::min(closest, glm::distance(points_[indices_[j]], p));
+      }
+    }
+    return closest;
+  }
+
+  // the smallest distance between 2 points, if below the radius
+  float MinDistance() const {
+    float min_distance = INFINITY;
+    for (uint32_t i = 0; i < points_.size(); i++) {
+      min_distance = std::min(min_distance, ClosestWithin(points_[i], i));
+    }
+    return min_distance;
+  }
+
+ private:
+  glm::vec<N, int32_t> Cell(Vec p) const {
+    glm::vec<N, int32_t> cell;
+    for (int i = 0; i < N; i++) {
+      cell[i] = std::clamp(int32_t(p[i] / radius_), 0, size_[i] - 1);
+    }
+    return cell;
+  }
+  size_t Index(glm::vec<N, int32_t> cell) const {
+    size_t index = 0;
+    for (int i = 0; i < N; i++) index = index * size_[i] + cell[i];
+    return index;
+  }
+
+  const std::vector<Vec> &points_;
+  float radius_;
+  glm::vec<N, int32_t> size_;
+  std::vector<uint32_t> begins_, indices_;
+};
+
+// prints the smallest distance and the share of random probes where another
+// point would fit, returns whether the points are a radius apart
+template <int N>
+bool Validate(const std::vector<glm::vec<N, float>> &points,
+              glm::vec<N, float> extent, float radius) {
+  PointIndex<N> index(points, extent, radius);
+  float min_distance = index.MinDistance();
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  uint32_t num_fillable = 0;
+  for (uint32_t i = 0; i < kNumProbes; i++) {
+    glm::vec<N, float> probe;
+    for (int j = 0; j < N; j++) probe[j] = uniform(rng) * extent[j];
+    num_fillable += index.ClosestWithin(probe) >= radius;
+  }
+  bool valid = min_distance >= radius;
+  fmt::print("  min distance / radius {:.4f} {}, room for more at {:.2f}% "
+             "of the probes\n",
+             std::min(min_distance / radius, 1e9f),
+             valid ? "valid" : "INVALID", 100.0 * num_fillable / kNumProbes);
+  return valid;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t num_points = argc > 1 ? std::stoul(argv[1]) : 1 << 20;
+  bool all_valid = true;
+
+  // the tables of the shadow kernels
+  {
+    fmt::print("shadow kernels:\n");
+    PoissonDiskGenerator generator(0);
+    std::vector<glm::vec2> points_2d;
+    double milliseconds =
+        kTable.Measure([&]() { points_2d = generator.Generate2D(128, 16); });
+    kTable.PrintRow("Generate2D(128, 16)", milliseconds, points_2d.size());
+    all_valid &= Validate<2>(points_2d, glm::vec2(1), std::sqrt(2.0f) / 16);
+    std::vector<glm::vec3> points_3d;
+    milliseconds =
+        kTable.Measure([&]() { points_3d = generator.Generate3D(128, 8); });
+    kTable.PrintRow("Generate3D(128, 8)", milliseconds, points_3d.size());
+    all_valid &= Validate<3>(points_3d, glm::vec3(1), std::sqrt(3.0f) / 8);
+  }
+
+  // as many points as fit, about num_points
+  {
+    fmt::print("{} points requested:\n", num_points);
+    PoissonDiskGenerator generator(0);
+    uint32_t num_grids_2d = std::sqrt(num_points / 0.4);
+    std::vector<glm::vec2> points_2d;
+    double milliseconds = kTable.Measure([&]() {
+      points_2d = generator.Generate2D(num_points, num_grids_2d);
+    });
+    kTable.PrintRow(fmt::format("Generate2D(n, {})", num_grids_2d),
+                    milliseconds, points_2d.size());
+    all_valid &= Validate<2>(points_2d, glm::vec2(1),
+                             std::sqrt(2.0f) / num_grids_2d);
+
+    uint32_t num_grids_3d = std::cbrt(num_points / 0.15);
+    std::vector<glm::vec3> points_3d;
+    milliseconds = kTable.Measure([&]() {
+      points_3d = generator.Generate3D(num_points, num_grids_3d);
+    });
+    kTable.PrintRow(fmt::format("Generate3D(n, {})", num_grids_3d),
+                    milliseconds, points_3d.size());
+    all_valid &= Validate<3>(points_3d, glm::vec3(1),
+                             std::sqrt(3.0f) / num_grids_3d);
+
+    // the same density, in tiles
+    float radius = 1;
+    glm::vec2 extent(std::sqrt(num_points / 0.85f));
+    std::vector<glm::vec2> points_tiled;
+    milliseconds = kTable.Measure([&]() {
+      points_tiled = generator.GenerateTiled2D(extent, radius);
+    });
+    kTable.PrintRow("GenerateTiled2D", milliseconds, points_tiled.size());
+    all_valid &= Validate<2>(points_tiled, extent, radius);
+
+    // around the borders of the tiles, within a radius, as in them
+    PointIndex<2> index(points_tiled, extent, radius);
+    float tile_size =
+        PoissonDiskGenerator::TILE_SIZE * radius / std::sqrt(2.0f);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(0, 1);
+    uint32_t num_probes[2] = {}, num_fillable[2] = {};
+    for (uint32_t i = 0; i < kNumProbes * 4; i++) {
+      glm::vec2 probe = glm::vec2(uniform(rng), uniform(rng)) * extent;
+      glm::vec2 to_border = glm::abs(probe - glm::round(probe / tile_size) *
+                                                 tile_size);
+      bool border = std::min(to_border.x, to_border.y) < radius;
+      num_probes[border]++;
+      num_fillable[border] += index.ClosestWithin(probe) >= radius;
+    }
+    fmt::print("  room for more at {:.2f}% of the probes inside the tiles, "
+               "{:.2f}% around their borders\n",
+               100.0 * num_fillable[0] / std::max(1u, num_probes[0]),
+               100.0 * num_fillable[1] / std::max(1u, num_probes[1]));
+  }
+
+  return all_valid ? 0 : 1;
+}
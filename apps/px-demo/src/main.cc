@@ -188,6 +188,7 @@ void ImGuiWindow() {
   camera_ptr->ImGuiWindow();
   light_sources_ptr->ImGuiWindow(camera_ptr.get());
   post_processes_ptr->ImGuiWindow();
+  multi_draw_indirect->ImGuiWindow();
 }
 
 void Init(uint32_t width, uint32_t height) {
@@ -273,6 +274,14 @@ int main(int argc, char *argv[]) {
     glfwPollEvents();
     camera_ptr->set_position(character_controller->position());
 
+    // the point light shadows are packed before culling for them
+    light_sources_ptr->UpdateShadowAtlas(
+        camera_ptr.get(), multi_draw_indirect->static_casters_version());
+    // cull once for the camera and all shadow views
+    multi_draw_indirect->ComputeVisibility(
+        camera_ptr.get(), light_sources_ptr.get(),
+        {{scene_model_ptr.get(), {{-1, 0, glm::mat4(1), glm::vec4(0)}}}});
+
     // draw depth map first
     light_sources_ptr->DrawDepthForShadow(
         [](int32_t directional_index, int32_t point_index) {
@@ -301,6 +310,8 @@ int main(int argc, char *argv[]) {
 
     post_processes_ptr->Draw(nullptr);
 
+    multi_draw_indirect->EndFrame();
+
     ImGui_ImplGlfw_NewFrame();
     ImGui_ImplOpenGL3_NewFrame();
     ImGui::NewFrame();
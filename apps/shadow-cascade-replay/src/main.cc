@@ -0,0 +1,146 @@
+#include <fmt/core.h>
+#include <stdint.h>
+
+#include <cmath>
+#include <fstream>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "shadows/cascade_fitting.h"
+#include "shadows/directional_shadow.h"
+
+// replays camera paths through the cascade fitting of DirectionalShadow and
+// reports how often each cascade is redrawn, usage:
+// shadow-cascade-replay [camera path files]
+// a camera path has one frame per line: x y z alpha beta, without files a few
+// synthetic paths are replayed
+
+constexpr uint32_t kResolution = 2048;
+const double kFovy = glm::radians(60.0);
+constexpr double kWidthHeightRatio = 16.0 / 9.0;
+constexpr double kZNear = 0.1, kZFar = 500;
+const glm::vec3 kLightDirection = glm::normalize(glm::vec3(-1, -2, -0.5));
+
+struct Frame {
+  glm::vec3 position;
+  double alpha, beta;
+};
+
+struct Path {
+  std::string name;
+  std::vector<Frame> frames;
+};
+
+Path LoadPath(const std::string &file_path) {
+  std::ifstream file(file_path);
+  if (!file) {
+    fmt::print(stderr, "[error] failed to open camera path: {}\n", file_path);
+    exit(1);
+  }
+  Path path{file_path, {}};
+  Frame frame;
+  while (file >> frame.position.x >> frame.position.y >> frame.position.z >>
+         frame.alpha >> frame.beta) {
+    path.frames.push_back(frame);
+  }
+  return path;
+}
+
+std::vector<Path> SyntheticPaths() {
+  constexpr uint32_t kNumFrames = 3600;
+  std::vector<Path> paths(4);
+  paths[0].name = "look around";
+  paths[1].name = "walk";
+  paths[2].name = "walk and turn";
+  paths[3].name = "fly";
+  for (uint32_t i = 0; i < kNumFrames; i++) {
+    double t = i / 60.0;
+    paths[0].frames.push_back(
+        {glm::vec3(0, 2, 0), t * 0.5, 0.3 * std::sin(t)});
+    paths[1].frames.push_back({glm::vec3(t * 1.5f, 2, 0), 0, 0});
+    paths[2].frames.push_back(
+        {glm::vec3(20 * std::sin(t * 0.1), 2, 20 * std::cos(t * 0.1)),
+         t * 0.7, 0.1 * std::sin(t * 2)});
+    paths[3].frames.push_back(
+        {glm::vec3(t * 40, 50 + 10 * std::sin(t), t * 10), 0.25, -0.2});
+  }
+  return paths;
+}
+
+struct Strategy {
+  std::string name;
+  CascadeFitter::Options options;
+};
+
+void Replay(const Path &path, const Strategy &strategy) {
+  Camera camera(glm::vec3(0), kWidthHeightRatio, 0, 0, kFovy, kZNear, kZFar);
+  std::vector<CascadeFitter> fitters(
+      DirectionalShadow::NUM_MOVING_CASCADES,
+      CascadeFitter(kResolution, kResolution, strategy.options));
+  for (auto &fitter : fitters) fitter.set_light_direction(kLightDirection);
+
+  struct Statistics {
+    uint32_t refits = 0, scrolls = 0;
+    uint64_t texels = 0;
+    double texel_size = 0;
+  };
+  std::vector<Statistics> statistics(fitters.size());
+  for (const auto &frame : path.frames) {
+    camera.set_position(frame.position);
+    camera.set_alpha(frame.alpha);
+    camera.set_beta(frame.beta);
+    auto inputs = DirectionalShadow::FitInputs(camera);
+
+    for (uint32_t i = 0; i < fitters.size(); i++) {
+      auto result = fitters[i].Fit(inputs.slice_corners[i],
+                                   inputs.caster_distance, false);
+      if (result.update == CascadeFitter::Update::kRefit) {
+        statistics[i].refits++;
+        statistics[i].texels += uint64_t(kResolution) * kResolution;
+      } else if (result.update == CascadeFitter::Update::kScroll) {
+        statistics[i].scrolls++;
+        for (const auto &strip : result.exposed) {
+          statistics[i].texels += uint64_t(strip.size.x) * strip.size.y;
+        }
+      }
+      statistics[i].texel_size += fitters[i].texel_size().x;
+    }
+  }
+
+  fmt::print("  {}:\n", strategy.name);
+  uint32_t num_frames = path.frames.size();
+  for (uint32_t i = 0; i < fitters.size(); i++) {
+    const Statistics &s = statistics[i];
+    // the margins are paid for with resolution
+    fmt::print(
+        "    cascade {}: {:>5} refits {:>5} scrolls, redrawn in {:>6.2f}% of "
+        "frames, {:>6.2f}% of the layer per frame, texel {:.3f}\n",
+        i, s.refits, s.scrolls, 100.0 * (s.refits + s.scrolls) / num_frames,
+        100.0 * s.texels / (double(kResolution) * kResolution * num_frames),
+        s.texel_size / num_frames);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<Path> paths;
+  for (int i = 1; i < argc; i++) paths.push_back(LoadPath(argv[i]));
+  if (paths.empty()) paths = SyntheticPaths();
+
+  std::vector<Strategy> strategies(3);
+  // the previous fitting enlarged the slice by a constant factor
+  strategies[0].name = "constant margin, refit";
+  strategies[0].options.min_margin = strategies[0].options.max_margin = 0.5f;
+  strategies[0].options.scrolling = false;
+  strategies[1].name = "motion margin, refit";
+  strategies[1].options.scrolling = false;
+  strategies[2].name = "motion margin, scroll";
+
+  for (const auto &path : paths) {
+    fmt::print("{} ({} frames):\n", path.name, path.frames.size());
+    for (const auto &strategy : strategies) Replay(path, strategy);
+  }
+  return 0;
+}
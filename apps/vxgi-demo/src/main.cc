@@ -72,6 +72,7 @@ int default_shading_choice = 0;
 int enable_ssao = 0;
 int enable_smaa = 0;
 int enable_bloom = 0;
+int enable_occlusion_culling = 0;
 int enable_voxelization_visualization = 0;
 int mipmap_level = 0;
 bool revoxelization = false;
@@ -132,6 +133,8 @@ void ImGuiWindow() {
   ImGui::ListBox("Enable SSAO", &enable_ssao, choices, IM_ARRAYSIZE(choices));
   ImGui::ListBox("Enable SMAA", &enable_smaa, choices, IM_ARRAYSIZE(choices));
   ImGui::ListBox("Enable Bloom", &enable_bloom, choices, IM_ARRAYSIZE(choices));
+  ImGui::ListBox("Enable Occlusion Culling", &enable_occlusion_culling,
+                 choices, IM_ARRAYSIZE(choices));
   ImGui::ListBox("Enable Voxelization Visualization",
                  &enable_voxelization_visualization, choices,
                  IM_ARRAYSIZE(choices));
@@ -143,10 +146,14 @@ void ImGuiWindow() {
   camera_ptr->ImGuiWindow();
   light_sources_ptr->ImGuiWindow(camera_ptr.get());
   post_processes_ptr->ImGuiWindow();
+  multi_draw_indirect->ImGuiWindow();
   vxgi_config_ptr->ImGuiWindow();
 
   post_processes_ptr->Enable(0, enable_bloom);
   post_processes_ptr->Enable(2, enable_smaa);
+  multi_draw_indirect->set_hi_z_buffer(
+      enable_occlusion_culling ? deferred_shading_render_quad_ptr->hi_z_buffer()
+                               : nullptr);
 }
 
 void Init(uint32_t width, uint32_t height) {
@@ -186,8 +193,8 @@ void Init(uint32_t width, uint32_t height) {
       vec3(0, -1, 0), vec3(50), camera_ptr.get()));
   light_sources_ptr->GetDirectional(0)->set_shadow(
       std::unique_ptr<DirectionalShadow>(new DirectionalShadow(
-          vec3(0, -1, 0), 2048, 2048, AABB(glm::vec3(-20), glm::vec3(20)),
-          camera_ptr.get())));
+          vec3(0, -1, 0), light_sources_ptr->cascade_pool(),
+          AABB(glm::vec3(-20), glm::vec3(20)), camera_ptr.get())));
 
   equirectangular_map_ptr.reset(new EquirectangularMap(
       "resources/kloofendal_48d_partly_cloudy_puresky_4k.hdr", 2048));
@@ -249,6 +256,14 @@ void RenderLoop() {
       revoxelization = false;
     }
 
+    // the point light shadows are packed before culling for them
+    light_sources_ptr->UpdateShadowAtlas(
+        camera_ptr.get(), multi_draw_indirect->static_casters_version());
+    // cull once for the camera and all shadow views
+    multi_draw_indirect->ComputeVisibility(
+        camera_ptr.get(), light_sources_ptr.get(),
+        {{model_ptr.get(), {{-1, 0, model_matrix, glm::vec4(0)}}}});
+
     // draw depth map first
     light_sources_ptr->DrawDepthForShadow(
         [&](int32_t directional_index, int32_t point_index) {
@@ -291,6 +306,8 @@ void RenderLoop() {
       post_processes_ptr->Draw(nullptr);
     }
 
+    multi_draw_indirect->EndFrame();
+
     ImGui_ImplGlfw_NewFrame();
     ImGui_ImplOpenGL3_NewFrame();
     ImGui::NewFrame();
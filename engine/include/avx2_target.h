@@ -0,0 +1,21 @@
+#ifndef AVX2_TARGET_H_
+#define AVX2_TARGET_H_
+
+// ENGINE_AVX2 is defined where the AVX2 intrinsics compile, the kernels are
+// still dispatched at runtime, see cpu_features.h. The rest of the engine is
+// built without -mavx2, so only the functions marked by AVX2_TARGET may use
+// them.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+#define ENGINE_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles AVX2 intrinsics without any flag
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef BATCH_CULLING_H_
+#define BATCH_CULLING_H_
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "aabb.h"
+#include "camera.h"
+#include "obb.h"
+
+// culling kernels over many boxes at once: the boxes are stored as
+// structures of arrays so that 8 of them are tested per AVX2 instruction,
+// every kernel also has a scalar version doing the same arithmetic in the
+// same order, the AVX2 one is chosen at runtime, see cpu_features.h;
+// the results are bit masks where box i is bit i % 32 of word i / 32
+namespace batch_culling {
+
+struct AABBArrays {
+  std::vector<float> min_x, min_y, min_z;
+  std::vector<float> max_x, max_y, max_z;
+
+  inline size_t size() const { return min_x.size(); }
+  void Resize(size_t size);
+  inline void Set(size_t i, const AABB &aabb) {
+    min_x[i] = aabb.min.x;
+    min_y[i] = aabb.min.y;
+    min_z[i] = aabb.min.z;
+    max_x[i] = aabb.max.x;
+    max_y[i] = aabb.max.y;
+    max_z[i] = aabb.max.z;
+  }
+  inline AABB Get(size_t i) const {
+    return AABB(glm::vec3(min_x[i], min_y[i], min_z[i]),
+                glm::vec3(max_x[i], max_y[i], max_z[i]));
+  }
+};
+
+struct OBBArrays {
+  // in world space, i.e. OBB::center_world_space()
+  std::vector<float> center_x, center_y, center_z;
+  std::vector<float> extent_x, extent_y, extent_z;
+  // axes[i][j] is component j of axis i, i.e. OBB::rotation()[i][j]
+  std::vector<float> axes[3][3];
+
+  inline size_t size() const { return center_x.size(); }
+  void Resize(size_t size);
+  void Set(size_t i, const OBB &obb);
+};
+
+// AABB::IsOnFrustum() of every box
+void IsOnFrustum(const Frustum &frustum, const AABBArrays &aabbs,
+                 std::vector<uint32_t> *mask);
+
+// box i transformed by transforms[i] by Arvo's method, i.e. the bounds of
+// AABB::Transform() without transforming the 8 corners, the transforms must
+// be affine
+void Transform(const glm::mat4 *transforms, const AABBArrays &aabbs,
+               AABBArrays *transformed);
+
+// obb.IntersectsOBB(box i, epsilon) of every box, by the 15 separating axes
+void IntersectsOBB(const OBB &obb, const OBBArrays &obbs, float epsilon,
+                   std::vector<uint32_t> *mask);
+
+}  // namespace batch_culling
+
+#endif
@@ -5,127 +5,1162 @@
 
 #include <algorithm>
 #include <functional>
+#include <future>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#define BVH_SSE
+#include <xmmintrin.h>
+#endif
+
 #include "aabb.h"
 
+// 32 bytes, the nodes are stored in depth-first order in a flat array, the
+// left child of an inner node is the next node
 struct BVHNode {
-  AABB aabb;
-  uint32_t split_axis = -1;
-  std::unique_ptr<BVHNode> left = nullptr, right = nullptr;
-  uint32_t* triangle_indices;
+  glm::vec3 min;
+  // leaf: offset of its first triangle in BVH::triangle_indices()
+  // inner: index of the right child
+  uint32_t offset;
+  glm::vec3 max;
+  // 0 for inner nodes
   uint32_t num_triangles;
+
+  inline AABB aabb() const { return AABB(min, max); }
+  inline bool is_leaf() const { return num_triangles > 0; }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode must be 32 bytes");
+
+// the binary tree collapsed into a 4-wide one for queries, the bounds of the
+// children are stored as SoA so that they are tested in one SIMD batch
+struct alignas(16) WideBVHNode {
+  static constexpr uint32_t kWidth = 4;
+  static constexpr uint32_t kLeafBit = 1u << 31;
+
+  float min_x[kWidth], min_y[kWidth], min_z[kWidth];
+  float max_x[kWidth], max_y[kWidth], max_z[kWidth];
+  // with kLeafBit: index of a leaf in BVH::nodes()
+  // without: index of a wide node in BVH::wide_nodes()
+  uint32_t children[kWidth];
+  uint32_t num_children;
+};
+
+// tests the children of a wide node against the planes in plane_mask, returns
+// the visible children as a bit mask, child_plane_masks[i] keeps the planes
+// that child i is not fully inside of
+inline uint32_t CullWideBVHNode(const WideBVHNode& node,
+                                const FrustumPlane* const planes[6],
+                                uint32_t plane_mask,
+                                uint32_t child_plane_masks[4]) {
+  uint32_t visible = (1u << node.num_children) - 1;
+  for (int i = 0; i < 4; i++) child_plane_masks[i] = plane_mask;
+
+#ifdef BVH_SSE
+  __m128 min_x = _mm_load_ps(node.min_x), max_x = _mm_load_ps(node.max_x);
+  __m128 min_y = _mm_load_ps(node.min_y), max_y = _mm_load_ps(node.max_y);
+  __m128 min_z = _mm_load_ps(node.min_z), max_z = _mm_load_ps(node.max_z);
+#endif
+  for (int i = 0; i < 6 && visible != 0; i++) {
+    if ((plane_mask & (1u << i)) == 0) continue;
+    glm::vec3 n = planes[i]->normal;
+    float d = planes[i]->distance;
+    // the corners farthest along and against the normal
+    uint32_t outside = 0, inside = 0;
+#ifdef BVH_SSE
+    __m128 p_x = n.x > 0 ? max_x : min_x, q_x = n.x > 0 ? min_x : max_x;
+    __m128 p_y = n.y > 0 ? max_y : min_y, q_y = n.y > 0 ? min_y : max_y;
+    __m128 p_z = n.z > 0 ? max_z : min_z, q_z = n.z > 0 ? min_z : max_z;
+    __m128 n_x = _mm_set1_ps(n.x), n_y = _mm_set1_ps(n.y);
+    __m128 n_z = _mm_set1_ps(n.z), d_4 = _mm_set1_ps(d);
+    __m128 p_distance = _mm_sub_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(n_x, p_x), _mm_mul_ps(n_y, p_y)),
+                   _mm_mul_ps(n_z, p_z)),
+        d_4);
+    __m128 q_distance = _mm_sub_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(n_x, q_x), _mm_mul_ps(n_y, q_y)),
+                   _mm_mul_ps(n_z, q_z)),
+        d_4);
+    outside = _mm_movemask_ps(_mm_cmplt_ps(p_distance, _mm_setzero_ps()));
+    inside = _mm_movemask_ps(_mm_cmpge_ps(q_distance, _mm_setzero_ps()));
+#else
+    for (int j = 0; j < 4; j++) {
+      float p_distance = n.x * (n.x > 0 ? node.max_x[j] : node.min_x[j]) +
+                         n.y * (n.y > 0 ? node.max_y[j] : node.min_y[j]) +
+                         n.z * (n.z > 0 ? node.max_z[j] : node.min_z[j]) - d;
+      float q_distance = n.x * (n.x > 0 ? node.min_x[j] : node.max_x[j]) +
+                         n.y * (n.y > 0 ? node.min_y[j] : node.max_y[j]) +
+                         n.z * (n.z > 0 ? node.min_z[j] : node.max_z[j]) - d;
+      outside |= uint32_t(p_distance < 0) << j;
+      inside |= uint32_t(q_distance >= 0) << j;
+    }
+#endif
+    visible &= ~outside;
+    for (int j = 0; j < 4; j++) {
+      if (inside & (1u << j)) child_plane_masks[j] &= ~(1u << i);
+    }
+  }
+  return visible;
+}
+
+struct Ray {
+  glm::vec3 origin, direction;
+  // the hits are searched in [t_min, t_max] along the direction
+  float t_min = 0, t_max = INFINITY;
+
+  inline Ray() = default;
+  inline Ray(glm::vec3 origin, glm::vec3 direction, float t_min = 0,
+             float t_max = INFINITY)
+      : origin(origin), direction(direction), t_min(t_min), t_max(t_max) {}
+
+  // the segment from a to b
+  static inline Ray FromSegment(glm::vec3 a, glm::vec3 b) {
+    return Ray(a, b - a, 0, 1);
+  }
+};
+
+struct RayHit {
+  static constexpr uint32_t kNoTriangle = 0xffffffffu;
+
+  float t = INFINITY;
+  // barycentrics of the hit point, weights of the 2nd and 3rd vertices
+  float u = 0, v = 0;
+  uint32_t triangle = kNoTriangle;
+
+  inline bool hit() const { return triangle != kNoTriangle; }
+};
+
+// Moller-Trumbore intersection of a ray with up to 4 triangles given as SoA,
+// returns the hit triangles in (t_min, t_max) as a bit mask
+inline uint32_t IntersectRayTriangles(const Ray& ray, float t_min, float t_max,
+                                      const float v0[3][4],
+                                      const float v1[3][4],
+                                      const float v2[3][4],
+                                      uint32_t num_triangles, float t[4],
+                                      float u[4], float v[4]) {
+  constexpr float kEpsilon = 1e-12f;
+  uint32_t hits = 0;
+#ifdef BVH_SSE
+  __m128 e1[3], e2[3], s[3];
+  for (int k = 0; k < 3; k++) {
+    __m128 p0 = _mm_loadu_ps(v0[k]);
+    e1[k] = _mm_sub_ps(_mm_loadu_ps(v1[k]), p0);
+    e2[k] = _mm_sub_ps(_mm_loadu_ps(v2[k]), p0);
+    s[k] = _mm_sub_ps(_mm_set1_ps(ray.origin[k]), p0);
+  }
+  __m128 d[3] = {_mm_set1_ps(ray.direction.x), _mm_set1_ps(ray.direction.y),
+                 _mm_set1_ps(ray.direction.z)};
+  auto cross = [](const __m128 a[3], const __m128 b[3], __m128 out[3]) {
+    out[0] = _mm_sub_ps(_mm_mul_ps(a[1], b[2]), _mm_mul_ps(a[2], b[1]));
+    out[1] = _mm_sub_ps(_mm_mul_ps(a[2], b[0]), _mm_mul_ps(a[0], b[2]));
+    out[2] = _mm_sub_ps(_mm_mul_ps(a[0], b[1]), _mm_mul_ps(a[1], b[0]));
+  };
+  auto dot = [](const __m128 a[3], const __m128 b[3]) {
+    __m128 xy = _mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1]));
+    return _mm_add_ps(xy, _mm_mul_ps(a[2], b[2]));
+  };
+  __m128 p[3], q[3];
+  cross(d, e2, p);
+  cross(s, e1, q);
+  __m128 det = dot(e1, p);
+  __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+  __m128 inv_det = _mm_div_ps(_mm_set1_ps(1.0f), det);
+  __m128 u_4 = _mm_mul_ps(dot(s, p), inv_det);
+  __m128 v_4 = _mm_mul_ps(dot(d, q), inv_det);
+  __m128 t_4 = _mm_mul_ps(dot(e2, q), inv_det);
+  __m128 zero = _mm_setzero_ps();
+  __m128 mask = _mm_cmpgt_ps(abs_det, _mm_set1_ps(kEpsilon));
+  mask = _mm_and_ps(mask, _mm_cmpge_ps(u_4, zero));
+  mask = _mm_and_ps(mask, _mm_cmpge_ps(v_4, zero));
+  mask = _mm_and_ps(mask,
+                    _mm_cmple_ps(_mm_add_ps(u_4, v_4), _mm_set1_ps(1.0f)));
+  mask = _mm_and_ps(mask, _mm_cmpgt_ps(t_4, _mm_set1_ps(t_min)));
+  mask = _mm_and_ps(mask, _mm_cmplt_ps(t_4, _mm_set1_ps(t_max)));
+  hits = _mm_movemask_ps(mask) & ((1u << num_triangles) - 1);
+  _mm_storeu_ps(t, t_4);
+  _mm_storeu_ps(u, u_4);
+  _mm_storeu_ps(v, v_4);
+#else
+  for (int i = 0; i < num_triangles; i++) {
+    glm::vec3 p0(v0[0][i], v0[1][i], v0[2][i]);
+    glm::vec3 e1 = glm::vec3(v1[0][i], v1[1][i], v1[2][i]) - p0;
+    glm::vec3 e2 = glm::vec3(v2[0][i], v2[1][i], v2[2][i]) - p0;
+    glm::vec3 p = glm::cross(ray.direction, e2);
+    float det = glm::dot(e1, p);
+    if (std::abs(det) <= kEpsilon) continue;
+    float inv_det = 1.0f / det;
+    glm::vec3 s = ray.origin - p0;
+    glm::vec3 q = glm::cross(s, e1);
+    u[i] = glm::dot(s, p) * inv_det;
+    v[i] = glm::dot(ray.direction, q) * inv_det;
+    t[i] = glm::dot(e2, q) * inv_det;
+    if (u[i] >= 0 && v[i] >= 0 && u[i] + v[i] <= 1 && t[i] > t_min &&
+        t[i] < t_max) {
+      hits |= 1u << i;
+    }
+  }
+#endif
+  return hits;
+}
+
+// slab test of a ray with the children of a wide node, returns the hit
+// children as a bit mask and their entry distances in t_near
+inline uint32_t IntersectRayWideBVHNode(const WideBVHNode& node,
+                                        glm::vec3 origin,
+                                        glm::vec3 inv_direction, float t_min,
+                                        float t_max, float t_near[4]) {
+  const float* mins[3] = {node.min_x, node.min_y, node.min_z};
+  const float* maxs[3] = {node.max_x, node.max_y, node.max_z};
+#ifdef BVH_SSE
+  __m128 near_4 = _mm_set1_ps(t_min), far_4 = _mm_set1_ps(t_max);
+  for (int k = 0; k < 3; k++) {
+    __m128 o = _mm_set1_ps(origin[k]), inv = _mm_set1_ps(inv_direction[k]);
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(mins[k]), o), inv);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxs[k]), o), inv);
+    near_4 = _mm_max_ps(near_4, _mm_min_ps(t0, t1));
+    far_4 = _mm_min_ps(far_4, _mm_max_ps(t0, t1));
+  }
+  _mm_storeu_ps(t_near, near_4);
+  return _mm_movemask_ps(_mm_cmple_ps(near_4, far_4)) &
+         ((1u << node.num_children) - 1);
+#else
+  uint32_t hits = 0;
+  for (int i = 0; i < node.num_children; i++) {
+    float t_entry = t_min, t_exit = t_max;
+    for (int k = 0; k < 3; k++) {
+      float t0 = (mins[k][i] - origin[k]) * inv_direction[k];
+      float t1 = (maxs[k][i] - origin[k]) * inv_direction[k];
+      t_entry = std::max(t_entry, std::min(t0, t1));
+      t_exit = std::min(t_exit, std::max(t0, t1));
+    }
+    t_near[i] = t_entry;
+    if (t_entry <= t_exit) hits |= 1u << i;
+  }
+  return hits;
+#endif
+}
+
+struct BVHBuildOptions {
+  // nodes with more triangles are always split
+  uint32_t max_triangles_in_leaf = 4;
+  // nodes with at most this many triangles are never split, in between the
+  // surface area heuristic (SAH) decides
+  uint32_t min_triangles_in_leaf = 1;
+  // SAH costs of visiting a node and testing a triangle
+  float traversal_cost = 1.0f;
+  float intersection_cost = 1.0f;
+  uint32_t num_bins = 16;
+  // subtrees with more triangles are built in parallel tasks, near the root
+  // only, so that there are at most twice as many tasks as threads
+  uint32_t min_triangles_per_task = 1 << 14;
 };
 
 template <typename V>
 class BVH {
  private:
-  static constexpr uint32_t kMinTrianglesInNode = 1 << 12;
+  struct Bounds {
+    glm::vec3 min = glm::vec3(INFINITY), max = glm::vec3(-INFINITY);
+
+    inline void Grow(glm::vec3 p) {
+      min = glm::min(min, p);
+      max = glm::max(max, p);
+    }
+    inline void Grow(const Bounds& b) {
+      min = glm::min(min, b.min);
+      max = glm::max(max, b.max);
+    }
+    inline float Area() const {
+      glm::vec3 d = glm::max(max - min, glm::vec3(0));
+      return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static inline Bounds Of(const BVHNode& node) {
+      Bounds bounds;
+      bounds.min = node.min;
+      bounds.max = node.max;
+      return bounds;
+    }
+  };
+
+  // the bounds and the centroid of a triangle are computed once before the
+  // build and partitioned along with its index
+  struct Reference {
+    Bounds bounds;
+    glm::vec3 centroid;
+    uint32_t id;
+  };
+
+  struct Builder {
+    BVHBuildOptions options;
+    // the triangles of [first, first + references.size()) of the
+    // triangle indices, by position
+    uint32_t first = 0;
+    std::vector<Reference> references;
+
+    inline const Reference& at(uint32_t i) const {
+      return references[i - first];
+    }
+
+    struct Bin {
+      Bounds bounds;
+      uint32_t count = 0;
+    };
+    // the bins of Split(), allocated once per task rather than per node
+    struct Scratch {
+      std::vector<Bin> bins;
+      std::vector<float> right_areas;
+      std::vector<uint32_t> right_counts;
+    };
+
+    // the depth down to which subtrees are built in parallel tasks, so that
+    // there are at most twice as many tasks as threads, the extra level
+    // evens out unbalanced splits
+    static uint32_t MaxTaskDepth() {
+      uint32_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+      if (num_threads == 1) return 0;
+      uint32_t depth = 1;
+      while ((1u << depth) < num_threads) depth++;
+      return depth + 1;
+    }
+
+    // appends the subtree of [begin, end) to nodes, the right child index of
+    // an inner node is relative to the node until BVH::Build() fixes it
+    void Build(uint32_t begin, uint32_t end, std::vector<BVHNode>* nodes) {
+      Scratch scratch;
+      Build(begin, end, nodes, &scratch, MaxTaskDepth());
+    }
+
+    void Build(uint32_t begin, uint32_t end, std::vector<BVHNode>* nodes,
+               Scratch* scratch, uint32_t task_depth) {
+      Bounds bounds, centroid_bounds;
+      for (uint32_t i = begin; i < end; i++) {
+        bounds.Grow(at(i).bounds);
+        centroid_bounds.Grow(at(i).centroid);
+      }
+
+      uint32_t node_index = nodes->size();
+      nodes->push_back({bounds.min, begin, bounds.max, end - begin});
+
+      uint32_t mid = Split(begin, end, bounds, centroid_bounds, scratch);
+      if (mid == begin) return;
+      (*nodes)[node_index].num_triangles = 0;
+
+      if (task_depth > 0 && end - begin >= options.min_triangles_per_task) {
+        std::vector<BVHNode> left_nodes, right_nodes;
+        auto left = std::async(std::launch::async, [&]() {
+          Scratch left_scratch;
+          Build(begin, mid, &left_nodes, &left_scratch, task_depth - 1);
+        });
+        Build(mid, end, &right_nodes, scratch, task_depth - 1);
+        left.get();
+        (*nodes)[node_index].offset = 1 + left_nodes.size();
+        nodes->insert(nodes->end(), left_nodes.begin(), left_nodes.end());
+        nodes->insert(nodes->end(), right_nodes.begin(), right_nodes.end());
+      } else {
+        Build(begin, mid, nodes, scratch, 0);
+        (*nodes)[node_index].offset = nodes->size() - node_index;
+        Build(mid, end, nodes, scratch, 0);
+      }
+    }
+
+    // partitions [begin, end) by the binned SAH split and returns the first
+    // index of the right half, or begin when the node should be a leaf
+    uint32_t Split(uint32_t begin, uint32_t end, const Bounds& bounds,
+                   const Bounds& centroid_bounds, Scratch* scratch) {
+      uint32_t num_triangles = end - begin;
+      if (num_triangles <= std::max(options.min_triangles_in_leaf, 1u)) {
+        return begin;
+      }
 
-  std::unique_ptr<BVHNode> root_ = nullptr;
+      uint32_t num_bins = std::max(options.num_bins, 2u);
+      std::vector<Bin>& bins = scratch->bins;
+      std::vector<float>& right_areas = scratch->right_areas;
+      std::vector<uint32_t>& right_counts = scratch->right_counts;
+      bins.resize(num_bins);
+      right_areas.resize(num_bins);
+      right_counts.resize(num_bins);
+
+      float best_cost = options.intersection_cost * num_triangles;
+      int32_t best_axis = -1;
+      uint32_t best_bin = 0;
+      for (int axis = 0; axis < 3; axis++) {
+        float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+        if (extent <= 0) continue;
+        float scale = num_bins / extent;
+
+        std::fill(bins.begin(), bins.end(), Bin());
+        for (uint32_t i = begin; i < end; i++) {
+          const Reference& reference = at(i);
+          auto& bin = bins[BinIndex(reference.centroid[axis],
+                                    centroid_bounds.min[axis], scale,
+                                    num_bins)];
+          bin.bounds.Grow(reference.bounds);
+          bin.count++;
+        }
+
+        // sweep from the right, then evaluate the splits from the left
+        Bounds right;
+        uint32_t right_count = 0;
+        for (uint32_t i = num_bins - 1; i > 0; i--) {
+          right.Grow(bins[i].bounds);
+          right_count += bins[i].count;
+          right_areas[i] = right.Area();
+          right_counts[i] = right_count;
+        }
+        Bounds left;
+        uint32_t left_count = 0;
+        for (uint32_t i = 1; i < num_bins; i++) {
+          left.Grow(bins[i - 1].bounds);
+          left_count += bins[i - 1].count;
+          if (left_count == 0 || right_counts[i] == 0) continue;
+          float cost = options.traversal_cost +
+                       options.intersection_cost *
+                           (left.Area() * left_count +
+                            right_areas[i] * right_counts[i]) /
+                           bounds.Area();
+          if (cost < best_cost) {
+            best_cost = cost;
+            best_axis = axis;
+            best_bin = i;
+          }
+        }
+      }
+
+      if (best_axis < 0) {
+        if (num_triangles <= options.max_triangles_in_leaf) return begin;
+        // no SAH split exists (e.g. all centroids coincide), split in half
+        return begin + num_triangles / 2;
+      }
+      if (best_cost >= options.intersection_cost * num_triangles &&
+          num_triangles <= options.max_triangles_in_leaf) {
+        return begin;
+      }
+
+      float min = centroid_bounds.min[best_axis];
+      float scale = num_bins / (centroid_bounds.max[best_axis] - min);
+      auto mid = std::partition(
+          references.begin() + (begin - first),
+          references.begin() + (end - first), [&](const Reference& reference) {
+            return BinIndex(reference.centroid[best_axis], min, scale,
+                            num_bins) < best_bin;
+          });
+      return first + (mid - references.begin());
+    }
+
+    static inline uint32_t BinIndex(float x, float min, float scale,
+                                    uint32_t num_bins) {
+      return std::min(static_cast<uint32_t>((x - min) * scale), num_bins - 1);
+    }
+  };
+
+  std::vector<BVHNode> nodes_;
   std::vector<uint32_t> triangle_indices_;
 
-  static AABB GetBV(const V* vertices, const glm::uvec3* triangles,
-                    const uint32_t* triangle_indices, uint32_t num_triangles) {
-    AABB aabb;
-    aabb.min = glm::vec3(INFINITY);
-    aabb.max = glm::vec3(-INFINITY);
-    for (int i = 0; i < num_triangles; i++)
-      for (int j = 0; j < 3; j++)
+  BVHBuildOptions options_;
+  // the SAH cost of the subtree of each node when it was built, and now,
+  // kept by the refits
+  std::vector<float> built_costs_, costs_;
+
+  // the bounds of a triangle, or of a box of a BoxBVH, by its index
+  static inline auto TriangleBounds(const V* vertices,
+                                    const glm::uvec3* triangles) {
+    return [vertices, triangles](uint32_t id) {
+      Bounds bounds;
+      for (int j = 0; j < 3; j++) {
+        bounds.Grow(vertices[triangles[id][j]].position);
+      }
+      return bounds;
+    };
+  }
+  static inline auto BoxBounds(const AABB* boxes) {
+    return [boxes](uint32_t id) {
+      Bounds bounds;
+      bounds.min = boxes[id].min;
+      bounds.max = boxes[id].max;
+      return bounds;
+    };
+  }
+
+  // builds the subtree of triangle_indices_[begin, end) and reorders them,
+  // the right child indices are relative to their node; the scratch memory
+  // is of the size of the range, not of the whole tree
+  template <typename BoundsOf>
+  std::vector<BVHNode> BuildSubtree(const BoundsOf& bounds_of, uint32_t begin,
+                                    uint32_t end) {
+    Builder builder;
+    builder.options = options_;
+    builder.first = begin;
+    builder.references.resize(end - begin);
+    for (uint32_t i = begin; i < end; i++) {
+      Reference& reference = builder.references[i - begin];
+      reference.id = triangle_indices_[i];
+      reference.bounds = bounds_of(reference.id);
+      reference.centroid = (reference.bounds.min + reference.bounds.max) * 0.5f;
+    }
+
+    std::vector<BVHNode> nodes;
+    builder.Build(begin, end, &nodes);
+    for (uint32_t i = begin; i < end; i++) {
+      triangle_indices_[i] = builder.references[i - begin].id;
+    }
+    return nodes;
+  }
+
+  template <typename BoundsOf>
+  void Build(const BoundsOf& bounds_of, uint32_t num_triangles,
+             const BVHBuildOptions& options) {
+    options_ = options;
+    triangle_indices_.resize(num_triangles);
+    for (int i = 0; i < num_triangles; i++) triangle_indices_[i] = i;
+    if (num_triangles == 0) return;
+
+    nodes_ = BuildSubtree(bounds_of, 0, num_triangles);
+    for (uint32_t i = 0; i < nodes_.size(); i++) {
+      if (!nodes_[i].is_leaf()) nodes_[i].offset += i;
+    }
+    BuildWideNodes();
+    built_costs_ = costs_ = SubtreeCosts();
+  }
+
+  // the unnormalized SAH cost of the subtree of each node, bottom-up since
+  // the children always follow their parent
+  std::vector<float> SubtreeCosts() const {
+    std::vector<float> costs(nodes_.size());
+    for (int64_t i = nodes_.size() - 1; i >= 0; i--) {
+      costs[i] = SubtreeCost(i, costs);
+    }
+    return costs;
+  }
+
+  // from the costs of its children
+  inline float SubtreeCost(uint32_t i, const std::vector<float>& costs) const {
+    const auto& node = nodes_[i];
+    float area = Bounds::Of(node).Area();
+    return node.is_leaf()
+               ? options_.intersection_cost * node.num_triangles * area
+               : options_.traversal_cost * area + costs[i + 1] +
+                     costs[node.offset];
+  }
+
+  // replaces the subtree of node_index by a new build of its triangles, the
+  // node count may change so the nodes after it are shifted
+  template <typename BoundsOf>
+  void RebuildSubtree(const BoundsOf& bounds_of, uint32_t node_index) {
+    // the subtree covers [node_index, node_end) and its triangles
+    // [triangle_begin, triangle_end), found by walking its rightmost path
+    uint32_t triangle_begin = node_index, node_end = node_index;
+    while (!nodes_[triangle_begin].is_leaf()) triangle_begin++;
+    while (!nodes_[node_end].is_leaf()) node_end = nodes_[node_end].offset;
+    triangle_begin = nodes_[triangle_begin].offset;
+    uint32_t triangle_end =
+        nodes_[node_end].offset + nodes_[node_end].num_triangles;
+    node_end++;
+
+    auto subtree = BuildSubtree(bounds_of, triangle_begin, triangle_end);
+    int64_t delta = int64_t(subtree.size()) - (node_end - node_index);
+    for (uint32_t i = 0; i < subtree.size(); i++) {
+      if (!subtree[i].is_leaf()) subtree[i].offset += node_index + i;
+    }
+    for (auto& node : nodes_) {
+      if (!node.is_leaf() && node.offset >= node_end) node.offset += delta;
+    }
+    nodes_.erase(nodes_.begin() + node_index, nodes_.begin() + node_end);
+    nodes_.insert(nodes_.begin() + node_index, subtree.begin(), subtree.end());
+  }
+
+  // updates the bounds of the wide nodes from the binary ones, bottom-up
+  // since the children always follow their parent
+  void RefitWideNodes() {
+    for (int64_t i = wide_nodes_.size() - 1; i >= 0; i--) {
+      auto& wide_node = wide_nodes_[i];
+      for (int j = 0; j < wide_node.num_children; j++) {
+        uint32_t child = wide_node.children[j];
+        Bounds bounds;
+        if (child & WideBVHNode::kLeafBit) {
+          bounds = Bounds::Of(nodes_[child & ~WideBVHNode::kLeafBit]);
+        } else {
+          const auto& child_node = wide_nodes_[child];
+          for (int k = 0; k < child_node.num_children; k++) {
+            bounds.Grow(glm::vec3(child_node.min_x[k], child_node.min_y[k],
+                                  child_node.min_z[k]));
+            bounds.Grow(glm::vec3(child_node.max_x[k], child_node.max_y[k],
+                                  child_node.max_z[k]));
+          }
+        }
+        SetWideChildBounds(bounds, j, &wide_node);
+      }
+    }
+  }
+
+  static inline void SetWideChildBounds(const Bounds& bounds, int i,
+                                        WideBVHNode* wide_node) {
+    wide_node->min_x[i] = bounds.min.x;
+    wide_node->min_y[i] = bounds.min.y;
+    wide_node->min_z[i] = bounds.min.z;
+    wide_node->max_x[i] = bounds.max.x;
+    wide_node->max_y[i] = bounds.max.y;
+    wide_node->max_z[i] = bounds.max.z;
+  }
+
+  std::vector<WideBVHNode> wide_nodes_;
+  // the traversal stack never grows beyond this
+  uint32_t max_stack_size_ = 0;
+  static constexpr uint32_t kLocalStackSize = 256;
+
+  // collapses the binary subtree of node_index into wide nodes, returns the
+  // index of its wide node and updates max_stack_size_ with its depth
+  uint32_t Collapse(uint32_t node_index, uint32_t depth) {
+    // open the inner child with the largest area until the node is full
+    std::vector<uint32_t> children = {node_index + 1,
+                                      nodes_[node_index].offset};
+    while (children.size() < WideBVHNode::kWidth) {
+      int32_t best = -1;
+      float best_area = -1;
+      for (int i = 0; i < children.size(); i++) {
+        const auto& child = nodes_[children[i]];
+        if (child.is_leaf()) continue;
+        float area = Bounds::Of(child).Area();
+        if (area > best_area) {
+          best_area = area;
+          best = i;
+        }
+      }
+      if (best < 0) break;
+      uint32_t inner = children[best];
+      children[best] = inner + 1;
+      children.insert(children.begin() + best + 1, nodes_[inner].offset);
+    }
+
+    uint32_t wide_index = wide_nodes_.size();
+    wide_nodes_.emplace_back();
+    for (int i = 0; i < children.size(); i++) {
+      wide_slots_[children[i]] = wide_index * WideBVHNode::kWidth + i;
+    }
+    // each level leaves at most kWidth - 1 entries on the stack
+    max_stack_size_ = std::max<uint32_t>(
+        max_stack_size_, depth * (WideBVHNode::kWidth - 1) + 1);
+    WideBVHNode wide_node;
+    wide_node.num_children = children.size();
+    for (int i = 0; i < WideBVHNode::kWidth; i++) {
+      // unused slots are never tested, they only need finite bounds
+      glm::vec3 min(0), max(0);
+      uint32_t child_index = 0;
+      if (i < children.size()) {
+        const auto& child = nodes_[children[i]];
+        min = child.min;
+        max = child.max;
+        child_index = child.is_leaf()
+                          ? (children[i] | WideBVHNode::kLeafBit)
+                          : Collapse(children[i], depth + 1);
+      }
+      wide_node.min_x[i] = min.x;
+      wide_node.min_y[i] = min.y;
+      wide_node.min_z[i] = min.z;
+      wide_node.max_x[i] = max.x;
+      wide_node.max_y[i] = max.y;
+      wide_node.max_z[i] = max.z;
+      wide_node.children[i] = child_index;
+    }
+    wide_nodes_[wide_index] = wide_node;
+    return wide_index;
+  }
+
+  // the links of the partial refits, see RefitImpl(ids)
+  static constexpr uint32_t kNoNode = 0xffffffffu;
+  std::vector<uint32_t> parents_;
+  std::vector<uint32_t> triangle_leaves_;
+  // wide node * kWidth + child slot of the nodes that are wide node children
+  std::vector<uint32_t> wide_slots_;
+  // kRefitPending during a partial refit, kRefitted from the refit until the
+  // next RebuildDegradedSubtrees(), which only visits those nodes
+  static constexpr uint8_t kRefitPending = 1, kRefitted = 2;
+  std::vector<uint8_t> refit_marks_;
+
+  // also (re)builds the links of the partial refits
+  void BuildWideNodes() {
+    wide_nodes_.clear();
+    max_stack_size_ = 0;
+    wide_slots_.assign(nodes_.size(), kNoNode);
+    if (nodes_.size() > 1) Collapse(0, 1);
+
+    parents_.assign(nodes_.size(), kNoNode);
+    triangle_leaves_.resize(triangle_indices_.size());
+    refit_marks_.assign(nodes_.size(), 0);
+    for (uint32_t i = 0; i < nodes_.size(); i++) {
+      const auto& node = nodes_[i];
+      if (node.is_leaf()) {
+        for (uint32_t j = 0; j < node.num_triangles; j++) {
+          triangle_leaves_[triangle_indices_[node.offset + j]] = i;
+        }
+      } else {
+        parents_[i + 1] = i;
+        parents_[node.offset] = i;
+      }
+    }
+  }
+
+  // a root that is a leaf has no wide node
+  inline bool root_is_leaf() const { return nodes_.size() == 1; }
+
+  // visits the leaves below the wide nodes on the stack, the stack entries
+  // keep the planes that their node is not fully inside of, a node fully
+  // inside the frustum is accepted without further tests
+  struct StackEntry {
+    uint32_t wide_index, plane_mask;
+  };
+
+  template <typename Visitor>
+  void SearchWideNodes(const FrustumPlane* const planes[6], Visitor& visitor,
+                       StackEntry* stack) const {
+    uint32_t stack_size = 0;
+    stack[stack_size++] = {0, (1u << 6) - 1};
+    while (stack_size > 0) {
+      StackEntry entry = stack[--stack_size];
+      const WideBVHNode& node = wide_nodes_[entry.wide_index];
+      uint32_t child_plane_masks[WideBVHNode::kWidth];
+      uint32_t visible = (1u << node.num_children) - 1;
+      if (entry.plane_mask != 0) {
+        visible =
+            CullWideBVHNode(node, planes, entry.plane_mask, child_plane_masks);
+      } else {
+        std::fill(child_plane_masks, child_plane_masks + WideBVHNode::kWidth,
+                  0);
+      }
+      // push in reverse so that the children are visited in order
+      for (int i = node.num_children - 1; i >= 0; i--) {
+        if ((visible & (1u << i)) == 0) continue;
+        uint32_t child = node.children[i];
+        if (child & WideBVHNode::kLeafBit) {
+          visitor(&nodes_[child & ~WideBVHNode::kLeafBit]);
+        } else {
+          stack[stack_size++] = {child, child_plane_masks[i]};
+        }
+      }
+    }
+  }
+
+  // intersects the triangles of a leaf 4 at a time, the closest hit so far
+  // is in hit, returns whether it was updated
+  bool IntersectLeaf(const V* vertices, const glm::uvec3* triangles,
+                     const BVHNode& leaf, const Ray& ray, RayHit* hit) const {
+    bool updated = false;
+    for (uint32_t first = 0; first < leaf.num_triangles; first += 4) {
+      uint32_t count = std::min(leaf.num_triangles - first, 4u);
+      float v0[3][4] = {}, v1[3][4] = {}, v2[3][4] = {};
+      uint32_t ids[4];
+      for (uint32_t i = 0; i < count; i++) {
+        ids[i] = triangle_indices_[leaf.offset + first + i];
+        const auto& triangle = triangles[ids[i]];
         for (int k = 0; k < 3; k++) {
-          aabb.min[k] =
-              std::min(vertices[triangles[triangle_indices[i]][j]].position[k],
-                       aabb.min[k]);
-          aabb.max[k] =
-              std::max(vertices[triangles[triangle_indices[i]][j]].position[k],
-                       aabb.max[k]);
+          v0[k][i] = vertices[triangle[0]].position[k];
+          v1[k][i] = vertices[triangle[1]].position[k];
+          v2[k][i] = vertices[triangle[2]].position[k];
         }
-    return aabb;
-  }
-
-  static std::unique_ptr<BVHNode> BuildRecursively(const V* vertices,
-                                                   const glm::uvec3* triangles,
-                                                   uint32_t* triangle_indices,
-                                                   uint32_t num_triangles) {
-    auto node = std::unique_ptr<BVHNode>(new BVHNode());
-    node->aabb =
-        BVH<V>::GetBV(vertices, triangles, triangle_indices, num_triangles);
-    node->triangle_indices = triangle_indices;
-    node->num_triangles = num_triangles;
-    if (num_triangles <= kMinTrianglesInNode) {
-      return node;
-    }
-
-    // calculate split axis
-    glm::vec3 range = node->aabb.max - node->aabb.min;
-    node->split_axis = 0;
-    for (int i = 1; i <= 2; i++) {
-      if (range[i] > range[node->split_axis]) {
-        node->split_axis = i;
-      }
-    }
-
-    std::sort(triangle_indices, triangle_indices + num_triangles,
-              [&](uint32_t a, uint32_t b) {
-                glm::vec3 a_center = (vertices[triangles[a][0]].position +
-                                      vertices[triangles[a][1]].position +
-                                      vertices[triangles[a][2]].position) /
-                                     3.0f;
-                glm::vec3 b_center = (vertices[triangles[b][0]].position +
-                                      vertices[triangles[b][1]].position +
-                                      vertices[triangles[b][2]].position) /
-                                     3.0f;
-                return a_center[node->split_axis] < b_center[node->split_axis];
-              });
-
-    node->left = BuildRecursively(vertices, triangles, triangle_indices,
-                                  num_triangles / 2);
-    node->right = BuildRecursively(vertices, triangles,
-                                   triangle_indices + num_triangles / 2,
-                                   (num_triangles + 1) / 2);
-    return node;
-  }
-
-  static void TraverseRecursively(
-      BVHNode* node, const std::function<void(BVHNode*)>& callback) {
-    if (node->split_axis == -1) {
-      callback(node);
-    } else {
-      TraverseRecursively(node->left.get(), callback);
-      TraverseRecursively(node->right.get(), callback);
+      }
+      float t[4], u[4], v[4];
+      uint32_t hits = IntersectRayTriangles(ray, ray.t_min, hit->t, v0, v1, v2,
+                                            count, t, u, v);
+      for (uint32_t i = 0; i < count; i++) {
+        if ((hits & (1u << i)) == 0 || t[i] >= hit->t) continue;
+        hit->t = t[i];
+        hit->u = u[i];
+        hit->v = v[i];
+        hit->triangle = ids[i];
+        updated = true;
+      }
     }
+    return updated;
   }
 
-  static void SearchRecursively(BVHNode* node, const Frustum& frustum,
-                                const std::function<void(BVHNode*)>& callback) {
-    if (!node->aabb.IsOnFrustum(frustum)) return;
-    if (node->split_axis == -1) {
-      callback(node);
-    } else {
-      SearchRecursively(node->left.get(), frustum, callback);
-      SearchRecursively(node->right.get(), frustum, callback);
+  // stops at the first hit when any_hit is set
+  RayHit IntersectImpl(const V* vertices, const glm::uvec3* triangles,
+                       const Ray& ray, bool any_hit) const {
+    RayHit hit;
+    hit.t = ray.t_max;
+    Traverse(ray, [&](const BVHNode* leaf, float* t_max) {
+      bool updated = IntersectLeaf(vertices, triangles, *leaf, ray, &hit);
+      *t_max = hit.t;
+      return updated && any_hit;
+    });
+    if (!hit.hit()) hit.t = INFINITY;
+    return hit;
+  }
+
+  template <typename BoundsOf>
+  void RefitImpl(const BoundsOf& bounds_of) {
+    uint32_t num_tasks = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t chunk_size = (nodes_.size() + num_tasks - 1) / num_tasks;
+    std::vector<std::future<void>> tasks;
+    for (uint32_t begin = 0; begin < nodes_.size(); begin += chunk_size) {
+      uint32_t end = std::min<uint32_t>(begin + chunk_size, nodes_.size());
+      tasks.push_back(std::async(std::launch::async, [&, begin, end]() {
+        for (uint32_t i = begin; i < end; i++) {
+          auto& node = nodes_[i];
+          if (!node.is_leaf()) continue;
+          Bounds bounds = LeafBounds(bounds_of, node);
+          node.min = bounds.min;
+          node.max = bounds.max;
+        }
+      }));
+    }
+    for (auto& task : tasks) task.get();
+
+    for (int64_t i = nodes_.size() - 1; i >= 0; i--) {
+      auto& node = nodes_[i];
+      if (node.is_leaf()) continue;
+      Bounds bounds = Bounds::Of(nodes_[i + 1]);
+      bounds.Grow(Bounds::Of(nodes_[node.offset]));
+      node.min = bounds.min;
+      node.max = bounds.max;
+    }
+    RefitWideNodes();
+    costs_ = SubtreeCosts();
+    std::fill(refit_marks_.begin(), refit_marks_.end(), kRefitted);
+  }
+
+  // refits the leaves of the triangles ids and their ancestors only, and
+  // the wide node slots of those nodes
+  template <typename BoundsOf>
+  void RefitImpl(const BoundsOf& bounds_of, const uint32_t* ids,
+                 uint32_t num_ids) {
+    if (nodes_.empty()) return;
+    // the walks up stop at the nodes marked by the previous ones
+    for (uint32_t i = 0; i < num_ids; i++) {
+      for (uint32_t node = triangle_leaves_[ids[i]];
+           node != kNoNode && !(refit_marks_[node] & kRefitPending);
+           node = parents_[node]) {
+        refit_marks_[node] |= kRefitPending;
+      }
+    }
+
+    // bottom-up since the children always follow their parent, a scan of
+    // the marks is cheaper than sorting the marked nodes
+    for (int64_t i = nodes_.size() - 1; i >= 0; i--) {
+      if (!(refit_marks_[i] & kRefitPending)) continue;
+      refit_marks_[i] = kRefitted;
+      auto& node = nodes_[i];
+      Bounds bounds;
+      if (node.is_leaf()) {
+        bounds = LeafBounds(bounds_of, node);
+      } else {
+        bounds = Bounds::Of(nodes_[i + 1]);
+        bounds.Grow(Bounds::Of(nodes_[node.offset]));
+      }
+      node.min = bounds.min;
+      node.max = bounds.max;
+      costs_[i] = SubtreeCost(i, costs_);
+      uint32_t slot = wide_slots_[i];
+      if (slot != kNoNode) {
+        SetWideChildBounds(bounds, slot % WideBVHNode::kWidth,
+                           &wide_nodes_[slot / WideBVHNode::kWidth]);
+      }
+    }
+  }
+
+  template <typename BoundsOf>
+  Bounds LeafBounds(const BoundsOf& bounds_of, const BVHNode& leaf) const {
+    Bounds bounds;
+    for (uint32_t j = 0; j < leaf.num_triangles; j++) {
+      bounds.Grow(bounds_of(triangle_indices_[leaf.offset + j]));
+    }
+    return bounds;
+  }
+
+  template <typename BoundsOf>
+  uint32_t RebuildDegradedSubtreesImpl(const BoundsOf& bounds_of,
+                                       float max_cost_growth) {
+    if (nodes_.empty()) return 0;
+    // the costs of the nodes not refitted since the last check are the same,
+    // and so are the ones of their subtrees
+    std::vector<uint32_t> degraded, stack;
+    if (refit_marks_[0] & kRefitted) stack.push_back(0);
+    while (!stack.empty()) {
+      uint32_t i = stack.back();
+      stack.pop_back();
+      refit_marks_[i] &= ~kRefitted;
+      if (costs_[i] > built_costs_[i] * max_cost_growth) {
+        degraded.push_back(i);
+      } else if (!nodes_[i].is_leaf()) {
+        for (uint32_t child : {i + 1, nodes_[i].offset}) {
+          if (refit_marks_[child] & kRefitted) stack.push_back(child);
+        }
+      }
+    }
+    if (degraded.empty()) return 0;
+
+    // from the back so that the indices of the remaining ones stay valid
+    std::sort(degraded.begin(), degraded.end(), std::greater<uint32_t>());
+    for (auto i : degraded) RebuildSubtree(bounds_of, i);
+    BuildWideNodes();
+    built_costs_ = costs_ = SubtreeCosts();
+    return degraded.size();
+  }
+
+  // visits the leaves whose bounds pass overlaps(min, max), the tests are
+  // done per child of the wide nodes
+  template <typename Overlaps, typename Visitor>
+  void SearchOverlapping(const Overlaps& overlaps, Visitor& visitor) const {
+    if (nodes_.empty()) return;
+    if (root_is_leaf()) {
+      if (overlaps(nodes_[0].min, nodes_[0].max)) visitor(&nodes_[0]);
+      return;
+    }
+
+    uint32_t local_stack[kLocalStackSize];
+    std::vector<uint32_t> heap_stack;
+    uint32_t* stack = local_stack;
+    if (max_stack_size_ > kLocalStackSize) {
+      // only for degenerate trees
+      heap_stack.resize(max_stack_size_);
+      stack = heap_stack.data();
+    }
+
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0) {
+      const WideBVHNode& node = wide_nodes_[stack[--stack_size]];
+      for (int i = node.num_children - 1; i >= 0; i--) {
+        glm::vec3 min(node.min_x[i], node.min_y[i], node.min_z[i]);
+        glm::vec3 max(node.max_x[i], node.max_y[i], node.max_z[i]);
+        if (!overlaps(min, max)) continue;
+        uint32_t child = node.children[i];
+        if (child & WideBVHNode::kLeafBit) {
+          visitor(&nodes_[child & ~WideBVHNode::kLeafBit]);
+        } else {
+          stack[stack_size++] = child;
+        }
+      }
     }
   }
 
  public:
-  BVH(const V* vertices, const glm::uvec3* triangles, uint32_t num_triangles) {
-    triangle_indices_.resize(num_triangles);
-    for (int i = 0; i < num_triangles; i++) triangle_indices_[i] = i;
+  BVH(const V* vertices, const glm::uvec3* triangles, uint32_t num_triangles,
+      const BVHBuildOptions& options = BVHBuildOptions()) {
+    Build(TriangleBounds(vertices, triangles), num_triangles, options);
+  }
+
+  // a tree over boxes instead of triangles, see BoxBVH
+  BVH(const AABB* boxes, uint32_t num_boxes,
+      const BVHBuildOptions& options = BVHBuildOptions()) {
+    Build(BoxBounds(boxes), num_boxes, options);
+  }
+
+  inline const std::vector<BVHNode>& nodes() const { return nodes_; }
+  inline const std::vector<WideBVHNode>& wide_nodes() const {
+    return wide_nodes_;
+  }
+
+  // the triangles of a leaf
+  inline const uint32_t* triangle_indices(const BVHNode* node) const {
+    return triangle_indices_.data() + node->offset;
+  }
 
-    root_ = BuildRecursively(vertices, triangles, triangle_indices_.data(),
-                             num_triangles);
+  // the expected cost of a query by the surface area heuristic, with the
+  // costs of the build options, to compare the quality of trees
+  float SAHCost() const {
+    if (nodes_.empty()) return 0;
+    return costs_[0] / std::max(Bounds::Of(nodes_[0]).Area(), 1e-12f);
   }
 
-  void Traverse(const std::function<void(BVHNode*)>& callback) {
-    TraverseRecursively(root_.get(), callback);
+  // updates the bounds bottom-up after the vertex positions changed, the
+  // topology and thus the node pointers stay the same
+  void Refit(const V* vertices, const glm::uvec3* triangles) {
+    RefitImpl(TriangleBounds(vertices, triangles));
   }
+  void Refit(const AABB* boxes) { RefitImpl(BoxBounds(boxes)); }
 
-  void Search(const Frustum& frustum,
-              const std::function<void(BVHNode*)>& callback) {
-    SearchRecursively(root_.get(), frustum, callback);
+  // Refit() after only the triangles ids changed, along the paths from
+  // their leaves to the root, cheaper than a full one while few did
+  void Refit(const V* vertices, const glm::uvec3* triangles,
+             const uint32_t* ids, uint32_t num_ids) {
+    RefitImpl(TriangleBounds(vertices, triangles), ids, num_ids);
+  }
+  void Refit(const AABB* boxes, const uint32_t* ids, uint32_t num_ids) {
+    RefitImpl(BoxBounds(boxes), ids, num_ids);
+  }
+
+  // rebuilds the topmost subtrees whose SAH cost grew by more than
+  // max_cost_growth times since they were built, e.g. after refits of moving
+  // geometry, returns the number of rebuilt subtrees; the node pointers are
+  // invalidated if any is rebuilt
+  uint32_t RebuildDegradedSubtrees(const V* vertices,
+                                   const glm::uvec3* triangles,
+                                   float max_cost_growth = 2.0f) {
+    return RebuildDegradedSubtreesImpl(TriangleBounds(vertices, triangles),
+                                       max_cost_growth);
+  }
+  uint32_t RebuildDegradedSubtrees(const AABB* boxes,
+                                   float max_cost_growth = 2.0f) {
+    return RebuildDegradedSubtreesImpl(BoxBounds(boxes), max_cost_growth);
+  }
+
+  // Refit() and RebuildDegradedSubtrees() in one call
+  uint32_t Update(const V* vertices, const glm::uvec3* triangles,
+                  float max_cost_growth = 2.0f) {
+    Refit(vertices, triangles);
+    return RebuildDegradedSubtrees(vertices, triangles, max_cost_growth);
+  }
+  uint32_t Update(const AABB* boxes, float max_cost_growth = 2.0f) {
+    Refit(boxes);
+    return RebuildDegradedSubtrees(boxes, max_cost_growth);
+  }
+
+  // the closest hit of the ray with the triangles, the vertices and triangles
+  // must be the ones the tree was built or refitted with
+  RayHit Intersect(const V* vertices, const glm::uvec3* triangles,
+                   const Ray& ray) const {
+    return IntersectImpl(vertices, triangles, ray, false);
+  }
+
+  // whether the ray hits any triangle, e.g. for line-of-sight checks
+  bool Occluded(const V* vertices, const glm::uvec3* triangles,
+                const Ray& ray) const {
+    return IntersectImpl(vertices, triangles, ray, true).hit();
+  }
+
+  // the closest hits of many rays, spread across threads
+  void Intersect(const V* vertices, const glm::uvec3* triangles,
+                 const Ray* rays, uint32_t num_rays, RayHit* hits) const {
+    uint32_t num_tasks = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t chunk_size = std::max((num_rays + num_tasks - 1) / num_tasks, 64u);
+    std::vector<std::future<void>> tasks;
+    for (uint32_t begin = 0; begin < num_rays; begin += chunk_size) {
+      uint32_t end = std::min(begin + chunk_size, num_rays);
+      tasks.push_back(std::async(std::launch::async, [&, begin, end]() {
+        for (uint32_t i = begin; i < end; i++) {
+          hits[i] = Intersect(vertices, triangles, rays[i]);
+        }
+      }));
+    }
+    for (auto& task : tasks) task.get();
+  }
+
+  // visitor(const BVHNode* leaf, float* t_max) is called for the leaves
+  // whose bounds the ray enters before *t_max, nearest first, e.g. to
+  // intersect the boxes of a BoxBVH; it shortens *t_max to its closest hit
+  // to skip the farther leaves, and returns true to stop the traversal
+  template <typename Visitor>
+  void Traverse(const Ray& ray, Visitor visitor) const {
+    float t_max = ray.t_max;
+    if (nodes_.empty()) return;
+    if (root_is_leaf()) {
+      visitor(&nodes_[0], &t_max);
+      return;
+    }
+
+    glm::vec3 inv_direction;
+    for (int k = 0; k < 3; k++) {
+      // avoids 0 * inf in the slab test
+      float d = ray.direction[k];
+      if (std::abs(d) < 1e-20f) d = std::copysign(1e-20f, d);
+      inv_direction[k] = 1.0f / d;
+    }
+
+    struct RayStackEntry {
+      uint32_t child;
+      float t_near;
+    };
+    RayStackEntry local_stack[kLocalStackSize];
+    std::vector<RayStackEntry> heap_stack;
+    RayStackEntry* stack = local_stack;
+    if (max_stack_size_ > kLocalStackSize) {
+      // only for degenerate trees
+      heap_stack.resize(max_stack_size_);
+      stack = heap_stack.data();
+    }
+
+    uint32_t stack_size = 0;
+    stack[stack_size++] = {0, ray.t_min};
+    while (stack_size > 0) {
+      RayStackEntry entry = stack[--stack_size];
+      if (entry.t_near > t_max) continue;
+      if (entry.child & WideBVHNode::kLeafBit) {
+        if (visitor(&nodes_[entry.child & ~WideBVHNode::kLeafBit], &t_max)) {
+          break;
+        }
+        continue;
+      }
+
+      const WideBVHNode& node = wide_nodes_[entry.child];
+      float t_near[WideBVHNode::kWidth];
+      uint32_t hits = IntersectRayWideBVHNode(node, ray.origin, inv_direction,
+                                              ray.t_min, t_max, t_near);
+      // push the farthest first so that the nearest is popped first
+      RayStackEntry children[WideBVHNode::kWidth];
+      uint32_t num_children = 0;
+      for (int i = 0; i < node.num_children; i++) {
+        if ((hits & (1u << i)) == 0) continue;
+        RayStackEntry child = {node.children[i], t_near[i]};
+        int j = num_children++;
+        for (; j > 0 && children[j - 1].t_near < child.t_near; j--) {
+          children[j] = children[j - 1];
+        }
+        children[j] = child;
+      }
+      for (int i = 0; i < num_children; i++) stack[stack_size++] = children[i];
+    }
+  }
+
+  // visitor(const BVHNode*) is called for every leaf
+  template <typename Visitor>
+  void Traverse(Visitor visitor) const {
+    for (const auto& node : nodes_) {
+      if (node.is_leaf()) visitor(&node);
+    }
+  }
+
+  // visitor(const BVHNode*) is called for every leaf intersecting the
+  // frustum, conservatively, without allocating
+  template <typename Visitor>
+  void Search(const Frustum& frustum, Visitor visitor) const {
+    if (nodes_.empty()) return;
+    if (root_is_leaf()) {
+      if (nodes_[0].aabb().IsOnFrustum(frustum)) visitor(&nodes_[0]);
+      return;
+    }
+
+    const FrustumPlane* const planes[6] = {
+        &frustum.top_plane,  &frustum.bottom_plane, &frustum.right_plane,
+        &frustum.left_plane, &frustum.far_plane,    &frustum.near_plane};
+    if (max_stack_size_ <= kLocalStackSize) {
+      StackEntry stack[kLocalStackSize];
+      SearchWideNodes(planes, visitor, stack);
+    } else {
+      // only for degenerate trees
+      std::vector<StackEntry> stack(max_stack_size_);
+      SearchWideNodes(planes, visitor, stack.data());
+    }
+  }
+
+  // visitor(const BVHNode*) is called for every leaf overlapping the box
+  template <typename Visitor>
+  void Search(const AABB& box, Visitor visitor) const {
+    SearchOverlapping(
+        [&](glm::vec3 min, glm::vec3 max) {
+          return min.x <= box.max.x && min.y <= box.max.y &&
+                 min.z <= box.max.z && box.min.x <= max.x &&
+                 box.min.y <= max.y && box.min.z <= max.z;
+        },
+        visitor);
+  }
+
+  // visitor(const BVHNode*) is called for every leaf overlapping the sphere
+  template <typename Visitor>
+  void Search(glm::vec3 center, float radius, Visitor visitor) const {
+    SearchOverlapping(
+        [&](glm::vec3 min, glm::vec3 max) {
+          glm::vec3 d = center - glm::clamp(center, min, max);
+          return glm::dot(d, d) <= radius * radius;
+        },
+        visitor);
   }
 };
 
-#endif
\ No newline at end of file
+// a tree over boxes, e.g. the bounds of instances, where the boxes take the
+// place of the triangles, i.e. triangle_indices() of a leaf index its boxes
+using BoxBVH = BVH<void>;
+
+#endif
@@ -32,6 +32,10 @@ struct Frustum {
   FrustumPlane left_plane;
   FrustumPlane far_plane;
   FrustumPlane near_plane;
+
+  // extracts the six planes from a view-projection matrix (Gribb-Hartmann),
+  // for views that do not come from a Camera, e.g. cube map faces
+  static Frustum FromViewProjectionMatrix(const glm::mat4 &view_projection);
 };
 
 class Camera {
@@ -68,6 +72,7 @@ class Camera {
   void set_center(glm::vec3 new_center);
   Frustum frustum() const;
   std::vector<glm::vec3> frustum_corners(double z_near, double z_far) const;
+  double fovy() const { return fovy_; }
   double z_near() const { return near_; }
   double z_far() const { return far_; }
   void ImGuiWindow();
@@ -0,0 +1,42 @@
+#ifndef CLOUDS_CLOUD_NOISE_H_
+#define CLOUDS_CLOUD_NOISE_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+// The noise textures of the clouds on the CPU (Sebastien Hillaire's
+// TileableVolumeNoise, and Nadir Roman Guerrero's weather map), across
+// threads a slice or a row each, and 8 texels per AVX2 instruction when
+// supported and enabled, see cpu_features.h. The AVX2 and the scalar paths
+// are bitwise identical, and the lattices are hashed with integers rather
+// than sin(), so the textures are the same on every run and machine. All of
+// them tile, the weather map included.
+namespace cloud_noise {
+
+// of the hashes, bumped whenever the textures change
+constexpr uint32_t VERSION = 1;
+
+// RGBA8 texels, x fastest, then y and z
+struct Volume {
+  uint32_t width, height, depth;
+  // level 0 and its mips down to 1 texel, see BuildMips()
+  std::vector<std::vector<uint8_t>> levels;
+
+  inline uint32_t num_levels() const { return levels.size(); }
+};
+
+// the base shape: Perlin-Worley, then 3 octaves of Worley fBm, size^3
+Volume PerlinWorley(uint32_t size);
+// the erosion: 3 octaves of Worley fBm and 1, size^3
+Volume Worley(uint32_t size);
+// the coverage and the type of the clouds, 0 and 1, size^2; the lattice of
+// each octave is rounded to a whole number of cells, so that it tiles
+Volume Weather(uint32_t size, float perlin_frequency);
+
+// the mips of level 0 by a box filter of 2^3 texels, or 2^2 when 2D
+void BuildMips(Volume *volume);
+
+}  // namespace cloud_noise
+
+#endif
@@ -26,7 +26,10 @@ class Clouds {
   void Deallocate();
 
  public:
-  Clouds(uint32_t width, uint32_t height);
+  // noise_cache_path, if not empty, is where the noise textures are saved
+  // and loaded back from on the next run, see NoiseTextureGenerator
+  Clouds(uint32_t width, uint32_t height,
+         const std::string &noise_cache_path = "");
 
   void Resize(uint32_t width, uint32_t height);
 
@@ -4,9 +4,19 @@
 #include <stdint.h>
 #include <texture.h>
 
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "clouds/cloud_noise.h"
+
 class NoiseTextureGenerator {
  public:
-  NoiseTextureGenerator(float weather_texture_perlin_frequency);
+  // the textures are generated on the CPU with their mips, see cloud_noise.h;
+  // cache_path, if not empty, is where they are saved and loaded back from on
+  // the next run
+  NoiseTextureGenerator(float weather_texture_perlin_frequency,
+                        const std::string &cache_path = "");
   ~NoiseTextureGenerator();
 
   inline const Texture& perlin_worley_texture() {
@@ -19,6 +29,15 @@ class NoiseTextureGenerator {
   float weather_texture_perlin_frequency_;
 
   Texture perlin_worley_texture_, weather_texture_, worley_texture_;
+
+  // of the sizes, the frequency and the version of the noise
+  uint64_t Fingerprint() const;
+  // logs the failures and returns false rather than exiting, the cache is
+  // optional
+  bool Save(const std::string &file_path,
+            const std::vector<cloud_noise::Volume> &volumes) const;
+  std::optional<std::vector<cloud_noise::Volume>> Load(
+      const std::string &file_path) const;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,17 @@
+#ifndef CPU_FEATURES_H_
+#define CPU_FEATURES_H_
+
+// the runtime switch of the AVX2 kernels of the engine (batch culling, Perlin
+// and cloud noise), see avx2_target.h for how they are compiled
+namespace cpu_features {
+
+// AVX2 needs both the CPU and the OS, which must save the YMM registers
+bool AVX2Supported();
+// the AVX2 kernels are used when supported and enabled, e.g. disabled to
+// compare with the scalar ones
+void SetAVX2Enabled(bool enabled);
+bool AVX2Enabled();
+
+}  // namespace cpu_features
+
+#endif
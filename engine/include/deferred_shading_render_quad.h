@@ -7,6 +7,7 @@
 #include "camera.h"
 #include "frame_buffer_object.h"
 #include "gi/vx/vxgi_config.h"
+#include "hi_z_buffer.h"
 #include "light_sources.h"
 #include "ogl_buffer.h"
 #include "shader.h"
@@ -26,6 +27,9 @@ class DeferredShadingRenderQuad {
   Texture ssao_noise_texture_;
   std::unique_ptr<FrameBufferObject> ssao_fbo_, ssao_blur_fbo_;
 
+  // built from the G-Buffer depth, for occlusion culling
+  std::unique_ptr<HiZBuffer> hi_z_buffer_;
+
   static std::unique_ptr<Shader> kShader, kSSAOShader, kSSAOBlurShader;
   static uint32_t vao_;
 
@@ -34,6 +38,8 @@ class DeferredShadingRenderQuad {
 
   void Resize(uint32_t width, uint32_t height);
 
+  inline HiZBuffer* hi_z_buffer() { return hi_z_buffer_.get(); }
+
   void TwoPasses(const Camera* camera, LightSources* light_sources,
                  bool enable_ssao, vxgi::VXGIConfig* vxgi_config,
                  const std::function<void()>& first_pass,
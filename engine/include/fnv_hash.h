@@ -0,0 +1,18 @@
+#ifndef FNV_HASH_H_
+#define FNV_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// FNV-1a, for the fingerprints and checksums of the generated data, the same
+// on every run and machine; a hash starts at FNV_OFFSET_BASIS
+constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+
+inline void FNVHash(uint64_t *hash, const void *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    *hash ^= ((const uint8_t *)data)[i];
+    *hash *= 0x100000001b3ull;
+  }
+}
+
+#endif
@@ -4,6 +4,7 @@
 #include <memory>
 #include <string>
 
+#include "grass/blade_record.h"
 #include "shader.h"
 
 class Blade {
@@ -15,6 +16,9 @@ class Blade {
   std::shared_ptr<Shader> shader_;
 
  public:
+  // the AABB of each BVH leaf, indexed by BladeRecord::leaf
+  static constexpr uint32_t LEAF_BOUNDS_BINDING = 0;
+
   Blade();
 
   inline uint32_t vao() const { return vao_; }
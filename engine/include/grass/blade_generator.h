@@ -0,0 +1,60 @@
+#ifndef GRASS_BLADE_GENERATOR_H_
+#define GRASS_BLADE_GENERATOR_H_
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bvh.h"
+#include "grass/blade_record.h"
+
+// Places the grass blades of a terrain on the CPU, without a GL context. The
+// random numbers of a blade come from Philox keyed by the seed with (triangle,
+// LOD) as the counter, so the blades only depend on the mesh and the seed, not
+// on the number of threads. They are written in the layout Grassland draws
+// from: the blades of a BVH leaf are contiguous from max_lod * leaf->offset,
+// LOD-major, then shuffled so that any prefix is a LOD. The leaves may also
+// be any partition of the mesh, e.g. a tile of the terrain as a single leaf.
+class BladeGenerator {
+ public:
+  struct Mesh {
+    const glm::vec3 *vertices;
+    const glm::vec2 *tex_coords;
+    const glm::uvec3 *triangles;
+  };
+
+  // a BVH leaf and BVH::triangle_indices() of it, the leaves in
+  // BVH::Traverse() order give BladeRecord::leaf
+  struct Leaf {
+    const BVHNode *node;
+    const uint32_t *triangle_indices;
+  };
+
+  explicit BladeGenerator(uint32_t max_lod, uint64_t seed);
+
+  // max_lod blades per triangle of the leaves, spread across threads
+  std::vector<BladeRecord> Generate(const Mesh &mesh,
+                                    const std::vector<Leaf> &leaves) const;
+
+  // a file is only loaded back by a generator of the same seed and LOD
+  // count, for the same leaves; Save() logs the failures and returns false
+  // rather than exiting, it runs in the streaming tasks of GrassTiles
+  bool Save(const std::string &file_path, const std::vector<Leaf> &leaves,
+            const std::vector<BladeRecord> &blades) const;
+  std::optional<std::vector<BladeRecord>> Load(
+      const std::string &file_path, const std::vector<Leaf> &leaves) const;
+
+ private:
+  void GenerateLeaf(const Mesh &mesh, const Leaf &leaf, uint32_t leaf_index,
+                    BladeRecord *blades) const;
+  uint64_t Fingerprint(const std::vector<Leaf> &leaves) const;
+
+  uint32_t max_lod_;
+  uint64_t seed_;
+  glm::uvec2 key_;
+};
+
+#endif
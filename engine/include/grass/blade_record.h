@@ -0,0 +1,18 @@
+#ifndef GRASS_BLADE_RECORD_H_
+#define GRASS_BLADE_RECORD_H_
+
+#include <stdint.h>
+
+// a blade instance, 16 bytes instead of its transform, decoded by grass.vert
+struct BladeRecord {
+  // unorms relative to the bounds of the BVH leaf, and the leaf index
+  uint16_t position[3];
+  uint16_t leaf;
+  // unorms of yaw, bend, width and height, grass.vert has their ranges
+  uint8_t shape[4];
+  // half floats, the terrain tex coords may repeat
+  uint32_t tex_coord;
+};
+static_assert(sizeof(BladeRecord) == 16);
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef GRASS_GRASS_TILES_H_
+#define GRASS_GRASS_TILES_H_
+
+#include <stdint.h>
+
+#include <future>
+#include <glm/glm.hpp>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "aabb.h"
+#include "grass/blade_generator.h"
+
+// The grass blades of a terrain in square tiles of the xz plane. The tiles in
+// range of the camera are generated by a BladeGenerator, or loaded from a
+// cache directory, on worker threads, and uploaded by Update() in a later
+// frame. Under the memory budget, the least recently used tiles out of range
+// are evicted. A tile is a single leaf of blades, so any prefix of them is a
+// LOD. The resident tiles share one pool of blade records, a range each, and
+// one buffer of leaf bounds, a slot each, so that they are drawn by a single
+// multi-draw. The pool is no larger than the budget: when it is too
+// fragmented for a tile, the resident ranges are compacted rather than the
+// pool grown.
+class GrassTiles {
+ public:
+  struct Options {
+    float tile_size = 32;
+    // the tiles within this distance of the camera are streamed in
+    float stream_radius = 200;
+    // of the resident and in flight tiles
+    uint64_t memory_budget = 256ull << 20;
+    uint32_t max_lod = 8;
+    uint64_t seed = 0;
+    // empty for no cache
+    std::string cache_directory;
+  };
+
+  struct Tile {
+    glm::ivec2 coord;
+    AABB bounds;
+    std::vector<uint32_t> triangles;
+
+    enum class State { kUnloaded, kInFlight, kResident } state;
+    std::future<std::vector<BladeRecord>> task;
+    // of its records in the blade pool, the base instance of its draw
+    uint32_t first_blade = 0;
+    // of its bounds in the leaf bounds buffer, BladeRecord::leaf, from the
+    // request to the eviction
+    uint16_t slot = 0;
+    uint64_t last_used_frame = 0;
+    // when it became resident, to fade in
+    double resident_time = 0;
+
+    inline uint64_t num_blades(uint32_t max_lod) const {
+      return uint64_t(triangles.size()) * max_lod;
+    }
+  };
+
+  struct Statistics {
+    uint32_t num_tiles = 0, num_resident = 0, num_in_flight = 0;
+    uint64_t resident_bytes = 0, in_flight_bytes = 0;
+    // of the blade pool, at most the budget, or the resident bytes when the
+    // tiles in range do not fit in it
+    uint64_t pool_bytes = 0;
+    // in the last Update()
+    uint32_t num_streamed_in = 0, num_evicted = 0, num_compactions = 0;
+  };
+
+  // the mesh is referenced by the workers, it must outlive the tiles
+  explicit GrassTiles(const BladeGenerator::Mesh &mesh, uint32_t num_triangles,
+                      const Options &options);
+  ~GrassTiles();
+
+  // once per frame before drawing
+  void Update(glm::vec3 camera_position, double time);
+
+  // visitor(const Tile &tile)
+  template <typename Visitor>
+  void ForEachResident(Visitor visitor) const {
+    for (const Tile *tile : resident_) visitor(*tile);
+  }
+
+  // the BladeRecord of every resident tile, and the AABB of every slot
+  inline uint32_t blade_pool() const { return blade_pool_; }
+  inline uint32_t leaf_bounds_ssbo() const { return leaf_bounds_ssbo_; }
+
+  inline const Options &options() const { return options_; }
+  inline const Statistics &statistics() const { return statistics_; }
+  inline void set_stream_radius(float radius) {
+    options_.stream_radius = radius;
+  }
+  inline void set_memory_budget(uint64_t budget) {
+    options_.memory_budget = budget;
+  }
+
+ private:
+  static inline uint64_t Key(glm::ivec2 coord) {
+    return (uint64_t(uint32_t(coord.x)) << 32) | uint32_t(coord.y);
+  }
+  uint64_t TileBytes(const Tile &tile) const;
+  void Request(Tile *tile);
+  void Upload(Tile *tile, const std::vector<BladeRecord> &blades, double time);
+  void Evict(Tile *tile);
+  // in blades, the pool capacity the budget allows
+  uint64_t BudgetCapacity() const;
+  // first fit in the free ranges, the resident ranges are compacted when none
+  // is large enough, the pool only grows when they do not fit in it at all
+  uint32_t AllocateBlades(uint32_t num_blades);
+  void FreeBlades(uint32_t first_blade, uint32_t num_blades);
+  // moves the resident ranges to the front of the pool, in place
+  void CompactBladePool();
+  // a new pool with the resident ranges compacted at its front
+  void ResizeBladePool(uint64_t capacity);
+  // evicts the least recently used tile that is out of range, false if
+  // there is none
+  bool EvictLeastRecentlyUsed();
+
+  BladeGenerator::Mesh mesh_;
+  Options options_;
+  BladeGenerator generator_;
+
+  std::unordered_map<uint64_t, Tile> tiles_;
+  std::vector<Tile *> in_flight_, resident_;
+
+  uint32_t blade_pool_ = 0, blade_pool_capacity_ = 0;
+  // of all the tiles, and of the resident ones
+  uint64_t num_blades_ = 0, num_resident_blades_ = 0;
+  // the free ranges of the pool by their first blade, never adjacent
+  std::map<uint32_t, uint32_t> free_blades_;
+  uint32_t leaf_bounds_ssbo_ = 0;
+  std::vector<uint16_t> free_slots_;
+
+  uint64_t frame_ = 0;
+  Statistics statistics_;
+};
+
+#endif
@@ -4,45 +4,64 @@
 #include <glad/glad.h>
 
 #include <glm/glm.hpp>
-#include <map>
 #include <memory>
 #include <string>
 
 #include "blade.h"
 #include "bvh.h"
 #include "camera.h"
+#include "grass/grass_tiles.h"
 #include "light_sources.h"
+#include "multi_draw_indirect.h"
 #include "shader.h"
 #include "texture.h"
 
 class Grassland {
  public:
+  // the meshes of the terrain model are merged, blade_cache_directory, if not
+  // empty, is where the generated tiles are saved and loaded back from on
+  // the next run, see GrassTiles
   Grassland(const std::string &terrain_model_path,
-            const std::string &distortion_texture_path);
+            const std::string &distortion_texture_path,
+            const std::string &blade_cache_directory = "");
 
   void Draw(Camera *camera, LightSources *light_sources, double time);
 
+  // ray queries against the terrain, e.g. for placing props or line-of-sight
+  // checks, see BVH::Intersect()
+  RayHit Intersect(const Ray &ray) const;
+  bool Occluded(const Ray &ray) const;
+  void Intersect(const Ray *rays, uint32_t num_rays, RayHit *hits) const;
+
+  AABB terrain_aabb() const;
+
   ~Grassland();
 
+  inline const GrassTiles::Statistics &tile_statistics() const {
+    return tiles_->statistics();
+  }
+
+  void ImGuiWindow();
+
  private:
   struct VertexType {
     glm::vec3 position;
   };
-  struct InstancingData {
-    glm::mat4 transform;
-    glm::vec3 position;
-    glm::vec2 tex_coord;
-  };
 
-  uint32_t vbo_;
+  // one indirect command per visible tile, the only per-frame upload
+  uint32_t draw_commands_buffer_;
+  std::vector<DrawElementsIndirectCommand> commands_;
   std::vector<VertexType> vertices_for_bvh_;
   std::vector<glm::uvec3> triangles_for_bvh_;
+  // per vertex, for the blades of the tiles
+  std::vector<glm::vec3> vertices_;
+  std::vector<glm::vec2> tex_coords_;
 
   std::unique_ptr<Blade> blade_;
 
   std::unique_ptr<BVH<VertexType>> bvh_;
-  std::map<BVHNode *, std::vector<InstancingData>> blade_data_;
-  std::vector<InstancingData> blade_data_for_gpu_;
+  // after the mesh, which its workers read
+  std::unique_ptr<GrassTiles> tiles_;
 
   Texture distortion_texture_;
 };
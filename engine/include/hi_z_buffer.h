@@ -0,0 +1,62 @@
+#ifndef HI_Z_BUFFER_H_
+#define HI_Z_BUFFER_H_
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+#include "aabb.h"
+#include "shader.h"
+#include "texture.h"
+
+// max-depth pyramid of a depth texture, used for occlusion culling
+//
+// level i + 1 has the size max(1, floor(size_i / 2)), when level i has an odd
+// size, its last row / column is folded into the last texel of level i + 1,
+// so that texel min(pixel >> i, size_i - 1) of level i always covers pixel
+class HiZBuffer {
+ private:
+  uint32_t width_, height_, num_levels_;
+  const Texture *depth_texture_ = nullptr;
+  Texture texture_;
+
+  static std::unique_ptr<Shader> kShader;
+
+  void Allocate(uint32_t width, uint32_t height);
+
+ public:
+  explicit HiZBuffer(uint32_t width, uint32_t height);
+
+  void Resize(uint32_t width, uint32_t height);
+
+  // the depth texture to build the pyramid from, it must have the same size
+  inline void set_depth_texture(const Texture *depth_texture) {
+    depth_texture_ = depth_texture;
+  }
+
+  void Build();
+  void Set(Shader *shader) const;
+
+  inline const Texture &texture() const { return texture_; }
+  inline uint32_t width() const { return width_; }
+  inline uint32_t height() const { return height_; }
+  inline uint32_t num_levels() const { return num_levels_; }
+
+  static uint32_t NumLevels(uint32_t width, uint32_t height);
+
+  // CPU reference of shaders/hi_z/build.comp, depth is row-major with the
+  // size width * height, returns every level of the pyramid
+  static std::vector<std::vector<float>> BuildPyramid(
+      const std::vector<float> &depth, uint32_t width, uint32_t height);
+
+  // CPU reference of AABBIsVisibleInHiZ() in shaders/hi_z/hi_z.glsl, the test
+  // is conservative: it only returns false when the whole AABB is behind the
+  // depth in the pyramid
+  static bool AABBIsVisible(const AABB &aabb, const glm::mat4 &view_projection,
+                            const std::vector<std::vector<float>> &pyramid,
+                            uint32_t width, uint32_t height);
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef INSTANCE_BVH_H_
+#define INSTANCE_BVH_H_
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+#include "aabb.h"
+#include "batch_culling.h"
+#include "bvh.h"
+#include "camera.h"
+#include "multi_draw_indirect.h"
+
+// two-level acceleration structure for CPU-side queries over the instances of
+// a MultiDrawIndirect, e.g. picking or line-of-sight checks: the top level is
+// a BoxBVH over the world space bounds of the instances, refitted when the
+// model matrices change and partially rebuilt when it degrades, the bottom
+// level is a BVH per geometry, built on the first ray that reaches it
+class InstanceBVH {
+ public:
+  // the geometry of the finest LOD, shared by the meshes that registered it
+  struct Geometry {
+    const VertexWithBones *vertices;
+    // relative to vertices
+    const uint32_t *indices;
+    uint32_t num_triangles;
+  };
+
+  // per instance / per mesh arrays owned by the MultiDrawIndirect, read by
+  // every Update() and ray query
+  struct Arrays {
+    // per mesh, after the mesh transform; empty (min > max) for animated
+    // meshes, whose instances are never culled
+    const std::vector<AABB> *aabbs;
+    const std::vector<uint32_t> *mesh_to_geometry;
+    const std::vector<uint32_t> *instance_to_mesh;
+    const std::vector<glm::mat4> *model_matrices;
+    const std::vector<glm::mat4> *transforms;
+  };
+
+  struct Hit {
+    static constexpr uint32_t kNoInstance = 0xffffffffu;
+
+    uint32_t instance = kNoInstance;
+    // triangle is an index into the triangles of the instance's geometry
+    RayHit ray_hit;
+
+    inline bool hit() const { return instance != kNoInstance; }
+  };
+
+  InstanceBVH(const std::vector<Geometry> &geometries, const Arrays &arrays);
+
+  // the top level is checked for degraded subtrees every this many updates
+  // that moved instances
+  static constexpr uint32_t kRebuildCheckInterval = 8;
+  // beyond this fraction of moved instances the whole top level is refitted
+  static constexpr float kMaxPartialRefitRatio = 0.25f;
+
+  // the instance's model matrix changed since the last Update()
+  void MarkMoved(uint32_t instance);
+
+  // refits the top level to the current model matrices, rebuilding the
+  // subtrees that degraded too much, builds it the first time; must be
+  // called before the queries. While few instances moved, only their
+  // bounds and their paths to the root are refitted
+  void Update();
+
+  // the instances whose bounds intersect the volume, conservatively; the
+  // animated instances have no bounds and are always returned
+  std::vector<uint32_t> Search(const Frustum &frustum) const;
+  std::vector<uint32_t> Search(const AABB &box) const;
+  std::vector<uint32_t> Search(glm::vec3 center, float radius) const;
+
+  // the closest hit of the ray with the triangles of the instances, animated
+  // instances are skipped since their skinned positions are only on the GPU;
+  // not thread-safe since it may build bottom levels
+  Hit Intersect(const Ray &ray);
+  bool Occluded(const Ray &ray);
+
+  inline const BoxBVH *top_level() const { return top_level_.get(); }
+  inline double update_milliseconds() const { return update_milliseconds_; }
+  inline uint32_t num_rebuilt_subtrees() const {
+    return num_rebuilt_subtrees_;
+  }
+
+ private:
+  Hit IntersectImpl(const Ray &ray, bool any_hit);
+  const BVH<VertexWithBones> *BottomLevel(uint32_t geometry);
+
+  Arrays arrays_;
+  std::vector<Geometry> geometries_;
+
+  // the top level is built over the bounded instances only
+  std::vector<uint32_t> bounded_instances_, unbounded_instances_;
+  // the index of each instance in bounded_instances_, kNoInstance if
+  // unbounded
+  std::vector<uint32_t> bounded_indices_;
+  // the bounded indices of the instances moved since the last Update(), each
+  // once
+  std::vector<uint32_t> moved_;
+  std::vector<uint8_t> is_moved_;
+  std::vector<AABB> instance_aabbs_;
+  std::unique_ptr<BoxBVH> top_level_;
+  // per instance, the bounds of its mesh, transformed by the model matrices
+  // as a batch, see batch_culling::Transform()
+  batch_culling::AABBArrays mesh_aabbs_, transformed_aabbs_;
+  // the moved ones gathered by a partial Update()
+  batch_culling::AABBArrays moved_mesh_aabbs_;
+  std::vector<glm::mat4> moved_model_matrices_;
+
+  // per geometry, nullptr until a ray reaches it
+  std::vector<std::vector<glm::uvec3>> triangles_;
+  std::vector<std::unique_ptr<BVH<VertexWithBones>>> bottom_levels_;
+
+  uint32_t num_updates_ = 0;
+  // of the last Update()
+  double update_milliseconds_ = 0;
+  uint32_t num_rebuilt_subtrees_ = 0;
+};
+
+#endif
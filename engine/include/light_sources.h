@@ -9,8 +9,10 @@
 #include "equirectangular_map.h"
 #include "ogl_buffer.h"
 #include "shader.h"
+#include "shadows/cascade_pool.h"
 #include "shadows/directional_shadow.h"
 #include "shadows/shadow.h"
+#include "shadows/shadow_atlas.h"
 #include "skybox.h"
 
 class Light {
@@ -42,6 +44,7 @@ class DirectionalLight : public Light {
  private:
   glm::vec3 dir_, color_;
   std::unique_ptr<DirectionalShadow> shadow_ = nullptr;
+  CascadePool *cascade_pool_ = nullptr;
   Camera *camera_;
 
  public:
@@ -57,6 +60,10 @@ class DirectionalLight : public Light {
     shadow_ = std::move(shadow);
     shadow_->set_direction(dir_);
   }
+  // where the shadow added in the ImGui window allocates its cascades
+  inline void set_cascade_pool(CascadePool *cascade_pool) {
+    cascade_pool_ = cascade_pool;
+  }
   inline void set_camera(Camera *camera) {
     camera_ = camera;
     if (shadow_ != nullptr) shadow_->set_camera(camera);
@@ -78,9 +85,11 @@ class PointLight : public Light {
  private:
   glm::vec3 pos_, color_, attenuation_;
   std::unique_ptr<OmnidirectionalShadow> shadow_ = nullptr;
+  ShadowAtlas *shadow_atlas_ = nullptr;
 
  public:
   static constexpr uint32_t GLSL_BINDING = 18;
+  static constexpr uint32_t INITIAL_SHADOW_TILE_SIZE = 256;
 
   explicit PointLight(glm::vec3 pos, glm::vec3 color, glm::vec3 attenuation);
 
@@ -94,6 +103,12 @@ class PointLight : public Light {
   }
 
   inline OmnidirectionalShadow *shadow() { return shadow_.get(); }
+  // where the shadow added in the ImGui window allocates its cube faces
+  inline void set_shadow_atlas(ShadowAtlas *shadow_atlas) {
+    shadow_atlas_ = shadow_atlas;
+  }
+  // the distance at which the light falls below 1/256 of its color
+  float range() const;
 
   void ImGuiWindow(uint32_t index,
                    const std::function<void()> &erase_callback) override;
@@ -145,6 +160,11 @@ class LightSources {
   std::unique_ptr<OGLBuffer> point_lights_ssbo_;
   std::unique_ptr<OGLBuffer> image_based_lights_ssbo_;
   std::unique_ptr<OGLBuffer> poisson_disk_2d_points_ssbo_;
+  std::unique_ptr<OGLBuffer> poisson_disk_3d_points_ssbo_;
+  // declared before the lights, whose shadows free their tiles and layers in
+  // them
+  std::unique_ptr<ShadowAtlas> shadow_atlas_;
+  std::unique_ptr<CascadePool> cascade_pool_;
 
   void ResizeAmbientOGLBuffer();
   void ResizeDirectioanlOGLBuffer();
@@ -166,6 +186,16 @@ class LightSources {
  public:
   static constexpr uint32_t POISSON_DISK_2D_BINDING = 20;
   static constexpr uint32_t POISSON_DISK_3D_BINDING = 21;
+  static constexpr uint32_t SHADOW_ATLAS_SIZE = 4096;
+  static constexpr uint32_t MIN_SHADOW_TILE_SIZE = 64;
+  static constexpr uint32_t MAX_SHADOW_TILE_SIZE = 1024;
+  // the texels of the point light tiles whose static cache is redrawn per
+  // frame, by reallocations or e.g. moved lights, two lights of 512^2 tiles
+  static constexpr uint64_t MAX_SHADOW_REDRAW_TEXELS = 2 * 6 * 512 * 512;
+  // the cascades of two directional lights with global cascades
+  static constexpr uint32_t CASCADE_SIZE = 2048;
+  static constexpr uint32_t MAX_CASCADE_LAYERS =
+      2 * DirectionalShadow::NUM_CASCADES;
 
   explicit LightSources();
 
@@ -181,8 +211,23 @@ class LightSources {
   DirectionalLight *GetDirectional(uint32_t index) const;
   PointLight *GetPoint(uint32_t index) const;
   ImageBasedLight *GetImageBased(uint32_t index) const;
+  // where the directional light shadows allocate their cascades
+  inline CascadePool *cascade_pool() { return cascade_pool_.get(); }
+
+  // allocates the cascades of the directional light shadows that did not fit
+  // in the cascade pool before, in the order of the lights; sizes the point
+  // light shadows by the screen coverage of the lights times their
+  // importance and packs them into the shadow atlas, the lights that do not
+  // fit lose their shadow until there is room; then defers the redraws
+  // of their static caches beyond MAX_SHADOW_REDRAW_TEXELS to the next
+  // frames. Called once per frame before culling for the shadows, with
+  // MultiDrawIndirect::static_casters_version()
+  void UpdateShadowAtlas(const Camera *camera,
+                         uint64_t static_casters_version);
 
   void Set(Shader *shader) const;
+  // binds each shadow for render_pass(directional index, point index), which
+  // draws the layers that need it, see Shadow
   void DrawDepthForShadow(
       const std::function<void(int32_t, int32_t)> &render_pass);
 
@@ -5,12 +5,15 @@
 
 #include <glm/glm.hpp>
 #include <map>
+#include <string>
 #include <vector>
 
 #include "aabb.h"
 #include "camera.h"
 #include "gi/vx/voxelization.h"
+#include "hi_z_buffer.h"
 #include "light_sources.h"
+#include "obb.h"
 #include "ogl_buffer.h"
 #include "oit_render_quad.h"
 #include "shader.h"
@@ -71,67 +74,143 @@ struct DrawElementsIndirectCommand {
   uint32_t base_instance;
 };
 
+// a view that instances are culled against, mirrors CullingView in
+// shaders/multi_draw_indirect/culling_view.glsl
+struct CullingView {
+  enum Type : uint32_t { kAll = 0, kFrustum = 1, kOBB = 2 };
+  // the instances that may pass, dynamic ones are animated or moving
+  enum Casters : uint32_t {
+    kAllCasters = 0,
+    kStaticCasters = 1,
+    kDynamicCasters = 2
+  };
+
+  OBB obb;
+  Frustum frustum;
+  uint32_t type;
+  uint32_t casters;
+
+  static CullingView All();
+  static CullingView FromFrustum(const Frustum &frustum);
+  static CullingView FromOBB(const OBB &obb);
+  CullingView WithCasters(Casters casters) const;
+};
+
+static_assert(sizeof(CullingView) == 192,
+              "CullingView must match the std430 layout in GLSL");
+
 class GPUDrivenWorkloadGeneration {
  public:
+  // the visibility of an instance is stored as a 32-bit mask
+  static constexpr uint32_t kMaxViews = 32;
+
+  // mirrors Statistics in shaders/multi_draw_indirect/statistics.comp
+  static constexpr uint32_t kStatisticsLODs = 8;
+  static constexpr uint32_t kMaxStatisticsSlots = 8;
+  struct Statistics {
+    // visible (instance, view) pairs, i.e. the instances drawn
+    uint32_t num_instances;
+    // commands with at least one instance
+    uint32_t num_commands;
+    // the last LOD also counts the coarser ones
+    uint32_t num_triangles[kStatisticsLODs];
+  };
+
+  // the statistics of a frame are read back this many frames later, so that
+  // reading them never waits for the GPU
+  static constexpr uint32_t kStatisticsLatency = 3;
+
   struct FixedArrays {
     const std::vector<AABB> *aabbs;
-    const std::vector<uint32_t> *instance_to_mesh;
     const std::vector<uint32_t> *mesh_to_cmd_offset;
     const std::vector<uint32_t> *mesh_to_num_cmds;
   };
 
   struct DynamicBuffers {
-    const OGLBuffer *input_model_matrices_ssbo;
-    const OGLBuffer *frustum_ssbo;
-    const OGLBuffer *shadow_obbs_ssbo;
-    const OGLBuffer *commands_ssbo;
-    const OGLBuffer *input_bone_matrices_offset_ssbo;
-    const OGLBuffer *input_animated_ssbo;
-    const OGLBuffer *input_transforms_ssbo;
-    const OGLBuffer *input_clip_planes_ssbo;
-    const OGLBuffer *input_materials_ssbo;
-
+    const OGLBuffer *instance_to_mesh_ssbo;
     const OGLBuffer *model_matrices_ssbo;
-    const OGLBuffer *bone_matrices_offset_ssbo;
-    const OGLBuffer *animated_ssbo;
-    const OGLBuffer *transforms_ssbo;
-    const OGLBuffer *clip_planes_ssbo;
-    const OGLBuffer *materials_ssbo;
+    const OGLBuffer *views_ssbo;
+    const OGLBuffer *commands_ssbo;
+    const OGLBuffer *instance_ids_ssbo;
+    const OGLBuffer *dynamic_ssbo;
   };
 
   struct Constants {
-    uint32_t num_commands, num_instances;
+    uint32_t num_commands, num_instances, max_views, num_statistics_slots;
+  };
+
+  // two-phase occlusion culling of view 0
+  enum class OcclusionPhase : uint32_t {
+    kDisabled = 0,
+    // only the instances visible in the last frame pass
+    kPreviouslyVisible = 1,
+    // the instances are tested against the Hi-Z buffer built from the first
+    // phase, only those that were not drawn by it pass
+    kNewlyVisible = 2,
   };
 
   explicit GPUDrivenWorkloadGeneration(const FixedArrays &fixed_arrays,
                                        const DynamicBuffers &dynamic_buffers,
                                        const Constants &constants);
 
-  void Compute(bool is_directional_shadow_pass,
-               bool is_omnidirectional_shadow_pass, bool is_voxelization_pass);
+  // culls every instance against the first num_views views in views_ssbo in a
+  // single pass, the commands of view i are written to
+  // [i * num_commands, (i + 1) * num_commands) in commands_ssbo,
+  // hi_z_buffer and hi_z_view_projection are only used by kNewlyVisible, the
+  // results of view i are added to the statistics slot view_to_slot[i]
+  void Compute(uint32_t num_views, OcclusionPhase occlusion_phase,
+               const HiZBuffer *hi_z_buffer,
+               const glm::mat4 &hi_z_view_projection,
+               const std::vector<uint32_t> &view_to_slot);
+
+  // fences the statistics of the current frame and starts a new one, reads
+  // back the frame kStatisticsLatency frames ago if the GPU has finished it
+  void EndStatisticsFrame();
+
+  // per slot, of frame statistics_frame()
+  inline const std::vector<Statistics> &statistics() const {
+    return statistics_;
+  }
+  inline uint64_t statistics_frame() const { return statistics_frame_; }
+
+  ~GPUDrivenWorkloadGeneration();
 
  private:
   void CompileShaders();
   void AllocateBuffers(const FixedArrays &fixed_arrays);
+  void ComputeStatistics(uint32_t num_views,
+                         const std::vector<uint32_t> &view_to_slot);
 
   DynamicBuffers dynamic_buffers_;
   Constants constants_;
 
   std::unique_ptr<OGLBuffer> aabbs_ssbo_;
-  std::unique_ptr<OGLBuffer> instance_to_mesh_ssbo_;
   std::unique_ptr<OGLBuffer> mesh_to_cmd_offset_ssbo_;
   std::unique_ptr<OGLBuffer> mesh_to_num_cmds_ssbo_;
   std::unique_ptr<OGLBuffer> cmd_instance_count_ssbo_;
   std::unique_ptr<OGLBuffer> instance_to_cmd_ssbo_;
+  std::unique_ptr<OGLBuffer> instance_visibility_ssbo_;
+  std::unique_ptr<OGLBuffer> occlusion_history_ssbo_;
   std::unique_ptr<OGLBuffer> work_group_prefix_sum_ssbo_;
+  std::unique_ptr<OGLBuffer> cmd_to_lod_ssbo_, view_to_slot_ssbo_;
+
+  // persistently mapped ring of statistics buffers, one per frame in flight
+  uint32_t statistics_buffers_[kStatisticsLatency];
+  const Statistics *statistics_mapped_[kStatisticsLatency];
+  GLsync statistics_fences_[kStatisticsLatency] = {};
+  uint32_t statistics_index_ = 0;
+  uint64_t frame_ = 0, statistics_frame_ = 0;
+  std::vector<Statistics> statistics_;
 
   static std::unique_ptr<Shader> frustum_culling_and_lod_selection_shader_;
   static std::unique_ptr<Shader> prefix_sum_0_shader_, prefix_sum_1_shader_,
       prefix_sum_2_shader_;
   static std::unique_ptr<Shader> remap_shader_;
+  static std::unique_ptr<Shader> statistics_shader_;
 };
 
 class Model;
+class InstanceBVH;
 
 class MultiDrawIndirect {
  public:
@@ -146,8 +225,33 @@ class MultiDrawIndirect {
     std::vector<ItemParameter> items;
   };
 
+  // the culling passes that statistics are collected for
+  enum Pass : uint32_t {
+    kCameraPass = 0,
+    // the second phase of occlusion culling
+    kCameraNewlyVisiblePass,
+    kDirectionalShadowPass,
+    kPointShadowPass,
+    kVoxelizationPass,
+    kNumPasses,
+  };
+  static_assert(
+      kNumPasses <= GPUDrivenWorkloadGeneration::kMaxStatisticsSlots,
+      "each pass must have its own statistics slot");
+
   std::vector<AABB> debug_instance_aabbs() const;
 
+  // for CPU-side queries over the instances, with the model matrices of the
+  // last ComputeVisibility() / DrawDepthForShadow() / Draw(), built on the
+  // first call and refitted on the first call after they changed
+  InstanceBVH *instance_bvh();
+
+  // stores the vertices and the indices of every LOD in the global VBO / EBO
+  // once, identical geometry registered again (e.g. the same model submitted
+  // twice, or two models sharing a mesh) returns the existing one
+  uint32_t RegisterGeometry(const std::vector<VertexWithBones> &vertices,
+                            const std::vector<std::vector<uint32_t>> &indices);
+
   void Receive(const std::vector<VertexWithBones> &vertices,
                const std::vector<std::vector<uint32_t>> &indices,
                const std::vector<TextureRecord> &textures,
@@ -182,6 +286,30 @@ class MultiDrawIndirect {
 
   void PrepareForDraw();
 
+  // enables two-phase occlusion culling for the deferred shading pass of
+  // Draw(): the instances visible in the last frame are drawn first, then the
+  // rest are tested against the Hi-Z buffer built from that depth, the depth
+  // texture of hi_z_buffer must be the one Draw() renders to; nullptr
+  // disables it
+  inline void set_hi_z_buffer(HiZBuffer *hi_z_buffer) {
+    hi_z_buffer_ = hi_z_buffer;
+  }
+
+  // culls the instances against the camera and every cascade and cube face
+  // of the shadowed lights in one dispatch, the following
+  // DrawDepthForShadow() and Draw() calls for these views reuse the results
+  // (and the buffers updated here) instead of culling again; the results stay
+  // valid until the next call, or until a pass that was not included here
+  // (e.g. voxelization, or views exceeding the budget) culls on its own
+  void ComputeVisibility(
+      Camera *camera, LightSources *light_sources,
+      const std::vector<RenderTargetParameter> &render_target_params);
+
+  // changes whenever the static casters do, see Shadow
+  inline uint64_t static_casters_version() const {
+    return static_casters_version_;
+  }
+
   void DrawDepthForShadow(
       LightSources *light_sources, int32_t directional_index,
       int32_t point_index,
@@ -192,6 +320,34 @@ class MultiDrawIndirect {
             bool force_pbr,
             const std::vector<RenderTargetParameter> &render_target_params);
 
+  // must be called once per frame after the last draw, for the statistics
+  // and the frame count of the static casters
+  void EndFrame();
+
+  // per frame, the shadow layers (cascades / cube faces) whose static casters
+  // were drawn into the cache or reused from it, and that drew the dynamic
+  // casters over the cache or were left untouched
+  struct ShadowCacheStatistics {
+    uint32_t static_draws = 0, static_draws_skipped = 0;
+    uint32_t dynamic_draws = 0, layers_untouched = 0;
+  };
+  // of the last frame
+  inline const ShadowCacheStatistics &shadow_cache_statistics() const {
+    return last_shadow_cache_statistics_;
+  }
+
+  // the culling statistics per Pass, summed over every culling of the pass in
+  // the frame statistics_frame(), which lags a few frames behind
+  inline const std::vector<GPUDrivenWorkloadGeneration::Statistics> &
+  statistics() const {
+    return gpu_driven_->statistics();
+  }
+  inline uint64_t statistics_frame() const {
+    return gpu_driven_->statistics_frame();
+  }
+
+  void ImGuiWindow();
+
   ~MultiDrawIndirect();
 
  private:
@@ -200,6 +356,24 @@ class MultiDrawIndirect {
   void UpdateBuffers(
       const std::vector<RenderTargetParameter> &render_target_params);
   void BindBuffers();
+  void ComputeViews(
+      const std::vector<CullingView> &views,
+      const std::vector<uint32_t> &view_to_pass,
+      GPUDrivenWorkloadGeneration::OcclusionPhase occlusion_phase,
+      const glm::mat4 &hi_z_view_projection);
+  void DrawView(uint32_t view_index);
+
+  // the views a shadow layer is drawn from, -1 for none
+  struct ShadowLayerViews {
+    int32_t static_view = -1, dynamic_view = -1;
+  };
+  // appends to views, the views from first_view on, the culling views of the
+  // casters that the layers of shadow need drawn
+  std::vector<ShadowLayerViews> AppendShadowViews(
+      const Shadow *shadow, const std::vector<CullingView> &layer_views,
+      uint32_t first_view, std::vector<CullingView> *views) const;
+  void DrawShadowLayers(Shadow *shadow, Shader *shader,
+                        const std::vector<ShadowLayerViews> &layer_views);
 
   struct Material {
     int32_t textures[7];
@@ -216,8 +390,9 @@ class MultiDrawIndirect {
     alignas(4) int32_t bind_metalness_and_diffuse_roughness;
   };
 
-  // counter to print
+  // counters to print
   uint32_t num_triangles_ = 0;
+  size_t num_geometry_bytes_saved_ = 0;
 
   // counters
   uint32_t num_instances_ = 0, num_bone_matrices_ = 0, num_meshes_ = 0;
@@ -227,33 +402,84 @@ class MultiDrawIndirect {
   std::vector<uint32_t> indices_;
   std::vector<DrawElementsIndirectCommand> commands_;
 
+  // geometry stored in vertices_ and indices_
+  struct Geometry {
+    int32_t base_vertex;
+    uint32_t num_vertices;
+    // per LOD
+    std::vector<uint32_t> first_index, count;
+  };
+  std::vector<Geometry> geometries_;
+  std::multimap<size_t, uint32_t> geometry_hash_to_index_;
+  bool GeometryEquals(const Geometry &geometry,
+                      const std::vector<VertexWithBones> &vertices,
+                      const std::vector<std::vector<uint32_t>> &indices) const;
+
   // the buffers corresponding to the OGLBuffers
   std::vector<glm::mat4> model_matrices_, bone_matrices_;
   std::vector<uint32_t> bone_matrices_offset_;
   std::vector<uint32_t> has_bone_, animated_;
+  // animated, or moved within the last kStaticFrames frames, the shadows
+  // cache the other instances; the frames are counted by EndFrame(), so that
+  // the several UpdateBuffers() of a frame count once
+  static constexpr uint64_t kStaticFrames = 30;
+  std::vector<uint32_t> dynamic_;
+  // every instance starts static, as if it last moved kStaticFrames ago
+  uint64_t frame_ = kStaticFrames;
+  std::vector<uint64_t> last_moved_frame_;
+  uint32_t num_dynamic_instances_ = 0;
+  // changes whenever an instance turns static or dynamic
+  uint64_t static_casters_version_ = 0;
+  bool model_matrices_initialized_ = false;
+  ShadowCacheStatistics shadow_cache_statistics_,
+      last_shadow_cache_statistics_;
   std::vector<glm::mat4> transforms_;
   std::vector<glm::vec4> clip_planes_;
+  // materials deduplicated by content, textures by OpenGL texture ID
   std::vector<Material> materials_;
+  std::vector<uint32_t> mesh_to_material_;
+  std::map<std::string, uint32_t> material_to_index_;
   std::vector<Texture> textures_;
   std::vector<uint64_t> texture_handles_;
+  std::map<uint32_t, int32_t> texture_id_to_index_;
 
   // buffers
   uint32_t commands_buffer_, vao_, ebo_, vbo_;
 
   // OGLBuffers
-  std::unique_ptr<OGLBuffer> input_model_matrices_ssbo_, bone_matrices_ssbo_,
-      input_bone_matrices_offset_ssbo_, input_animated_ssbo_,
-      input_transforms_ssbo_, input_clip_planes_ssbo_, input_materials_ssbo_,
+  std::unique_ptr<OGLBuffer> model_matrices_ssbo_, bone_matrices_ssbo_,
+      bone_matrices_offset_ssbo_, animated_ssbo_, transforms_ssbo_,
+      clip_planes_ssbo_, materials_ssbo_, mesh_to_material_ssbo_,
       textures_ssbo_;
-  std::unique_ptr<OGLBuffer> model_matrices_ssbo_, bone_matrices_offset_ssbo_,
-      animated_ssbo_, transforms_ssbo_, clip_planes_ssbo_, materials_ssbo_;
-  std::unique_ptr<OGLBuffer> commands_ssbo_, frustum_ssbo_, shadow_obbs_ssbo_;
+  std::unique_ptr<OGLBuffer> commands_ssbo_, views_ssbo_, instance_ids_ssbo_,
+      instance_to_mesh_ssbo_, dynamic_ssbo_;
+
+  // number of views that fit in the commands buffer
+  uint32_t max_views_ = 0;
+
+  HiZBuffer *hi_z_buffer_ = nullptr;
+
+  // views computed by ComputeVisibility()
+  struct Visibility {
+    bool valid = false;
+    const Camera *camera = nullptr;
+    int32_t camera_view = -1;
+    bool camera_occlusion_culling = false;
+    // light index to the views of its cascades / cube faces
+    std::map<int32_t, std::vector<ShadowLayerViews>> directional_views,
+        point_views;
+  } visibility_;
 
   // for gpu driven workload generation
   std::vector<AABB> aabbs_;
   std::vector<uint32_t> instance_to_mesh_;
   std::vector<uint32_t> mesh_to_cmd_offset_, mesh_to_num_cmds_;
 
+  // for the instance BVH
+  std::vector<uint32_t> mesh_to_geometry_;
+  std::unique_ptr<InstanceBVH> instance_bvh_;
+  bool instance_bvh_outdated_ = true;
+
   struct SubmissionCache {
     Model *model;
     uint32_t item_count;
@@ -0,0 +1,25 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <thread>
+#include <vector>
+
+// f(i) for i in [0, n), strided across a task per hardware thread, for the
+// CPU-side generators that have no GL context
+inline void ParallelFor(uint32_t n, const std::function<void(uint32_t)> &f) {
+  uint32_t num_tasks = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::future<void>> tasks;
+  for (uint32_t t = 0; t < std::min(num_tasks, n); t++) {
+    tasks.push_back(std::async(std::launch::async, [&, t]() {
+      for (uint32_t i = t; i < n; i += num_tasks) f(i);
+    }));
+  }
+  for (auto &task : tasks) task.get();
+}
+
+#endif
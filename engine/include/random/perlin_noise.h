@@ -1,8 +1,9 @@
 #ifndef RANDOM_PERLIN_NOISE_H_
 #define RANDOM_PERLIN_NOISE_H_
 
+#include <stdint.h>
+
 #include <glm/glm.hpp>
-#include <tuple>
 #include <vector>
 
 class PerlinNoise {
@@ -11,19 +12,36 @@ class PerlinNoise {
   PerlinNoise(int perm_size, int seed);
   double Noise(double x, double y, double z) const;
   double Noise(glm::vec3 position) const;
+  // the analytic gradient of Noise()
   glm::vec3 DerivativeNoise(double x, double y, double z) const;
   glm::vec3 DerivativeNoise(glm::vec3 position) const;
+  // fBm of depth octaves, each of twice the frequency and half the weight
   double Turbulent(glm::vec3 position, uint32_t depth) const;
 
+  // the batched versions in float, 8 points per AVX2 instruction when
+  // cpu_features::AVX2Enabled(), the scalar and AVX2 kernels do the same
+  // arithmetic in the same order so their results are identical
+  void Noise(const float *xs, const float *ys, const float *zs, float *out,
+             size_t n) const;
+  // the values and their gradients together, gradients may be nullptr
+  void NoiseAndGradient(const float *xs, const float *ys, const float *zs,
+                        float *values, glm::vec3 *gradients, size_t n) const;
+  // Turbulent() at origin + (i, j) * step for the width * height points of a
+  // grid in the plane z, row-major, spread across threads
+  void Turbulent(glm::vec2 origin, glm::vec2 step, float z, uint32_t width,
+                 uint32_t height, uint32_t depth, float *out) const;
+
  private:
-  using WeightsType = std::tuple<std::vector<double>, std::vector<double>,
-                                 std::vector<double>, std::vector<double>>;
-  WeightsType CalcWeights(double x, double y, double z) const;
+  template <typename T>
+  T NoiseImpl(T x, T y, T z, glm::vec<3, T> *gradient) const;
+  void NoiseScalar(const float *xs, const float *ys, const float *zs,
+                   float *values, glm::vec3 *gradients, size_t begin,
+                   size_t end) const;
+  void NoiseAVX2(const float *xs, const float *ys, const float *zs,
+                 float *values, glm::vec3 *gradients, size_t end) const;
+
   const int PERM_SIZE;
   std::vector<int> perm_random_;
-  double Grad(int x, int y, int z, double dx, double dy, double dz) const;
-  static double F(double x);
-  static double DerivativeF(double x);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,30 @@
+#ifndef RANDOM_PHILOX_H_
+#define RANDOM_PHILOX_H_
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2,
+// 3"), a counter-based RNG: the random words are a function of a counter and
+// a key, so any part of a stream is drawn without the rest of it, in any
+// order and on any thread
+inline glm::uvec4 Philox4x32(glm::uvec4 counter, glm::uvec2 key) {
+  constexpr uint32_t kM0 = 0xD2511F53, kM1 = 0xCD9E8D57;
+  constexpr uint32_t kW0 = 0x9E3779B9, kW1 = 0xBB67AE85;
+  for (int round = 0; round < 10; round++) {
+    uint64_t p0 = uint64_t(kM0) * counter.x;
+    uint64_t p1 = uint64_t(kM1) * counter.z;
+    counter = glm::uvec4(uint32_t(p1 >> 32) ^ counter.y ^ key.x, uint32_t(p1),
+                         uint32_t(p0 >> 32) ^ counter.w ^ key.y, uint32_t(p0));
+    key += glm::uvec2(kW0, kW1);
+  }
+  return counter;
+}
+
+// a float in [0, 1) from the high 24 bits of a random word
+inline float PhiloxUnitFloat(uint32_t word) {
+  return (word >> 8) * (1.0f / 16777216.0f);
+}
+
+#endif
@@ -5,16 +5,38 @@
 #include <random>
 #include <vector>
 
+// Bridson's sampling ("Fast Poisson Disk Sampling in Arbitrary Dimensions"):
+// points grown from an active list, each one at least a radius from the
+// others, found in a background grid that holds at most a point per cell
 class PoissonDiskGenerator {
  private:
   std::mt19937 engine_;
 
  public:
+  // in grid cells of radius / sqrt(2), of GenerateTiled2D()
+  static constexpr uint32_t TILE_SIZE = 32;
+
   explicit PoissonDiskGenerator();
+  explicit PoissonDiskGenerator(uint32_t seed);
 
+  // up to num_points in [0, 1)^2, sqrt(2) / num_grids apart
   std::vector<glm::vec2> Generate2D(uint32_t num_points, uint32_t num_grids);
 
+  // up to num_points in [0, 1)^3, sqrt(3) / num_grids apart
   std::vector<glm::vec3> Generate3D(uint32_t num_points, uint32_t num_grids);
+
+  // the points radius apart in [0, extent.x) x [0, extent.y), for millions of
+  // them: the domain is split into tiles grown across threads in 4 phases, so
+  // the tiles of a phase are a tile apart, and a tile grows from the points
+  // of its neighbours near its borders, so the borders are seamless. The
+  // points depend on the generator, not on the number of threads
+  std::vector<glm::vec2> GenerateTiled2D(glm::vec2 extent, float radius);
+
+  // the tables of the shadow kernels, generated once with a fixed seed and
+  // shuffled, so that any run of them is spread over the kernel
+  static const std::vector<glm::vec2> &ShadowKernel2D();
+  // xyz in [0, 1)^3, w is padding for std430
+  static const std::vector<glm::vec4> &ShadowKernel3D();
 };
 
 #endif
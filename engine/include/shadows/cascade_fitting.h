@@ -0,0 +1,101 @@
+#ifndef SHADOWS_CASCADE_FITTING_H_
+#define SHADOWS_CASCADE_FITTING_H_
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "obb.h"
+
+// Fits a shadow cascade to a slice of the camera frustum. The cascade is a
+// square around the bounding sphere of the slice, which does not change when
+// the camera turns, on a texel grid fixed in light space, so it only ever
+// moves by whole texels. The margin around the sphere follows the camera
+// speed, and when the sphere leaves the cascade it scrolls: the layer is
+// addressed toroidally (texel g of the grid is stored at g mod size) and only
+// the newly exposed strips have to be drawn again.
+class CascadeFitter {
+ public:
+  struct Options {
+    // the margin around the bounding sphere, as ratios of its radius
+    float min_margin = 0.2f;
+    float max_margin = 1.0f;
+    // the margin covers the camera motion of this many frames
+    float margin_frames = 60;
+    // false to refit instead of scrolling
+    bool scrolling = true;
+  };
+
+  enum class Update { kNone, kScroll, kRefit };
+
+  // a rectangle of the light space texel grid
+  struct TexelRect {
+    glm::ivec2 min, size;
+  };
+
+  struct Result {
+    Update update = Update::kNone;
+    // after a scroll, the strips of the grid to draw again
+    std::vector<TexelRect> exposed;
+  };
+
+  explicit CascadeFitter(uint32_t width, uint32_t height,
+                         const Options &options);
+
+  // rotation only, from world space to light space
+  void set_light_direction(glm::vec3 direction);
+  // the next Fit() refits
+  inline void Reset() { fitted_ = false; }
+
+  // caster_distance extends the cascade toward the light for the casters
+  // outside of the slice
+  Result Fit(const std::vector<glm::vec3> &slice_corners,
+             float caster_distance, bool force_refit);
+
+  inline bool fitted() const { return fitted_; }
+  inline glm::mat4 view_matrix() const { return glm::mat4(light_rotation_); }
+  inline glm::ivec2 grid_min() const { return grid_min_; }
+  inline glm::ivec2 size() const { return size_; }
+  inline glm::vec2 texel_size() const { return texel_size_; }
+  // the camera speed in light space, per frame
+  inline float speed() const { return speed_; }
+
+  // the whole cascade
+  inline TexelRect rect() const { return {grid_min_, size_}; }
+  glm::mat4 projection_matrix() const;
+  glm::mat4 projection_matrix(const TexelRect &rect) const;
+  // from world space to the toroidal texture coordinates (wrapped by the
+  // sampler) and the depth in [0, 1]
+  glm::mat4 sampling_matrix() const;
+  OBB obb() const;
+
+  // splits a rectangle of the grid at the edges of the layer, so that each
+  // part is contiguous in the texture
+  std::vector<TexelRect> Wrap(const TexelRect &rect) const;
+  // where a part returned by Wrap() is in the texture
+  glm::ivec2 TextureOffset(const TexelRect &rect) const;
+  // the inverse, for a part of the current cascade
+  TexelRect GridRect(glm::ivec2 texture_offset, glm::ivec2 size) const;
+
+ private:
+  void Refit(glm::vec3 center, float half_extent, float caster_distance);
+  bool Contains(glm::vec3 center, float radius) const;
+  bool ContainsDepth(glm::vec3 center, float radius) const;
+
+  glm::ivec2 size_;
+  Options options_;
+  glm::mat3 light_rotation_ = glm::mat3(1);
+
+  bool fitted_ = false;
+  glm::vec3 previous_center_ = glm::vec3(0);
+  float speed_ = 0;
+
+  float half_extent_ = 0;
+  glm::vec2 texel_size_ = glm::vec2(1);
+  glm::ivec2 grid_min_ = glm::ivec2(0);
+  // light space depth range, larger z is closer to the light
+  float z_min_ = 0, z_max_ = 1, caster_distance_ = 0;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SHADOWS_CASCADE_POOL_H_
+#define SHADOWS_CASCADE_POOL_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <optional>
+#include <set>
+#include <vector>
+
+#include "frame_buffer_object.h"
+#include "texture.h"
+
+// The cascades of all the directional lights are layers of one depth texture
+// array, with a cache of the same size for their static casters (see
+// Shadow). A cascade keeps a whole layer since it wraps around the edges of
+// its layer when scrolled, see CascadeFitter. The textures are created on
+// first use, the VRAM is bounded by the number of layers however many
+// directional lights are shadowed.
+class CascadePool {
+ public:
+  explicit CascadePool(uint32_t size, uint32_t num_layers);
+
+  // num_layers free layers, std::nullopt if there are not as many
+  std::optional<std::vector<uint32_t>> Allocate(uint32_t num_layers);
+  void Free(const std::vector<uint32_t> &layers);
+
+  inline uint32_t size() const { return size_; }
+  inline uint32_t num_layers() const { return num_layers_; }
+  inline uint32_t num_allocated_layers() const {
+    return num_layers_ - free_layers_.size();
+  }
+
+  FrameBufferObject *fbo();
+  FrameBufferObject *static_cache_fbo();
+  inline const Texture &depth_texture() { return fbo()->depth_texture(); }
+  inline const Texture &static_cache() {
+    return static_cache_fbo()->depth_texture();
+  }
+
+ private:
+  void CreateTextures();
+
+  uint32_t size_, num_layers_;
+  std::set<uint32_t> free_layers_;
+  std::unique_ptr<FrameBufferObject> fbo_, static_cache_fbo_;
+};
+
+#endif
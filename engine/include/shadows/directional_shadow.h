@@ -5,8 +5,12 @@
 
 #include "aabb.h"
 #include "obb.h"
+#include "shadows/cascade_fitting.h"
+#include "shadows/cascade_pool.h"
 #include "shadows/shadow.h"
 
+// the cascades are layers of a CascadePool shared with other directional
+// lights, all of them or none are allocated
 class DirectionalShadow : public Shadow {
  public:
   static constexpr uint32_t NUM_CASCADES = 6;
@@ -16,53 +20,46 @@ class DirectionalShadow : public Shadow {
   };
 
  private:
-  static constexpr float ENLARGE_FACTOR = 1.5f;
-
   glm::vec3 direction_;
-  uint32_t fbo_width_, fbo_height_;
-  std::unique_ptr<FrameBufferObject> fbo_;
-  glm::vec2 max_viewport_size_;
+  CascadePool *pool_;
+  // the layer of the pool per cascade, empty when the pool had no room
+  std::vector<uint32_t> layers_;
   std::optional<AABB> global_cascade_aabb_;
   const Camera *camera_;
   bool update_flag_;
+  // whether the cascades have been fitted to the camera in the current frame
+  mutable bool cascades_updated_ = false;
 
   struct Cascade {
-    glm::mat4 view_matrix;
-    glm::mat4 projection_matrix;
     float cascade_plane_distances[2];
-    AABB ortho_param;
-    OBB obb;
-    bool requires_update;
-    glm::vec4 viewport;
-    glm::vec2 scale_factor;
+    bool requires_update = true;
+    CascadeFitter::Update update = CascadeFitter::Update::kRefit;
   };
 
   mutable Cascade cascades_[NUM_CASCADES];
+  mutable std::vector<CascadeFitter> fitters_;
 
-  std::pair<float, float> cascade_plane_distances(uint32_t index) const;
-  bool ShouldUsePreviousFrame(
-      uint32_t index,
-      const std::vector<glm::vec3> &current_frame_frustum_corners) const;
-  glm::mat4 view_matrix(
-      const std::vector<glm::vec3> &current_frame_frustum_corners) const;
-  AABB ortho_param(const std::vector<glm::vec3> &current_frame_frustum_corners,
-                   glm::mat4 view_matrix) const;
-  glm::mat4 projection_matrix(AABB ortho_param) const;
-  OBB obb(const std::vector<glm::vec3> &current_frame_frustum_corners) const;
-  std::pair<glm::vec4, glm::vec2> viewport(
-      const std::vector<glm::vec3> &current_frame_frustum_corners,
-      const AABB &camera_ortho_param,
-      glm::mat4 camera_frustum_view_matrix) const;
   void InvalidatePreviousCascades();
 
-  void UpdateCascades() const;
+ protected:
+  LayerRegion layer_region(uint32_t layer) const override;
+  inline const Texture &shadow_map() const override {
+    return pool_->depth_texture();
+  }
+  inline const Texture &static_cache() const override {
+    return pool_->static_cache();
+  }
 
  public:
-  explicit DirectionalShadow(glm::vec3 direction, uint32_t fbo_width,
-                             uint32_t fbo_height,
+  explicit DirectionalShadow(glm::vec3 direction, CascadePool *pool,
                              std::optional<AABB> global_cascade_aabb,
                              const Camera *camera);
-  inline ~DirectionalShadow() {}
+  ~DirectionalShadow();
+
+  inline bool allocated() const { return !layers_.empty(); }
+  // allocates the layers of the cascades if not allocated yet, returns false
+  // if the pool has no room
+  bool Allocate();
 
   inline glm::vec3 direction() { return direction_; }
   void set_direction(glm::vec3 direction);
@@ -71,10 +68,33 @@ class DirectionalShadow : public Shadow {
   uint32_t num_cascades_in_use() const;
 
   std::vector<OBB> cascade_obbs() const;
+  bool cascade_requires_update(uint32_t index) const;
+  // how the cascade was updated in the current frame
+  inline CascadeFitter::Update cascade_update(uint32_t index) const {
+    return cascades_[index].update;
+  }
+
+  // fits the cascades to the camera; called by Bind() unless it has already
+  // been called in the current frame (e.g. to cull against the cascades
+  // before the shadow pass)
+  void UpdateCascades() const;
+
+  // what UpdateCascades() fits the moving cascades to: the slices of the
+  // camera frustum and the distance up to which the casters between the
+  // light and a cascade are kept
+  struct CascadeFitInputs {
+    float cascade_plane_distances[NUM_MOVING_CASCADES][2];
+    std::vector<glm::vec3> slice_corners[NUM_MOVING_CASCADES];
+    float caster_distance;
+  };
+  // without GL, e.g. to replay camera paths through CascadeFitter offline
+  static CascadeFitInputs FitInputs(const Camera &camera);
 
   struct DirectionalShadowGLSL {
     glm::mat4 transformation_matrices[NUM_CASCADES];
     int32_t requires_update[NUM_CASCADES];
+    // the layers of the shadow map
+    int32_t layers[NUM_CASCADES];
     float cascade_plane_distances[NUM_MOVING_CASCADES * 2];
     uint64_t shadow_map;
     alignas(16) glm::vec3 dir;
@@ -85,8 +105,14 @@ class DirectionalShadow : public Shadow {
   void Visualize() const override;
   void Bind() override;
   void Unbind() override;
-  void Clear() override;
   void Set(Shader *shader) override;
+  // the layers are the cascades in use, each attached on its own and
+  // addressed toroidally, see CascadeFitter; none when unallocated, then
+  // nothing is drawn
+  uint32_t num_layers() const override;
+  std::vector<LayerRegion> draw_regions(uint32_t layer) const override;
+  void BindRegion(uint32_t layer, bool static_cache, const LayerRegion &region,
+                  Shader *shader) override;
 
   // set this flag when the scene changes
   void set_requires_update();
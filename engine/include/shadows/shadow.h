@@ -5,6 +5,7 @@
 #include <glm/glm.hpp>
 #include <memory>
 #include <optional>
+#include <vector>
 
 #include "aabb.h"
 #include "camera.h"
@@ -12,44 +13,141 @@
 #include "obb.h"
 #include "ogl_buffer.h"
 #include "shader.h"
+#include "shadows/shadow_atlas.h"
 #include "texture.h"
 
+// The static casters of each layer (cascade / cube face) are rendered into a
+// cache only when the light or the static casters change. Every frame the
+// cache is copied into the shadow map and the dynamic casters are drawn on
+// top, a layer is left untouched when it already holds the cache alone and
+// there are no dynamic casters.
 class Shadow {
  public:
-  virtual void Clear() = 0;
   virtual void Bind() = 0;
   virtual void Unbind() = 0;
   virtual void Set(Shader *shader) = 0;
   virtual void Visualize() const = 0;
   virtual ~Shadow(){};
+
+  // where a layer is, the same in the shadow map and in the cache
+  struct LayerRegion {
+    uint32_t x, y, z, width, height;
+  };
+
+  virtual uint32_t num_layers() const = 0;
+  // the parts of a layer drawn one by one, e.g. a scrolled cascade wraps
+  // around the edges of its layer
+  virtual std::vector<LayerRegion> draw_regions(uint32_t layer) const;
+  // after Bind(), directs the following draws to a region of a layer of the
+  // shadow map or of the static cache
+  virtual void BindRegion(uint32_t layer, bool static_cache,
+                          const LayerRegion &region, Shader *shader) = 0;
+
+  // static_casters_version changes whenever the static casters do; a layer
+  // drawn before is not redrawn while its static draw is deferred
+  bool RequiresStaticDraw(uint32_t layer,
+                          uint64_t static_casters_version) const;
+  // e.g. to spread the redraws over frames, see
+  // LightSources::UpdateShadowAtlas(), the outdated cache is used meanwhile
+  void set_static_draw_deferred(uint32_t layer, bool deferred) const;
+  // whether the layer of the cache holds anything, even if outdated
+  bool static_cache_drawn(uint32_t layer) const;
+  bool RequiresDynamicDraw(uint32_t layer, bool has_dynamic_casters) const;
+  // clears the regions of the layer of the cache that need drawing and
+  // returns them
+  std::vector<LayerRegion> BeginStaticDraw(uint32_t layer,
+                                           uint64_t static_casters_version);
+  // copies the layer of the cache into the shadow map and returns the
+  // regions to draw
+  std::vector<LayerRegion> BeginDynamicDraw(uint32_t layer,
+                                            bool has_dynamic_casters);
+  // e.g. when the light moves
+  void InvalidateStaticCache() const;
+  void InvalidateStaticCache(uint32_t layer) const;
+  // the layer has moved by whole texels, the cache is kept but for the
+  // exposed regions
+  void ScrollStaticCache(uint32_t layer,
+                         const std::vector<LayerRegion> &exposed) const;
+
+ protected:
+  virtual LayerRegion layer_region(uint32_t layer) const = 0;
+  virtual const Texture &shadow_map() const = 0;
+  virtual const Texture &static_cache() const = 0;
+  // forgets every cached layer, must be called when the layers change
+  void ResetStaticCache() const;
+
+ private:
+  struct CachedLayer {
+    bool valid = false;
+    bool drawn = false;
+    bool static_draw_deferred = false;
+    uint64_t static_casters_version = 0;
+    // whether the layer of the shadow map equals the one of the cache
+    bool shadow_map_is_cache = false;
+    // the regions still to draw after a scroll
+    std::vector<LayerRegion> exposed_regions;
+  };
+
+  mutable std::vector<CachedLayer> cached_layers_;
 };
 
+// the 6 cube faces are tiles of a ShadowAtlas shared with other lights, the
+// tile size is chosen by LightSources::UpdateShadowAtlas()
 class OmnidirectionalShadow : public Shadow {
  private:
   glm::vec3 position_;
   float radius_;
-  uint32_t fbo_width_, fbo_height_;
-  std::unique_ptr<FrameBufferObject> fbo_;
+  ShadowAtlas *atlas_;
+  // one per face, empty when the atlas had no room
+  std::vector<ShadowAtlas::Tile> tiles_;
+  uint32_t tile_size_ = 0;
+  float importance_ = 1;
   float z_near_ = 1e-2, z_far_ = 1e2;
 
+  void FreeTiles();
+
+ protected:
+  LayerRegion layer_region(uint32_t layer) const override;
+  inline const Texture &shadow_map() const override {
+    return atlas_->depth_texture();
+  }
+  inline const Texture &static_cache() const override {
+    return atlas_->static_cache();
+  }
+
  public:
-  OmnidirectionalShadow(glm::vec3 position, float radius, uint32_t fbo_width,
-                        uint32_t fbo_height);
+  OmnidirectionalShadow(glm::vec3 position, float radius, ShadowAtlas *atlas,
+                        uint32_t tile_size);
   void Bind() override;
-  inline void Unbind() override { fbo_->Unbind(); }
+  inline void Unbind() override { atlas_->fbo()->Unbind(); }
+  // no layers when unallocated, then nothing is drawn
+  inline uint32_t num_layers() const override { return tiles_.size(); }
+  void BindRegion(uint32_t layer, bool static_cache, const LayerRegion &region,
+                  Shader *shader) override;
   inline glm::vec3 position() { return position_; }
-  inline void set_position(glm::vec3 position) { position_ = position; }
+  void set_position(glm::vec3 position);
   inline float radius() { return radius_; }
   inline void set_radius(float radius) { radius_ = radius; }
+  inline float z_far() const { return z_far_; }
   std::vector<glm::mat4> view_projection_matrices() const;
-  inline ~OmnidirectionalShadow() {}
+  ~OmnidirectionalShadow();
+
+  inline bool allocated() const { return !tiles_.empty(); }
+  inline uint32_t tile_size() const { return tile_size_; }
+  // reallocates the 6 tiles, keeps the current ones and returns false if
+  // there is no room, 0 frees them
+  bool set_tile_size(uint32_t tile_size);
+  // scales the tile size chosen for the screen coverage of the light
+  inline float importance() const { return importance_; }
+  inline void set_importance(float importance) { importance_ = importance; }
 
   void Visualize() const override;
-  void Clear() override;
   void Set(Shader *shader) override;
 
   struct OmnidirectionalShadowGLSL {
     glm::mat4 view_projection_matrices[6];
+    // per face, the offset and the size of its tile in the atlas, in UV
+    glm::vec4 atlas_rects[6];
     uint64_t shadow_map;
     alignas(16) glm::vec3 pos;
     float radius;
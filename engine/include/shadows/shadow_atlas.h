@@ -0,0 +1,60 @@
+#ifndef SHADOWS_SHADOW_ATLAS_H_
+#define SHADOWS_SHADOW_ATLAS_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <optional>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "frame_buffer_object.h"
+#include "texture.h"
+
+// A depth texture shared by the shadow maps of many lights, with a cache of
+// the same size for their static casters (see Shadow). It is split into
+// square tiles by a quadtree: a tile is free, allocated, or split into 4
+// tiles of half its size, and 4 free siblings are merged again. The textures
+// are created on first use, the VRAM is bounded by the atlas size however
+// many lights are shadowed.
+class ShadowAtlas {
+ public:
+  struct Tile {
+    uint32_t x, y, size;
+  };
+
+  // size and min_tile_size must be powers of two
+  explicit ShadowAtlas(uint32_t size, uint32_t min_tile_size);
+
+  // a tile of size rounded up to a power of two, at least min_tile_size,
+  // std::nullopt if no free tile is large enough
+  std::optional<Tile> Allocate(uint32_t size);
+  void Free(const Tile &tile);
+
+  inline uint32_t size() const { return size_; }
+  inline uint32_t min_tile_size() const { return min_tile_size_; }
+  inline uint64_t num_allocated_texels() const {
+    return num_allocated_texels_;
+  }
+
+  FrameBufferObject *fbo();
+  FrameBufferObject *static_cache_fbo();
+  inline const Texture &depth_texture() { return fbo()->depth_texture(); }
+  inline const Texture &static_cache() {
+    return static_cache_fbo()->depth_texture();
+  }
+
+ private:
+  void CreateTextures();
+  uint32_t Level(uint32_t size) const;
+  inline uint32_t TileSize(uint32_t level) const { return size_ >> level; }
+
+  uint32_t size_, min_tile_size_, num_levels_;
+  // per level, from the whole atlas at level 0, the free tiles by (y, x)
+  std::vector<std::set<std::pair<uint32_t, uint32_t>>> free_tiles_;
+  uint64_t num_allocated_texels_ = 0;
+  std::unique_ptr<FrameBufferObject> fbo_, static_cache_fbo_;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef TERRAIN_CDLOD_QUADTREE_H_
+#define TERRAIN_CDLOD_QUADTREE_H_
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "aabb.h"
+#include "camera.h"
+
+// The node selection of CDLOD (Strugar, "Continuous Distance-Dependent Level
+// of Detail for Rendering Heightmaps"), on the CPU and without GL. The terrain
+// is a grid of root nodes, each a quadtree down to leaves of 2 * patch_size
+// squares of the heightfield. A node of LOD l is drawn within ranges()[l] of
+// the camera, as a patch of patch_size^2 quads for each quarter its children
+// do not cover, so every patch has as many triangles and their count stays
+// roughly constant with view distance whatever the size of the terrain. The
+// vertices of a patch morph to the grid of the next LOD between
+// morph_range(l).x and morph_range(l).y, which meets the neighbouring
+// patches as long as a node is smaller than about 2 / 3 of its range.
+class CDLODQuadtree {
+ public:
+  static constexpr uint32_t MAX_NUM_LODS = 16;
+
+  struct Options {
+    // quads per side of a patch, even
+    uint32_t patch_size = 16;
+    uint32_t max_num_lods = 8;
+    // the range of LOD 0, doubling per LOD, 0 for 4 times the size of a leaf
+    float lod0_range = 0;
+    // where the morph starts between the ranges of the previous LOD and this
+    float morph_start_ratio = 0.66f;
+  };
+
+  // a quarter of a node, in the heightfield coordinates of [0, 1]^2 in xz
+  struct Patch {
+    glm::vec2 origin;
+    float size;
+    // a float for the instance attribute
+    float lod;
+  };
+
+  // heights as in HeightfieldFile, (size + 1)^2 unorms row-major in x, and the
+  // transform of the heightfield coordinates to the world; the size must be a
+  // multiple of 2 * patch_size
+  explicit CDLODQuadtree(uint32_t size, const uint16_t *heights,
+                         float min_height, float max_height,
+                         const glm::mat4 &transform, const Options &options);
+
+  // the patches within range and, if frustum is not nullptr, on it
+  void Select(glm::vec3 camera_position, const Frustum *frustum,
+              std::vector<Patch> *patches) const;
+
+  // in the world, of the node at (x, z) of the grid of a LOD
+  AABB NodeBounds(uint32_t lod, uint32_t x, uint32_t z) const;
+
+  inline uint32_t num_lods() const { return min_max_.size(); }
+  inline const std::vector<float> &ranges() const { return ranges_; }
+  glm::vec2 morph_range(uint32_t lod) const;
+  inline const Options &options() const { return options_; }
+
+ private:
+  // the nodes of a LOD per side
+  inline uint32_t GridSize(uint32_t lod) const {
+    return size_ / (options_.patch_size << (lod + 1));
+  }
+  // false if the node is out of range, so its parent draws its area
+  bool SelectNode(uint32_t lod, uint32_t x, uint32_t z,
+                  glm::vec3 camera_position, const Frustum *frustum,
+                  std::vector<Patch> *patches) const;
+  void AddQuarter(uint32_t lod, uint32_t x, uint32_t z, uint32_t quarter,
+                  std::vector<Patch> *patches) const;
+
+  uint32_t size_;
+  glm::mat4 transform_;
+  Options options_;
+  // the height bounds of the nodes of each LOD, row-major in x
+  std::vector<std::vector<glm::vec2>> min_max_;
+  std::vector<float> ranges_;
+};
+
+#endif
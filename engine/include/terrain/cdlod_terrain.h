@@ -0,0 +1,47 @@
+#ifndef TERRAIN_CDLOD_TERRAIN_H_
+#define TERRAIN_CDLOD_TERRAIN_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "light_sources.h"
+#include "shader.h"
+#include "terrain/cdlod_quadtree.h"
+#include "terrain/heightfield_file.h"
+#include "texture.h"
+
+// A terrain drawn straight from a HeightfieldFile: the heights in a texture,
+// and a single grid patch instanced once per patch CDLODQuadtree selects, in
+// one draw call. The vertex shader samples the heights and morphs the
+// vertices between the LODs.
+class CDLODTerrain {
+ public:
+  explicit CDLODTerrain(const std::string &heightfield_path,
+                        const CDLODQuadtree::Options &options = {});
+  ~CDLODTerrain();
+
+  void Draw(Camera *camera, LightSources *light_sources);
+
+  void ImGuiWindow();
+
+  inline const HeightfieldFile &heightfield() const { return *heightfield_; }
+  inline const CDLODQuadtree &quadtree() const { return *quadtree_; }
+  // of the last Draw()
+  inline uint32_t num_patches() const { return patches_.size(); }
+
+ private:
+  std::unique_ptr<HeightfieldFile> heightfield_;
+  std::unique_ptr<CDLODQuadtree> quadtree_;
+  Texture height_texture_;
+  std::unique_ptr<Shader> shader_;
+
+  // the grid of a patch, and a CDLODQuadtree::Patch per instance
+  uint32_t vao_, vbo_, ebo_, instance_vbo_, num_indices_;
+  std::vector<CDLODQuadtree::Patch> patches_;
+
+  bool frustum_culling_ = true, wireframe_ = false;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef TERRAIN_HEIGHTFIELD_H_
+#define TERRAIN_HEIGHTFIELD_H_
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "aabb.h"
+#include "terrain/heightfield_file.h"
+
+// The heights of a terrain for gameplay and placement queries, built once
+// into tiles of TILE_SIZE^2 squares. A tile keeps its border grid points, so
+// a query reads 4 heights that are close in memory, whatever the size of the
+// terrain. The queries are in world xz, the transform of the heightfield
+// coordinates must not move xz with the height.
+class Heightfield {
+ public:
+  static constexpr uint32_t TILE_SIZE = 32;
+
+  enum class Interpolation {
+    kBilinear,
+    // on the triangles of the exported mesh, each square split from its
+    // min corner to its max corner
+    kTriangle,
+  };
+
+  explicit Heightfield(const HeightfieldFile &file);
+  // (size + 1)^2 heights row-major in x, e.g.
+  // PerlinNoiseTerrainGenerator::heights()
+  explicit Heightfield(uint32_t size, const float *heights,
+                       const glm::mat4 &transform);
+
+  // clamped to the terrain
+  float Height(glm::vec2 xz,
+               Interpolation interpolation = Interpolation::kTriangle) const;
+  glm::vec3 Normal(
+      glm::vec2 xz,
+      Interpolation interpolation = Interpolation::kTriangle) const;
+  // both of n points at once, normals may be nullptr, spread across threads
+  // for large batches
+  void Query(const glm::vec2 *xzs, uint32_t n, float *heights,
+             glm::vec3 *normals,
+             Interpolation interpolation = Interpolation::kTriangle) const;
+
+  inline uint32_t size() const { return size_; }
+  inline const AABB &bounds() const { return bounds_; }
+
+ private:
+  template <typename GetHeight>
+  void Build(GetHeight get_height);
+  // in grid units, the height and its gradient
+  float Sample(glm::vec2 grid, Interpolation interpolation,
+               glm::vec2 *gradient) const;
+  void QueryRange(const glm::vec2 *xzs, uint32_t begin, uint32_t end,
+                  float *heights, glm::vec3 *normals,
+                  Interpolation interpolation) const;
+
+  uint32_t size_, num_tiles_;
+  glm::mat4 transform_;
+  // from world xz to grid units, and back with the height
+  glm::mat2 world_to_grid_;
+  glm::vec2 origin_xz_;
+  glm::vec4 height_row_;
+  glm::mat3 normal_matrix_;
+  AABB bounds_;
+  // (TILE_SIZE + 1)^2 per tile, row-major in x, the tiles too
+  std::vector<float> tiles_;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef TERRAIN_HEIGHTFIELD_FILE_H_
+#define TERRAIN_HEIGHTFIELD_FILE_H_
+
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+#include <string>
+
+// The binary heightfield written by PerlinNoiseTerrainGenerator. The header is
+// followed by the bounds of each chunk and the heights of the (size + 1)^2
+// grid points, both row-major in x, so the file is used in place once mapped.
+struct HeightfieldHeader {
+  char magic[4];
+  uint32_t version;
+  // squares per side of the terrain and of a chunk
+  uint32_t size, chunk_size;
+  // from (x, height, z), x and z in [0, 1], to the world
+  float transform[16];
+  // the heights are unorms between them
+  float min_height, max_height;
+  uint64_t chunks_offset, heights_offset;
+};
+
+struct HeightfieldChunk {
+  float min_height, max_height;
+};
+
+// A read-only memory mapping of a heightfield file, the pages are only read
+// in when touched.
+class HeightfieldFile {
+ public:
+  static constexpr char MAGIC[4] = {'T', 'G', 'H', 'F'};
+  static constexpr uint32_t VERSION = 1;
+
+  explicit HeightfieldFile(const std::string &file_path);
+  ~HeightfieldFile();
+  HeightfieldFile(const HeightfieldFile &) = delete;
+  HeightfieldFile &operator=(const HeightfieldFile &) = delete;
+
+  inline const HeightfieldHeader &header() const {
+    return *(const HeightfieldHeader *)data_;
+  }
+  inline uint32_t num_chunks() const {
+    return header().size / header().chunk_size;
+  }
+  // row-major in x, num_chunks() per row
+  inline const HeightfieldChunk *chunks() const {
+    return (const HeightfieldChunk *)(data_ + header().chunks_offset);
+  }
+  // row-major in x, size + 1 per row
+  inline const uint16_t *heights() const {
+    return (const uint16_t *)(data_ + header().heights_offset);
+  }
+  inline float height(uint32_t x, uint32_t z) const {
+    const HeightfieldHeader &h = header();
+    return h.min_height + (h.max_height - h.min_height) *
+                              heights()[size_t(x) * (h.size + 1) + z] /
+                              65535.0f;
+  }
+  glm::mat4 transform() const;
+
+ private:
+  const uint8_t *data_ = nullptr;
+  size_t file_size_ = 0;
+#ifdef _WIN32
+  void *file_ = nullptr, *mapping_ = nullptr;
+#endif
+};
+
+#endif
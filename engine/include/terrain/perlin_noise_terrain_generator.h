@@ -2,11 +2,13 @@
 #define TERRAIN_PERLIN_NOISE_TERRAIN_H_
 
 #include <memory>
+#include <vector>
 
 #include "camera.h"
 #include "light_sources.h"
 #include "random/perlin_noise.h"
 #include "shader.h"
+#include "terrain/heightfield_file.h"
 
 class PerlinNoiseTerrainGenerator {
  private:
@@ -15,13 +17,32 @@ class PerlinNoiseTerrainGenerator {
   double ratio_;
   glm::mat4 transform_;
 
+  // computed once by heights()
+  std::vector<float> heights_;
+  std::vector<HeightfieldChunk> chunks_;
+
  public:
   PerlinNoiseTerrainGenerator(int size, int subdiv_size, double ratio,
                               glm::mat4 transform);
 
+  // the noise at (x, y) of [0, 1]^2, evaluated on each call, see Heightfield
+  // for repeated queries
   double get_height(double x, double y);
 
+  inline int size() const { return size_; }
+  inline const glm::mat4 &transform() const { return transform_; }
+
+  // get_height() of the (size + 1)^2 grid points, row-major in x, in float,
+  // a subdivision per task
+  const std::vector<float> &heights();
+  // the height bounds of each subdivision, row-major in x
+  const std::vector<HeightfieldChunk> &chunks();
+
+  // a HeightfieldFile with a chunk per subdivision
+  void ExportHeightfield(const std::string &file_path);
+  // an object per subdivision, sharing the vertices on their borders,
+  // formatted across threads
   void ExportToOBJ(const std::string &file_path);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,382 @@
+#include "batch_culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "avx2_target.h"
+#include "cpu_features.h"
+
+namespace batch_culling {
+
+void AABBArrays::Resize(size_t size) {
+  for (auto *v : {&min_x, &min_y, &min_z, &max_x, &max_y, &max_z}) {
+    v->resize(size);
+  }
+}
+
+void OBBArrays::Resize(size_t size) {
+  for (auto *v : {&center_x, &center_y, &center_z, &extent_x, &extent_y,
+                  &extent_z}) {
+    v->resize(size);
+  }
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) axes[i][j].resize(size);
+  }
+}
+
+void OBBArrays::Set(size_t i, const OBB &obb) {
+  glm::vec3 center = obb.center_world_space();
+  glm::vec3 extents = obb.extents();
+  glm::mat3 rotation = obb.rotation();
+  center_x[i] = center.x;
+  center_y[i] = center.y;
+  center_z[i] = center.z;
+  extent_x[i] = extents.x;
+  extent_y[i] = extents.y;
+  extent_z[i] = extents.z;
+  for (int j = 0; j < 3; j++) {
+    for (int k = 0; k < 3; k++) axes[j][k][i] = rotation[j][k];
+  }
+}
+
+namespace {
+
+// the first index that the scalar kernels handle after the AVX2 ones
+inline size_t VectorizedEnd(size_t size) {
+  return cpu_features::AVX2Enabled() ? size / 8 * 8 : 0;
+}
+
+inline void SetBit(std::vector<uint32_t> *mask, size_t i, bool value) {
+  (*mask)[i / 32] |= uint32_t(value) << (i % 32);
+}
+
+inline void ResizeMask(std::vector<uint32_t> *mask, size_t size) {
+  mask->assign((size + 31) / 32, 0);
+}
+
+// the kernels below follow the arithmetic of AABB::IsOnOrForwardPlane(),
+// Arvo's method and OBB::IntersectsOBB() operation by operation, so that
+// the scalar and AVX2 results are identical
+
+void IsOnFrustumScalar(const FrustumPlane *planes, const AABBArrays &aabbs,
+                       size_t begin, std::vector<uint32_t> *mask) {
+  for (size_t i = begin; i < aabbs.size(); i++) {
+    float center[3] = {(aabbs.max_x[i] + aabbs.min_x[i]) * 0.5f,
+                       (aabbs.max_y[i] + aabbs.min_y[i]) * 0.5f,
+                       (aabbs.max_z[i] + aabbs.min_z[i]) * 0.5f};
+    float extents[3] = {aabbs.max_x[i] - center[0],
+                        aabbs.max_y[i] - center[1],
+                        aabbs.max_z[i] - center[2]};
+    bool visible = true;
+    for (int p = 0; p < 6; p++) {
+      glm::vec3 n = planes[p].normal;
+      float r = extents[0] * std::abs(n.x) + extents[1] * std::abs(n.y) +
+                extents[2] * std::abs(n.z);
+      float distance = n.x * center[0] + n.y * center[1] + n.z * center[2] -
+                       planes[p].distance;
+      visible = visible && distance >= -r;
+    }
+    SetBit(mask, i, visible);
+  }
+}
+
+void TransformScalar(const glm::mat4 *transforms, const AABBArrays &aabbs,
+                     size_t begin, AABBArrays *transformed) {
+  const std::vector<float> *mins[3] = {&aabbs.min_x, &aabbs.min_y,
+                                       &aabbs.min_z};
+  const std::vector<float> *maxs[3] = {&aabbs.max_x, &aabbs.max_y,
+                                       &aabbs.max_z};
+  std::vector<float> *out_mins[3] = {&transformed->min_x, &transformed->min_y,
+                                     &transformed->min_z};
+  std::vector<float> *out_maxs[3] = {&transformed->max_x, &transformed->max_y,
+                                     &transformed->max_z};
+  for (size_t i = begin; i < aabbs.size(); i++) {
+    const float *m = &transforms[i][0][0];
+    for (int j = 0; j < 3; j++) {
+      float lo = m[12 + j], hi = m[12 + j];
+      for (int k = 0; k < 3; k++) {
+        float a = m[k * 4 + j] * (*mins[k])[i];
+        float b = m[k * 4 + j] * (*maxs[k])[i];
+        lo = lo + std::min(a, b);
+        hi = hi + std::max(a, b);
+      }
+      (*out_mins[j])[i] = lo;
+      (*out_maxs[j])[i] = hi;
+    }
+  }
+}
+
+// the obb is "a" and every box is "b" in OBB::IntersectsOBB()
+struct OBBConstants {
+  float a_c[3], a_e[3], a_u[3][3];
+};
+
+OBBConstants MakeOBBConstants(const OBB &obb) {
+  OBBConstants constants;
+  glm::vec3 a_c = obb.center_world_space(), a_e = obb.extents();
+  glm::mat3 a_u = obb.rotation();
+  for (int i = 0; i < 3; i++) {
+    constants.a_c[i] = a_c[i];
+    constants.a_e[i] = a_e[i];
+    for (int j = 0; j < 3; j++) constants.a_u[i][j] = a_u[i][j];
+  }
+  return constants;
+}
+
+// the other two axes of axis i, for the 9 cross products; the sign of the
+// tested distance differs from OBB::IntersectsOBB() for i = 1, which its
+// absolute value hides
+constexpr int kOther[3][2] = {{1, 2}, {0, 2}, {0, 1}};
+
+void IntersectsOBBScalar(const OBBConstants &a, const OBBArrays &obbs,
+                         float epsilon, size_t begin,
+                         std::vector<uint32_t> *mask) {
+  const std::vector<float> *centers[3] = {&obbs.center_x, &obbs.center_y,
+                                          &obbs.center_z};
+  const std::vector<float> *extents[3] = {&obbs.extent_x, &obbs.extent_y,
+                                          &obbs.extent_z};
+  for (size_t n = begin; n < obbs.size(); n++) {
+    float b_e[3], v1[3], t[3], R[3][3], AbsR[3][3];
+    for (int i = 0; i < 3; i++) {
+      b_e[i] = (*extents[i])[n];
+      v1[i] = (*centers[i])[n] - a.a_c[i];
+    }
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        R[i][j] = a.a_u[i][0] * obbs.axes[j][0][n] +
+                  a.a_u[i][1] * obbs.axes[j][1][n] +
+                  a.a_u[i][2] * obbs.axes[j][2][n];
+        AbsR[i][j] = std::abs(R[i][j]) + epsilon;
+      }
+      t[i] = v1[0] * a.a_u[i][0] + v1[1] * a.a_u[i][1] + v1[2] * a.a_u[i][2];
+    }
+
+    bool separated = false;
+    for (int i = 0; i < 3; i++) {
+      float ra = a.a_e[i];
+      float rb = b_e[0] * AbsR[i][0] + b_e[1] * AbsR[i][1] +
+                 b_e[2] * AbsR[i][2];
+      separated = separated || std::abs(t[i]) > ra + rb;
+    }
+    for (int i = 0; i < 3; i++) {
+      float ra = a.a_e[0] * AbsR[0][i] + a.a_e[1] * AbsR[1][i] +
+                 a.a_e[2] * AbsR[2][i];
+      float rb = b_e[i];
+      float distance = t[0] * R[0][i] + t[1] * R[1][i] + t[2] * R[2][i];
+      separated = separated || std::abs(distance) > ra + rb;
+    }
+    for (int i = 0; i < 3; i++) {
+      int i1 = kOther[i][0], i2 = kOther[i][1];
+      for (int j = 0; j < 3; j++) {
+        int j1 = kOther[j][0], j2 = kOther[j][1];
+        float ra = a.a_e[i1] * AbsR[i2][j] + a.a_e[i2] * AbsR[i1][j];
+        float rb = b_e[j1] * AbsR[i][j2] + b_e[j2] * AbsR[i][j1];
+        float distance = t[i2] * R[i1][j] - t[i1] * R[i2][j];
+        separated = separated || std::abs(distance) > ra + rb;
+      }
+    }
+    SetBit(mask, n, !separated);
+  }
+}
+
+#ifdef ENGINE_AVX2
+
+AVX2_TARGET inline __m256 Abs(__m256 x) {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+}
+
+// the lanes where the axis separates the boxes, |distance| > ra + rb
+AVX2_TARGET inline __m256 Separates(__m256 distance, __m256 ra, __m256 rb) {
+  return _mm256_cmp_ps(Abs(distance), _mm256_add_ps(ra, rb), _CMP_GT_OQ);
+}
+
+AVX2_TARGET void IsOnFrustumAVX2(const FrustumPlane *planes,
+                                 const AABBArrays &aabbs, size_t end,
+                                 std::vector<uint32_t> *mask) {
+  __m256 half = _mm256_set1_ps(0.5f);
+  for (size_t i = 0; i < end; i += 8) {
+    __m256 max_x = _mm256_loadu_ps(&aabbs.max_x[i]);
+    __m256 max_y = _mm256_loadu_ps(&aabbs.max_y[i]);
+    __m256 max_z = _mm256_loadu_ps(&aabbs.max_z[i]);
+    __m256 center_x = _mm256_mul_ps(
+        _mm256_add_ps(max_x, _mm256_loadu_ps(&aabbs.min_x[i])), half);
+    __m256 center_y = _mm256_mul_ps(
+        _mm256_add_ps(max_y, _mm256_loadu_ps(&aabbs.min_y[i])), half);
+    __m256 center_z = _mm256_mul_ps(
+        _mm256_add_ps(max_z, _mm256_loadu_ps(&aabbs.min_z[i])), half);
+    __m256 extent_x = _mm256_sub_ps(max_x, center_x);
+    __m256 extent_y = _mm256_sub_ps(max_y, center_y);
+    __m256 extent_z = _mm256_sub_ps(max_z, center_z);
+    __m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      glm::vec3 n = planes[p].normal;
+      __m256 r = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(extent_x, _mm256_set1_ps(std::abs(n.x))),
+                        _mm256_mul_ps(extent_y, _mm256_set1_ps(std::abs(n.y)))),
+          _mm256_mul_ps(extent_z, _mm256_set1_ps(std::abs(n.z))));
+      __m256 distance = _mm256_sub_ps(
+          _mm256_add_ps(
+              _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(n.x), center_x),
+                            _mm256_mul_ps(_mm256_set1_ps(n.y), center_y)),
+              _mm256_mul_ps(_mm256_set1_ps(n.z), center_z)),
+          _mm256_set1_ps(planes[p].distance));
+      __m256 negative_r = _mm256_xor_ps(r, _mm256_set1_ps(-0.0f));
+      visible = _mm256_and_ps(visible,
+                              _mm256_cmp_ps(distance, negative_r, _CMP_GE_OQ));
+    }
+    (*mask)[i / 32] |= uint32_t(_mm256_movemask_ps(visible)) << (i % 32);
+  }
+}
+
+AVX2_TARGET void TransformAVX2(const glm::mat4 *transforms,
+                               const AABBArrays &aabbs, size_t end,
+                               AABBArrays *transformed) {
+  const float *mins[3] = {aabbs.min_x.data(), aabbs.min_y.data(),
+                          aabbs.min_z.data()};
+  const float *maxs[3] = {aabbs.max_x.data(), aabbs.max_y.data(),
+                          aabbs.max_z.data()};
+  float *out_mins[3] = {transformed->min_x.data(), transformed->min_y.data(),
+                        transformed->min_z.data()};
+  float *out_maxs[3] = {transformed->max_x.data(), transformed->max_y.data(),
+                        transformed->max_z.data()};
+  // the same element of 8 consecutive matrices
+  __m256i matrix_offsets = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+  for (size_t i = 0; i < end; i += 8) {
+    const float *m = &transforms[i][0][0];
+    __m256 box_mins[3], box_maxs[3];
+    for (int k = 0; k < 3; k++) {
+      box_mins[k] = _mm256_loadu_ps(mins[k] + i);
+      box_maxs[k] = _mm256_loadu_ps(maxs[k] + i);
+    }
+    for (int j = 0; j < 3; j++) {
+      __m256 lo = _mm256_i32gather_ps(m + 12 + j, matrix_offsets, 4);
+      __m256 hi = lo;
+      for (int k = 0; k < 3; k++) {
+        __m256 element = _mm256_i32gather_ps(m + k * 4 + j, matrix_offsets, 4);
+        __m256 a = _mm256_mul_ps(element, box_mins[k]);
+        __m256 b = _mm256_mul_ps(element, box_maxs[k]);
+        lo = _mm256_add_ps(lo, _mm256_min_ps(a, b));
+        hi = _mm256_add_ps(hi, _mm256_max_ps(a, b));
+      }
+      _mm256_storeu_ps(out_mins[j] + i, lo);
+      _mm256_storeu_ps(out_maxs[j] + i, hi);
+    }
+  }
+}
+
+AVX2_TARGET void IntersectsOBBAVX2(const OBBConstants &a,
+                                   const OBBArrays &obbs, float epsilon,
+                                   size_t end, std::vector<uint32_t> *mask) {
+  const float *centers[3] = {obbs.center_x.data(), obbs.center_y.data(),
+                             obbs.center_z.data()};
+  const float *extents[3] = {obbs.extent_x.data(), obbs.extent_y.data(),
+                             obbs.extent_z.data()};
+  __m256 a_e[3], a_u[3][3];
+  for (int i = 0; i < 3; i++) {
+    a_e[i] = _mm256_set1_ps(a.a_e[i]);
+    for (int j = 0; j < 3; j++) a_u[i][j] = _mm256_set1_ps(a.a_u[i][j]);
+  }
+  __m256 epsilon_8 = _mm256_set1_ps(epsilon);
+
+  for (size_t n = 0; n < end; n += 8) {
+    __m256 b_e[3], v1[3], t[3], R[3][3], AbsR[3][3];
+    for (int i = 0; i < 3; i++) {
+      b_e[i] = _mm256_loadu_ps(extents[i] + n);
+      v1[i] = _mm256_sub_ps(_mm256_loadu_ps(centers[i] + n),
+                            _mm256_set1_ps(a.a_c[i]));
+    }
+    __m256 b_u[3][3];
+    for (int j = 0; j < 3; j++) {
+      for (int k = 0; k < 3; k++) {
+        b_u[j][k] = _mm256_loadu_ps(&obbs.axes[j][k][n]);
+      }
+    }
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        R[i][j] = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(a_u[i][0], b_u[j][0]),
+                          _mm256_mul_ps(a_u[i][1], b_u[j][1])),
+            _mm256_mul_ps(a_u[i][2], b_u[j][2]));
+        AbsR[i][j] = _mm256_add_ps(Abs(R[i][j]), epsilon_8);
+      }
+      t[i] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(v1[0], a_u[i][0]),
+                                         _mm256_mul_ps(v1[1], a_u[i][1])),
+                           _mm256_mul_ps(v1[2], a_u[i][2]));
+    }
+
+    __m256 separated = _mm256_setzero_ps();
+    for (int i = 0; i < 3; i++) {
+      __m256 rb = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(b_e[0], AbsR[i][0]),
+                        _mm256_mul_ps(b_e[1], AbsR[i][1])),
+          _mm256_mul_ps(b_e[2], AbsR[i][2]));
+      separated = _mm256_or_ps(separated, Separates(t[i], a_e[i], rb));
+    }
+    for (int i = 0; i < 3; i++) {
+      __m256 ra = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(a_e[0], AbsR[0][i]),
+                        _mm256_mul_ps(a_e[1], AbsR[1][i])),
+          _mm256_mul_ps(a_e[2], AbsR[2][i]));
+      __m256 distance =
+          _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t[0], R[0][i]),
+                                      _mm256_mul_ps(t[1], R[1][i])),
+                        _mm256_mul_ps(t[2], R[2][i]));
+      separated = _mm256_or_ps(separated, Separates(distance, ra, b_e[i]));
+    }
+    for (int i = 0; i < 3; i++) {
+      int i1 = kOther[i][0], i2 = kOther[i][1];
+      for (int j = 0; j < 3; j++) {
+        int j1 = kOther[j][0], j2 = kOther[j][1];
+        __m256 ra = _mm256_add_ps(_mm256_mul_ps(a_e[i1], AbsR[i2][j]),
+                                  _mm256_mul_ps(a_e[i2], AbsR[i1][j]));
+        __m256 rb = _mm256_add_ps(_mm256_mul_ps(b_e[j1], AbsR[i][j2]),
+                                  _mm256_mul_ps(b_e[j2], AbsR[i][j1]));
+        __m256 distance = _mm256_sub_ps(_mm256_mul_ps(t[i2], R[i1][j]),
+                                        _mm256_mul_ps(t[i1], R[i2][j]));
+        separated = _mm256_or_ps(separated, Separates(distance, ra, rb));
+      }
+    }
+    uint32_t bits = ~uint32_t(_mm256_movemask_ps(separated)) & 0xff;
+    (*mask)[n / 32] |= bits << (n % 32);
+  }
+}
+
+#endif
+
+}  // namespace
+
+void IsOnFrustum(const Frustum &frustum, const AABBArrays &aabbs,
+                 std::vector<uint32_t> *mask) {
+  const FrustumPlane planes[6] = {
+      frustum.top_plane,  frustum.bottom_plane, frustum.right_plane,
+      frustum.left_plane, frustum.far_plane,    frustum.near_plane};
+  ResizeMask(mask, aabbs.size());
+  size_t end = VectorizedEnd(aabbs.size());
+#ifdef ENGINE_AVX2
+  if (end > 0) IsOnFrustumAVX2(planes, aabbs, end, mask);
+#endif
+  IsOnFrustumScalar(planes, aabbs, end, mask);
+}
+
+void Transform(const glm::mat4 *transforms, const AABBArrays &aabbs,
+               AABBArrays *transformed) {
+  transformed->Resize(aabbs.size());
+  size_t end = VectorizedEnd(aabbs.size());
+#ifdef ENGINE_AVX2
+  if (end > 0) TransformAVX2(transforms, aabbs, end, transformed);
+#endif
+  TransformScalar(transforms, aabbs, end, transformed);
+}
+
+void IntersectsOBB(const OBB &obb, const OBBArrays &obbs, float epsilon,
+                   std::vector<uint32_t> *mask) {
+  OBBConstants constants = MakeOBBConstants(obb);
+  ResizeMask(mask, obbs.size());
+  size_t end = VectorizedEnd(obbs.size());
+#ifdef ENGINE_AVX2
+  if (end > 0) IntersectsOBBAVX2(constants, obbs, epsilon, end, mask);
+#endif
+  IntersectsOBBScalar(constants, obbs, epsilon, end, mask);
+}
+
+}  // namespace batch_culling
@@ -93,6 +93,30 @@ void Camera::set_center(vec3 new_center) {
   set_front(new_front);
 }
 
+Frustum Frustum::FromViewProjectionMatrix(const glm::mat4 &view_projection) {
+  auto row = [&view_projection](int i) {
+    return glm::vec4(view_projection[0][i], view_projection[1][i],
+                     view_projection[2][i], view_projection[3][i]);
+  };
+  // a point p is inside when dot(plane.xyz, p) + plane.w >= 0
+  auto to_frustum_plane = [](glm::vec4 plane) {
+    float length = glm::length(glm::vec3(plane));
+    FrustumPlane ret;
+    ret.normal = glm::vec3(plane) / length;
+    ret.distance = -plane.w / length;
+    return ret;
+  };
+
+  Frustum frustum;
+  frustum.left_plane = to_frustum_plane(row(3) + row(0));
+  frustum.right_plane = to_frustum_plane(row(3) - row(0));
+  frustum.bottom_plane = to_frustum_plane(row(3) + row(1));
+  frustum.top_plane = to_frustum_plane(row(3) - row(1));
+  frustum.near_plane = to_frustum_plane(row(3) + row(2));
+  frustum.far_plane = to_frustum_plane(row(3) - row(2));
+  return frustum;
+}
+
 Frustum Camera::frustum() const {
   Frustum frustum;
   const float half_far_height = far_ * tan(fovy_ * 0.5);
@@ -0,0 +1,650 @@
+#include "clouds/cloud_noise.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "avx2_target.h"
+#include "cpu_features.h"
+#include "parallel.h"
+#include "random/philox.h"
+
+namespace cloud_noise {
+
+namespace {
+
+// the Worley lattices are hashed in the layer of their number of cells, the
+// octaves of the weather map above them
+constexpr uint32_t kWeatherLayer = 1 << 16;
+constexpr uint32_t kMaxWeatherOctaves = 16;
+
+// lowbias32 (Chris Wellons, "Prospecting for Hash Functions")
+inline uint32_t Hash(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+inline uint32_t Hash(uint32_t x, uint32_t y, uint32_t z, uint32_t layer) {
+  return Hash(x ^ Hash(y ^ Hash(z ^ Hash(layer))));
+}
+
+inline int32_t Wrap(int32_t i, int32_t n) {
+  return i < 0 ? i + n : (i >= n ? i - n : i);
+}
+
+// texel / size in [0, 1) times the lattice
+inline float Scale(uint32_t texel, uint32_t size, float scale) {
+  return float(texel) / float(size) * scale;
+}
+
+inline float Mix(float a, float b, float t) { return a * (1 - t) + b * t; }
+
+inline float Fade(float t) { return t * t * t * (t * (t * 6 - 15) + 10); }
+
+inline uint8_t Quantize(float v) {
+  return uint8_t(std::clamp(v, 0.0f, 1.0f) * 255 + 0.5f);
+}
+
+// cells() of TileableVolumeNoise: a feature point per cell of a count^3
+// lattice that wraps, at the same random offset from the corner of the cell
+// along all 3 axes, x fastest
+struct WorleyLattice {
+  int32_t count;
+  std::vector<float> offsets;
+};
+
+WorleyLattice MakeWorleyLattice(uint32_t count) {
+  WorleyLattice lattice{int32_t(count),
+                        std::vector<float>(size_t(count) * count * count)};
+  for (uint32_t z = 0, i = 0; z < count; z++) {
+    for (uint32_t y = 0; y < count; y++) {
+      for (uint32_t x = 0; x < count; x++, i++) {
+        lattice.offsets[i] = PhiloxUnitFloat(Hash(x, y, z, count));
+      }
+    }
+  }
+  return lattice;
+}
+
+// 1 - the squared distance to the closest feature point, clamped to [0, 1],
+// of the texels [begin, end) of the row (y, z) of a size^3 volume
+void WorleyRowScalar(const WorleyLattice &lattice, uint32_t size, uint32_t y,
+                     uint32_t z, uint32_t begin, uint32_t end, float *out) {
+  int32_t n = lattice.count;
+  float py = Scale(y, size, n), pz = Scale(z, size, n);
+  float fy = std::floor(py), fz = std::floor(pz);
+  for (uint32_t x = begin; x < end; x++) {
+    float px = Scale(x, size, n), fx = std::floor(px);
+    float closest = 1;
+    for (int32_t oz = -1; oz <= 1; oz++) {
+      for (int32_t oy = -1; oy <= 1; oy++) {
+        const float *row =
+            &lattice.offsets[(size_t(Wrap(int32_t(fz) + oz, n)) * n +
+                              Wrap(int32_t(fy) + oy, n)) *
+                             n];
+        float dy = py - (fy + oy), dz = pz - (fz + oz);
+        for (int32_t ox = -1; ox <= 1; ox++) {
+          float h = row[Wrap(int32_t(fx) + ox, n)];
+          float dx = px - (fx + ox) - h;
+          float d = (dx * dx + (dy - h) * (dy - h)) + (dz - h) * (dz - h);
+          closest = std::min(closest, d);
+        }
+      }
+    }
+    out[x] = 1 - closest;
+  }
+}
+
+// perlinNoise3D() of TileableVolumeNoise, 3 octaves of glm::perlin() in 4D at
+// w = 0, from a frequency of 8 and a weight of 0.5, clamped to [0, 1]. Along a
+// row the gradients only depend on the cell along x, so each octave keeps the
+// x components of the gradients and the rest of their dot products, per
+// corner (y, z) and cell
+class PerlinRow {
+ public:
+  static constexpr uint32_t kNumOctaves = 3;
+
+  PerlinRow(uint32_t size, uint32_t y, uint32_t z) : size_(size) {
+    const Tables &tables = GetTables();
+    float weight = 0.5f;
+    for (uint32_t o = 0; o < kNumOctaves; o++) {
+      Octave &octave = octaves_[o];
+      octave.rep = 8 << o;
+      octave.frequency = octave.rep;
+      octave.weight = weight;
+      weight *= weight;
+      float py = Scale(y, size, octave.frequency);
+      float pz = Scale(z, size, octave.frequency);
+      int32_t iy[2], iz[2];
+      iy[0] = int32_t(std::floor(py)) % octave.rep;
+      iz[0] = int32_t(std::floor(pz)) % octave.rep;
+      iy[1] = (iy[0] + 1) % octave.rep;
+      iz[1] = (iz[0] + 1) % octave.rep;
+      float fy[2], fz[2];
+      fy[0] = py - std::floor(py);
+      fz[0] = pz - std::floor(pz);
+      fy[1] = fy[0] - 1;
+      fz[1] = fz[0] - 1;
+      octave.fade_y = Fade(fy[0]);
+      octave.fade_z = Fade(fz[0]);
+      for (int32_t c = 0; c < 4; c++) {
+        int32_t by = c & 1, bz = c >> 1;
+        octave.gx[c].resize(octave.rep);
+        octave.gyz[c].resize(octave.rep);
+        for (int32_t ix = 0; ix < octave.rep; ix++) {
+          // permute() of the mod 289 polynomial, and iw = 0
+          int32_t h = tables.perm[tables.perm[ix] + iy[by]];
+          h = tables.perm[tables.perm[h + iz[bz]]];
+          octave.gx[c][ix] = tables.gx[h];
+          octave.gyz[c][ix] = tables.gy[h] * fy[by] + tables.gz[h] * fz[bz];
+        }
+      }
+    }
+  }
+
+  void EvaluateScalar(uint32_t begin, uint32_t end, float *out) const {
+    for (uint32_t x = begin; x < end; x++) {
+      float sum = 0;
+      for (const Octave &octave : octaves_) {
+        float px = Scale(x, size_, octave.frequency);
+        float fx = px - std::floor(px);
+        int32_t ix0 = int32_t(std::floor(px));
+        int32_t ix1 = ix0 + 1 == octave.rep ? 0 : ix0 + 1;
+        // the corners (x, y, z) mixed along z, then y, then x
+        float xy[2][2];
+        for (int32_t by = 0; by < 2; by++) {
+          float n[2][2];
+          for (int32_t bz = 0; bz < 2; bz++) {
+            int32_t c = by | bz << 1;
+            n[0][bz] = octave.gx[c][ix0] * fx + octave.gyz[c][ix0];
+            n[1][bz] = octave.gx[c][ix1] * (fx - 1) + octave.gyz[c][ix1];
+          }
+          for (int32_t bx = 0; bx < 2; bx++) {
+            xy[bx][by] = Mix(n[bx][0], n[bx][1], octave.fade_z);
+          }
+        }
+        float value = 2.2f * Mix(Mix(xy[0][0], xy[0][1], octave.fade_y),
+                                 Mix(xy[1][0], xy[1][1], octave.fade_y),
+                                 Fade(fx));
+        sum += value * octave.weight;
+      }
+      out[x] = std::clamp(sum / kWeightSum, 0.0f, 1.0f);
+    }
+  }
+
+#ifdef ENGINE_AVX2
+  AVX2_TARGET void EvaluateAVX2(uint32_t end, float *out) const;
+#endif
+
+ private:
+  static constexpr float kWeightSum = 0.5f + 0.25f + 0.0625f;
+
+  // glm's permute() and the normalized gradients of its 289 hashes
+  struct Tables {
+    int32_t perm[289 * 2];
+    float gx[289], gy[289], gz[289];
+  };
+
+  struct Octave {
+    int32_t rep;
+    float frequency, weight, fade_y, fade_z;
+    std::vector<float> gx[4], gyz[4];
+  };
+
+  static const Tables &GetTables() {
+    static const Tables tables = []() {
+      Tables tables;
+      // twice, so that a sum of 2 hashes needs no mod
+      for (int32_t i = 0; i < 289 * 2; i++) {
+        tables.perm[i] = (34 * (i % 289) + 1) * (i % 289) % 289;
+      }
+      for (int32_t h = 0; h < 289; h++) {
+        float gx = h / 7.0f;
+        float gy = std::floor(gx) / 7.0f;
+        float gz = std::floor(gy) / 6.0f;
+        gx = gx - std::floor(gx) - 0.5f;
+        gy = gy - std::floor(gy) - 0.5f;
+        gz = gz - std::floor(gz) - 0.5f;
+        float gw = 0.75f - std::abs(gx) - std::abs(gy) - std::abs(gz);
+        if (gw <= 0) {
+          gx -= (gx >= 0 ? 1 : 0) - 0.5f;
+          gy -= (gy >= 0 ? 1 : 0) - 0.5f;
+        }
+        // taylorInvSqrt()
+        float dot = gx * gx + gy * gy + gz * gz + gw * gw;
+        float norm = 1.79284291400159f - 0.85373472095314f * dot;
+        tables.gx[h] = gx * norm;
+        tables.gy[h] = gy * norm;
+        tables.gz[h] = gz * norm;
+      }
+      return tables;
+    }();
+    return tables;
+  }
+
+  uint32_t size_;
+  Octave octaves_[kNumOctaves];
+};
+
+// perlinNoise() of the weather map, octaves of value noise on lattices of 3
+// times the cells of the previous ones and a quarter of their amplitude,
+// squared.
+// A lattice of a whole number of cells wraps around the texture, so the cells
+// and the weights of the texels, shifted by the offset, are exact integers
+struct WeatherAxis {
+  std::vector<uint32_t> cells, next_cells;
+  std::vector<float> weights;
+};
+
+WeatherAxis MakeWeatherAxis(uint32_t size, uint32_t num_cells,
+                            uint32_t offset) {
+  WeatherAxis axis;
+  for (uint32_t i = 0; i < size; i++) {
+    uint64_t p = uint64_t((i + offset) % size) * num_cells;
+    uint32_t cell = p / size;
+    // smoothstep()
+    float w = float(p % size) / float(size);
+    axis.cells.push_back(cell);
+    axis.next_cells.push_back(cell + 1 == num_cells ? 0 : cell + 1);
+    axis.weights.push_back(w * w * (3 - 2 * w));
+  }
+  return axis;
+}
+
+struct WeatherOctave {
+  WeatherAxis x, y;
+  uint32_t layer;
+  float amplitude;
+};
+
+std::vector<WeatherOctave> MakeWeatherField(uint32_t size, uint32_t field,
+                                            uint32_t num_cells,
+                                            float amplitude,
+                                            uint32_t num_octaves,
+                                            uint32_t offset_x,
+                                            uint32_t offset_y) {
+  std::vector<WeatherOctave> octaves;
+  for (uint32_t o = 0; o < num_octaves; o++) {
+    octaves.push_back(WeatherOctave{
+        MakeWeatherAxis(size, num_cells, offset_x),
+        MakeWeatherAxis(size, num_cells, offset_y),
+        Hash(kWeatherLayer + field * kMaxWeatherOctaves + o), amplitude});
+    num_cells *= 3;
+    amplitude *= 0.25f;
+  }
+  return octaves;
+}
+
+void WeatherRowScalar(const std::vector<WeatherOctave> &octaves, uint32_t y,
+                      uint32_t begin, uint32_t end, float *out) {
+  for (uint32_t x = begin; x < end; x++) {
+    float sum = 0;
+    for (const WeatherOctave &octave : octaves) {
+      uint32_t y0 = Hash(octave.y.cells[y] ^ octave.layer);
+      uint32_t y1 = Hash(octave.y.next_cells[y] ^ octave.layer);
+      float p0 = PhiloxUnitFloat(Hash(octave.x.cells[x] ^ y0));
+      float p1 = PhiloxUnitFloat(Hash(octave.x.next_cells[x] ^ y0));
+      float p2 = PhiloxUnitFloat(Hash(octave.x.cells[x] ^ y1));
+      float p3 = PhiloxUnitFloat(Hash(octave.x.next_cells[x] ^ y1));
+      float wx = octave.x.weights[x], wy = octave.y.weights[y];
+      float value = p0 + (p1 - p0) * wx + (p2 - p0) * wy * (1 - wx) +
+                    (p3 - p1) * (wy * wx);
+      sum += value * octave.amplitude;
+    }
+    out[x] = sum * sum;
+  }
+}
+
+#ifdef ENGINE_AVX2
+
+AVX2_TARGET inline __m256i Hash8(__m256i x) {
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+  x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+  x = _mm256_mullo_epi32(x, _mm256_set1_epi32(int32_t(0x846ca68bu)));
+  return _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+}
+
+AVX2_TARGET inline __m256 UnitFloat8(__m256i word) {
+  return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(word, 8)),
+                       _mm256_set1_ps(1.0f / 16777216.0f));
+}
+
+AVX2_TARGET inline __m256 Mix8(__m256 a, __m256 b, __m256 t) {
+  return _mm256_add_ps(_mm256_mul_ps(a, _mm256_sub_ps(_mm256_set1_ps(1), t)),
+                       _mm256_mul_ps(b, t));
+}
+
+AVX2_TARGET inline __m256 Fade8(__m256 t) {
+  __m256 inner = _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6)),
+                               _mm256_set1_ps(15));
+  inner = _mm256_add_ps(_mm256_mul_ps(t, inner), _mm256_set1_ps(10));
+  return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+}
+
+// Scale() of the texels x to x + 7
+AVX2_TARGET inline __m256 Scale8(uint32_t x, uint32_t size, float scale) {
+  __m256i texels = _mm256_add_epi32(_mm256_set1_epi32(x),
+                                    _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  return _mm256_mul_ps(_mm256_div_ps(_mm256_cvtepi32_ps(texels),
+                                     _mm256_set1_ps(float(size))),
+                       _mm256_set1_ps(scale));
+}
+
+AVX2_TARGET inline __m256i Wrap8(__m256i i, __m256i n) {
+  __m256i zero = _mm256_setzero_si256();
+  i = _mm256_add_epi32(i, _mm256_and_si256(_mm256_cmpgt_epi32(zero, i), n));
+  __m256i last = _mm256_sub_epi32(n, _mm256_set1_epi32(1));
+  return _mm256_sub_epi32(
+      i, _mm256_and_si256(_mm256_cmpgt_epi32(i, last), n));
+}
+
+AVX2_TARGET inline __m256 Square8(__m256 x) { return _mm256_mul_ps(x, x); }
+
+// WorleyRowScalar() of the texels [0, end), end a multiple of 8
+AVX2_TARGET void WorleyRowAVX2(const WorleyLattice &lattice, uint32_t size,
+                               uint32_t y, uint32_t z, uint32_t end,
+                               float *out) {
+  int32_t n = lattice.count;
+  __m256i n8 = _mm256_set1_epi32(n);
+  float py = Scale(y, size, n), pz = Scale(z, size, n);
+  float fy = std::floor(py), fz = std::floor(pz);
+  for (uint32_t x = 0; x < end; x += 8) {
+    __m256 px = Scale8(x, size, n), fx = _mm256_floor_ps(px);
+    __m256i ix = _mm256_cvttps_epi32(fx);
+    __m256 closest = _mm256_set1_ps(1);
+    for (int32_t oz = -1; oz <= 1; oz++) {
+      for (int32_t oy = -1; oy <= 1; oy++) {
+        const float *row =
+            &lattice.offsets[(size_t(Wrap(int32_t(fz) + oz, n)) * n +
+                              Wrap(int32_t(fy) + oy, n)) *
+                             n];
+        __m256 dy = _mm256_set1_ps(py - (fy + oy));
+        __m256 dz = _mm256_set1_ps(pz - (fz + oz));
+        for (int32_t ox = -1; ox <= 1; ox++) {
+          __m256i cell =
+              Wrap8(_mm256_add_epi32(ix, _mm256_set1_epi32(ox)), n8);
+          __m256 h = _mm256_i32gather_ps(row, cell, 4);
+          __m256 dx = _mm256_sub_ps(
+              _mm256_sub_ps(px, _mm256_add_ps(fx, _mm256_set1_ps(ox))), h);
+          __m256 d = _mm256_add_ps(
+              _mm256_add_ps(Square8(dx), Square8(_mm256_sub_ps(dy, h))),
+              Square8(_mm256_sub_ps(dz, h)));
+          closest = _mm256_min_ps(d, closest);
+        }
+      }
+    }
+    _mm256_storeu_ps(out + x, _mm256_sub_ps(_mm256_set1_ps(1), closest));
+  }
+}
+
+// EvaluateScalar() of the texels [0, end), end a multiple of 8
+AVX2_TARGET void PerlinRow::EvaluateAVX2(uint32_t end, float *out) const {
+  for (uint32_t x = 0; x < end; x += 8) {
+    __m256 sum = _mm256_setzero_ps();
+    for (const Octave &octave : octaves_) {
+      __m256 px = Scale8(x, size_, octave.frequency);
+      __m256 floor_px = _mm256_floor_ps(px);
+      __m256 fx = _mm256_sub_ps(px, floor_px);
+      __m256 fx1 = _mm256_sub_ps(fx, _mm256_set1_ps(1));
+      __m256i ix0 = _mm256_cvttps_epi32(floor_px);
+      __m256i ix1 = _mm256_add_epi32(ix0, _mm256_set1_epi32(1));
+      ix1 = _mm256_andnot_si256(
+          _mm256_cmpeq_epi32(ix1, _mm256_set1_epi32(octave.rep)), ix1);
+      __m256 fade_y = _mm256_set1_ps(octave.fade_y);
+      __m256 fade_z = _mm256_set1_ps(octave.fade_z);
+      __m256 xy[2][2];
+      for (int32_t by = 0; by < 2; by++) {
+        __m256 n[2][2];
+        for (int32_t bz = 0; bz < 2; bz++) {
+          int32_t c = by | bz << 1;
+          const float *gx = octave.gx[c].data(), *gyz = octave.gyz[c].data();
+          n[0][bz] = _mm256_add_ps(
+              _mm256_mul_ps(_mm256_i32gather_ps(gx, ix0, 4), fx),
+              _mm256_i32gather_ps(gyz, ix0, 4));
+          n[1][bz] = _mm256_add_ps(
+              _mm256_mul_ps(_mm256_i32gather_ps(gx, ix1, 4), fx1),
+              _mm256_i32gather_ps(gyz, ix1, 4));
+        }
+        for (int32_t bx = 0; bx < 2; bx++) {
+          xy[bx][by] = Mix8(n[bx][0], n[bx][1], fade_z);
+        }
+      }
+      __m256 value = _mm256_mul_ps(
+          _mm256_set1_ps(2.2f), Mix8(Mix8(xy[0][0], xy[0][1], fade_y),
+                                     Mix8(xy[1][0], xy[1][1], fade_y),
+                                     Fade8(fx)));
+      sum = _mm256_add_ps(sum,
+                          _mm256_mul_ps(value, _mm256_set1_ps(octave.weight)));
+    }
+    __m256 noise = _mm256_div_ps(sum, _mm256_set1_ps(kWeightSum));
+    noise = _mm256_min_ps(_mm256_max_ps(noise, _mm256_setzero_ps()),
+                          _mm256_set1_ps(1));
+    _mm256_storeu_ps(out + x, noise);
+  }
+}
+
+// WeatherRowScalar() of the texels [0, end), end a multiple of 8
+AVX2_TARGET void WeatherRowAVX2(const std::vector<WeatherOctave> &octaves,
+                                uint32_t y, uint32_t end, float *out) {
+  __m256 one = _mm256_set1_ps(1);
+  for (uint32_t x = 0; x < end; x += 8) {
+    __m256 sum = _mm256_setzero_ps();
+    for (const WeatherOctave &octave : octaves) {
+      __m256i y0 = _mm256_set1_epi32(Hash(octave.y.cells[y] ^ octave.layer));
+      __m256i y1 =
+          _mm256_set1_epi32(Hash(octave.y.next_cells[y] ^ octave.layer));
+      __m256i x0 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(octave.x.cells.data() + x));
+      __m256i x1 = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(octave.x.next_cells.data() + x));
+      __m256 p0 = UnitFloat8(Hash8(_mm256_xor_si256(x0, y0)));
+      __m256 p1 = UnitFloat8(Hash8(_mm256_xor_si256(x1, y0)));
+      __m256 p2 = UnitFloat8(Hash8(_mm256_xor_si256(x0, y1)));
+      __m256 p3 = UnitFloat8(Hash8(_mm256_xor_si256(x1, y1)));
+      __m256 wx = _mm256_loadu_ps(octave.x.weights.data() + x);
+      __m256 wy = _mm256_set1_ps(octave.y.weights[y]);
+      __m256 value =
+          _mm256_add_ps(p0, _mm256_mul_ps(_mm256_sub_ps(p1, p0), wx));
+      value = _mm256_add_ps(
+          value, _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(p2, p0), wy),
+                               _mm256_sub_ps(one, wx)));
+      value = _mm256_add_ps(value, _mm256_mul_ps(_mm256_sub_ps(p3, p1),
+                                                 _mm256_mul_ps(wy, wx)));
+      sum = _mm256_add_ps(
+          sum, _mm256_mul_ps(value, _mm256_set1_ps(octave.amplitude)));
+    }
+    _mm256_storeu_ps(out + x, _mm256_mul_ps(sum, sum));
+  }
+}
+
+#endif
+
+// the first texel of a row that the scalar kernels handle after the AVX2 ones
+inline uint32_t ScalarBegin(uint32_t size) {
+  return cpu_features::AVX2Enabled() ? size / 8 * 8 : 0;
+}
+
+void WorleyRow(const WorleyLattice &lattice, uint32_t size, uint32_t y,
+               uint32_t z, float *out) {
+  uint32_t begin = ScalarBegin(size);
+#ifdef ENGINE_AVX2
+  if (begin > 0) WorleyRowAVX2(lattice, size, y, z, begin, out);
+#endif
+  WorleyRowScalar(lattice, size, y, z, begin, size, out);
+}
+
+void EvaluatePerlinRow(const PerlinRow &row, uint32_t size, float *out) {
+  uint32_t begin = ScalarBegin(size);
+#ifdef ENGINE_AVX2
+  if (begin > 0) row.EvaluateAVX2(begin, out);
+#endif
+  row.EvaluateScalar(begin, size, out);
+}
+
+void WeatherRow(const std::vector<WeatherOctave> &octaves, uint32_t size,
+                uint32_t y, float *out) {
+  uint32_t begin = ScalarBegin(size);
+#ifdef ENGINE_AVX2
+  if (begin > 0) WeatherRowAVX2(octaves, y, begin, out);
+#endif
+  WeatherRowScalar(octaves, y, begin, size, out);
+}
+
+// the texels of a row of level 0, from the rows of its channels
+template <typename F>
+void FillRow(Volume *volume, uint32_t y, uint32_t z, const F &texel) {
+  uint8_t *texels =
+      &volume->levels[0][((size_t(z) * volume->height + y) * volume->width) *
+                         4];
+  for (uint32_t x = 0; x < volume->width; x++, texels += 4) {
+    float rgba[4];
+    texel(x, rgba);
+    for (int i = 0; i < 4; i++) texels[i] = Quantize(rgba[i]);
+  }
+}
+
+Volume MakeVolume(uint32_t width, uint32_t height, uint32_t depth) {
+  return Volume{width, height, depth,
+                {std::vector<uint8_t>(size_t(width) * height * depth * 4)}};
+}
+
+}  // namespace
+
+Volume PerlinWorley(uint32_t size) {
+  // 4 times 2, 8 and 14 for the Perlin-Worley, and 2, 4, 8 and 16 for the
+  // fBm, as TileableVolumeNoise
+  enum { k8, k16, k32, k56, k64, kNumLattices };
+  const uint32_t counts[kNumLattices] = {8, 16, 32, 56, 64};
+  WorleyLattice lattices[kNumLattices];
+  for (int i = 0; i < kNumLattices; i++) {
+    lattices[i] = MakeWorleyLattice(counts[i]);
+  }
+
+  Volume volume = MakeVolume(size, size, size);
+  ParallelFor(size, [&](uint32_t z) {
+    std::vector<float> perlin(size), worley[kNumLattices];
+    for (auto &w : worley) w.resize(size);
+    for (uint32_t y = 0; y < size; y++) {
+      EvaluatePerlinRow(PerlinRow(size, y, z), size, perlin.data());
+      for (int i = 0; i < kNumLattices; i++) {
+        WorleyRow(lattices[i], size, y, z, worley[i].data());
+      }
+      FillRow(&volume, y, z, [&](uint32_t x, float *rgba) {
+        float w8 = worley[k8][x], w16 = worley[k16][x];
+        float w32 = worley[k32][x], w56 = worley[k56][x];
+        float w64 = worley[k64][x];
+        // remap(perlin, 0, 1, fbm, 1), GPU Pro 7 p.101
+        float fbm = w8 * 0.625f + w32 * 0.25f + w56 * 0.125f;
+        float perlin_worley = fbm + perlin[x] * (1 - fbm);
+        rgba[0] = perlin_worley * perlin_worley;
+        rgba[1] = w8 * 0.625f + w16 * 0.25f + w32 * 0.125f;
+        rgba[2] = w16 * 0.625f + w32 * 0.25f + w64 * 0.125f;
+        rgba[3] = w32 * 0.75f + w64 * 0.25f;
+      });
+    }
+  });
+  BuildMips(&volume);
+  return volume;
+}
+
+Volume Worley(uint32_t size) {
+  constexpr int kNumLattices = 4;
+  WorleyLattice lattices[kNumLattices];
+  for (int i = 0; i < kNumLattices; i++) {
+    lattices[i] = MakeWorleyLattice(2 << i);
+  }
+
+  Volume volume = MakeVolume(size, size, size);
+  ParallelFor(size, [&](uint32_t z) {
+    std::vector<float> worley[kNumLattices];
+    for (auto &w : worley) w.resize(size);
+    for (uint32_t y = 0; y < size; y++) {
+      for (int i = 0; i < kNumLattices; i++) {
+        WorleyRow(lattices[i], size, y, z, worley[i].data());
+      }
+      FillRow(&volume, y, z, [&](uint32_t x, float *rgba) {
+        float w2 = worley[0][x], w4 = worley[1][x];
+        float w8 = worley[2][x], w16 = worley[3][x];
+        rgba[0] = w2 * 0.625f + w4 * 0.25f + w8 * 0.125f;
+        rgba[1] = w4 * 0.625f + w8 * 0.25f + w16 * 0.125f;
+        rgba[2] = w8 * 0.75f + w16 * 0.25f;
+        rgba[3] = 1;
+      });
+    }
+  });
+  BuildMips(&volume);
+  return volume;
+}
+
+Volume Weather(uint32_t size, float perlin_frequency) {
+  // the coverage at uv, and the type at uv + 5.5, uv = (texel + (2, 0)) /
+  // size, of the scales and amplitudes of the original
+  uint32_t shift = size * 11 / 2;
+  std::vector<WeatherOctave> coverage = MakeWeatherField(
+      size, 0, uint32_t(std::max(1.0f, std::round(95 * perlin_frequency))),
+      0.5f, 4, 2, 0);
+  std::vector<WeatherOctave> type =
+      MakeWeatherField(size, 1, 90, 0.7f, 10, 2 + shift, shift);
+
+  Volume volume = MakeVolume(size, size, 1);
+  ParallelFor(size, [&](uint32_t y) {
+    std::vector<float> coverages(size), types(size);
+    WeatherRow(coverage, size, y, coverages.data());
+    WeatherRow(type, size, y, types.data());
+    FillRow(&volume, y, 0, [&](uint32_t x, float *rgba) {
+      rgba[0] = coverages[x];
+      rgba[1] = types[x];
+      rgba[2] = 0;
+      rgba[3] = 1;
+    });
+  });
+  BuildMips(&volume);
+  return volume;
+}
+
+void BuildMips(Volume *volume) {
+  volume->levels.resize(1);
+  uint32_t width = volume->width, height = volume->height,
+           depth = volume->depth;
+  while (width > 1 || height > 1 || depth > 1) {
+    const std::vector<uint8_t> &src = volume->levels.back();
+    uint32_t w = std::max(1u, width / 2), h = std::max(1u, height / 2),
+             d = std::max(1u, depth / 2);
+    // 2 texels along each axis but those of 1 texel
+    uint32_t sx = width > 1 ? 2 : 1, sy = height > 1 ? 2 : 1,
+             sz = depth > 1 ? 2 : 1;
+    uint32_t num_taps = sx * sy * sz;
+    std::vector<uint8_t> dst(size_t(w) * h * d * 4);
+    for (uint32_t z = 0, i = 0; z < d; z++) {
+      for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++, i += 4) {
+          uint32_t sum[4] = {};
+          for (uint32_t dz = 0; dz < sz; dz++) {
+            for (uint32_t dy = 0; dy < sy; dy++) {
+              for (uint32_t dx = 0; dx < sx; dx++) {
+                size_t j = ((size_t(z * sz + dz) * height + y * sy + dy) *
+                                width +
+                            x * sx + dx) *
+                           4;
+                for (int c = 0; c < 4; c++) sum[c] += src[j + c];
+              }
+            }
+          }
+          for (int c = 0; c < 4; c++) {
+            dst[i + c] = (sum[c] + num_taps / 2) / num_taps;
+          }
+        }
+      }
+    }
+    volume->levels.push_back(std::move(dst));
+    width = w;
+    height = h;
+    depth = d;
+  }
+}
+
+}  // namespace cloud_noise
@@ -29,8 +29,10 @@ void Clouds::Allocate(uint32_t width, uint32_t height) {
 
 void Clouds::Deallocate() { frag_color_texture_.Clear(); }
 
-Clouds::Clouds(uint32_t width, uint32_t height) {
-  noise_texture_generator_.reset(new NoiseTextureGenerator(0.8));
+Clouds::Clouds(uint32_t width, uint32_t height,
+               const std::string &noise_cache_path) {
+  noise_texture_generator_.reset(
+      new NoiseTextureGenerator(0.8, noise_cache_path));
   shader_.reset(new Shader(
       {{GL_COMPUTE_SHADER, "clouds/clouds.comp"}},
       {
@@ -43,6 +45,8 @@ Clouds::Clouds(uint32_t width, uint32_t height) {
            std::any(ImageBasedLight::GLSL_BINDING)},
           {"POISSON_DISK_2D_BINDING",
            std::any(LightSources::POISSON_DISK_2D_BINDING)},
+          {"POISSON_DISK_3D_BINDING",
+           std::any(LightSources::POISSON_DISK_3D_BINDING)},
       }));
   screen_space_shader_ = Shader::ScreenSpaceShader("clouds/clouds.frag", {});
   glGenVertexArrays(1, &vao_);
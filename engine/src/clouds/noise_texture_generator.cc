@@ -1,57 +1,168 @@
 #include "clouds/noise_texture_generator.h"
 
+#include <fmt/core.h>
 #include <glad/glad.h>
 
-#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 
-#include "shader.h"
+#include "fnv_hash.h"
 #include "utils.h"
 
+namespace {
+
+constexpr uint32_t kPerlinWorleySize = 128;
+constexpr uint32_t kWorleySize = 32;
+constexpr uint32_t kWeatherSize = 1024;
+
+constexpr char kMagic[4] = {'T', 'G', 'C', 'N'};
+constexpr uint32_t kVersion = 1;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t fingerprint;
+};
+
+// the perlin-worley, worley and weather volumes, without their texels
+std::vector<cloud_noise::Volume> EmptyVolumes() {
+  return {{kPerlinWorleySize, kPerlinWorleySize, kPerlinWorleySize, {}},
+          {kWorleySize, kWorleySize, kWorleySize, {}},
+          {kWeatherSize, kWeatherSize, 1, {}}};
+}
+
+// level 0 by the constructor, and the prebuilt mips rather than
+// glGenerateMipmap()
+void Upload(const cloud_noise::Volume &volume, Texture *texture) {
+  void *data = (void *)volume.levels[0].data();
+  uint32_t target = volume.depth > 1 ? GL_TEXTURE_3D : GL_TEXTURE_2D;
+  if (target == GL_TEXTURE_3D) {
+    *texture = Texture(data, GL_TEXTURE_3D, volume.width, volume.height,
+                       volume.depth, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE,
+                       GL_REPEAT, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, {},
+                       false);
+  } else {
+    *texture = Texture(data, volume.width, volume.height, GL_RGBA8, GL_RGBA,
+                       GL_UNSIGNED_BYTE, GL_REPEAT, GL_LINEAR_MIPMAP_LINEAR,
+                       GL_LINEAR, {}, false);
+  }
+
+  glBindTexture(target, texture->id());
+  glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, volume.num_levels() - 1);
+  for (uint32_t level = 1; level < volume.num_levels(); level++) {
+    uint32_t width = std::max(1u, volume.width >> level);
+    uint32_t height = std::max(1u, volume.height >> level);
+    uint32_t depth = std::max(1u, volume.depth >> level);
+    data = (void *)volume.levels[level].data();
+    if (target == GL_TEXTURE_3D) {
+      glTexImage3D(target, level, GL_RGBA8, width, height, depth, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, data);
+    } else {
+      glTexImage2D(target, level, GL_RGBA8, width, height, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, data);
+    }
+  }
+  glBindTexture(target, 0);
+  CHECK_OPENGL_ERROR();
+}
+
+}  // namespace
+
 NoiseTextureGenerator::NoiseTextureGenerator(
-    float weather_texture_perlin_frequency)
+    float weather_texture_perlin_frequency, const std::string &cache_path)
     : weather_texture_perlin_frequency_(weather_texture_perlin_frequency) {
-  {
-    std::unique_ptr<Shader> shader(
-        new Shader({{GL_COMPUTE_SHADER, "clouds/perlinworley.comp"}}, {}));
-    perlin_worley_texture_ = Texture(
-        nullptr, GL_TEXTURE_3D, 128, 128, 128, GL_RGBA8, GL_RGBA, GL_FLOAT,
-        GL_REPEAT, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, {}, true);
-
-    shader->Use();
-    glBindImageTexture(0, perlin_worley_texture_.id(), 0, GL_FALSE, 0,
-                       GL_WRITE_ONLY, GL_RGBA8);
-    glDispatchCompute(128, 128, 128);
-    CHECK_OPENGL_ERROR();
-  }
-  {
-    std::unique_ptr<Shader> shader(
-        new Shader({{GL_COMPUTE_SHADER, "clouds/worley.comp"}}, {}));
-    worley_texture_ =
-        Texture(nullptr, GL_TEXTURE_3D, 32, 32, 32, GL_RGBA8, GL_RGBA, GL_FLOAT,
-                GL_REPEAT, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, {}, true);
-
-    shader->Use();
-    glBindImageTexture(0, worley_texture_.id(), 0, GL_FALSE, 0, GL_WRITE_ONLY,
-                       GL_RGBA8);
-    glDispatchCompute(32, 32, 32);
-    CHECK_OPENGL_ERROR();
-  }
-  {
-    std::unique_ptr<Shader> shader(
-        new Shader({{GL_COMPUTE_SHADER, "clouds/weather.comp"}}, {}));
-    weather_texture_ =
-        Texture(nullptr, 1024, 1024, GL_RGBA8, GL_RGBA, GL_FLOAT, GL_REPEAT,
-                GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, {}, true);
-
-    shader->Use();
-    shader->SetUniform<float>("perlinFrequency",
-                              weather_texture_perlin_frequency_);
-    shader->SetUniform<glm::vec3>("seed", glm::vec3(0));
-    glBindImageTexture(0, weather_texture_.id(), 0, GL_FALSE, 0, GL_WRITE_ONLY,
-                       GL_RGBA8);
-    glDispatchCompute(1024 / 16, 1024 / 16, 1);
-    CHECK_OPENGL_ERROR();
+  std::optional<std::vector<cloud_noise::Volume>> volumes;
+  if (!cache_path.empty()) volumes = Load(cache_path);
+  if (!volumes) {
+    volumes = std::vector<cloud_noise::Volume>{
+        cloud_noise::PerlinWorley(kPerlinWorleySize),
+        cloud_noise::Worley(kWorleySize),
+        cloud_noise::Weather(kWeatherSize, weather_texture_perlin_frequency_)};
+    // without the cache, the volumes are generated again on the next run,
+    // the failure is logged by Save()
+    if (!cache_path.empty()) {
+      std::filesystem::path parent =
+          std::filesystem::path(cache_path).parent_path();
+      std::error_code error;
+      if (!parent.empty()) std::filesystem::create_directories(parent, error);
+      Save(cache_path, *volumes);
+    }
   }
+
+  Upload((*volumes)[0], &perlin_worley_texture_);
+  Upload((*volumes)[1], &worley_texture_);
+  Upload((*volumes)[2], &weather_texture_);
 }
 
-NoiseTextureGenerator::~NoiseTextureGenerator() {}
\ No newline at end of file
+NoiseTextureGenerator::~NoiseTextureGenerator() {}
+
+uint64_t NoiseTextureGenerator::Fingerprint() const {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  FNVHash(&hash, &cloud_noise::VERSION, sizeof(cloud_noise::VERSION));
+  for (const auto &volume : EmptyVolumes()) {
+    FNVHash(&hash, &volume.width, sizeof(volume.width));
+    FNVHash(&hash, &volume.height, sizeof(volume.height));
+    FNVHash(&hash, &volume.depth, sizeof(volume.depth));
+  }
+  FNVHash(&hash, &weather_texture_perlin_frequency_,
+          sizeof(weather_texture_perlin_frequency_));
+  return hash;
+}
+
+bool NoiseTextureGenerator::Save(
+    const std::string &file_path,
+    const std::vector<cloud_noise::Volume> &volumes) const {
+  std::ofstream file(file_path, std::ios::binary);
+  if (!file) {
+    fmt::print(stderr, "[error] failed to save cloud noise: {}\n", file_path);
+    return false;
+  }
+  FileHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.fingerprint = Fingerprint();
+  file.write((const char *)&header, sizeof(header));
+  for (const auto &volume : volumes) {
+    for (const auto &level : volume.levels) {
+      file.write((const char *)level.data(), level.size());
+    }
+  }
+  if (!file) {
+    // a partial file fails the reads of Load()
+    fmt::print(stderr, "[error] failed to write cloud noise: {}\n", file_path);
+    return false;
+  }
+  return true;
+}
+
+std::optional<std::vector<cloud_noise::Volume>> NoiseTextureGenerator::Load(
+    const std::string &file_path) const {
+  std::ifstream file(file_path, std::ios::binary);
+  if (!file) return std::nullopt;
+  FileHeader header;
+  if (!file.read((char *)&header, sizeof(header)) ||
+      memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion || header.fingerprint != Fingerprint()) {
+    return std::nullopt;
+  }
+  // the levels down to 1 texel, as cloud_noise::BuildMips()
+  std::vector<cloud_noise::Volume> volumes = EmptyVolumes();
+  for (auto &volume : volumes) {
+    uint32_t width = volume.width, height = volume.height,
+             depth = volume.depth;
+    while (true) {
+      auto &level =
+          volume.levels.emplace_back(size_t(width) * height * depth * 4);
+      if (!file.read((char *)level.data(), level.size())) {
+        return std::nullopt;
+      }
+      if (width == 1 && height == 1 && depth == 1) break;
+      width = std::max(1u, width / 2);
+      height = std::max(1u, height / 2);
+      depth = std::max(1u, depth / 2);
+    }
+  }
+  return volumes;
+}
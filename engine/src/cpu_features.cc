@@ -0,0 +1,42 @@
+#include "cpu_features.h"
+
+#include "avx2_target.h"
+
+namespace cpu_features {
+
+namespace {
+
+#ifdef ENGINE_AVX2
+bool DetectAVX2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+                      (_xgetbv(0) & 6) == 6;
+  __cpuidex(info, 7, 0);
+  return os_saves_ymm && (info[1] & (1 << 5));
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#else
+bool DetectAVX2() { return false; }
+#endif
+
+bool avx2_enabled = true;
+
+}  // namespace
+
+bool AVX2Supported() {
+  static const bool supported = DetectAVX2();
+  return supported;
+}
+
+void SetAVX2Enabled(bool enabled) { avx2_enabled = enabled; }
+
+bool AVX2Enabled() { return avx2_enabled && AVX2Supported(); }
+
+}  // namespace cpu_features
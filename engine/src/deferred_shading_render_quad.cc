@@ -77,6 +77,14 @@ void DeferredShadingRenderQuad::Allocate(uint32_t width, uint32_t height) {
                         GL_LINEAR, {}, false);
   fbo_.reset(new FrameBufferObject(color_textures, depth_texture));
 
+  // resized in place, so that the pointers handed out stay valid
+  if (hi_z_buffer_ == nullptr) {
+    hi_z_buffer_.reset(new HiZBuffer(width, height));
+  } else {
+    hi_z_buffer_->Resize(width, height);
+  }
+  hi_z_buffer_->set_depth_texture(&fbo_->depth_texture());
+
   // SSAO
   Texture ssao_color_texture(nullptr, width, height, GL_RED, GL_RED, GL_FLOAT,
                              GL_CLAMP_TO_EDGE, GL_NEAREST, GL_NEAREST, {},
@@ -108,6 +116,8 @@ DeferredShadingRenderQuad::DeferredShadingRenderQuad(uint32_t width,
         {"IMAGE_BASED_LIGHT_BINDING", std::any(ImageBasedLight::GLSL_BINDING)},
         {"POISSON_DISK_2D_BINDING",
          std::any(LightSources::POISSON_DISK_2D_BINDING)},
+        {"POISSON_DISK_3D_BINDING",
+         std::any(LightSources::POISSON_DISK_3D_BINDING)},
     };
     kShader = Shader::ScreenSpaceShader(
         "deferred_shading/deferred_shading.frag", defines);
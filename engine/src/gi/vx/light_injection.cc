@@ -19,7 +19,9 @@ LightInjection::LightInjection(float world_size, uint32_t voxel_resolution)
          {"POINT_LIGHT_BINDING", std::any(PointLight::GLSL_BINDING)},
          {"IMAGE_BASED_LIGHT_BINDING", std::any(ImageBasedLight::GLSL_BINDING)},
          {"POISSON_DISK_2D_BINDING",
-          std::any(LightSources::POISSON_DISK_2D_BINDING)}}));
+          std::any(LightSources::POISSON_DISK_2D_BINDING)},
+         {"POISSON_DISK_3D_BINDING",
+          std::any(LightSources::POISSON_DISK_3D_BINDING)}}));
 
     kMipmapShader.reset(
         new Shader({{GL_COMPUTE_SHADER, "vxgi/mipmap.comp"}}, {}));
@@ -45,6 +45,9 @@ Blade::Blade() {
            std::any(ImageBasedLight::GLSL_BINDING)},
           {"POISSON_DISK_2D_BINDING",
            std::any(LightSources::POISSON_DISK_2D_BINDING)},
+          {"POISSON_DISK_3D_BINDING",
+           std::any(LightSources::POISSON_DISK_3D_BINDING)},
+          {"LEAF_BOUNDS_BINDING", std::any(LEAF_BOUNDS_BINDING)},
       }));
 
   auto scene = aiImportFileFromMemory(
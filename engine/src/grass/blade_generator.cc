@@ -0,0 +1,181 @@
+#include "grass/blade_generator.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <glm/gtc/packing.hpp>
+#include <thread>
+
+#include "fnv_hash.h"
+#include "random/philox.h"
+
+namespace {
+
+constexpr char kMagic[4] = {'T', 'G', 'B', 'L'};
+constexpr uint32_t kVersion = 2;
+
+struct FileHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t fingerprint;
+  uint64_t num_blades;
+};
+
+// the counters of the streams, the last word tells them apart
+constexpr uint32_t kBladeStream = 0;
+constexpr uint32_t kShuffleStream = 1;
+
+BladeRecord EncodeBlade(glm::vec3 position, const AABB &leaf_bounds,
+                        uint32_t leaf, glm::vec4 shape, glm::vec2 tex_coord) {
+  BladeRecord record;
+  glm::vec3 extent =
+      glm::max(leaf_bounds.max - leaf_bounds.min, glm::vec3(1e-6f));
+  glm::vec3 t = glm::clamp((position - leaf_bounds.min) / extent, 0.0f, 1.0f);
+  for (int k = 0; k < 3; k++) {
+    record.position[k] = (uint16_t)std::round(t[k] * 65535.0f);
+  }
+  record.leaf = (uint16_t)leaf;
+  for (int k = 0; k < 4; k++) {
+    record.shape[k] =
+        (uint8_t)std::round(std::clamp(shape[k], 0.0f, 1.0f) * 255.0f);
+  }
+  record.tex_coord = glm::packHalf2x16(tex_coord);
+  return record;
+}
+
+}  // namespace
+
+BladeGenerator::BladeGenerator(uint32_t max_lod, uint64_t seed)
+    : max_lod_(max_lod),
+      seed_(seed),
+      key_(uint32_t(seed), uint32_t(seed >> 32)) {}
+
+std::vector<BladeRecord> BladeGenerator::Generate(
+    const Mesh &mesh, const std::vector<Leaf> &leaves) const {
+  if (leaves.size() > 65536) {
+    fmt::print(stderr, "[error] too many BVH leaves for grass: {}\n",
+               leaves.size());
+    exit(1);
+  }
+  size_t num_triangles = 0;
+  for (const auto &leaf : leaves) {
+    num_triangles = std::max<size_t>(
+        num_triangles, leaf.node->offset + leaf.node->num_triangles);
+  }
+  std::vector<BladeRecord> blades(num_triangles * max_lod_);
+
+  uint32_t num_tasks = std::max(1u, std::thread::hardware_concurrency());
+  uint32_t chunk_size =
+      std::max<uint32_t>((leaves.size() + num_tasks - 1) / num_tasks, 1);
+  std::vector<std::future<void>> tasks;
+  for (uint32_t begin = 0; begin < leaves.size(); begin += chunk_size) {
+    uint32_t end = std::min<uint32_t>(begin + chunk_size, leaves.size());
+    tasks.push_back(std::async(std::launch::async, [&, begin, end]() {
+      for (uint32_t i = begin; i < end; i++) {
+        GenerateLeaf(mesh, leaves[i], i,
+                     blades.data() + size_t(leaves[i].node->offset) * max_lod_);
+      }
+    }));
+  }
+  for (auto &task : tasks) task.get();
+  return blades;
+}
+
+void BladeGenerator::GenerateLeaf(const Mesh &mesh, const Leaf &leaf,
+                                  uint32_t leaf_index,
+                                  BladeRecord *blades) const {
+  uint32_t num_triangles = leaf.node->num_triangles;
+  AABB bounds = leaf.node->aabb();
+  for (uint32_t lod = 0; lod < max_lod_; lod++) {
+    for (uint32_t i = 0; i < num_triangles; i++) {
+      uint32_t id = leaf.triangle_indices[i];
+      glm::uvec4 r0 = Philox4x32(glm::uvec4(id, lod, 0, kBladeStream), key_);
+      glm::uvec4 r1 = Philox4x32(glm::uvec4(id, lod, 1, kBladeStream), key_);
+      // width, height, bend and yaw
+      glm::vec4 rands(PhiloxUnitFloat(r0.x), PhiloxUnitFloat(r0.y),
+                      PhiloxUnitFloat(r0.z), PhiloxUnitFloat(r0.w));
+      glm::vec3 coord(PhiloxUnitFloat(r1.x), PhiloxUnitFloat(r1.y),
+                      PhiloxUnitFloat(r1.z));
+      float sum = coord.x + coord.y + coord.z;
+      coord = sum > 0 ? coord / sum : glm::vec3(1.0f / 3);
+
+      glm::uvec3 triangle = mesh.triangles[id];
+      glm::vec3 position = mesh.vertices[triangle.x] * coord.x +
+                           mesh.vertices[triangle.y] * coord.y +
+                           mesh.vertices[triangle.z] * coord.z;
+      glm::vec2 tex_coord = mesh.tex_coords[triangle.x] * coord.x +
+                            mesh.tex_coords[triangle.y] * coord.y +
+                            mesh.tex_coords[triangle.z] * coord.z;
+      blades[lod * num_triangles + i] = EncodeBlade(
+          position, bounds, leaf_index,
+          glm::vec4(rands.w, rands.z, rands.x, rands.y), tex_coord);
+    }
+  }
+
+  // Fisher-Yates, on a stream of the first triangle of the leaf
+  uint32_t num_blades = num_triangles * max_lod_;
+  for (uint32_t i = num_blades - 1; i > 0; i--) {
+    uint32_t word = Philox4x32(
+        glm::uvec4(leaf.triangle_indices[0], i, 0, kShuffleStream), key_)[0];
+    uint32_t j = uint32_t((uint64_t(word) * (i + 1)) >> 32);
+    std::swap(blades[i], blades[j]);
+  }
+}
+
+uint64_t BladeGenerator::Fingerprint(const std::vector<Leaf> &leaves) const {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  FNVHash(&hash, &seed_, sizeof(seed_));
+  FNVHash(&hash, &max_lod_, sizeof(max_lod_));
+  for (const auto &leaf : leaves) {
+    FNVHash(&hash, leaf.node, sizeof(BVHNode));
+    FNVHash(&hash, leaf.triangle_indices,
+            leaf.node->num_triangles * sizeof(uint32_t));
+  }
+  return hash;
+}
+
+bool BladeGenerator::Save(const std::string &file_path,
+                          const std::vector<Leaf> &leaves,
+                          const std::vector<BladeRecord> &blades) const {
+  std::ofstream file(file_path, std::ios::binary);
+  if (!file) {
+    fmt::print(stderr, "[error] failed to save grass blades: {}\n", file_path);
+    return false;
+  }
+  FileHeader header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.fingerprint = Fingerprint(leaves);
+  header.num_blades = blades.size();
+  file.write((const char *)&header, sizeof(header));
+  file.write((const char *)blades.data(), blades.size() * sizeof(BladeRecord));
+  if (!file) {
+    // a partial file fails the size check of Load()
+    fmt::print(stderr, "[error] failed to write grass blades: {}\n", file_path);
+    return false;
+  }
+  return true;
+}
+
+std::optional<std::vector<BladeRecord>> BladeGenerator::Load(
+    const std::string &file_path, const std::vector<Leaf> &leaves) const {
+  std::ifstream file(file_path, std::ios::binary);
+  if (!file) return std::nullopt;
+  FileHeader header;
+  if (!file.read((char *)&header, sizeof(header)) ||
+      memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion ||
+      header.fingerprint != Fingerprint(leaves)) {
+    return std::nullopt;
+  }
+  std::vector<BladeRecord> blades(header.num_blades);
+  if (!file.read((char *)blades.data(),
+                 blades.size() * sizeof(BladeRecord))) {
+    return std::nullopt;
+  }
+  return blades;
+}
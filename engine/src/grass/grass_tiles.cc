@@ -0,0 +1,336 @@
+// clang-format off
+#include <glad/glad.h>
+// clang-format on
+
+#include "grass/grass_tiles.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <iterator>
+#include <optional>
+#include <thread>
+
+// BladeRecord::leaf is 16-bit
+constexpr uint32_t kMaxSlots = 1 << 16;
+
+GrassTiles::GrassTiles(const BladeGenerator::Mesh &mesh,
+                       uint32_t num_triangles, const Options &options)
+    : mesh_(mesh),
+      options_(options),
+      generator_(options.max_lod, options.seed) {
+  // a triangle belongs to the tile of its centroid
+  for (uint32_t i = 0; i < num_triangles; i++) {
+    glm::uvec3 triangle = mesh.triangles[i];
+    glm::vec3 v[3] = {mesh.vertices[triangle.x], mesh.vertices[triangle.y],
+                      mesh.vertices[triangle.z]};
+    glm::vec3 centroid = (v[0] + v[1] + v[2]) / 3.0f;
+    glm::ivec2 coord = glm::ivec2(
+        glm::floor(glm::vec2(centroid.x, centroid.z) / options_.tile_size));
+    auto [it, inserted] = tiles_.try_emplace(Key(coord));
+    Tile &tile = it->second;
+    if (inserted) {
+      tile.coord = coord;
+      tile.bounds = AABB(v[0], v[0]);
+      tile.state = Tile::State::kUnloaded;
+    }
+    tile.triangles.push_back(i);
+    for (auto vertex : v) {
+      tile.bounds.min = glm::min(tile.bounds.min, vertex);
+      tile.bounds.max = glm::max(tile.bounds.max, vertex);
+    }
+  }
+  statistics_.num_tiles = tiles_.size();
+
+  // the pool is the budget, or all the blades when fewer, and a slot of the
+  // bounds is taken by each tile in flight or resident
+  for (const auto &[key, tile] : tiles_) {
+    num_blades_ += tile.num_blades(options_.max_lod);
+  }
+  ResizeBladePool(BudgetCapacity());
+  uint32_t num_slots = std::min<size_t>(tiles_.size(), kMaxSlots);
+  for (uint32_t i = num_slots; i > 0; i--) free_slots_.push_back(i - 1);
+  glCreateBuffers(1, &leaf_bounds_ssbo_);
+  glNamedBufferStorage(leaf_bounds_ssbo_,
+                       std::max(num_slots, 1u) * sizeof(AABB), nullptr,
+                       GL_DYNAMIC_STORAGE_BIT);
+
+  if (!options_.cache_directory.empty()) {
+    std::filesystem::create_directories(options_.cache_directory);
+  }
+}
+
+GrassTiles::~GrassTiles() {
+  for (Tile *tile : in_flight_) tile->task.wait();
+  glDeleteBuffers(1, &blade_pool_);
+  glDeleteBuffers(1, &leaf_bounds_ssbo_);
+}
+
+uint64_t GrassTiles::TileBytes(const Tile &tile) const {
+  return tile.num_blades(options_.max_lod) * sizeof(BladeRecord) +
+         sizeof(AABB);
+}
+
+void GrassTiles::Update(glm::vec3 camera_position, double time) {
+  frame_++;
+  statistics_.num_streamed_in = 0;
+  statistics_.num_evicted = 0;
+  statistics_.num_compactions = 0;
+
+  // the finished tiles, drawn from the next frame on
+  for (uint32_t i = 0; i < in_flight_.size();) {
+    Tile *tile = in_flight_[i];
+    if (tile->task.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      i++;
+      continue;
+    }
+    Upload(tile, tile->task.get(), time);
+    statistics_.in_flight_bytes -= TileBytes(*tile);
+    in_flight_[i] = in_flight_.back();
+    in_flight_.pop_back();
+    statistics_.num_streamed_in++;
+  }
+
+  // the tiles in range, nearest first, only those in range are looked up so
+  // that the terrain may be unbounded
+  glm::vec2 center = glm::vec2(camera_position.x, camera_position.z);
+  float radius = options_.stream_radius;
+  glm::ivec2 min_coord =
+      glm::ivec2(glm::floor((center - radius) / options_.tile_size));
+  glm::ivec2 max_coord =
+      glm::ivec2(glm::floor((center + radius) / options_.tile_size));
+  std::vector<std::pair<float, Tile *>> in_range;
+  for (int32_t x = min_coord.x; x <= max_coord.x; x++) {
+    for (int32_t y = min_coord.y; y <= max_coord.y; y++) {
+      auto it = tiles_.find(Key(glm::ivec2(x, y)));
+      if (it == tiles_.end()) continue;
+      Tile &tile = it->second;
+      glm::vec2 min = glm::vec2(tile.bounds.min.x, tile.bounds.min.z);
+      glm::vec2 max = glm::vec2(tile.bounds.max.x, tile.bounds.max.z);
+      float distance = glm::distance(glm::clamp(center, min, max), center);
+      if (distance > radius) continue;
+      tile.last_used_frame = frame_;
+      in_range.emplace_back(distance, &tile);
+    }
+  }
+  std::sort(in_range.begin(), in_range.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+
+  uint32_t max_in_flight =
+      std::max(1u, std::thread::hardware_concurrency() / 2);
+  for (auto [distance, tile] : in_range) {
+    if (in_flight_.size() >= max_in_flight) break;
+    if (tile->state != Tile::State::kUnloaded) continue;
+    if (free_slots_.empty()) break;
+    // the farther tiles wait for the nearer ones to fit in the budget
+    bool fits = true;
+    while (statistics_.resident_bytes + statistics_.in_flight_bytes +
+               TileBytes(*tile) >
+           options_.memory_budget) {
+      if (!EvictLeastRecentlyUsed()) {
+        fits = false;
+        break;
+      }
+    }
+    if (!fits) break;
+    Request(tile);
+  }
+
+  // the budget may have been lowered
+  while (statistics_.resident_bytes + statistics_.in_flight_bytes >
+             options_.memory_budget &&
+         EvictLeastRecentlyUsed()) {
+  }
+  // and the pool shrinks with it, down to the resident blades
+  uint64_t capacity = std::max(BudgetCapacity(), num_resident_blades_);
+  if (capacity < blade_pool_capacity_) ResizeBladePool(capacity);
+
+  statistics_.num_resident = resident_.size();
+  statistics_.num_in_flight = in_flight_.size();
+}
+
+void GrassTiles::Request(Tile *tile) {
+  tile->state = Tile::State::kInFlight;
+  tile->slot = free_slots_.back();
+  free_slots_.pop_back();
+  statistics_.in_flight_bytes += TileBytes(*tile);
+  in_flight_.push_back(tile);
+
+  std::string cache_path;
+  if (!options_.cache_directory.empty()) {
+    cache_path = (std::filesystem::path(options_.cache_directory) /
+                  fmt::format("{}_{}.blades", tile->coord.x, tile->coord.y))
+                     .string();
+  }
+  // the tile is never modified while in flight
+  tile->task = std::async(std::launch::async, [this, tile, cache_path,
+                                                slot = tile->slot]() {
+    BVHNode node;
+    node.min = tile->bounds.min;
+    node.max = tile->bounds.max;
+    node.offset = 0;
+    node.num_triangles = tile->triangles.size();
+    std::vector<BladeGenerator::Leaf> leaves = {
+        {&node, tile->triangles.data()}};
+    std::optional<std::vector<BladeRecord>> blades;
+    if (!cache_path.empty()) blades = generator_.Load(cache_path, leaves);
+    if (!blades.has_value()) {
+      blades = generator_.Generate(mesh_, leaves);
+      // without the cache write, the tile is generated again next time
+      if (!cache_path.empty()) generator_.Save(cache_path, leaves, *blades);
+    }
+    // the cache is independent of the slot, the records are patched after
+    for (BladeRecord &blade : *blades) blade.leaf = slot;
+    return std::move(*blades);
+  });
+}
+
+void GrassTiles::Upload(Tile *tile, const std::vector<BladeRecord> &blades,
+                        double time) {
+  tile->first_blade = AllocateBlades(blades.size());
+  glNamedBufferSubData(blade_pool_,
+                       uint64_t(tile->first_blade) * sizeof(BladeRecord),
+                       blades.size() * sizeof(BladeRecord), blades.data());
+  glNamedBufferSubData(leaf_bounds_ssbo_, tile->slot * sizeof(AABB),
+                       sizeof(AABB), &tile->bounds);
+  num_resident_blades_ += blades.size();
+  tile->state = Tile::State::kResident;
+  tile->resident_time = time;
+  statistics_.resident_bytes += TileBytes(*tile);
+  resident_.push_back(tile);
+}
+
+void GrassTiles::Evict(Tile *tile) {
+  FreeBlades(tile->first_blade, tile->num_blades(options_.max_lod));
+  num_resident_blades_ -= tile->num_blades(options_.max_lod);
+  free_slots_.push_back(tile->slot);
+  tile->state = Tile::State::kUnloaded;
+  statistics_.resident_bytes -= TileBytes(*tile);
+  statistics_.num_evicted++;
+}
+
+bool GrassTiles::EvictLeastRecentlyUsed() {
+  int32_t lru = -1;
+  for (uint32_t i = 0; i < resident_.size(); i++) {
+    if (resident_[i]->last_used_frame == frame_) continue;
+    if (lru < 0 ||
+        resident_[i]->last_used_frame < resident_[lru]->last_used_frame) {
+      lru = i;
+    }
+  }
+  if (lru < 0) return false;
+  Evict(resident_[lru]);
+  resident_[lru] = resident_.back();
+  resident_.pop_back();
+  return true;
+}
+
+uint64_t GrassTiles::BudgetCapacity() const {
+  return std::min(num_blades_, options_.memory_budget / sizeof(BladeRecord));
+}
+
+uint32_t GrassTiles::AllocateBlades(uint32_t num_blades) {
+  auto first_fit = [&]() {
+    auto it = free_blades_.begin();
+    while (it != free_blades_.end() && it->second < num_blades) it++;
+    return it;
+  };
+  auto it = first_fit();
+  if (it == free_blades_.end()) {
+    // either way, the free blades are a single range at the end
+    uint64_t num_needed = num_resident_blades_ + num_blades;
+    if (num_needed <= blade_pool_capacity_) {
+      CompactBladePool();
+    } else {
+      ResizeBladePool(std::max(num_needed, BudgetCapacity()));
+    }
+    it = first_fit();
+  }
+  auto [first_blade, size] = *it;
+  free_blades_.erase(it);
+  if (size > num_blades) {
+    free_blades_[first_blade + num_blades] = size - num_blades;
+  }
+  return first_blade;
+}
+
+void GrassTiles::FreeBlades(uint32_t first_blade, uint32_t num_blades) {
+  if (num_blades == 0) return;
+  auto next = free_blades_.lower_bound(first_blade);
+  if (next != free_blades_.end() && next->first == first_blade + num_blades) {
+    num_blades += next->second;
+    next = free_blades_.erase(next);
+  }
+  if (next != free_blades_.begin()) {
+    auto previous = std::prev(next);
+    if (previous->first + previous->second == first_blade) {
+      previous->second += num_blades;
+      return;
+    }
+  }
+  free_blades_[first_blade] = num_blades;
+}
+
+void GrassTiles::CompactBladePool() {
+  std::vector<Tile *> tiles = resident_;
+  std::sort(tiles.begin(), tiles.end(), [](const Tile *a, const Tile *b) {
+    return a->first_blade < b->first_blade;
+  });
+  // a range that overlaps its destination goes through a scratch buffer, a
+  // buffer may not be copied onto itself where the ranges overlap
+  uint32_t scratch = 0;
+  uint64_t scratch_size = 0;
+  uint32_t first_blade = 0;
+  for (Tile *tile : tiles) {
+    uint32_t num_blades = tile->num_blades(options_.max_lod);
+    uint64_t size = uint64_t(num_blades) * sizeof(BladeRecord);
+    uint64_t source = uint64_t(tile->first_blade) * sizeof(BladeRecord);
+    uint64_t destination = uint64_t(first_blade) * sizeof(BladeRecord);
+    // the ranges only move down
+    if (destination + size <= source) {
+      glCopyNamedBufferSubData(blade_pool_, blade_pool_, source, destination,
+                               size);
+    } else if (destination != source) {
+      if (size > scratch_size) {
+        glDeleteBuffers(1, &scratch);
+        glCreateBuffers(1, &scratch);
+        glNamedBufferStorage(scratch, size, nullptr, 0);
+        scratch_size = size;
+      }
+      glCopyNamedBufferSubData(blade_pool_, scratch, source, 0, size);
+      glCopyNamedBufferSubData(scratch, blade_pool_, 0, destination, size);
+    }
+    tile->first_blade = first_blade;
+    first_blade += num_blades;
+  }
+  glDeleteBuffers(1, &scratch);
+  free_blades_.clear();
+  FreeBlades(first_blade, blade_pool_capacity_ - first_blade);
+  statistics_.num_compactions++;
+}
+
+void GrassTiles::ResizeBladePool(uint64_t capacity) {
+  uint32_t blade_pool;
+  glCreateBuffers(1, &blade_pool);
+  glNamedBufferStorage(blade_pool,
+                       std::max(capacity, uint64_t(1)) * sizeof(BladeRecord),
+                       nullptr, GL_DYNAMIC_STORAGE_BIT);
+  uint32_t first_blade = 0;
+  for (Tile *tile : resident_) {
+    uint32_t num_blades = tile->num_blades(options_.max_lod);
+    glCopyNamedBufferSubData(blade_pool_, blade_pool,
+                             uint64_t(tile->first_blade) * sizeof(BladeRecord),
+                             uint64_t(first_blade) * sizeof(BladeRecord),
+                             uint64_t(num_blades) * sizeof(BladeRecord));
+    tile->first_blade = first_blade;
+    first_blade += num_blades;
+  }
+  glDeleteBuffers(1, &blade_pool_);
+  blade_pool_ = blade_pool;
+  blade_pool_capacity_ = uint32_t(capacity);
+  free_blades_.clear();
+  FreeBlades(first_blade, blade_pool_capacity_ - first_blade);
+  statistics_.pool_bytes = capacity * sizeof(BladeRecord);
+}
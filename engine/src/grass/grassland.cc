@@ -6,21 +6,27 @@
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 #include <fmt/core.h>
+#include <imgui.h>
 
 #include <algorithm>
 #include <assimp/Importer.hpp>
+#include <chrono>
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
-#include <random>
 
-#include "ogl_buffer.h"
 #include "utils.h"
 #include "vertex.h"
 
 constexpr int32_t kMaxLOD = 8;
+constexpr uint64_t kBladeSeed = 5489;
+// the tiles grow from no blades to their LOD in this long
+constexpr double kFadeInSeconds = 0.5;
+// the vertex buffer binding of the BladeRecords of the tile pool
+constexpr uint32_t kBladeBinding = 3;
 
 Grassland::Grassland(const std::string& terrain_model_path,
-                     const std::string& distortion_texture_path)
+                     const std::string& distortion_texture_path,
+                     const std::string& blade_cache_directory)
     : blade_(std::make_unique<Blade>()) {
   distortion_texture_ =
       Texture(distortion_texture_path, GL_REPEAT, GL_LINEAR_MIPMAP_LINEAR,
@@ -33,177 +39,137 @@ Grassland::Grassland(const std::string& terrain_model_path,
       aiImportFile(terrain_model_path.c_str(),
                    aiProcess_GlobalScale | aiProcess_CalcTangentSpace |
                        aiProcess_Triangulate | aiProcess_GenNormals);
-  if (scene->mNumMeshes != 1) {
-    fmt::print(stderr, "[error] scene->mNumMeshes != 1\n");
+  if (scene->mNumMeshes == 0) {
+    fmt::print(stderr, "[error] scene->mNumMeshes == 0\n");
     exit(1);
   }
-  auto mesh = scene->mMeshes[0];
-
-  std::vector<glm::vec4> vertices;
-  std::vector<glm::vec2> tex_coords;
-  vertices.reserve(mesh->mNumVertices);
-  tex_coords.reserve(mesh->mNumVertices);
-  vertices_for_bvh_.reserve(mesh->mNumVertices);
-  for (int i = 0; i < mesh->mNumVertices; i++) {
-    vertices.emplace_back(mesh->mVertices[i].x, mesh->mVertices[i].y,
-                          mesh->mVertices[i].z, 1);
-    tex_coords.emplace_back(mesh->mTextureCoords[0][i].x,
-                            mesh->mTextureCoords[0][i].y);
-    vertices_for_bvh_.push_back({vertices.back()});
-  }
-  std::vector<uint32_t> indices;
-  indices.reserve(mesh->mNumFaces * 3);
-  triangles_for_bvh_.reserve(mesh->mNumFaces);
-  for (int i = 0; i < mesh->mNumFaces; i++) {
-    auto face = mesh->mFaces[i];
-    for (int j = 0; j < face.mNumIndices; j++)
-      indices.push_back(face.mIndices[j]);
-    triangles_for_bvh_.emplace_back(face.mIndices[0], face.mIndices[1],
-                                    face.mIndices[2]);
+  // a large terrain is often exported in chunks
+  for (int m = 0; m < scene->mNumMeshes; m++) {
+    auto mesh = scene->mMeshes[m];
+    uint32_t base_vertex = vertices_.size();
+    for (int i = 0; i < mesh->mNumVertices; i++) {
+      vertices_.emplace_back(mesh->mVertices[i].x, mesh->mVertices[i].y,
+                             mesh->mVertices[i].z);
+      tex_coords_.emplace_back(mesh->mTextureCoords[0][i].x,
+                               mesh->mTextureCoords[0][i].y);
+      vertices_for_bvh_.push_back({vertices_.back()});
+    }
+    for (int i = 0; i < mesh->mNumFaces; i++) {
+      auto face = mesh->mFaces[i];
+      triangles_for_bvh_.emplace_back(base_vertex + face.mIndices[0],
+                                      base_vertex + face.mIndices[1],
+                                      base_vertex + face.mIndices[2]);
+    }
   }
   uint32_t num_triangles = triangles_for_bvh_.size();
-  std::vector<float> rands(num_triangles * kMaxLOD * 7);
-  std::mt19937 rd;
-  for (int i = 0; i < rands.size(); i++) {
-    rands[i] = std::uniform_real_distribution<float>(0, 1)(rd);
-  }
 
-  // launch compute shader to calculate blade transforms once and for all
-
-  auto calc_blade_transforms_shader = std::unique_ptr<Shader>(
-      new Shader({{GL_COMPUTE_SHADER, "grass/grass.comp"}}, {}));
-  OGLBuffer vertices_ssbo(GL_SHADER_STORAGE_BUFFER,
-                          vertices.size() * sizeof(glm::vec4),
-                          glm::value_ptr(vertices[0]), GL_STATIC_DRAW, 0);
-  OGLBuffer indices_ssbo(GL_SHADER_STORAGE_BUFFER,
-                         indices.size() * sizeof(uint32_t), &indices[0],
-                         GL_STATIC_DRAW, 1);
-  OGLBuffer tex_coords_ssbo(GL_SHADER_STORAGE_BUFFER,
-                            tex_coords.size() * sizeof(glm::vec2),
-                            glm::value_ptr(tex_coords[0]), GL_STATIC_DRAW, 2);
-  OGLBuffer rands_ssbo(GL_SHADER_STORAGE_BUFFER, rands.size() * sizeof(float),
-                       rands.data(), GL_STATIC_READ, 3);
-
-  OGLBuffer blade_transforms_ssbo(GL_SHADER_STORAGE_BUFFER,
-                                  num_triangles * kMaxLOD * sizeof(glm::mat4),
-                                  nullptr, GL_STATIC_READ, 4);
-  OGLBuffer blade_positions_ssbo(GL_SHADER_STORAGE_BUFFER,
-                                 num_triangles * kMaxLOD * sizeof(glm::vec4),
-                                 nullptr, GL_STATIC_READ, 5);
-  OGLBuffer blade_tex_coords_ssbo(GL_SHADER_STORAGE_BUFFER,
-                                  num_triangles * kMaxLOD * sizeof(glm::vec2),
-                                  nullptr, GL_STATIC_READ, 6);
-
-  calc_blade_transforms_shader->Use();
-  calc_blade_transforms_shader->SetUniform<uint32_t>("uNumTriangles",
-                                                     num_triangles);
-  glDispatchCompute((num_triangles + 63) / 64, 1, 1);
-  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT |
-                  GL_ATOMIC_COUNTER_BARRIER_BIT);
-
-  // copy data from GPU memory to CPU memory
+  // release scene
+
+  aiReleaseImport(scene);
+
+  // for the ray queries
 
+  auto bvh_start = std::chrono::steady_clock::now();
   bvh_.reset(new BVH<VertexType>(vertices_for_bvh_.data(),
-                                 triangles_for_bvh_.data(), num_triangles));
-  {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, blade_transforms_ssbo.id());
-    glm::mat4* buffer =
-        (glm::mat4*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-    bvh_->Traverse([&](BVHNode* node) {
-      blade_data_[node].resize(kMaxLOD * node->num_triangles);
-      for (int lod = 0; lod < kMaxLOD; lod++) {
-        for (int i = 0; i < node->num_triangles; i++) {
-          blade_data_[node][lod * node->num_triangles + i].transform =
-              buffer[node->triangle_indices[i] * kMaxLOD + lod];
-        }
-      }
-    });
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-  }
-  {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, blade_positions_ssbo.id());
-    glm::vec4* buffer =
-        (glm::vec4*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-    bvh_->Traverse([&](BVHNode* node) {
-      for (int lod = 0; lod < kMaxLOD; lod++) {
-        for (int i = 0; i < node->num_triangles; i++) {
-          blade_data_[node][lod * node->num_triangles + i].position =
-              buffer[node->triangle_indices[i] * kMaxLOD + lod];
-        }
-      }
-    });
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-  }
-  {
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, blade_tex_coords_ssbo.id());
-    glm::vec2* buffer =
-        (glm::vec2*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-    bvh_->Traverse([&](BVHNode* node) {
-      for (int lod = 0; lod < kMaxLOD; lod++) {
-        for (int i = 0; i < node->num_triangles; i++) {
-          blade_data_[node][lod * node->num_triangles + i].tex_coord =
-              buffer[node->triangle_indices[i] * kMaxLOD + lod];
-        }
-      }
-      std::shuffle(blade_data_[node].begin(), blade_data_[node].end(), rd);
-    });
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-  }
+                                 triangles_for_bvh_.data(), num_triangles,
+                                 BVHBuildOptions()));
+  std::chrono::duration<double, std::milli> bvh_duration =
+      std::chrono::steady_clock::now() - bvh_start;
+  fmt::print(stderr,
+             "[info] BVH of {} triangles built in {:.1f} ms, {} nodes, SAH "
+             "cost: {:.1f}\n",
+             num_triangles, bvh_duration.count(), bvh_->nodes().size(),
+             bvh_->SAHCost());
+
+  // the blades are streamed in by tiles
+
+  GrassTiles::Options options;
+  options.max_lod = kMaxLOD;
+  options.seed = kBladeSeed;
+  options.cache_directory = blade_cache_directory;
+  tiles_.reset(new GrassTiles(
+      {vertices_.data(), tex_coords_.data(), triangles_for_bvh_.data()},
+      num_triangles, options));
+  fmt::print(stderr, "[info] {} grass tiles of {} m\n",
+             tiles_->statistics().num_tiles, options.tile_size);
+
+  // the records of all the tiles are in one pool, bound once per frame
+  glBindVertexArray(blade_->vao());
+  glEnableVertexAttribArray(3);
+  glVertexAttribIFormat(3, 4, GL_UNSIGNED_SHORT,
+                        offsetof(BladeRecord, position));
+  glVertexAttribBinding(3, kBladeBinding);
+  glEnableVertexAttribArray(4);
+  glVertexAttribFormat(4, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                       offsetof(BladeRecord, shape));
+  glVertexAttribBinding(4, kBladeBinding);
+  glEnableVertexAttribArray(5);
+  glVertexAttribIFormat(5, 1, GL_UNSIGNED_INT,
+                        offsetof(BladeRecord, tex_coord));
+  glVertexAttribBinding(5, kBladeBinding);
+  glVertexBindingDivisor(kBladeBinding, 1);
+  glBindVertexArray(0);
 
-  // release scene
+  glCreateBuffers(1, &draw_commands_buffer_);
+}
 
-  aiReleaseImport(scene);
+Grassland::~Grassland() { glDeleteBuffers(1, &draw_commands_buffer_); }
+
+RayHit Grassland::Intersect(const Ray& ray) const {
+  return bvh_->Intersect(vertices_for_bvh_.data(), triangles_for_bvh_.data(),
+                         ray);
+}
 
-  // create vbo
+bool Grassland::Occluded(const Ray& ray) const {
+  return bvh_->Occluded(vertices_for_bvh_.data(), triangles_for_bvh_.data(),
+                        ray);
+}
 
-  blade_data_for_gpu_.resize(num_triangles * kMaxLOD);
-  glGenBuffers(1, &vbo_);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-  glBufferData(GL_ARRAY_BUFFER,
-               blade_data_for_gpu_.size() * sizeof(blade_data_for_gpu_[0]),
-               nullptr, GL_STREAM_DRAW);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+void Grassland::Intersect(const Ray* rays, uint32_t num_rays,
+                          RayHit* hits) const {
+  bvh_->Intersect(vertices_for_bvh_.data(), triangles_for_bvh_.data(), rays,
+                  num_rays, hits);
 }
 
-Grassland::~Grassland() { glDeleteBuffers(1, &vbo_); }
+AABB Grassland::terrain_aabb() const {
+  return bvh_->nodes().empty() ? AABB(glm::vec3(0), glm::vec3(0))
+                               : bvh_->nodes()[0].aabb();
+}
 
 void Grassland::Draw(Camera* camera, LightSources* light_sources, double time) {
-  // copy blade_transforms to vbo
-  uint32_t num_blades = 0;
-  bvh_->Search(camera->frustum(), [&](BVHNode* node) {
-    float distance = glm::distance(node->aabb.center(), camera->position());
+  tiles_->Update(camera->position(), time);
+
+  // a prefix of the blades of each visible tile, growing while it fades in,
+  // base_instance offsets the per-instance attributes into the pool
+  Frustum frustum = camera->frustum();
+  commands_.clear();
+  tiles_->ForEachResident([&](const GrassTiles::Tile& tile) {
+    if (!tile.bounds.IsOnFrustum(frustum)) return;
+    float distance = glm::distance(tile.bounds.center(), camera->position());
     float lod = std::max(1.0f, -distance * 4e-2f + 4.0f);
-    std::copy(
-        this->blade_data_[node].data(),
-        this->blade_data_[node].data() + (uint32_t)(node->num_triangles * lod),
-        this->blade_data_for_gpu_.data() + num_blades);
-    num_blades += (uint32_t)(node->num_triangles * lod);
+    float fade = std::clamp(
+        float((time - tile.resident_time) / kFadeInSeconds), 0.0f, 1.0f);
+    DrawElementsIndirectCommand command;
+    command.count = blade_->indices_size();
+    command.instance_count = (uint32_t)(tile.triangles.size() * lod * fade);
+    command.first_index = 0;
+    command.base_vertex = 0;
+    command.base_instance = tile.first_blade;
+    if (command.instance_count > 0) commands_.push_back(command);
   });
+  if (commands_.empty()) return;
 
-  // draw blades with calculated transforms
   blade_->shader()->Use();
   light_sources->Set(blade_->shader());
-  // bind vbo to glsl
   glBindVertexArray(blade_->vao());
-  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
-  glBufferSubData(GL_ARRAY_BUFFER, 0, num_blades * sizeof(InstancingData),
-                  &blade_data_for_gpu_[0]);
-  for (int i = 0; i < 4; i++) {
-    uint32_t location = 3 + i;
-    glEnableVertexAttribArray(location);
-    glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE,
-                          sizeof(InstancingData),
-                          (void*)(i * sizeof(glm::vec4)));
-    glVertexAttribDivisor(location, 1);
-  }
-  glEnableVertexAttribArray(7);
-  glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, sizeof(InstancingData),
-                        (void*)offsetof(InstancingData, position));
-  glVertexAttribDivisor(7, 1);
-  glEnableVertexAttribArray(8);
-  glVertexAttribPointer(8, 2, GL_FLOAT, GL_FALSE, sizeof(InstancingData),
-                        (void*)offsetof(InstancingData, tex_coord));
-  glVertexAttribDivisor(8, 1);
+  glBindVertexBuffer(kBladeBinding, tiles_->blade_pool(), 0,
+                     sizeof(BladeRecord));
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Blade::LEAF_BOUNDS_BINDING,
+                   tiles_->leaf_bounds_ssbo());
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, draw_commands_buffer_);
+  glNamedBufferData(draw_commands_buffer_,
+                    commands_.size() * sizeof(DrawElementsIndirectCommand),
+                    commands_.data(), GL_STREAM_DRAW);
 
   // set uniforms
   blade_->shader()->SetUniform<glm::mat4>("uViewMatrix", camera->view_matrix());
@@ -216,9 +182,33 @@ void Grassland::Draw(Camera* camera, LightSources* light_sources, double time) {
   blade_->shader()->SetUniformSampler("uDistortionTexture", distortion_texture_,
                                       0);
 
-  // draw blades
-  glDrawElementsInstanced(GL_TRIANGLES, blade_->indices_size(), GL_UNSIGNED_INT,
-                          0, num_blades);
+  // draw blades, every visible tile at once
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                              commands_.size(), 0);
   glBindVertexArray(0);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-}
\ No newline at end of file
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void Grassland::ImGuiWindow() {
+  const auto& statistics = tiles_->statistics();
+  ImGui::Begin("Grassland:");
+  ImGui::Text("Tiles: %u, resident: %u, in flight: %u", statistics.num_tiles,
+              statistics.num_resident, statistics.num_in_flight);
+  ImGui::Text("Resident: %.1f MiB, in flight: %.1f MiB",
+              statistics.resident_bytes / 1048576.0,
+              statistics.in_flight_bytes / 1048576.0);
+  ImGui::Text("Streamed in: %u, evicted: %u, compactions: %u",
+              statistics.num_streamed_in, statistics.num_evicted,
+              statistics.num_compactions);
+  ImGui::Text("Blade pool: %.1f MiB, draws: %u",
+              statistics.pool_bytes / 1048576.0, (uint32_t)commands_.size());
+  float stream_radius = tiles_->options().stream_radius;
+  if (ImGui::SliderFloat("Stream radius", &stream_radius, 32, 1000)) {
+    tiles_->set_stream_radius(stream_radius);
+  }
+  int budget = tiles_->options().memory_budget >> 20;
+  if (ImGui::SliderInt("Budget (MiB)", &budget, 16, 2048)) {
+    tiles_->set_memory_budget(uint64_t(budget) << 20);
+  }
+  ImGui::End();
+}
@@ -0,0 +1,155 @@
+#include "hi_z_buffer.h"
+
+#include <fmt/core.h>
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <limits>
+
+std::unique_ptr<Shader> HiZBuffer::kShader = nullptr;
+
+HiZBuffer::HiZBuffer(uint32_t width, uint32_t height) {
+  if (kShader == nullptr) {
+    kShader.reset(new Shader({{GL_COMPUTE_SHADER, "hi_z/build.comp"}}, {}));
+  }
+  Resize(width, height);
+}
+
+uint32_t HiZBuffer::NumLevels(uint32_t width, uint32_t height) {
+  uint32_t num_levels = 1;
+  while ((std::max(width, height) >> num_levels) > 0) num_levels++;
+  return num_levels;
+}
+
+void HiZBuffer::Allocate(uint32_t width, uint32_t height) {
+  texture_ = Texture(nullptr, width, height, GL_R32F, GL_RED, GL_FLOAT,
+                     GL_CLAMP_TO_EDGE, GL_NEAREST_MIPMAP_NEAREST, GL_NEAREST,
+                     {}, true);
+}
+
+void HiZBuffer::Resize(uint32_t width, uint32_t height) {
+  width_ = width;
+  height_ = height;
+  num_levels_ = NumLevels(width, height);
+  depth_texture_ = nullptr;
+  Allocate(width, height);
+}
+
+void HiZBuffer::Build() {
+  if (depth_texture_ == nullptr) {
+    fmt::print(stderr, "[error] no depth texture to build Hi-Z buffer from\n");
+    exit(1);
+  }
+
+  kShader->Use();
+  glm::ivec2 last_size(width_, height_);
+  for (int level = 0; level < num_levels_; level++) {
+    glm::ivec2 size = glm::max(glm::ivec2(width_, height_) >> level, 1);
+
+    glBindImageTexture(0, texture_.id(), level, GL_FALSE, 0, GL_WRITE_ONLY,
+                       GL_R32F);
+    kShader->SetUniform<int32_t>("uHiZ", 0);
+    // level 0 is copied from the depth texture
+    glBindImageTexture(1, texture_.id(), std::max(level - 1, 0), GL_FALSE, 0,
+                       GL_READ_ONLY, GL_R32F);
+    kShader->SetUniform<int32_t>("uLastHiZ", 1);
+    kShader->SetUniformSampler("uDepth", *depth_texture_, 0);
+    kShader->SetUniform<int32_t>("uFromDepth", level == 0);
+    kShader->SetUniform<glm::ivec2>("uSize", size);
+    kShader->SetUniform<glm::ivec2>("uLastSize", last_size);
+    glDispatchCompute((size.x + 7) / 8, (size.y + 7) / 8, 1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT |
+                    GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    last_size = size;
+  }
+}
+
+void HiZBuffer::Set(Shader *shader) const {
+  shader->SetUniformSampler("uHiZ", texture_, 0);
+  shader->SetUniform<glm::ivec2>("uHiZSize", glm::ivec2(width_, height_));
+  shader->SetUniform<int32_t>("uHiZNumLevels", num_levels_);
+}
+
+std::vector<std::vector<float>> HiZBuffer::BuildPyramid(
+    const std::vector<float> &depth, uint32_t width, uint32_t height) {
+  std::vector<std::vector<float>> pyramid;
+  pyramid.push_back(depth);
+
+  uint32_t last_width = width, last_height = height;
+  for (int level = 1; level < NumLevels(width, height); level++) {
+    uint32_t level_width = std::max(width >> level, 1u);
+    uint32_t level_height = std::max(height >> level, 1u);
+    const auto &last = pyramid.back();
+    std::vector<float> current(level_width * level_height);
+    for (uint32_t y = 0; y < level_height; y++) {
+      for (uint32_t x = 0; x < level_width; x++) {
+        // fold the last row / column of an odd sized level
+        uint32_t last_x_max =
+            x == level_width - 1 ? last_width - 1 : 2 * x + 1;
+        uint32_t last_y_max =
+            y == level_height - 1 ? last_height - 1 : 2 * y + 1;
+        float max_depth = 0;
+        for (uint32_t last_y = 2 * y; last_y <= last_y_max; last_y++) {
+          for (uint32_t last_x = 2 * x; last_x <= last_x_max; last_x++) {
+            max_depth =
+                std::max(max_depth, last[last_y * last_width + last_x]);
+          }
+        }
+        current[y * level_width + x] = max_depth;
+      }
+    }
+    pyramid.push_back(std::move(current));
+    last_width = level_width;
+    last_height = level_height;
+  }
+
+  return pyramid;
+}
+
+bool HiZBuffer::AABBIsVisible(const AABB &aabb,
+                              const glm::mat4 &view_projection,
+                              const std::vector<std::vector<float>> &pyramid,
+                              uint32_t width, uint32_t height) {
+  glm::vec3 ndc_min(std::numeric_limits<float>::max());
+  glm::vec3 ndc_max(std::numeric_limits<float>::lowest());
+  for (auto corner : aabb.corners()) {
+    glm::vec4 clip = view_projection * glm::vec4(corner, 1);
+    // the AABB crosses the near plane
+    if (clip.w <= 0) return true;
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    ndc_min = glm::min(ndc_min, ndc);
+    ndc_max = glm::max(ndc_max, ndc);
+  }
+
+  glm::ivec2 size(width, height);
+  glm::vec2 uv_min = glm::clamp(glm::vec2(ndc_min) * 0.5f + 0.5f, 0.0f, 1.0f);
+  glm::vec2 uv_max = glm::clamp(glm::vec2(ndc_max) * 0.5f + 0.5f, 0.0f, 1.0f);
+  float depth_min = ndc_min.z * 0.5f + 0.5f;
+  glm::ivec2 pixel_min =
+      glm::min(glm::ivec2(uv_min * glm::vec2(size)), size - 1);
+  glm::ivec2 pixel_max =
+      glm::min(glm::ivec2(uv_max * glm::vec2(size)), size - 1);
+
+  // the coarsest level at which the AABB covers at most 2x2 texels
+  int32_t num_levels = pyramid.size();
+  int32_t level = 0;
+  while (level < num_levels - 1 &&
+         ((pixel_max.x >> level) - (pixel_min.x >> level) > 1 ||
+          (pixel_max.y >> level) - (pixel_min.y >> level) > 1)) {
+    level++;
+  }
+
+  glm::ivec2 level_size = glm::max(size >> level, 1);
+  auto fetch = [&](int32_t x, int32_t y) {
+    x = std::min(x >> level, level_size.x - 1);
+    y = std::min(y >> level, level_size.y - 1);
+    return pyramid[level][y * level_size.x + x];
+  };
+  float max_depth =
+      std::max(std::max(fetch(pixel_min.x, pixel_min.y),
+                        fetch(pixel_max.x, pixel_min.y)),
+               std::max(fetch(pixel_min.x, pixel_max.y),
+                        fetch(pixel_max.x, pixel_max.y)));
+  return depth_min <= max_depth;
+}
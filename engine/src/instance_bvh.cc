@@ -0,0 +1,235 @@
+#include "instance_bvh.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+bool Overlaps(const AABB &a, const AABB &b) {
+  return a.min.x <= b.max.x && a.min.y <= b.max.y && a.min.z <= b.max.z &&
+         b.min.x <= a.max.x && b.min.y <= a.max.y && b.min.z <= a.max.z;
+}
+
+bool Overlaps(const AABB &aabb, glm::vec3 center, float radius) {
+  glm::vec3 d = center - glm::clamp(center, aabb.min, aabb.max);
+  return glm::dot(d, d) <= radius * radius;
+}
+
+// slab test in [ray.t_min, t_max]
+bool Intersects(const Ray &ray, const AABB &aabb, float t_max) {
+  float t_entry = ray.t_min, t_exit = t_max;
+  for (int k = 0; k < 3; k++) {
+    float inv_direction = 1.0f / ray.direction[k];
+    float t0 = (aabb.min[k] - ray.origin[k]) * inv_direction;
+    float t1 = (aabb.max[k] - ray.origin[k]) * inv_direction;
+    // NaN from 0 * inf, i.e. the origin on a slab parallel to the ray,
+    // leaves the interval unchanged
+    t_entry = std::max(t_entry, std::min(t0, t1));
+    t_exit = std::min(t_exit, std::max(t0, t1));
+  }
+  return t_entry <= t_exit;
+}
+
+}  // namespace
+
+InstanceBVH::InstanceBVH(const std::vector<Geometry> &geometries,
+                         const Arrays &arrays)
+    : arrays_(arrays), geometries_(geometries) {
+  const auto &aabbs = *arrays_.aabbs;
+  const auto &instance_to_mesh = *arrays_.instance_to_mesh;
+  bounded_indices_.resize(instance_to_mesh.size(), Hit::kNoInstance);
+  mesh_aabbs_.Resize(instance_to_mesh.size());
+  for (uint32_t i = 0; i < instance_to_mesh.size(); i++) {
+    const AABB &aabb = aabbs[instance_to_mesh[i]];
+    if (aabb.min.x > aabb.max.x) {
+      unbounded_instances_.push_back(i);
+      // transformed along with the others but never read
+      mesh_aabbs_.Set(i, AABB(glm::vec3(0), glm::vec3(0)));
+    } else {
+      bounded_indices_[i] = bounded_instances_.size();
+      bounded_instances_.push_back(i);
+      mesh_aabbs_.Set(i, aabb);
+    }
+  }
+  instance_aabbs_.resize(bounded_instances_.size());
+  is_moved_.resize(bounded_instances_.size(), 0);
+  triangles_.resize(geometries_.size());
+  bottom_levels_.resize(geometries_.size());
+}
+
+void InstanceBVH::MarkMoved(uint32_t instance) {
+  uint32_t i = bounded_indices_[instance];
+  if (i == Hit::kNoInstance || is_moved_[i]) return;
+  is_moved_[i] = 1;
+  moved_.push_back(i);
+}
+
+void InstanceBVH::Update() {
+  auto start = std::chrono::steady_clock::now();
+
+  const auto &model_matrices = *arrays_.model_matrices;
+
+  uint32_t num_instances = bounded_instances_.size();
+  bool build = top_level_ == nullptr;
+  bool partial =
+      !build && moved_.size() <= num_instances * kMaxPartialRefitRatio;
+  if (partial) {
+    // the moved instances are gathered so that they are transformed by the
+    // same kernel as all of them
+    moved_mesh_aabbs_.Resize(moved_.size());
+    moved_model_matrices_.resize(moved_.size());
+    for (uint32_t j = 0; j < moved_.size(); j++) {
+      uint32_t instance = bounded_instances_[moved_[j]];
+      moved_mesh_aabbs_.Set(j, mesh_aabbs_.Get(instance));
+      moved_model_matrices_[j] = model_matrices[instance];
+    }
+    batch_culling::Transform(moved_model_matrices_.data(), moved_mesh_aabbs_,
+                             &transformed_aabbs_);
+    for (uint32_t j = 0; j < moved_.size(); j++) {
+      instance_aabbs_[moved_[j]] = transformed_aabbs_.Get(j);
+    }
+  } else {
+    batch_culling::Transform(model_matrices.data(), mesh_aabbs_,
+                             &transformed_aabbs_);
+    for (uint32_t i = 0; i < num_instances; i++) {
+      instance_aabbs_[i] = transformed_aabbs_.Get(bounded_instances_[i]);
+    }
+  }
+
+  num_rebuilt_subtrees_ = 0;
+  if (build) {
+    // the leaves are tested box by box anyway, larger ones halve the nodes
+    // to refit
+    BVHBuildOptions options;
+    options.min_triangles_in_leaf = 4;
+    options.max_triangles_in_leaf = 8;
+    top_level_.reset(
+        new BoxBVH(instance_aabbs_.data(), num_instances, options));
+  } else if (!moved_.empty()) {
+    if (partial) {
+      top_level_->Refit(instance_aabbs_.data(), moved_.data(), moved_.size());
+    } else {
+      top_level_->Refit(instance_aabbs_.data());
+    }
+    // the check visits the nodes refitted since the last one
+    if (++num_updates_ % kRebuildCheckInterval == 0) {
+      num_rebuilt_subtrees_ =
+          top_level_->RebuildDegradedSubtrees(instance_aabbs_.data());
+    }
+  }
+  for (uint32_t i : moved_) is_moved_[i] = 0;
+  moved_.clear();
+
+  std::chrono::duration<double, std::milli> duration =
+      std::chrono::steady_clock::now() - start;
+  update_milliseconds_ = duration.count();
+  if (build) {
+    fmt::print(stderr,
+               "[info] instance BVH of {} instances built in {:.2f} ms, {} "
+               "unbounded instances\n",
+               num_instances, update_milliseconds_,
+               unbounded_instances_.size());
+  }
+}
+
+std::vector<uint32_t> InstanceBVH::Search(const Frustum &frustum) const {
+  std::vector<uint32_t> instances = unbounded_instances_;
+  top_level_->Search(frustum, [&](const BVHNode *leaf) {
+    for (uint32_t i = 0; i < leaf->num_triangles; i++) {
+      uint32_t id = top_level_->triangle_indices(leaf)[i];
+      if (instance_aabbs_[id].IsOnFrustum(frustum)) {
+        instances.push_back(bounded_instances_[id]);
+      }
+    }
+  });
+  return instances;
+}
+
+std::vector<uint32_t> InstanceBVH::Search(const AABB &box) const {
+  std::vector<uint32_t> instances = unbounded_instances_;
+  top_level_->Search(box, [&](const BVHNode *leaf) {
+    for (uint32_t i = 0; i < leaf->num_triangles; i++) {
+      uint32_t id = top_level_->triangle_indices(leaf)[i];
+      if (Overlaps(instance_aabbs_[id], box)) {
+        instances.push_back(bounded_instances_[id]);
+      }
+    }
+  });
+  return instances;
+}
+
+std::vector<uint32_t> InstanceBVH::Search(glm::vec3 center,
+                                          float radius) const {
+  std::vector<uint32_t> instances = unbounded_instances_;
+  top_level_->Search(center, radius, [&](const BVHNode *leaf) {
+    for (uint32_t i = 0; i < leaf->num_triangles; i++) {
+      uint32_t id = top_level_->triangle_indices(leaf)[i];
+      if (Overlaps(instance_aabbs_[id], center, radius)) {
+        instances.push_back(bounded_instances_[id]);
+      }
+    }
+  });
+  return instances;
+}
+
+InstanceBVH::Hit InstanceBVH::Intersect(const Ray &ray) {
+  return IntersectImpl(ray, false);
+}
+
+bool InstanceBVH::Occluded(const Ray &ray) {
+  return IntersectImpl(ray, true).hit();
+}
+
+const BVH<VertexWithBones> *InstanceBVH::BottomLevel(uint32_t geometry) {
+  if (bottom_levels_[geometry] == nullptr) {
+    const Geometry &g = geometries_[geometry];
+    auto &triangles = triangles_[geometry];
+    triangles.resize(g.num_triangles);
+    for (uint32_t i = 0; i < g.num_triangles; i++) {
+      triangles[i] = glm::uvec3(g.indices[i * 3], g.indices[i * 3 + 1],
+                                g.indices[i * 3 + 2]);
+    }
+    bottom_levels_[geometry].reset(new BVH<VertexWithBones>(
+        g.vertices, triangles.data(), g.num_triangles));
+  }
+  return bottom_levels_[geometry].get();
+}
+
+InstanceBVH::Hit InstanceBVH::IntersectImpl(const Ray &ray, bool any_hit) {
+  const auto &mesh_to_geometry = *arrays_.mesh_to_geometry;
+  const auto &instance_to_mesh = *arrays_.instance_to_mesh;
+  const auto &model_matrices = *arrays_.model_matrices;
+  const auto &transforms = *arrays_.transforms;
+
+  Hit hit;
+  top_level_->Traverse(ray, [&](const BVHNode *leaf, float *t_max) {
+    for (uint32_t i = 0; i < leaf->num_triangles; i++) {
+      uint32_t id = top_level_->triangle_indices(leaf)[i];
+      if (!Intersects(ray, instance_aabbs_[id], *t_max)) continue;
+
+      // the ray in the space of the geometry keeps its parameterization
+      // since the direction is not normalized
+      uint32_t instance = bounded_instances_[id];
+      uint32_t geometry = mesh_to_geometry[instance_to_mesh[instance]];
+      glm::mat4 to_geometry =
+          glm::inverse(model_matrices[instance] * transforms[instance]);
+      Ray geometry_ray(glm::vec3(to_geometry * glm::vec4(ray.origin, 1)),
+                       glm::vec3(to_geometry * glm::vec4(ray.direction, 0)),
+                       ray.t_min, *t_max);
+      RayHit ray_hit = BottomLevel(geometry)->Intersect(
+          geometries_[geometry].vertices, triangles_[geometry].data(),
+          geometry_ray);
+      if (!ray_hit.hit()) continue;
+
+      hit.instance = instance;
+      hit.ray_hit = ray_hit;
+      *t_max = ray_hit.t;
+      if (any_hit) return true;
+    }
+    return false;
+  });
+  return hit;
+}
@@ -3,6 +3,9 @@
 #include <fmt/core.h>
 #include <imgui.h>
 
+#include <algorithm>
+#include <cmath>
+
 #include "cg_exception.h"
 #include "equirectangular_map.h"
 #include "random/poisson_disk_generator.h"
@@ -57,7 +60,7 @@ void DirectionalLight::ImGuiWindow(
   if (shadow_ == nullptr) {
     if (ImGui::Button(fmt::format("Add Shadow{}", suffix).c_str())) {
       shadow_ = std::unique_ptr<DirectionalShadow>(
-          new DirectionalShadow(dir_, 2048, 2048, std::nullopt, camera_));
+          new DirectionalShadow(dir_, cascade_pool_, std::nullopt, camera_));
     }
   } else {
     if (ImGui::Button(fmt::format("Erase Shadow{}", suffix).c_str())) {
@@ -67,6 +70,9 @@ void DirectionalLight::ImGuiWindow(
 
   if (shadow_ != nullptr) {
     shadow_->set_direction(dir_);
+    if (!shadow_->allocated()) {
+      ImGui::Text("Shadow: no free cascade layers");
+    }
   }
 }
 
@@ -75,8 +81,8 @@ DirectionalLight::directional_light_glsl() const {
   DirectionalLightGLSL ret;
   ret.dir = dir_;
   ret.color = color_;
-  ret.shadow_enabled = shadow_ != nullptr;
-  if (shadow_ != nullptr) {
+  ret.shadow_enabled = shadow_ != nullptr && shadow_->allocated();
+  if (ret.shadow_enabled) {
     ret.shadow = shadow_->directional_shadow_glsl();
   }
   return ret;
@@ -109,7 +115,8 @@ void PointLight::ImGuiWindow(uint32_t index,
   if (shadow_ == nullptr) {
     if (ImGui::Button(fmt::format("Add Shadow{}", suffix).c_str())) {
       shadow_ = std::unique_ptr<OmnidirectionalShadow>(
-          new OmnidirectionalShadow(pos_, 1, 2048, 2048));
+          new OmnidirectionalShadow(pos_, 1, shadow_atlas_,
+                                    INITIAL_SHADOW_TILE_SIZE));
     }
   } else {
     if (ImGui::Button(fmt::format("Erase Shadow{}", suffix).c_str())) {
@@ -124,16 +131,32 @@ void PointLight::ImGuiWindow(uint32_t index,
     ImGui::SliderFloat(fmt::format("Shadow Radius{}", suffix).c_str(), &radius,
                        0, 10);
     shadow_->set_radius(radius);
+
+    float importance = shadow_->importance();
+    ImGui::SliderFloat(fmt::format("Shadow Importance{}", suffix).c_str(),
+                       &importance, 0, 4);
+    shadow_->set_importance(importance);
+    ImGui::Text("Shadow tile size: %u", shadow_->tile_size());
   }
 }
 
+float PointLight::range() const {
+  // c + l * d + q * d^2 = 256 * max(color)
+  float c = attenuation_.x, l = attenuation_.y, q = attenuation_.z;
+  float target = 256 * std::max({color_.r, color_.g, color_.b}) - c;
+  if (target <= 0) return 0;
+  if (q > 0) return (-l + std::sqrt(l * l + 4 * q * target)) / (2 * q);
+  if (l > 0) return target / l;
+  return INFINITY;
+}
+
 PointLight::PointLightGLSL PointLight::point_light_glsl() const {
   PointLightGLSL ret;
   ret.pos = pos_;
   ret.color = color_;
   ret.attenuation = attenuation_;
-  ret.shadow_enabled = shadow_ != nullptr;
-  if (shadow_ != nullptr) {
+  ret.shadow_enabled = shadow_ != nullptr && shadow_->allocated();
+  if (ret.shadow_enabled) {
     ret.shadow = shadow_->omnidirectional_shadow_glsl();
   }
   return ret;
@@ -206,7 +229,9 @@ void LightSources::ResizeImageBasedOGLBuffer() {
       nullptr, GL_DYNAMIC_DRAW, ImageBasedLight::GLSL_BINDING));
 }
 
-LightSources::LightSources() {
+LightSources::LightSources()
+    : shadow_atlas_(new ShadowAtlas(SHADOW_ATLAS_SIZE, MIN_SHADOW_TILE_SIZE)),
+      cascade_pool_(new CascadePool(CASCADE_SIZE, MAX_CASCADE_LAYERS)) {
   ResizeAmbientOGLBuffer();
   ResizeDirectioanlOGLBuffer();
   ResizePointOGLBuffer();
@@ -216,15 +241,12 @@ LightSources::LightSources() {
 }
 
 void LightSources::AllocatePoissonDiskOGLBuffer() {
-  auto engine = std::default_random_engine{};
-
-  auto generator = PoissonDiskGenerator();
-  std::vector<glm::vec2> poisson_disk_2d_points = generator.Generate2D(128, 16);
-  std::shuffle(poisson_disk_2d_points.begin(), poisson_disk_2d_points.end(),
-               engine);
-  poisson_disk_2d_points_ssbo_.reset(
-      new OGLBuffer(GL_SHADER_STORAGE_BUFFER, poisson_disk_2d_points,
-                    GL_STATIC_DRAW, POISSON_DISK_2D_BINDING));
+  poisson_disk_2d_points_ssbo_.reset(new OGLBuffer(
+      GL_SHADER_STORAGE_BUFFER, PoissonDiskGenerator::ShadowKernel2D(),
+      GL_STATIC_DRAW, POISSON_DISK_2D_BINDING));
+  poisson_disk_3d_points_ssbo_.reset(new OGLBuffer(
+      GL_SHADER_STORAGE_BUFFER, PoissonDiskGenerator::ShadowKernel3D(),
+      GL_STATIC_DRAW, POISSON_DISK_3D_BINDING));
 }
 
 uint32_t LightSources::SizeAmbient() const { return ambient_lights_.size(); }
@@ -245,11 +267,13 @@ void LightSources::AddAmbient(std::unique_ptr<AmbientLight> light) {
 }
 
 void LightSources::AddDirectional(std::unique_ptr<DirectionalLight> light) {
+  light->set_cascade_pool(cascade_pool_.get());
   directional_lights_.emplace_back(std::move(light));
   ResizeDirectioanlOGLBuffer();
 }
 
 void LightSources::AddPoint(std::unique_ptr<PointLight> light) {
+  light->set_shadow_atlas(shadow_atlas_.get());
   point_lights_.emplace_back(std::move(light));
   ResizePointOGLBuffer();
 }
@@ -326,6 +350,17 @@ void LightSources::ImGuiWindow(Camera *camera) {
     });
   }
 
+  if (ImGui::TreeNode("Shadow atlas")) {
+    uint64_t num_texels = uint64_t(SHADOW_ATLAS_SIZE) * SHADOW_ATLAS_SIZE;
+    ImGui::Text("%u x %u, %.1f%% allocated", SHADOW_ATLAS_SIZE,
+                SHADOW_ATLAS_SIZE,
+                100.0 * shadow_atlas_->num_allocated_texels() / num_texels);
+    ImGui::Text("Cascades: %u / %u layers of %u x %u",
+                cascade_pool_->num_allocated_layers(), MAX_CASCADE_LAYERS,
+                CASCADE_SIZE, CASCADE_SIZE);
+    ImGui::TreePop();
+  }
+
   for (int i = 0; i < image_based_lights_.size(); i++) {
     image_based_lights_[i]->ImGuiWindow(i, [this, i]() {
       this->image_based_lights_.erase(image_based_lights_.begin() + i);
@@ -336,6 +371,121 @@ void LightSources::ImGuiWindow(Camera *camera) {
   ImGui::End();
 }
 
+void LightSources::UpdateShadowAtlas(const Camera *camera,
+                                     uint64_t static_casters_version) {
+  // the layers freed by erased shadows go to the first lights waiting
+  for (const auto &light : directional_lights_) {
+    DirectionalShadow *shadow = light->shadow();
+    if (shadow != nullptr) shadow->Allocate();
+  }
+
+  struct Request {
+    OmnidirectionalShadow *shadow;
+    float priority;
+    uint32_t tile_size;
+  };
+  std::vector<Request> requests;
+  float tan_half_fovy = std::tan(camera->fovy() * 0.5);
+  for (const auto &light : point_lights_) {
+    OmnidirectionalShadow *shadow = light->shadow();
+    if (shadow == nullptr) continue;
+
+    // the fraction of the screen height covered by the sphere of the range
+    float range = std::min(light->range(), shadow->z_far());
+    float distance = glm::distance(camera->position(), light->position());
+    float coverage = 1;
+    if (distance > range) {
+      coverage = std::min(1.0f, range / (distance * tan_half_fovy));
+    }
+    float priority = coverage * shadow->importance();
+
+    // rounded in log2 space, with some hysteresis so that a light near the
+    // threshold does not reallocate every frame
+    float continuous_size = MAX_SHADOW_TILE_SIZE * priority;
+    uint32_t tile_size = shadow->tile_size();
+    if (tile_size == 0 || continuous_size < 0.7f * tile_size ||
+        continuous_size > 1.5f * tile_size) {
+      float exponent = std::round(std::log2(std::max(continuous_size, 1.0f)));
+      tile_size = std::clamp(1u << uint32_t(exponent), MIN_SHADOW_TILE_SIZE,
+                             MAX_SHADOW_TILE_SIZE);
+    }
+    requests.push_back({shadow, priority, tile_size});
+  }
+
+  // the most important lights are fitted first, halving the tiles until the
+  // 6 faces fit into what is left of the atlas
+  std::sort(requests.begin(), requests.end(),
+            [](const Request &a, const Request &b) {
+              return a.priority > b.priority;
+            });
+  uint64_t remaining = uint64_t(SHADOW_ATLAS_SIZE) * SHADOW_ATLAS_SIZE;
+  for (auto &request : requests) {
+    while (request.tile_size > MIN_SHADOW_TILE_SIZE &&
+           6 * uint64_t(request.tile_size) * request.tile_size > remaining) {
+      request.tile_size /= 2;
+    }
+    uint64_t area = 6 * uint64_t(request.tile_size) * request.tile_size;
+    if (area > remaining) {
+      request.tile_size = 0;
+    } else {
+      remaining -= area;
+    }
+  }
+
+  // the redraws of the frame, by priority, the first one always fits
+  uint64_t redraw_texels = 0;
+  auto fits = [&](uint64_t texels) {
+    return redraw_texels == 0 ||
+           redraw_texels + texels <= MAX_SHADOW_REDRAW_TEXELS;
+  };
+
+  // a reallocated light redraws its 6 faces, shrinking first frees the room
+  // for growing
+  for (bool grow : {false, true}) {
+    for (const auto &request : requests) {
+      uint32_t current = request.shadow->tile_size();
+      if (request.tile_size == current ||
+          (request.tile_size > current) != grow) {
+        continue;
+      }
+      uint64_t texels = 6 * uint64_t(request.tile_size) * request.tile_size;
+      if (!fits(texels)) continue;
+      if (!grow) {
+        // the freed tiles always have room for the smaller ones
+        request.shadow->set_tile_size(request.tile_size);
+        redraw_texels += texels;
+        continue;
+      }
+      // fragmentation may leave no room for the fitted size
+      for (uint32_t tile_size = request.tile_size;
+           tile_size > current && tile_size >= MIN_SHADOW_TILE_SIZE;
+           tile_size /= 2) {
+        if (request.shadow->set_tile_size(tile_size)) {
+          redraw_texels += 6 * uint64_t(tile_size) * tile_size;
+          break;
+        }
+      }
+    }
+  }
+
+  // the outdated faces, e.g. of moved lights, keep their cache until the
+  // budget has room; the faces not outdated yet are deferred too, so that
+  // the static casters changing during culling wait for the next frame; the
+  // faces never drawn, e.g. reallocated above, are always drawn
+  for (const auto &request : requests) {
+    OmnidirectionalShadow *shadow = request.shadow;
+    uint64_t texels = uint64_t(shadow->tile_size()) * shadow->tile_size();
+    for (uint32_t i = 0; i < shadow->num_layers(); i++) {
+      if (!shadow->static_cache_drawn(i)) continue;
+      shadow->set_static_draw_deferred(i, false);
+      bool redraw = shadow->RequiresStaticDraw(i, static_casters_version) &&
+                    fits(texels);
+      if (redraw) redraw_texels += texels;
+      shadow->set_static_draw_deferred(i, !redraw);
+    }
+  }
+}
+
 void LightSources::Set(Shader *shader) const {
   // ambient
   std::vector<AmbientLight::AmbientLightGLSL> ambient_light_glsl_vec;
@@ -390,16 +540,16 @@ void LightSources::DrawDepthForShadow(
     const std::function<void(int32_t, int32_t)> &render_pass) {
   glDisable(GL_CULL_FACE);
   for (int i = 0; i < directional_lights_.size(); i++) {
-    if (directional_lights_[i]->shadow() == nullptr) continue;
+    auto shadow = directional_lights_[i]->shadow();
+    if (shadow == nullptr || !shadow->allocated()) continue;
     directional_lights_[i]->shadow()->Bind();
-    directional_lights_[i]->shadow()->Clear();
     render_pass(i, -1);
     directional_lights_[i]->shadow()->Unbind();
   }
   for (int i = 0; i < point_lights_.size(); i++) {
-    if (point_lights_[i]->shadow() == nullptr) continue;
+    auto shadow = point_lights_[i]->shadow();
+    if (shadow == nullptr || !shadow->allocated()) continue;
     point_lights_[i]->shadow()->Bind();
-    point_lights_[i]->shadow()->Clear();
     render_pass(-1, i);
     point_lights_[i]->shadow()->Unbind();
   }
@@ -240,20 +240,24 @@ void Model::CompileShaders() {
         {"IMAGE_BASED_LIGHT_BINDING", std::any(ImageBasedLight::GLSL_BINDING)},
         {"POISSON_DISK_2D_BINDING",
          std::any(LightSources::POISSON_DISK_2D_BINDING)},
+        {"POISSON_DISK_3D_BINDING",
+         std::any(LightSources::POISSON_DISK_3D_BINDING)},
     };
     kShader.reset(new Shader("model/model.vert", "model/model.frag", defines));
     kOITShader.reset(new Shader("model/model.vert", "model/oit.frag", defines));
     kDeferredShadingShader.reset(
         new Shader("model/model.vert", "model/deferred_shading.frag", defines));
 
-    defines["USE_GEOM_SHADER"] = std::any(true);
+    // each cascade draws its own command stream into its own layer, so no
+    // geometry shader is needed to route the triangles
     kDirectionalShadowShader.reset(new Shader(
         {
             {GL_VERTEX_SHADER, "model/model.vert"},
-            {GL_GEOMETRY_SHADER, "model/directional_shadow.geom"},
             {GL_FRAGMENT_SHADER, "model/directional_shadow.frag"},
         },
         defines));
+
+    defines["USE_GEOM_SHADER"] = std::any(true);
     kOmnidirectionalShadowShader.reset(new Shader(
         {
             {GL_VERTEX_SHADER, "model/model.vert"},
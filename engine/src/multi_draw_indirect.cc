@@ -2,14 +2,48 @@
 
 #include <fmt/core.h>
 #include <glad/glad.h>
+#include <imgui.h>
 
+#include <algorithm>
+#include <cstring>
 #include <iterator>
 #include <set>
+#include <string_view>
 
+#include "instance_bvh.h"
 #include "model.h"
 #include "obb.h"
 #include "utils.h"
 
+CullingView CullingView::All() {
+  CullingView view;
+  view.obb = OBB();
+  view.frustum = Frustum();
+  view.type = kAll;
+  view.casters = kAllCasters;
+  return view;
+}
+
+CullingView CullingView::FromFrustum(const Frustum &frustum) {
+  CullingView view = All();
+  view.frustum = frustum;
+  view.type = kFrustum;
+  return view;
+}
+
+CullingView CullingView::FromOBB(const OBB &obb) {
+  CullingView view = All();
+  view.obb = obb;
+  view.type = kOBB;
+  return view;
+}
+
+CullingView CullingView::WithCasters(Casters casters) const {
+  CullingView view = *this;
+  view.casters = casters;
+  return view;
+}
+
 GPUDrivenWorkloadGeneration::GPUDrivenWorkloadGeneration(
     const FixedArrays &fixed_arrays, const DynamicBuffers &dynamic_buffers,
     const Constants &constants)
@@ -28,7 +62,8 @@ GPUDrivenWorkloadGeneration::GPUDrivenWorkloadGeneration(
 void GPUDrivenWorkloadGeneration::CompileShaders() {
   if (frustum_culling_and_lod_selection_shader_ == nullptr &&
       prefix_sum_0_shader_ == nullptr && prefix_sum_1_shader_ == nullptr &&
-      prefix_sum_2_shader_ == nullptr && remap_shader_ == nullptr) {
+      prefix_sum_2_shader_ == nullptr && remap_shader_ == nullptr &&
+      statistics_shader_ == nullptr) {
     frustum_culling_and_lod_selection_shader_.reset(new Shader(
         {{GL_COMPUTE_SHADER,
           "multi_draw_indirect/frustum_culling_and_lod_selection.comp"}},
@@ -41,6 +76,8 @@ void GPUDrivenWorkloadGeneration::CompileShaders() {
         {{GL_COMPUTE_SHADER, "multi_draw_indirect/prefix_sum_2.comp"}}, {}));
     remap_shader_.reset(new Shader(
         {{GL_COMPUTE_SHADER, "multi_draw_indirect/remap.comp"}}, {}));
+    statistics_shader_.reset(new Shader(
+        {{GL_COMPUTE_SHADER, "multi_draw_indirect/statistics.comp"}}, {}));
   }
 }
 
@@ -49,9 +86,6 @@ void GPUDrivenWorkloadGeneration::AllocateBuffers(
   // constant buffers
   aabbs_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER, *fixed_arrays.aabbs,
                                   GL_STATIC_DRAW, 0));
-  instance_to_mesh_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER,
-                                             *fixed_arrays.instance_to_mesh,
-                                             GL_STATIC_DRAW, 1));
   mesh_to_cmd_offset_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER,
                                                *fixed_arrays.mesh_to_cmd_offset,
                                                GL_STATIC_DRAW, 2));
@@ -61,25 +95,85 @@ void GPUDrivenWorkloadGeneration::AllocateBuffers(
 
   // intermediate buffers
   cmd_instance_count_ssbo_.reset(new OGLBuffer(
-      GL_SHADER_STORAGE_BUFFER, constants_.num_commands * sizeof(uint32_t),
+      GL_SHADER_STORAGE_BUFFER,
+      constants_.max_views * constants_.num_commands * sizeof(uint32_t),
       nullptr, GL_DYNAMIC_DRAW, 6));
   instance_to_cmd_ssbo_.reset(new OGLBuffer(
       GL_SHADER_STORAGE_BUFFER, constants_.num_instances * sizeof(int32_t),
       nullptr, GL_DYNAMIC_DRAW, 7));
+  instance_visibility_ssbo_.reset(new OGLBuffer(
+      GL_SHADER_STORAGE_BUFFER, constants_.num_instances * sizeof(uint32_t),
+      nullptr, GL_DYNAMIC_DRAW, 8));
+  occlusion_history_ssbo_.reset(new OGLBuffer(
+      GL_SHADER_STORAGE_BUFFER, constants_.num_instances * sizeof(uint32_t),
+      nullptr, GL_DYNAMIC_DRAW, 9));
+  uint32_t zero = 0;
+  glClearNamedBufferData(occlusion_history_ssbo_->id(), GL_R32UI,
+                         GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
   work_group_prefix_sum_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER,
                                                   1024 * sizeof(uint32_t),
                                                   nullptr, GL_DYNAMIC_DRAW, 1));
+
+  // statistics
+  std::vector<uint32_t> cmd_to_lod(constants_.num_commands);
+  for (int i = 0; i < fixed_arrays.mesh_to_cmd_offset->size(); i++) {
+    uint32_t cmd_offset = (*fixed_arrays.mesh_to_cmd_offset)[i];
+    for (int lod = 0; lod < (*fixed_arrays.mesh_to_num_cmds)[i]; lod++) {
+      cmd_to_lod[cmd_offset + lod] =
+          std::min<uint32_t>(lod, kStatisticsLODs - 1);
+    }
+  }
+  cmd_to_lod_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER, cmd_to_lod,
+                                       GL_STATIC_DRAW, 1));
+  view_to_slot_ssbo_.reset(new OGLBuffer(
+      GL_SHADER_STORAGE_BUFFER, constants_.max_views * sizeof(uint32_t),
+      nullptr, GL_DYNAMIC_DRAW, 2));
+
+  uint32_t statistics_size =
+      constants_.num_statistics_slots * sizeof(Statistics);
+  uint32_t flags =
+      GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glCreateBuffers(kStatisticsLatency, statistics_buffers_);
+  for (int i = 0; i < kStatisticsLatency; i++) {
+    glNamedBufferStorage(statistics_buffers_[i], statistics_size, nullptr,
+                         flags);
+    statistics_mapped_[i] = reinterpret_cast<const Statistics *>(
+        glMapNamedBufferRange(statistics_buffers_[i], 0, statistics_size,
+                              flags));
+    glClearNamedBufferData(statistics_buffers_[i], GL_R32UI, GL_RED_INTEGER,
+                           GL_UNSIGNED_INT, &zero);
+  }
+  statistics_.resize(constants_.num_statistics_slots, Statistics{});
 }
 
-void GPUDrivenWorkloadGeneration::Compute(bool is_directional_shadow_pass,
-                                          bool is_omnidirectional_shadow_pass,
-                                          bool is_voxelization_pass) {
+GPUDrivenWorkloadGeneration::~GPUDrivenWorkloadGeneration() {
+  for (int i = 0; i < kStatisticsLatency; i++) {
+    if (statistics_fences_[i] != nullptr) glDeleteSync(statistics_fences_[i]);
+    glUnmapNamedBuffer(statistics_buffers_[i]);
+  }
+  glDeleteBuffers(kStatisticsLatency, statistics_buffers_);
+}
+
+void GPUDrivenWorkloadGeneration::Compute(
+    uint32_t num_views, OcclusionPhase occlusion_phase,
+    const HiZBuffer *hi_z_buffer, const glm::mat4 &hi_z_view_projection,
+    const std::vector<uint32_t> &view_to_slot) {
+  if (num_views == 0 || num_views > constants_.max_views ||
+      view_to_slot.size() != num_views) {
+    fmt::print(stderr, "[error] invalid number of culling views: {}\n",
+               num_views);
+    exit(1);
+  }
+  // all views share the prefix sum, view i owns commands
+  // [i * num_commands, (i + 1) * num_commands)
+  uint32_t num_view_commands = num_views * constants_.num_commands;
+
   // compute frustum culling and lod selection
   frustum_culling_and_lod_selection_shader_->Use();
   aabbs_ssbo_->BindBufferBase(0);
-  dynamic_buffers_.input_model_matrices_ssbo->BindBufferBase(1);
-  instance_to_mesh_ssbo_->BindBufferBase(2);
-  dynamic_buffers_.frustum_ssbo->BindBufferBase(3);
+  dynamic_buffers_.model_matrices_ssbo->BindBufferBase(1);
+  dynamic_buffers_.instance_to_mesh_ssbo->BindBufferBase(2);
+  dynamic_buffers_.views_ssbo->BindBufferBase(3);
   mesh_to_cmd_offset_ssbo_->BindBufferBase(4);
   mesh_to_num_cmds_ssbo_->BindBufferBase(5);
   uint32_t zero = 0;
@@ -87,15 +181,22 @@ void GPUDrivenWorkloadGeneration::Compute(bool is_directional_shadow_pass,
                          GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
   cmd_instance_count_ssbo_->BindBufferBase(6);
   instance_to_cmd_ssbo_->BindBufferBase(7);
-  dynamic_buffers_.shadow_obbs_ssbo->BindBufferBase(8);
-  frustum_culling_and_lod_selection_shader_->SetUniform<int32_t>(
-      "uIsDirectionalShadowPass", is_directional_shadow_pass);
-  frustum_culling_and_lod_selection_shader_->SetUniform<int32_t>(
-      "uIsOmnidirectionalShadowPass", is_omnidirectional_shadow_pass);
-  frustum_culling_and_lod_selection_shader_->SetUniform<int32_t>(
-      "uIsVoxelizationPass", is_voxelization_pass);
+  instance_visibility_ssbo_->BindBufferBase(8);
+  occlusion_history_ssbo_->BindBufferBase(9);
+  dynamic_buffers_.dynamic_ssbo->BindBufferBase(10);
+  frustum_culling_and_lod_selection_shader_->SetUniform<uint32_t>(
+      "uOcclusionPhase", static_cast<uint32_t>(occlusion_phase));
+  if (occlusion_phase == OcclusionPhase::kNewlyVisible) {
+    hi_z_buffer->Set(frustum_culling_and_lod_selection_shader_.get());
+    frustum_culling_and_lod_selection_shader_->SetUniform<glm::mat4>(
+        "uHiZViewProjection", hi_z_view_projection);
+  }
   frustum_culling_and_lod_selection_shader_->SetUniform<uint32_t>(
       "uInstanceCount", constants_.num_instances);
+  frustum_culling_and_lod_selection_shader_->SetUniform<uint32_t>(
+      "uCmdCount", constants_.num_commands);
+  frustum_culling_and_lod_selection_shader_->SetUniform<uint32_t>("uViewCount",
+                                                                  num_views);
   glDispatchCompute((constants_.num_instances + 255) / 256, 1, 1);
   glMemoryBarrier(GL_ALL_BARRIER_BITS);
 
@@ -103,18 +204,16 @@ void GPUDrivenWorkloadGeneration::Compute(bool is_directional_shadow_pass,
   prefix_sum_0_shader_->Use();
   cmd_instance_count_ssbo_->BindBufferBase(0);
   dynamic_buffers_.commands_ssbo->BindBufferBase(1);
-  prefix_sum_0_shader_->SetUniform<uint32_t>("uCmdCount",
-                                             constants_.num_commands);
-  uint32_t last_stage_num_work_groups = (constants_.num_commands + 1023) / 1024;
+  prefix_sum_0_shader_->SetUniform<uint32_t>("uCmdCount", num_view_commands);
+  uint32_t last_stage_num_work_groups = (num_view_commands + 1023) / 1024;
   glDispatchCompute(last_stage_num_work_groups, 1, 1);
   glMemoryBarrier(GL_ALL_BARRIER_BITS);
-  if (constants_.num_commands > 1024) {
+  if (num_view_commands > 1024) {
     prefix_sum_1_shader_->Use();
     dynamic_buffers_.commands_ssbo->BindBufferBase(0);
     work_group_prefix_sum_ssbo_->BindBufferBase(1);
     prefix_sum_1_shader_->SetUniform<uint32_t>("uLastStageWorkGroupSize", 1024);
-    prefix_sum_1_shader_->SetUniform<uint32_t>("uCmdCount",
-                                               constants_.num_commands);
+    prefix_sum_1_shader_->SetUniform<uint32_t>("uCmdCount", num_view_commands);
     glDispatchCompute((last_stage_num_work_groups + 1023) / 1024, 1, 1);
     glMemoryBarrier(GL_ALL_BARRIER_BITS);
 
@@ -122,35 +221,80 @@ void GPUDrivenWorkloadGeneration::Compute(bool is_directional_shadow_pass,
     dynamic_buffers_.commands_ssbo->BindBufferBase(0);
     work_group_prefix_sum_ssbo_->BindBufferBase(1);
     cmd_instance_count_ssbo_->BindBufferBase(2);
-    prefix_sum_2_shader_->SetUniform<uint32_t>("uCmdCount",
-                                               constants_.num_commands);
+    prefix_sum_2_shader_->SetUniform<uint32_t>("uCmdCount", num_view_commands);
     glDispatchCompute(last_stage_num_work_groups, 1, 1);
     glMemoryBarrier(GL_ALL_BARRIER_BITS);
   }
 
-  // compute remap
+  // compute remap, only the instance ids are written, the per instance arrays
+  // are read through them when drawing
   remap_shader_->Use();
   instance_to_cmd_ssbo_->BindBufferBase(0);
   dynamic_buffers_.commands_ssbo->BindBufferBase(1);
   glClearNamedBufferData(cmd_instance_count_ssbo_->id(), GL_R32UI,
                          GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
   cmd_instance_count_ssbo_->BindBufferBase(2);
-  dynamic_buffers_.input_model_matrices_ssbo->BindBufferBase(3);
-  dynamic_buffers_.input_bone_matrices_offset_ssbo->BindBufferBase(4);
-  dynamic_buffers_.input_animated_ssbo->BindBufferBase(5);
-  dynamic_buffers_.input_transforms_ssbo->BindBufferBase(6);
-  dynamic_buffers_.input_clip_planes_ssbo->BindBufferBase(7);
-  dynamic_buffers_.input_materials_ssbo->BindBufferBase(8);
-  dynamic_buffers_.model_matrices_ssbo->BindBufferBase(9);
-  dynamic_buffers_.bone_matrices_offset_ssbo->BindBufferBase(10);
-  dynamic_buffers_.animated_ssbo->BindBufferBase(11);
-  dynamic_buffers_.transforms_ssbo->BindBufferBase(12);
-  dynamic_buffers_.clip_planes_ssbo->BindBufferBase(13);
-  dynamic_buffers_.materials_ssbo->BindBufferBase(14);
+  instance_visibility_ssbo_->BindBufferBase(3);
+  dynamic_buffers_.instance_ids_ssbo->BindBufferBase(4);
   remap_shader_->SetUniform<uint32_t>("uInstanceCount",
                                       constants_.num_instances);
+  remap_shader_->SetUniform<uint32_t>("uCmdCount", constants_.num_commands);
   glDispatchCompute((constants_.num_instances + 255) / 256, 1, 1);
   glMemoryBarrier(GL_ALL_BARRIER_BITS);
+
+  ComputeStatistics(num_views, view_to_slot);
+}
+
+void GPUDrivenWorkloadGeneration::ComputeStatistics(
+    uint32_t num_views, const std::vector<uint32_t> &view_to_slot) {
+  for (auto slot : view_to_slot) {
+    if (slot >= constants_.num_statistics_slots) {
+      fmt::print(stderr, "[error] invalid statistics slot: {}\n", slot);
+      exit(1);
+    }
+  }
+  view_to_slot_ssbo_->SubData(0, num_views * sizeof(uint32_t),
+                              view_to_slot.data());
+
+  uint32_t num_view_commands = num_views * constants_.num_commands;
+  statistics_shader_->Use();
+  dynamic_buffers_.commands_ssbo->BindBufferBase(0);
+  cmd_to_lod_ssbo_->BindBufferBase(1);
+  view_to_slot_ssbo_->BindBufferBase(2);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3,
+                   statistics_buffers_[statistics_index_]);
+  statistics_shader_->SetUniform<uint32_t>("uCmdCount",
+                                           constants_.num_commands);
+  statistics_shader_->SetUniform<uint32_t>("uViewCmdCount", num_view_commands);
+  statistics_shader_->SetUniform<uint32_t>("uSlotCount",
+                                           constants_.num_statistics_slots);
+  glDispatchCompute((num_view_commands + 255) / 256, 1, 1);
+}
+
+void GPUDrivenWorkloadGeneration::EndStatisticsFrame() {
+  glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+  statistics_fences_[statistics_index_] =
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  statistics_index_ = (statistics_index_ + 1) % kStatisticsLatency;
+  frame_++;
+
+  // the buffer to reuse holds the frame kStatisticsLatency frames ago
+  GLsync &fence = statistics_fences_[statistics_index_];
+  if (fence != nullptr) {
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+      const Statistics *mapped = statistics_mapped_[statistics_index_];
+      std::copy(mapped, mapped + constants_.num_statistics_slots,
+                statistics_.begin());
+      statistics_frame_ = frame_ - kStatisticsLatency;
+    }
+    // when the GPU is that far behind, the frame is dropped instead of waited
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+  uint32_t zero = 0;
+  glClearNamedBufferData(statistics_buffers_[statistics_index_], GL_R32UI,
+                         GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
 }
 
 std::unique_ptr<Shader>
@@ -163,6 +307,8 @@ std::unique_ptr<Shader> GPUDrivenWorkloadGeneration::prefix_sum_1_shader_ =
 std::unique_ptr<Shader> GPUDrivenWorkloadGeneration::prefix_sum_2_shader_ =
     nullptr;
 std::unique_ptr<Shader> GPUDrivenWorkloadGeneration::remap_shader_ = nullptr;
+std::unique_ptr<Shader> GPUDrivenWorkloadGeneration::statistics_shader_ =
+    nullptr;
 
 MultiDrawIndirect::~MultiDrawIndirect() {
   glDeleteBuffers(1, &commands_buffer_);
@@ -181,6 +327,29 @@ std::vector<AABB> MultiDrawIndirect::debug_instance_aabbs() const {
   return ret;
 }
 
+InstanceBVH *MultiDrawIndirect::instance_bvh() {
+  if (instance_bvh_ == nullptr) {
+    std::vector<InstanceBVH::Geometry> geometries;
+    for (const auto &geometry : geometries_) {
+      geometries.push_back({vertices_.data() + geometry.base_vertex,
+                            indices_.data() + geometry.first_index[0],
+                            geometry.count[0] / 3});
+    }
+    InstanceBVH::Arrays arrays;
+    arrays.aabbs = &aabbs_;
+    arrays.mesh_to_geometry = &mesh_to_geometry_;
+    arrays.instance_to_mesh = &instance_to_mesh_;
+    arrays.model_matrices = &model_matrices_;
+    arrays.transforms = &transforms_;
+    instance_bvh_.reset(new InstanceBVH(geometries, arrays));
+  }
+  if (instance_bvh_outdated_) {
+    instance_bvh_->Update();
+    instance_bvh_outdated_ = false;
+  }
+  return instance_bvh_.get();
+}
+
 void MultiDrawIndirect::CheckRenderTargetParameter(
     const std::vector<RenderTargetParameter> &render_target_params) {
   const std::string all_models_must_present_error_message =
@@ -226,28 +395,53 @@ void MultiDrawIndirect::UpdateBuffers(
       uint32_t item_count = param.items.size();
       for (int i = 0, j = 0; i < param.model->meshes_.size(); i++) {
         if (param.model->meshes_[i] == nullptr) continue;
+        uint32_t instance = instance_offset + j * item_count;
         // animated
-        animated_[instance_offset + j * item_count] =
-            has_bone_[instance_offset + j * item_count] && item_is_animated;
-        model_matrices_[instance_offset + j * item_count] = item.model_matrix;
-        clip_planes_[instance_offset + j * item_count] = item.clip_plane;
+        animated_[instance] = has_bone_[instance] && item_is_animated;
+        if (model_matrices_initialized_ &&
+            model_matrices_[instance] != item.model_matrix) {
+          last_moved_frame_[instance] = frame_;
+          if (instance_bvh_ != nullptr) instance_bvh_->MarkMoved(instance);
+        }
+        model_matrices_[instance] = item.model_matrix;
+        clip_planes_[instance] = item.clip_plane;
         j++;
       }
     }
   }
+  model_matrices_initialized_ = true;
+
+  // the shadow caches are invalidated whenever an instance turns static or
+  // dynamic, hence the delay before a moved instance counts as static again
+  bool dynamic_changed = false;
+  num_dynamic_instances_ = 0;
+  for (uint32_t i = 0; i < num_instances_; i++) {
+    uint32_t dynamic =
+        animated_[i] || frame_ - last_moved_frame_[i] < kStaticFrames;
+    dynamic_changed = dynamic_changed || dynamic != dynamic_[i];
+    dynamic_[i] = dynamic;
+    num_dynamic_instances_ += dynamic;
+  }
+  if (dynamic_changed) {
+    static_casters_version_++;
+    glNamedBufferSubData(dynamic_ssbo_->id(), 0,
+                         dynamic_.size() * sizeof(dynamic_[0]),
+                         dynamic_.data());
+  }
 
   glNamedBufferSubData(bone_matrices_ssbo_->id(), 0,
                        bone_matrices_.size() * sizeof(bone_matrices_[0]),
                        bone_matrices_.data());
-  glNamedBufferSubData(input_animated_ssbo_->id(), 0,
+  glNamedBufferSubData(animated_ssbo_->id(), 0,
                        animated_.size() * sizeof(animated_[0]),
                        animated_.data());
-  glNamedBufferSubData(input_model_matrices_ssbo_->id(), 0,
+  glNamedBufferSubData(model_matrices_ssbo_->id(), 0,
                        model_matrices_.size() * sizeof(model_matrices_[0]),
                        model_matrices_.data());
-  glNamedBufferSubData(input_clip_planes_ssbo_->id(), 0,
+  glNamedBufferSubData(clip_planes_ssbo_->id(), 0,
                        clip_planes_.size() * sizeof(clip_planes_[0]),
                        clip_planes_.data());
+  instance_bvh_outdated_ = true;
 }
 
 void MultiDrawIndirect::BindBuffers() {
@@ -262,45 +456,219 @@ void MultiDrawIndirect::BindBuffers() {
   clip_planes_ssbo_->BindBufferBase(5);
   materials_ssbo_->BindBufferBase(6);
   textures_ssbo_->BindBufferBase(7);
+  instance_ids_ssbo_->BindBufferBase(8);
+  instance_to_mesh_ssbo_->BindBufferBase(9);
+  mesh_to_material_ssbo_->BindBufferBase(10);
+}
+
+namespace {
+
+std::vector<CullingView> DirectionalShadowViews(
+    const DirectionalShadow *shadow) {
+  std::vector<CullingView> views;
+  // no layers to draw until the cascade pool has room for the light
+  if (!shadow->allocated()) return views;
+  for (const auto &obb : shadow->cascade_obbs()) {
+    views.push_back(CullingView::FromOBB(obb));
+  }
+  return views;
+}
+
+std::vector<CullingView> OmnidirectionalShadowViews(
+    const OmnidirectionalShadow *shadow) {
+  std::vector<CullingView> views;
+  // no layers to draw until the shadow atlas has room for the light
+  if (!shadow->allocated()) return views;
+  for (const auto &view_projection : shadow->view_projection_matrices()) {
+    views.push_back(CullingView::FromFrustum(
+        Frustum::FromViewProjectionMatrix(view_projection)));
+  }
+  return views;
+}
+
+}  // namespace
+
+std::vector<MultiDrawIndirect::ShadowLayerViews>
+MultiDrawIndirect::AppendShadowViews(
+    const Shadow *shadow, const std::vector<CullingView> &layer_views,
+    uint32_t first_view, std::vector<CullingView> *views) const {
+  std::vector<ShadowLayerViews> ret(layer_views.size());
+  for (uint32_t i = 0; i < layer_views.size(); i++) {
+    if (shadow->RequiresStaticDraw(i, static_casters_version_)) {
+      ret[i].static_view = first_view + views->size();
+      views->push_back(
+          layer_views[i].WithCasters(CullingView::kStaticCasters));
+    }
+    if (num_dynamic_instances_ > 0) {
+      ret[i].dynamic_view = first_view + views->size();
+      views->push_back(
+          layer_views[i].WithCasters(CullingView::kDynamicCasters));
+    }
+  }
+  return ret;
+}
+
+void MultiDrawIndirect::DrawShadowLayers(
+    Shadow *shadow, Shader *shader,
+    const std::vector<ShadowLayerViews> &layer_views) {
+  bool has_dynamic_casters = num_dynamic_instances_ > 0;
+  auto &statistics = shadow_cache_statistics_;
+  for (uint32_t i = 0; i < layer_views.size(); i++) {
+    if (layer_views[i].static_view >= 0) {
+      // only the exposed strips of a scrolled cascade
+      for (const auto &region :
+           shadow->BeginStaticDraw(i, static_casters_version_)) {
+        shadow->BindRegion(i, true, region, shader);
+        DrawView(layer_views[i].static_view);
+      }
+      statistics.static_draws++;
+    } else {
+      statistics.static_draws_skipped++;
+    }
+    if (!shadow->RequiresDynamicDraw(i, has_dynamic_casters)) {
+      statistics.layers_untouched++;
+      continue;
+    }
+    auto regions = shadow->BeginDynamicDraw(i, has_dynamic_casters);
+    if (layer_views[i].dynamic_view >= 0) {
+      for (const auto &region : regions) {
+        shadow->BindRegion(i, false, region, shader);
+        DrawView(layer_views[i].dynamic_view);
+      }
+      statistics.dynamic_draws++;
+    }
+  }
+}
+
+void MultiDrawIndirect::ComputeViews(
+    const std::vector<CullingView> &views,
+    const std::vector<uint32_t> &view_to_pass,
+    GPUDrivenWorkloadGeneration::OcclusionPhase occlusion_phase,
+    const glm::mat4 &hi_z_view_projection) {
+  views_ssbo_->SubData(0, views.size() * sizeof(views[0]), views.data());
+  gpu_driven_->Compute(views.size(), occlusion_phase, hi_z_buffer_,
+                       hi_z_view_projection, view_to_pass);
+  // the command streams of the previous views have been overwritten
+  visibility_ = Visibility();
+}
+
+void MultiDrawIndirect::DrawView(uint32_t view_index) {
+  uint64_t offset =
+      view_index * commands_.size() * sizeof(DrawElementsIndirectCommand);
+  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)offset,
+                              commands_.size(), 0);
+}
+
+void MultiDrawIndirect::ComputeVisibility(
+    Camera *camera, LightSources *light_sources,
+    const std::vector<RenderTargetParameter> &render_target_params) {
+  CheckRenderTargetParameter(render_target_params);
+  UpdateBuffers(render_target_params);
+
+  std::vector<CullingView> views;
+  Visibility visibility;
+
+  views.push_back(CullingView::FromFrustum(camera->frustum()));
+  std::vector<uint32_t> view_to_pass = {kCameraPass};
+  visibility.camera = camera;
+  visibility.camera_view = 0;
+  visibility.camera_occlusion_culling = hi_z_buffer_ != nullptr;
+
+  // only the layers whose cache or dynamic casters need drawing get views,
+  // lights that do not fit in the budget cull on their own when drawn
+  for (int i = 0; i < light_sources->SizeDirectional(); i++) {
+    auto shadow = light_sources->GetDirectional(i)->shadow();
+    if (shadow == nullptr) continue;
+    // the cascades are fitted here instead of in DirectionalShadow::Bind()
+    shadow->UpdateCascades();
+    std::vector<CullingView> light_views;
+    auto layer_views = AppendShadowViews(shadow, DirectionalShadowViews(shadow),
+                                         views.size(), &light_views);
+    if (views.size() + light_views.size() > max_views_) break;
+    visibility.directional_views[i] = layer_views;
+    views.insert(views.end(), light_views.begin(), light_views.end());
+    view_to_pass.resize(views.size(), kDirectionalShadowPass);
+  }
+  for (int i = 0; i < light_sources->SizePoint(); i++) {
+    auto shadow = light_sources->GetPoint(i)->shadow();
+    if (shadow == nullptr) continue;
+    std::vector<CullingView> light_views;
+    auto layer_views =
+        AppendShadowViews(shadow, OmnidirectionalShadowViews(shadow),
+                          views.size(), &light_views);
+    if (views.size() + light_views.size() > max_views_) break;
+    visibility.point_views[i] = layer_views;
+    views.insert(views.end(), light_views.begin(), light_views.end());
+    view_to_pass.resize(views.size(), kPointShadowPass);
+  }
+
+  ComputeViews(views, view_to_pass,
+               visibility.camera_occlusion_culling
+                   ? GPUDrivenWorkloadGeneration::OcclusionPhase::
+                         kPreviouslyVisible
+                   : GPUDrivenWorkloadGeneration::OcclusionPhase::kDisabled,
+               glm::mat4(1));
+  visibility.valid = true;
+  visibility_ = visibility;
 }
 
 void MultiDrawIndirect::DrawDepthForShadow(
     LightSources *light_sources, int32_t directional_index, int32_t point_index,
     const std::vector<RenderTargetParameter> &render_target_params) {
   CheckRenderTargetParameter(render_target_params);
-  UpdateBuffers(render_target_params);
 
+  Shadow *shadow = nullptr;
+  Shader *shader = nullptr;
+  uint32_t light_index = 0, pass = 0;
+  std::vector<CullingView> layer_views;
+  const std::map<int32_t, std::vector<ShadowLayerViews>> *computed = nullptr;
   if (directional_index >= 0) {
-    auto obbs = light_sources->GetDirectional(directional_index)
-                    ->shadow()
-                    ->cascade_obbs();
-    glNamedBufferSubData(shadow_obbs_ssbo_->id(), 0,
-                         obbs.size() * sizeof(obbs[0]), obbs.data());
-    gpu_driven_->Compute(true, false, false);
+    auto directional_shadow =
+        light_sources->GetDirectional(directional_index)->shadow();
+    shadow = directional_shadow;
+    shader = Model::kDirectionalShadowShader.get();
+    light_index = directional_index;
+    pass = kDirectionalShadowPass;
+    layer_views = DirectionalShadowViews(directional_shadow);
+    computed = &visibility_.directional_views;
   } else if (point_index >= 0) {
-    gpu_driven_->Compute(false, true, false);
+    auto omnidirectional_shadow =
+        light_sources->GetPoint(point_index)->shadow();
+    shadow = omnidirectional_shadow;
+    shader = Model::kOmnidirectionalShadowShader.get();
+    light_index = point_index;
+    pass = kPointShadowPass;
+    layer_views = OmnidirectionalShadowViews(omnidirectional_shadow);
+    computed = &visibility_.point_views;
+  } else {
+    return;
+  }
+
+  std::vector<ShadowLayerViews> shadow_layer_views;
+  auto it = computed->find(light_index);
+  if (visibility_.valid && it != computed->end()) {
+    shadow_layer_views = it->second;
+  } else {
+    UpdateBuffers(render_target_params);
+    std::vector<CullingView> views;
+    shadow_layer_views = AppendShadowViews(shadow, layer_views, 0, &views);
+    // the views are empty when the whole shadow map can be left untouched
+    if (!views.empty()) {
+      ComputeViews(views, std::vector<uint32_t>(views.size(), pass),
+                   GPUDrivenWorkloadGeneration::OcclusionPhase::kDisabled,
+                   glm::mat4(1));
+    }
   }
 
   BindBuffers();
 
-  if (directional_index >= 0) {
-    Model::kDirectionalShadowShader->Use();
-    light_sources->Set(Model::kDirectionalShadowShader.get());
-    Model::kDirectionalShadowShader->SetUniform<uint32_t>("uLightIndex",
-                                                          directional_index);
-    auto shadow = light_sources->GetDirectional(directional_index)->shadow();
-    shadow->Set(Model::kDirectionalShadowShader.get());
-  } else if (point_index >= 0) {
-    Model::kOmnidirectionalShadowShader->Use();
-    light_sources->Set(Model::kOmnidirectionalShadowShader.get());
-    Model::kOmnidirectionalShadowShader->SetUniform<uint32_t>("uLightIndex",
-                                                              point_index);
-    auto shadow = light_sources->GetPoint(point_index)->shadow();
-    shadow->Set(Model::kOmnidirectionalShadowShader.get());
-  }
+  // each cascade / cube face draws its own command streams
+  shader->Use();
+  light_sources->Set(shader);
+  shader->SetUniform<uint32_t>("uLightIndex", light_index);
+  shadow->Set(shader);
+  DrawShadowLayers(shadow, shader, shadow_layer_views);
 
-  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
-                              commands_.size(), 0);
   glBindVertexArray(0);
   glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 }
@@ -311,7 +679,6 @@ void MultiDrawIndirect::Draw(
     bool default_shading, bool force_pbr,
     const std::vector<RenderTargetParameter> &render_target_params) {
   CheckRenderTargetParameter(render_target_params);
-  UpdateBuffers(render_target_params);
 
   Shader *shader = nullptr;
   if (oit_render_quad != nullptr) {
@@ -324,12 +691,30 @@ void MultiDrawIndirect::Draw(
     shader = Model::kShader.get();
   }
 
-  if (voxelization == nullptr) {
-    Frustum frustum = camera->frustum();
-    frustum_ssbo_->SubData(0, sizeof(Frustum), &frustum);
-  }
+  using OcclusionPhase = GPUDrivenWorkloadGeneration::OcclusionPhase;
+  // the Hi-Z buffer is built from the G-Buffer depth
+  bool occlusion_culling = hi_z_buffer_ != nullptr && deferred_shading &&
+                           oit_render_quad == nullptr &&
+                           voxelization == nullptr;
 
-  gpu_driven_->Compute(false, false, voxelization != nullptr);
+  uint32_t view = 0;
+  if (voxelization == nullptr && visibility_.valid &&
+      visibility_.camera == camera &&
+      visibility_.camera_occlusion_culling == occlusion_culling) {
+    view = visibility_.camera_view;
+  } else {
+    UpdateBuffers(render_target_params);
+    if (voxelization == nullptr) {
+      ComputeViews({CullingView::FromFrustum(camera->frustum())},
+                   {kCameraPass},
+                   occlusion_culling ? OcclusionPhase::kPreviouslyVisible
+                                     : OcclusionPhase::kDisabled,
+                   glm::mat4(1));
+    } else {
+      ComputeViews({CullingView::All()}, {kVoxelizationPass},
+                   OcclusionPhase::kDisabled, glm::mat4(1));
+    }
+  }
 
   BindBuffers();
   shader->Use();
@@ -360,18 +745,91 @@ void MultiDrawIndirect::Draw(
     shader->SetUniform<int32_t>("uForcePBR", force_pbr);
   }
 
-  glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
-                              commands_.size(), 0);
+  DrawView(view);
+
+  if (occlusion_culling) {
+    hi_z_buffer_->Build();
+    ComputeViews({CullingView::FromFrustum(camera->frustum())},
+                 {kCameraNewlyVisiblePass}, OcclusionPhase::kNewlyVisible,
+                 camera->projection_matrix() * camera->view_matrix());
+    BindBuffers();
+    shader->Use();
+    DrawView(0);
+  }
+
   glBindVertexArray(0);
   glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 }
 
+void MultiDrawIndirect::EndFrame() {
+  frame_++;
+  gpu_driven_->EndStatisticsFrame();
+  last_shadow_cache_statistics_ = shadow_cache_statistics_;
+  shadow_cache_statistics_ = ShadowCacheStatistics();
+}
+
+void MultiDrawIndirect::ImGuiWindow() {
+  const char *pass_names[kNumPasses] = {"Camera", "Camera (newly visible)",
+                                        "Directional shadow", "Point shadow",
+                                        "Voxelization"};
+
+  ImGui::Begin("Multi Draw Indirect:");
+  ImGui::Text("Frame: %llu",
+              static_cast<unsigned long long>(statistics_frame()));
+  ImGui::Text("Instances: %u, commands: %u, triangles: %u", num_instances_,
+              static_cast<uint32_t>(commands_.size()), num_triangles_);
+  for (int i = 0; i < kNumPasses; i++) {
+    const auto &statistics = this->statistics()[i];
+    if (!ImGui::TreeNode(pass_names[i])) continue;
+    ImGui::Text("Visible instances: %u", statistics.num_instances);
+    ImGui::Text("Commands: %u", statistics.num_commands);
+    for (int lod = 0; lod < GPUDrivenWorkloadGeneration::kStatisticsLODs;
+         lod++) {
+      ImGui::Text("Triangles of LOD %d: %u", lod,
+                  statistics.num_triangles[lod]);
+    }
+    ImGui::TreePop();
+  }
+  if (ImGui::TreeNode("Shadow cache")) {
+    const auto &statistics = last_shadow_cache_statistics_;
+    ImGui::Text("Dynamic instances: %u, static casters version: %llu",
+                num_dynamic_instances_,
+                static_cast<unsigned long long>(static_casters_version_));
+    ImGui::Text("Static draws: %u, skipped: %u", statistics.static_draws,
+                statistics.static_draws_skipped);
+    ImGui::Text("Dynamic draws: %u, layers untouched: %u",
+                statistics.dynamic_draws, statistics.layers_untouched);
+    ImGui::TreePop();
+  }
+  if (instance_bvh_ != nullptr && ImGui::TreeNode("Instance BVH")) {
+    const auto &nodes = instance_bvh_->top_level()->nodes();
+    ImGui::Text("Nodes: %u", static_cast<uint32_t>(nodes.size()));
+    ImGui::Text("Last update: %.3f ms, %u subtrees rebuilt",
+                instance_bvh_->update_milliseconds(),
+                instance_bvh_->num_rebuilt_subtrees());
+    ImGui::TreePop();
+  }
+  ImGui::End();
+}
+
 void MultiDrawIndirect::PrepareForDraw() {
-  // commands buffer
+  // the prefix sum handles at most 1024 * 1024 commands across all views
+  max_views_ = std::clamp<uint32_t>(
+      1024 * 1024 / std::max<uint32_t>(commands_.size(), 1), 1,
+      GPUDrivenWorkloadGeneration::kMaxViews);
+
+  // commands buffer, one copy of the commands per view
+  std::vector<DrawElementsIndirectCommand> view_commands;
+  view_commands.reserve(max_views_ * commands_.size());
+  for (int i = 0; i < max_views_; i++) {
+    std::copy(commands_.begin(), commands_.end(),
+              std::back_inserter(view_commands));
+  }
   glCreateBuffers(1, &commands_buffer_);
-  glNamedBufferStorage(commands_buffer_,
-                       sizeof(DrawElementsIndirectCommand) * commands_.size(),
-                       (const void *)commands_.data(), GL_DYNAMIC_STORAGE_BIT);
+  glNamedBufferStorage(
+      commands_buffer_,
+      sizeof(DrawElementsIndirectCommand) * view_commands.size(),
+      (const void *)view_commands.data(), GL_DYNAMIC_STORAGE_BIT);
 
   // vao
   glGenVertexArrays(1, &vao_);
@@ -421,87 +879,146 @@ void MultiDrawIndirect::PrepareForDraw() {
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
   // create OGLBuffer
-  input_model_matrices_ssbo_.reset(new OGLBuffer(
-      GL_SHADER_STORAGE_BUFFER, num_instances_ * sizeof(glm::mat4), nullptr,
-      GL_DYNAMIC_DRAW, 0));
-  bone_matrices_ssbo_.reset(new OGLBuffer(
-      GL_SHADER_STORAGE_BUFFER, num_bone_matrices_ * sizeof(glm::mat4), nullptr,
-      GL_DYNAMIC_DRAW, 0));
-  input_bone_matrices_offset_ssbo_.reset(new OGLBuffer(
-      GL_SHADER_STORAGE_BUFFER, bone_matrices_offset_, GL_STATIC_DRAW, 0));
-  input_animated_ssbo_.reset(new OGLBuffer(
-      GL_SHADER_STORAGE_BUFFER, has_bone_.size() * sizeof(has_bone_[0]),
-      nullptr, GL_DYNAMIC_DRAW, 0));
-  input_transforms_ssbo_.reset(
-      new OGLBuffer(GL_SHADER_STORAGE_BUFFER, transforms_, GL_STATIC_DRAW, 0));
-  input_clip_planes_ssbo_.reset(new OGLBuffer(
-      GL_SHADER_STORAGE_BUFFER, num_instances_ * sizeof(glm::vec4), nullptr,
-      GL_DYNAMIC_DRAW, 0));
-  input_materials_ssbo_.reset(
-      new OGLBuffer(GL_SHADER_STORAGE_BUFFER, materials_, GL_STATIC_DRAW, 0));
-  textures_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER, texture_handles_,
-                                     GL_STATIC_DRAW, 0));
-
   model_matrices_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER,
                                            num_instances_ * sizeof(glm::mat4),
                                            nullptr, GL_DYNAMIC_DRAW, 0));
+  bone_matrices_ssbo_.reset(new OGLBuffer(
+      GL_SHADER_STORAGE_BUFFER, num_bone_matrices_ * sizeof(glm::mat4), nullptr,
+      GL_DYNAMIC_DRAW, 0));
   bone_matrices_offset_ssbo_.reset(new OGLBuffer(
-      GL_SHADER_STORAGE_BUFFER, bone_matrices_offset_, GL_DYNAMIC_DRAW, 0));
+      GL_SHADER_STORAGE_BUFFER, bone_matrices_offset_, GL_STATIC_DRAW, 0));
   animated_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER,
                                      has_bone_.size() * sizeof(has_bone_[0]),
                                      nullptr, GL_DYNAMIC_DRAW, 0));
   transforms_ssbo_.reset(
-      new OGLBuffer(GL_SHADER_STORAGE_BUFFER, transforms_, GL_DYNAMIC_DRAW, 0));
+      new OGLBuffer(GL_SHADER_STORAGE_BUFFER, transforms_, GL_STATIC_DRAW, 0));
   clip_planes_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER,
                                         num_instances_ * sizeof(glm::vec4),
                                         nullptr, GL_DYNAMIC_DRAW, 0));
   materials_ssbo_.reset(
-      new OGLBuffer(GL_SHADER_STORAGE_BUFFER, materials_, GL_DYNAMIC_DRAW, 0));
+      new OGLBuffer(GL_SHADER_STORAGE_BUFFER, materials_, GL_STATIC_DRAW, 0));
+  mesh_to_material_ssbo_.reset(new OGLBuffer(
+      GL_SHADER_STORAGE_BUFFER, mesh_to_material_, GL_STATIC_DRAW, 0));
+  textures_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER, texture_handles_,
+                                     GL_STATIC_DRAW, 0));
 
   commands_ssbo_.reset(
       new OGLBuffer(GL_SHADER_STORAGE_BUFFER, commands_buffer_, 0, false));
-  frustum_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER, sizeof(Frustum),
-                                    nullptr, GL_DYNAMIC_DRAW, 0));
-  shadow_obbs_ssbo_.reset(new OGLBuffer(
-      GL_SHADER_STORAGE_BUFFER, sizeof(OBB) * DirectionalShadow::NUM_CASCADES,
-      nullptr, GL_DYNAMIC_DRAW, 8));
+  views_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER,
+                                  max_views_ * sizeof(CullingView), nullptr,
+                                  GL_DYNAMIC_DRAW, 0));
+  instance_ids_ssbo_.reset(new OGLBuffer(
+      GL_SHADER_STORAGE_BUFFER, max_views_ * num_instances_ * sizeof(uint32_t),
+      nullptr, GL_DYNAMIC_DRAW, 0));
+  instance_to_mesh_ssbo_.reset(new OGLBuffer(
+      GL_SHADER_STORAGE_BUFFER, instance_to_mesh_, GL_STATIC_DRAW, 0));
 
   bone_matrices_.resize(num_bone_matrices_);
   animated_.resize(num_instances_);
+  // every instance starts static
+  dynamic_.resize(num_instances_, 0);
+  last_moved_frame_.resize(num_instances_, 0);
+  dynamic_ssbo_.reset(new OGLBuffer(GL_SHADER_STORAGE_BUFFER, dynamic_,
+                                    GL_DYNAMIC_DRAW, 0));
   model_matrices_.resize(num_instances_);
   clip_planes_.resize(num_instances_);
 
   GPUDrivenWorkloadGeneration::FixedArrays fixed_arrays;
   fixed_arrays.aabbs = &aabbs_;
-  fixed_arrays.instance_to_mesh = &instance_to_mesh_;
   fixed_arrays.mesh_to_cmd_offset = &mesh_to_cmd_offset_;
   fixed_arrays.mesh_to_num_cmds = &mesh_to_num_cmds_;
 
   GPUDrivenWorkloadGeneration::DynamicBuffers dynamic_buffers;
-  dynamic_buffers.input_model_matrices_ssbo = input_model_matrices_ssbo_.get();
-  dynamic_buffers.frustum_ssbo = frustum_ssbo_.get();
-  dynamic_buffers.shadow_obbs_ssbo = shadow_obbs_ssbo_.get();
-  dynamic_buffers.commands_ssbo = commands_ssbo_.get();
-  dynamic_buffers.input_bone_matrices_offset_ssbo =
-      input_bone_matrices_offset_ssbo_.get();
-  dynamic_buffers.input_animated_ssbo = input_animated_ssbo_.get();
-  dynamic_buffers.input_transforms_ssbo = input_transforms_ssbo_.get();
-  dynamic_buffers.input_clip_planes_ssbo = input_clip_planes_ssbo_.get();
-  dynamic_buffers.input_materials_ssbo = input_materials_ssbo_.get();
+  dynamic_buffers.instance_to_mesh_ssbo = instance_to_mesh_ssbo_.get();
   dynamic_buffers.model_matrices_ssbo = model_matrices_ssbo_.get();
-  dynamic_buffers.bone_matrices_offset_ssbo = bone_matrices_offset_ssbo_.get();
-  dynamic_buffers.animated_ssbo = animated_ssbo_.get();
-  dynamic_buffers.transforms_ssbo = transforms_ssbo_.get();
-  dynamic_buffers.clip_planes_ssbo = clip_planes_ssbo_.get();
-  dynamic_buffers.materials_ssbo = materials_ssbo_.get();
+  dynamic_buffers.views_ssbo = views_ssbo_.get();
+  dynamic_buffers.commands_ssbo = commands_ssbo_.get();
+  dynamic_buffers.instance_ids_ssbo = instance_ids_ssbo_.get();
+  dynamic_buffers.dynamic_ssbo = dynamic_ssbo_.get();
 
   GPUDrivenWorkloadGeneration::Constants constants;
   constants.num_commands = commands_.size();
   constants.num_instances = num_instances_;
+  constants.max_views = max_views_;
+  constants.num_statistics_slots = kNumPasses;
   gpu_driven_.reset(new GPUDrivenWorkloadGeneration(
       fixed_arrays, dynamic_buffers, constants));
 
   fmt::print(stderr, "[info] # of triangles: {}\n", num_triangles_);
+  fmt::print(stderr, "[info] # of materials: {}, # of textures: {}\n",
+             materials_.size(), textures_.size());
+  fmt::print(stderr,
+             "[info] # of geometries: {}, {} bytes of geometry shared\n",
+             geometries_.size(), num_geometry_bytes_saved_);
+}
+
+namespace {
+
+template <typename T>
+std::string_view BytesOf(const std::vector<T> &v) {
+  return std::string_view(reinterpret_cast<const char *>(v.data()),
+                          v.size() * sizeof(T));
+}
+
+}  // namespace
+
+bool MultiDrawIndirect::GeometryEquals(
+    const Geometry &geometry, const std::vector<VertexWithBones> &vertices,
+    const std::vector<std::vector<uint32_t>> &indices) const {
+  if (geometry.num_vertices != vertices.size() ||
+      geometry.count.size() != indices.size()) {
+    return false;
+  }
+  for (int i = 0; i < indices.size(); i++) {
+    if (geometry.count[i] != indices[i].size()) return false;
+  }
+  if (std::memcmp(vertices_.data() + geometry.base_vertex, vertices.data(),
+                  vertices.size() * sizeof(VertexWithBones)) != 0) {
+    return false;
+  }
+  for (int i = 0; i < indices.size(); i++) {
+    if (!std::equal(indices[i].begin(), indices[i].end(),
+                    indices_.begin() + geometry.first_index[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t MultiDrawIndirect::RegisterGeometry(
+    const std::vector<VertexWithBones> &vertices,
+    const std::vector<std::vector<uint32_t>> &indices) {
+  size_t hash = std::hash<std::string_view>()(BytesOf(vertices));
+  for (const auto &lod : indices) {
+    hash ^= std::hash<std::string_view>()(BytesOf(lod)) + 0x9e3779b9 +
+            (hash << 6) + (hash >> 2);
+  }
+
+  // the hash only narrows down the candidates, the content decides
+  auto range = geometry_hash_to_index_.equal_range(hash);
+  for (auto it = range.first; it != range.second; it++) {
+    if (GeometryEquals(geometries_[it->second], vertices, indices)) {
+      num_geometry_bytes_saved_ += vertices.size() * sizeof(VertexWithBones);
+      for (const auto &lod : indices) {
+        num_geometry_bytes_saved_ += lod.size() * sizeof(uint32_t);
+      }
+      return it->second;
+    }
+  }
+
+  Geometry geometry;
+  geometry.base_vertex = vertices_.size();
+  geometry.num_vertices = vertices.size();
+  for (const auto &lod : indices) {
+    geometry.first_index.push_back(indices_.size());
+    geometry.count.push_back(lod.size());
+    std::copy(lod.begin(), lod.end(), std::back_inserter(indices_));
+  }
+  std::copy(vertices.begin(), vertices.end(), std::back_inserter(vertices_));
+
+  geometries_.push_back(std::move(geometry));
+  geometry_hash_to_index_.emplace(hash, geometries_.size() - 1);
+  return geometries_.size() - 1;
 }
 
 void MultiDrawIndirect::Receive(
@@ -518,30 +1035,34 @@ void MultiDrawIndirect::Receive(
   mesh_to_num_cmds_.push_back(indices.size());
 
   num_triangles_ += indices[0].size() / 3;
+  mesh_to_geometry_.push_back(RegisterGeometry(vertices, indices));
+  const auto &geometry = geometries_[mesh_to_geometry_.back()];
   for (int i = 0; i < indices.size(); i++) {
     DrawElementsIndirectCommand cmd;
-    cmd.count = indices[i].size();
+    cmd.count = geometry.count[i];
     cmd.instance_count = 0;
-    cmd.first_index = indices_.size();
-    cmd.base_vertex = vertices_.size();
+    cmd.first_index = geometry.first_index[i];
+    cmd.base_vertex = geometry.base_vertex;
     cmd.base_instance = 0;
     commands_.push_back(cmd);
-
-    std::copy(indices[i].begin(), indices[i].end(),
-              std::back_inserter(indices_));
   }
 
-  std::copy(vertices.begin(), vertices.end(), std::back_inserter(vertices_));
-
   Material material;
+  // the padding takes part in the deduplication
+  std::memset(&material, 0, sizeof(material));
   for (int i = 0; i < texture_records.size(); i++) {
     if (!texture_records[i].enabled) {
       material.textures[i] = -1;
-    } else {
+      continue;
+    }
+    uint32_t texture_id = texture_records[i].texture.id();
+    auto it = texture_id_to_index_.find(texture_id);
+    if (it == texture_id_to_index_.end()) {
       textures_.push_back(texture_records[i].texture.Reference());
       texture_handles_.push_back(textures_.back().handle());
-      material.textures[i] = textures_.size() - 1;
+      it = texture_id_to_index_.emplace(texture_id, textures_.size() - 1).first;
     }
+    material.textures[i] = it->second;
   }
   material.ka = material_params.ka;
   material.kd = material_params.kd;
@@ -564,8 +1085,16 @@ void MultiDrawIndirect::Receive(
       texture_records[4].enabled && texture_records[5].enabled &&
       texture_records[4].texture.id() == texture_records[5].texture.id();
 
-  for (int i = 0; i < submission_cache_.item_count; i++) {
+  std::string material_key(reinterpret_cast<const char *>(&material),
+                           sizeof(material));
+  auto [material_it, inserted] =
+      material_to_index_.emplace(material_key, materials_.size());
+  if (inserted) {
     materials_.push_back(material);
+  }
+  mesh_to_material_.push_back(material_it->second);
+
+  for (int i = 0; i < submission_cache_.item_count; i++) {
     bone_matrices_offset_.push_back(num_bone_matrices_ +
                                     submission_cache_.num_bone_matrices * i);
     has_bone_.push_back(has_bone);
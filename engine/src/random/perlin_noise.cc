@@ -2,47 +2,40 @@
 
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <cmath>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <random>
 #include <stdexcept>
+#include <thread>
+
+#include "avx2_target.h"
+#include "cpu_features.h"
 
 using glm::vec3;
-using std::tuple;
-using std::vector;
 
-double PerlinNoise::F(double x) {
-  return 6 * pow(x, 5) - 15 * pow(x, 4) + 10 * pow(x, 3);
+namespace {
+
+// 6t^5 - 15t^4 + 10t^3 and its derivative, in Horner form
+template <typename T>
+inline T Fade(T t) {
+  return t * t * t * (t * (t * 6 - 15) + 10);
 }
 
-double PerlinNoise::DerivativeF(double x) {
-  return 30 * pow(x, 4) - 60 * pow(x, 3) + 30 * pow(x, 2);
+template <typename T>
+inline T DerivativeFade(T t) {
+  return 30 * t * t * (t * (t - 2) + 1);
 }
 
-PerlinNoise::WeightsType PerlinNoise::CalcWeights(double x, double y,
-                                                  double z) const {
-  static auto lerp = [](double a, double b, double t) -> double {
-    return a * (1 - t) + b * t;
-  };
-  vector<double> w(8), xw(4), xyw(2), xyzw(1);
-  int ix = floor(x), iy = floor(y), iz = floor(z);
-  double dx = x - ix, dy = y - iy, dz = z - iz;
-  for (int i = 0; i < 8; i++) {
-    int nix = ix + !!(i & 4);
-    int niy = iy + !!(i & 2);
-    int niz = iz + !!(i & 1);
-    double ndx = dx - !!(i & 4);
-    double ndy = dy - !!(i & 2);
-    double ndz = dz - !!(i & 1);
-    w[i] = Grad(nix, niy, niz, ndx, ndy, ndz);
-  }
-  double wdx = F(dx), wdy = F(dy), wdz = F(dz);
-  for (int i = 0; i < 4; i++) xw[i] = lerp(w[i], w[i + 4], wdx);
-  for (int i = 0; i < 2; i++) xyw[i] = lerp(xw[i], xw[i + 2], wdy);
-  xyzw[0] = lerp(xyw[0], xyw[1], wdz);
-  return WeightsType(w, xw, xyw, xyzw);
+template <typename T>
+inline T Lerp(T a, T b, T t) {
+  return a * (1 - t) + b * t;
 }
 
+}  // namespace
+
 PerlinNoise::PerlinNoise(int perm_size, int seed) : PERM_SIZE(perm_size) {
   if (perm_size != (perm_size & -perm_size)) {
     fmt::print(stderr, "[error] perm_size != (perm_size & -perm_size)\n");
@@ -57,22 +50,66 @@ PerlinNoise::PerlinNoise(int perm_size, int seed) : PERM_SIZE(perm_size) {
   }
 }
 
-double PerlinNoise::Noise(double x, double y, double z) const {
-  using std::ignore;
-  vector<double> xyzw;
-  std::tie(ignore, ignore, ignore, xyzw) = CalcWeights(x, y, z);
-  return xyzw[0];
+// the corners of the cell are indexed by x * 4 + y * 2 + z, each has a value
+// w and a gradient g, which are blended by the fade weights of the position
+// in the cell
+template <typename T>
+T PerlinNoise::NoiseImpl(T x, T y, T z, glm::vec<3, T> *gradient) const {
+  int mask = PERM_SIZE - 1;
+  T fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+  T d[3] = {x - fx, y - fy, z - fz};
+  int ix[2] = {int(fx) & mask, (int(fx) + 1) & mask};
+  int iy[2] = {int(fy) & mask, (int(fy) + 1) & mask};
+  int iz[2] = {int(fz) & mask, (int(fz) + 1) & mask};
+
+  T w[8], g[3][8];
+  for (int i = 0; i < 8; i++) {
+    int bx = (i >> 2) & 1, by = (i >> 1) & 1, bz = i & 1;
+    int h = perm_random_[perm_random_[perm_random_[ix[bx]] + iy[by]] + iz[bz]] &
+            15;
+    T nd[3] = {d[0] - T(bx), d[1] - T(by), d[2] - T(bz)};
+    // without branches, the bits of h are random
+    int u_is_x = (h < 8) | (h == 12) | (h == 13);
+    int v_is_y = (h < 4) | (h == 12) | (h == 13);
+    int su = 1 - ((h & 1) << 1), sv = 1 - (h & 2);
+    T u = nd[1 - u_is_x], v = nd[2 - v_is_y];
+    w[i] = u * T(su) + v * T(sv);
+    g[0][i] = T(u_is_x * su);
+    g[1][i] = T((1 - u_is_x) * su + v_is_y * sv);
+    g[2][i] = T((1 - v_is_y) * sv);
+  }
+
+  T wx = Fade(d[0]), wy = Fade(d[1]), wz = Fade(d[2]);
+  auto trilerp = [&](const T *c) {
+    T xw[4], xyw[2];
+    for (int i = 0; i < 4; i++) xw[i] = Lerp(c[i], c[i + 4], wx);
+    for (int i = 0; i < 2; i++) xyw[i] = Lerp(xw[i], xw[i + 2], wy);
+    return Lerp(xyw[0], xyw[1], wz);
+  };
+  T xw[4], xyw[2];
+  for (int i = 0; i < 4; i++) xw[i] = Lerp(w[i], w[i + 4], wx);
+  for (int i = 0; i < 2; i++) xyw[i] = Lerp(xw[i], xw[i + 2], wy);
+  T value = Lerp(xyw[0], xyw[1], wz);
+  if (gradient == nullptr) return value;
+
+  // through the fade weights
+  T dwx = DerivativeFade(d[0]), dwy = DerivativeFade(d[1]),
+    dwz = DerivativeFade(d[2]);
+  T dxw[4], dxyw[2];
+  for (int i = 0; i < 4; i++) dxw[i] = (w[i + 4] - w[i]) * dwx;
+  for (int i = 0; i < 2; i++) dxyw[i] = Lerp(dxw[i], dxw[i + 2], wy);
+  T fade_x = Lerp(dxyw[0], dxyw[1], wz);
+  for (int i = 0; i < 2; i++) dxyw[i] = (xw[i + 2] - xw[i]) * dwy;
+  T fade_y = Lerp(dxyw[0], dxyw[1], wz);
+  T fade_z = (xyw[1] - xyw[0]) * dwz;
+  // and through the corner values
+  *gradient = glm::vec<3, T>(fade_x + trilerp(g[0]), fade_y + trilerp(g[1]),
+                             fade_z + trilerp(g[2]));
+  return value;
 }
 
-double PerlinNoise::Grad(int x, int y, int z, double dx, double dy,
-                         double dz) const {
-  x &= PERM_SIZE - 1;
-  y &= PERM_SIZE - 1;
-  z &= PERM_SIZE - 1;
-  int h = perm_random_[perm_random_[perm_random_[x] + y] + z] & 15;
-  double u = h < 8 || h == 12 || h == 13 ? dx : dy;
-  double v = h < 4 || h == 12 || h == 13 ? dy : dz;
-  return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+double PerlinNoise::Noise(double x, double y, double z) const {
+  return NoiseImpl<double>(x, y, z, nullptr);
 }
 
 double PerlinNoise::Noise(vec3 position) const {
@@ -80,36 +117,9 @@ double PerlinNoise::Noise(vec3 position) const {
 }
 
 vec3 PerlinNoise::DerivativeNoise(double x, double y, double z) const {
-  vec3 ans;
-  vector<double> w, xw, xyw, xyzw;
-  std::tie(w, xw, xyw, xyzw) = CalcWeights(x, y, z);
-  double dx = x - floor(x), dy = y - floor(y), dz = z - floor(z);
-  {
-    // x
-    vector<double> dxw(4), dxyw(2), dxyzw(1);
-    for (int i = 0; i < 4; i++) dxw[i] = (w[i + 4] - w[i]) * DerivativeF(dx);
-    for (int i = 0; i < 2; i++)
-      dxyw[i] = dxw[i] * (1 - F(dy)) + dxw[i + 2] * F(dy);
-    for (int i = 0; i < 1; i++)
-      dxyzw[i] = dxyw[i] * (1 - F(dz)) + dxyw[i + 1] * F(dz);
-    ans.x = dxyzw[0];
-  }
-  {
-    // y
-    vector<double> dxyw(2), dxyzw(1);
-    for (int i = 0; i < 2; i++) dxyw[i] = (xw[i + 2] - xw[i]) * DerivativeF(dy);
-    for (int i = 0; i < 1; i++)
-      dxyzw[i] = dxyw[i] * (1 - F(dz)) + dxyw[i + 1] * F(dz);
-    ans.y = dxyzw[0];
-  }
-  {
-    // z
-    vector<double> dxyzw(1);
-    for (int i = 0; i < 1; i++)
-      dxyzw[i] = (xyw[i + 1] - xyw[i]) * DerivativeF(dz);
-    ans.z = dxyzw[0];
-  }
-  return ans;
+  glm::dvec3 gradient;
+  NoiseImpl<double>(x, y, z, &gradient);
+  return vec3(gradient);
 }
 
 vec3 PerlinNoise::DerivativeNoise(vec3 position) const {
@@ -130,4 +140,218 @@ double PerlinNoise::Turbulent(glm::vec3 position, uint32_t depth) const {
   }
   res /= total_weight;
   return res;
-}
\ No newline at end of file
+}
+
+void PerlinNoise::NoiseScalar(const float *xs, const float *ys,
+                              const float *zs, float *values,
+                              glm::vec3 *gradients, size_t begin,
+                              size_t end) const {
+  for (size_t i = begin; i < end; i++) {
+    values[i] = NoiseImpl<float>(xs[i], ys[i], zs[i],
+                                 gradients ? gradients + i : nullptr);
+  }
+}
+
+#ifdef ENGINE_AVX2
+
+namespace {
+
+AVX2_TARGET inline __m256 Lerp8(__m256 a, __m256 b, __m256 t) {
+  __m256 one = _mm256_set1_ps(1);
+  return _mm256_add_ps(_mm256_mul_ps(a, _mm256_sub_ps(one, t)),
+                       _mm256_mul_ps(b, t));
+}
+
+AVX2_TARGET inline __m256 Fade8(__m256 t) {
+  __m256 inner = _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6)),
+                               _mm256_set1_ps(15));
+  inner = _mm256_add_ps(_mm256_mul_ps(t, inner), _mm256_set1_ps(10));
+  return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+}
+
+AVX2_TARGET inline __m256 DerivativeFade8(__m256 t) {
+  __m256 inner = _mm256_mul_ps(t, _mm256_sub_ps(t, _mm256_set1_ps(2)));
+  inner = _mm256_add_ps(inner, _mm256_set1_ps(1));
+  return _mm256_mul_ps(
+      _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(30), t), t), inner);
+}
+
+AVX2_TARGET inline __m256 Trilerp8(const __m256 *c, __m256 wx, __m256 wy,
+                                   __m256 wz) {
+  __m256 xw[4], xyw[2];
+  for (int i = 0; i < 4; i++) xw[i] = Lerp8(c[i], c[i + 4], wx);
+  for (int i = 0; i < 2; i++) xyw[i] = Lerp8(xw[i], xw[i + 2], wy);
+  return Lerp8(xyw[0], xyw[1], wz);
+}
+
+// NoiseImpl<float>() on 8 points at once
+AVX2_TARGET void NoiseAVX2Kernel(const int *perm, int perm_size,
+                                 const float *xs, const float *ys,
+                                 const float *zs, float *values,
+                                 glm::vec3 *gradients, size_t end) {
+  const __m256i mask = _mm256_set1_epi32(perm_size - 1);
+  const __m256i int_one = _mm256_set1_epi32(1);
+  const __m256 one = _mm256_set1_ps(1);
+  for (size_t p = 0; p < end; p += 8) {
+    __m256 x = _mm256_loadu_ps(xs + p), y = _mm256_loadu_ps(ys + p),
+           z = _mm256_loadu_ps(zs + p);
+    __m256 fx = _mm256_floor_ps(x), fy = _mm256_floor_ps(y),
+           fz = _mm256_floor_ps(z);
+    __m256 d[3] = {_mm256_sub_ps(x, fx), _mm256_sub_ps(y, fy),
+                   _mm256_sub_ps(z, fz)};
+    __m256i ix[2], iy[2], iz[2];
+    __m256i ifx = _mm256_cvttps_epi32(fx), ify = _mm256_cvttps_epi32(fy),
+            ifz = _mm256_cvttps_epi32(fz);
+    ix[0] = _mm256_and_si256(ifx, mask);
+    ix[1] = _mm256_and_si256(_mm256_add_epi32(ifx, int_one), mask);
+    iy[0] = _mm256_and_si256(ify, mask);
+    iy[1] = _mm256_and_si256(_mm256_add_epi32(ify, int_one), mask);
+    iz[0] = _mm256_and_si256(ifz, mask);
+    iz[1] = _mm256_and_si256(_mm256_add_epi32(ifz, int_one), mask);
+
+    __m256i px[2] = {_mm256_i32gather_epi32(perm, ix[0], 4),
+                     _mm256_i32gather_epi32(perm, ix[1], 4)};
+    __m256 w[8], g[3][8];
+    for (int bx = 0; bx < 2; bx++) {
+      for (int by = 0; by < 2; by++) {
+        __m256i pxy = _mm256_i32gather_epi32(
+            perm, _mm256_add_epi32(px[bx], iy[by]), 4);
+        for (int bz = 0; bz < 2; bz++) {
+          int i = bx * 4 + by * 2 + bz;
+          __m256i h = _mm256_and_si256(
+              _mm256_i32gather_epi32(perm, _mm256_add_epi32(pxy, iz[bz]), 4),
+              _mm256_set1_epi32(15));
+          __m256 ndx = bx ? _mm256_sub_ps(d[0], one) : d[0];
+          __m256 ndy = by ? _mm256_sub_ps(d[1], one) : d[1];
+          __m256 ndz = bz ? _mm256_sub_ps(d[2], one) : d[2];
+          __m256i is_12_or_13 =
+              _mm256_or_si256(_mm256_cmpeq_epi32(h, _mm256_set1_epi32(12)),
+                              _mm256_cmpeq_epi32(h, _mm256_set1_epi32(13)));
+          __m256 u_is_x = _mm256_castsi256_ps(_mm256_or_si256(
+              _mm256_cmpgt_epi32(_mm256_set1_epi32(8), h), is_12_or_13));
+          __m256 v_is_y = _mm256_castsi256_ps(_mm256_or_si256(
+              _mm256_cmpgt_epi32(_mm256_set1_epi32(4), h), is_12_or_13));
+          __m256 u = _mm256_blendv_ps(ndy, ndx, u_is_x);
+          __m256 v = _mm256_blendv_ps(ndz, ndy, v_is_y);
+          // the signs of u and v from the lowest bits
+          __m256 u_sign = _mm256_castsi256_ps(
+              _mm256_slli_epi32(_mm256_and_si256(h, int_one), 31));
+          __m256 v_sign = _mm256_castsi256_ps(_mm256_slli_epi32(
+              _mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+          w[i] = _mm256_add_ps(_mm256_xor_ps(u, u_sign),
+                               _mm256_xor_ps(v, v_sign));
+          __m256 su = _mm256_xor_ps(one, u_sign);
+          __m256 sv = _mm256_xor_ps(one, v_sign);
+          g[0][i] = _mm256_and_ps(u_is_x, su);
+          g[1][i] = _mm256_add_ps(_mm256_andnot_ps(u_is_x, su),
+                                  _mm256_and_ps(v_is_y, sv));
+          g[2][i] = _mm256_andnot_ps(v_is_y, sv);
+        }
+      }
+    }
+
+    __m256 wx = Fade8(d[0]), wy = Fade8(d[1]), wz = Fade8(d[2]);
+    __m256 xw[4], xyw[2];
+    for (int i = 0; i < 4; i++) xw[i] = Lerp8(w[i], w[i + 4], wx);
+    for (int i = 0; i < 2; i++) xyw[i] = Lerp8(xw[i], xw[i + 2], wy);
+    _mm256_storeu_ps(values + p, Lerp8(xyw[0], xyw[1], wz));
+    if (gradients == nullptr) continue;
+
+    __m256 dwx = DerivativeFade8(d[0]), dwy = DerivativeFade8(d[1]),
+           dwz = DerivativeFade8(d[2]);
+    __m256 dxw[4], dxyw[2];
+    for (int i = 0; i < 4; i++) {
+      dxw[i] = _mm256_mul_ps(_mm256_sub_ps(w[i + 4], w[i]), dwx);
+    }
+    for (int i = 0; i < 2; i++) dxyw[i] = Lerp8(dxw[i], dxw[i + 2], wy);
+    __m256 fade_x = Lerp8(dxyw[0], dxyw[1], wz);
+    for (int i = 0; i < 2; i++) {
+      dxyw[i] = _mm256_mul_ps(_mm256_sub_ps(xw[i + 2], xw[i]), dwy);
+    }
+    __m256 fade_y = Lerp8(dxyw[0], dxyw[1], wz);
+    __m256 fade_z = _mm256_mul_ps(_mm256_sub_ps(xyw[1], xyw[0]), dwz);
+    float gradient[3][8];
+    _mm256_storeu_ps(gradient[0],
+                     _mm256_add_ps(fade_x, Trilerp8(g[0], wx, wy, wz)));
+    _mm256_storeu_ps(gradient[1],
+                     _mm256_add_ps(fade_y, Trilerp8(g[1], wx, wy, wz)));
+    _mm256_storeu_ps(gradient[2],
+                     _mm256_add_ps(fade_z, Trilerp8(g[2], wx, wy, wz)));
+    for (int i = 0; i < 8; i++) {
+      gradients[p + i] =
+          vec3(gradient[0][i], gradient[1][i], gradient[2][i]);
+    }
+  }
+}
+
+}  // namespace
+
+void PerlinNoise::NoiseAVX2(const float *xs, const float *ys,
+                            const float *zs, float *values,
+                            glm::vec3 *gradients, size_t end) const {
+  NoiseAVX2Kernel(perm_random_.data(), PERM_SIZE, xs, ys, zs, values,
+                  gradients, end);
+}
+
+#else
+
+void PerlinNoise::NoiseAVX2(const float *xs, const float *ys,
+                            const float *zs, float *values,
+                            glm::vec3 *gradients, size_t end) const {}
+
+#endif
+
+void PerlinNoise::Noise(const float *xs, const float *ys, const float *zs,
+                        float *out, size_t n) const {
+  NoiseAndGradient(xs, ys, zs, out, nullptr, n);
+}
+
+void PerlinNoise::NoiseAndGradient(const float *xs, const float *ys,
+                                   const float *zs, float *values,
+                                   glm::vec3 *gradients, size_t n) const {
+  size_t end = cpu_features::AVX2Enabled() ? n / 8 * 8 : 0;
+  if (end > 0) NoiseAVX2(xs, ys, zs, values, gradients, end);
+  NoiseScalar(xs, ys, zs, values, gradients, end, n);
+}
+
+void PerlinNoise::Turbulent(glm::vec2 origin, glm::vec2 step, float z,
+                            uint32_t width, uint32_t height, uint32_t depth,
+                            float *out) const {
+  if (depth == 0) throw std::invalid_argument("");
+  uint32_t num_tasks = std::max(1u, std::thread::hardware_concurrency());
+  uint32_t chunk_size = (height + num_tasks - 1) / num_tasks;
+  std::vector<std::future<void>> tasks;
+  for (uint32_t begin = 0; begin < height; begin += chunk_size) {
+    uint32_t end = std::min(begin + chunk_size, height);
+    tasks.push_back(std::async(std::launch::async, [&, begin, end]() {
+      std::vector<float> xs(width), ys(width), zs(width), noise(width);
+      std::vector<double> res(width);
+      for (uint32_t j = begin; j < end; j++) {
+        std::fill(res.begin(), res.end(), 0.0);
+        double weight = 1;
+        double scale = 1;
+        double total_weight = 0;
+        for (uint32_t octave = 0; octave < depth; octave++) {
+          // as Turbulent() scales the float position
+          for (uint32_t i = 0; i < width; i++) {
+            glm::vec3 position(origin.x + i * step.x, origin.y + j * step.y,
+                               z);
+            position *= float(scale);
+            xs[i] = position.x;
+            ys[i] = position.y;
+            zs[i] = position.z;
+          }
+          Noise(xs.data(), ys.data(), zs.data(), noise.data(), width);
+          for (uint32_t i = 0; i < width; i++) res[i] += noise[i] * weight;
+          total_weight += weight;
+          weight *= 0.5;
+          scale *= 2;
+        }
+        for (uint32_t i = 0; i < width; i++) {
+          out[size_t(j) * width + i] = res[i] / total_weight;
+        }
+      }
+    }));
+  }
+  for (auto &task : tasks) task.get();
+}
@@ -1,61 +1,352 @@
 #include "random/poisson_disk_generator.h"
 
+#include <algorithm>
+#include <cmath>
 #include <glm/gtc/constants.hpp>
+#include <limits>
+
+#include "parallel.h"
+#include "random/philox.h"
+
+namespace {
+
+template <int N>
+using Vec = glm::vec<N, float>;
+template <int N>
+using IVec = glm::vec<N, int32_t>;
+
+// the shadow kernels are the same on every run
+constexpr uint32_t kShadowKernelSeed = 0;
+// the random points thrown in a tile without neighbours until one fits
+constexpr uint32_t kNumSeedDarts = 16;
+
+// the background grid, a point or infinity per cell of radius / sqrt(N), so
+// that a cell holds at most a point. It is padded with 2 empty cells on each
+// side, so the neighbourhoods of the cells in the domain need no bounds checks
+template <int N>
+class Grid {
+ public:
+  static constexpr int32_t kPadding = 2;
+
+  Grid(Vec<N> extent, float radius)
+      : extent_(extent),
+        radius_(radius),
+        cell_size_(radius / std::sqrt(float(N))) {
+    size_t stride = 1;
+    for (int i = N - 1; i >= 0; i--) {
+      size_[i] = std::max(1, int32_t(std::ceil(extent[i] / cell_size_)));
+      strides_[i] = stride;
+      stride *= size_[i] + 2 * kPadding;
+    }
+    cells_.resize(stride, Vec<N>(std::numeric_limits<float>::infinity()));
+
+    // the cells up to 2 away, but those whose points are all a radius away,
+    // like the corners of the 5^2 cells in 2D; the nearest first, as they are
+    // the likeliest to reject a candidate
+    std::vector<std::pair<int32_t, ptrdiff_t>> offsets;
+    int32_t num_offsets = 1;
+    for (int i = 0; i < N; i++) num_offsets *= 2 * kPadding + 1;
+    for (int32_t o = 0; o < num_offsets; o++) {
+      int32_t distance2 = 0, min_distance2 = 0;
+      ptrdiff_t offset = 0;
+      for (int i = 0, rest = o; i < N; i++, rest /= 2 * kPadding + 1) {
+        int32_t d = rest % (2 * kPadding + 1) - kPadding;
+        int32_t min_d = std::max(std::abs(d) - 1, 0);
+        distance2 += d * d;
+        min_distance2 += min_d * min_d;
+        offset += d * ptrdiff_t(strides_[i]);
+      }
+      // in cells, the radius is sqrt(N)
+      if (min_distance2 < N) offsets.emplace_back(distance2, offset);
+    }
+    std::stable_sort(offsets.begin(), offsets.end(),
+                     [](const auto &a, const auto &b) {
+                       return a.first < b.first;
+                     });
+    for (const auto &[distance2, offset] : offsets) {
+      offsets_.push_back(offset);
+    }
+  }
+
+  inline const IVec<N> &size() const { return size_; }
+  inline float radius() const { return radius_; }
+  inline float cell_size() const { return cell_size_; }
+
+  inline bool Contains(Vec<N> p) const {
+    bool contains = true;
+    for (int i = 0; i < N; i++) contains &= 0 <= p[i] && p[i] < extent_[i];
+    return contains;
+  }
+  inline IVec<N> Cell(Vec<N> p) const {
+    IVec<N> cell;
+    for (int i = 0; i < N; i++) {
+      cell[i] = std::min(int32_t(p[i] / cell_size_), size_[i] - 1);
+    }
+    return cell;
+  }
+  inline size_t Index(IVec<N> cell) const {
+    size_t index = 0;
+    for (int i = 0; i < N; i++) index += (cell[i] + kPadding) * strides_[i];
+    return index;
+  }
+  inline const Vec<N> &at(size_t index) const { return cells_[index]; }
+  inline bool empty(size_t index) const {
+    return cells_[index][0] == std::numeric_limits<float>::infinity();
+  }
+
+  // whether p is a radius away from the points around its cell
+  bool Fits(Vec<N> p, size_t index) const {
+    float radius2 = radius_ * radius_;
+    for (ptrdiff_t offset : offsets_) {
+      Vec<N> d = cells_[index + offset] - p;
+      if (glm::dot(d, d) < radius2) return false;
+    }
+    return true;
+  }
+  inline void Insert(Vec<N> p, size_t index) { cells_[index] = p; }
+
+ private:
+  Vec<N> extent_;
+  float radius_, cell_size_;
+  IVec<N> size_;
+  size_t strides_[N];
+  std::vector<ptrdiff_t> offsets_;
+  // row-major in x
+  std::vector<Vec<N>> cells_;
+};
+
+// the candidates around an active point are on the sphere of
+// (1 + kEpsilon) * radius, in a fixed set of directions turned by a random
+// rotation per active point (Roberts' variant of Bridson's algorithm) rather
+// than random in the shell of [radius, 2 * radius): the points pack closer
+// with fewer candidates, and the trigonometry is per active point
+constexpr uint32_t kNumCandidates2D = 16;
+constexpr uint32_t kNumCandidates3D = 32;
+constexpr float kEpsilon = 1e-3f;
+
+template <int N>
+constexpr uint32_t kNumCandidates = N == 2 ? kNumCandidates2D
+                                           : kNumCandidates3D;
+
+// evenly around the circle from a random angle, of the word y
+void Candidates(glm::vec2 p, float radius, glm::uvec4 words,
+                glm::vec2 *candidates) {
+  constexpr float kStep = 2 * glm::pi<float>() / kNumCandidates2D;
+  float theta = PhiloxUnitFloat(words.y) * kStep;
+  float distance = radius * (1 + kEpsilon);
+  glm::vec2 direction(std::cos(theta), std::sin(theta));
+  glm::vec2 step(std::cos(kStep), std::sin(kStep));
+  for (uint32_t i = 0; i < kNumCandidates2D; i++) {
+    candidates[i] = p + direction * distance;
+    direction = glm::vec2(direction.x * step.x - direction.y * step.y,
+                          direction.x * step.y + direction.y * step.x);
+  }
+}
+
+// a spherical Fibonacci set turned by a uniform random rotation, from the
+// unit quaternion of 3 random words of yzw (Shoemake, "Uniform Random
+// Rotations")
+void Candidates(glm::vec3 p, float radius, glm::uvec4 words,
+                glm::vec3 *candidates) {
+  static const std::vector<glm::vec3> kDirections = []() {
+    std::vector<glm::vec3> directions;
+    float golden_angle = glm::pi<float>() * (3 - std::sqrt(5.0f));
+    for (uint32_t i = 0; i < kNumCandidates3D; i++) {
+      float z = 1 - (2 * i + 1.0f) / kNumCandidates3D;
+      float r = std::sqrt(1 - z * z);
+      directions.emplace_back(r * std::cos(golden_angle * i),
+                              r * std::sin(golden_angle * i), z);
+    }
+    return directions;
+  }();
+  float u = PhiloxUnitFloat(words.y);
+  float theta1 = PhiloxUnitFloat(words.z) * 2 * glm::pi<float>();
+  float theta2 = PhiloxUnitFloat(words.w) * 2 * glm::pi<float>();
+  float r1 = std::sqrt(1 - u), r2 = std::sqrt(u);
+  float x = r1 * std::sin(theta1), y = r1 * std::cos(theta1);
+  float z = r2 * std::sin(theta2), w = r2 * std::cos(theta2);
+  glm::mat3 rotation(
+      glm::vec3(1 - 2 * (y * y + z * z), 2 * (x * y + w * z),
+                2 * (x * z - w * y)),
+      glm::vec3(2 * (x * y - w * z), 1 - 2 * (x * x + z * z),
+                2 * (y * z + w * x)),
+      glm::vec3(2 * (x * z + w * y), 2 * (y * z - w * x),
+                1 - 2 * (x * x + y * y)));
+  float distance = radius * (1 + kEpsilon);
+  for (uint32_t i = 0; i < kNumCandidates3D; i++) {
+    candidates[i] = p + rotation * (kDirections[i] * distance);
+  }
+}
+
+template <int N>
+bool InCells(IVec<N> cell, IVec<N> cell_min, IVec<N> cell_max) {
+  bool in_cells = true;
+  for (int i = 0; i < N; i++) {
+    in_cells &= cell_min[i] <= cell[i] && cell[i] < cell_max[i];
+  }
+  return in_cells;
+}
+
+// grows points from the active ones until none is left or there are
+// max_points, in the cells of [cell_min, cell_max); the random words are those
+// of the stream under the key, drawn in order
+template <int N>
+void Grow(Grid<N> *grid, std::vector<Vec<N>> active, IVec<N> cell_min,
+          IVec<N> cell_max, size_t max_points, glm::uvec2 key,
+          glm::uvec2 stream, std::vector<Vec<N>> *points) {
+  uint32_t draw = 0;
+  auto random = [&]() {
+    return Philox4x32(glm::uvec4(stream, draw++, 0), key);
+  };
+  float radius = grid->radius();
+  while (!active.empty() && points->size() < max_points) {
+    uint32_t i = (uint64_t(random().x) * active.size()) >> 32;
+    Vec<N> candidates[kNumCandidates<N>];
+    Candidates(active[i], radius, random(), candidates);
+    bool found = false;
+    for (uint32_t k = 0; k < kNumCandidates<N> && !found; k++) {
+      Vec<N> candidate = candidates[k];
+      if (!grid->Contains(candidate)) continue;
+      IVec<N> cell = grid->Cell(candidate);
+      if (!InCells<N>(cell, cell_min, cell_max)) continue;
+      size_t index = grid->Index(cell);
+      if (!grid->Fits(candidate, index)) continue;
+      grid->Insert(candidate, index);
+      points->push_back(candidate);
+      active.push_back(candidate);
+      found = true;
+    }
+    // retired
+    if (!found) {
+      active[i] = active.back();
+      active.pop_back();
+    }
+  }
+}
+
+// up to num_points in [0, 1)^N, grown from the center
+template <int N>
+std::vector<Vec<N>> Generate(uint32_t num_points, uint32_t num_grids,
+                             glm::uvec2 key) {
+  std::vector<Vec<N>> points;
+  if (num_points == 0) return points;
+  Grid<N> grid(Vec<N>(1), std::sqrt(float(N)) / num_grids);
+  Vec<N> center(0.5f);
+  grid.Insert(center, grid.Index(grid.Cell(center)));
+  points.push_back(center);
+  Grow<N>(&grid, {center}, IVec<N>(0), grid.size(), num_points, key,
+          glm::uvec2(0), &points);
+  return points;
+}
+
+}  // namespace
 
 PoissonDiskGenerator::PoissonDiskGenerator() {}
 
+PoissonDiskGenerator::PoissonDiskGenerator(uint32_t seed) : engine_(seed) {}
+
 std::vector<glm::vec2> PoissonDiskGenerator::Generate2D(uint32_t num_points,
                                                         uint32_t num_grids) {
-  std::vector<glm::vec2> samples_2d;
-  std::vector<int32_t> grid;
-  float radius = 1.0 / num_grids * sqrt(2);
+  glm::uvec2 key(engine_(), engine_());
+  return Generate<2>(num_points, num_grids, key);
+}
 
-  auto set_grid = [num_grids, &grid](glm::vec2 coord, int32_t samples_index) {
-    auto grid_coord = glm::ivec2(coord * glm::vec2(num_grids));
-    grid[grid_coord.x * num_grids + grid_coord.y] = samples_index;
-  };
+std::vector<glm::vec3> PoissonDiskGenerator::Generate3D(uint32_t num_points,
+                                                        uint32_t num_grids) {
+  glm::uvec2 key(engine_(), engine_());
+  return Generate<3>(num_points, num_grids, key);
+}
 
-  auto check_collision = [num_grids, radius, &grid,
-                          &samples_2d](glm::vec2 coord) -> bool {
-    auto grid_coord = glm::ivec2(coord * glm::vec2(num_grids));
-    for (int i = std::max(0, grid_coord.x - 2);
-         i <= std::min(grid_coord.x + 2, (int32_t)num_grids - 1); i++)
-      for (int j = std::max(0, grid_coord.y - 2);
-           j <= std::min(grid_coord.y + 2, (int32_t)num_grids - 1); j++) {
-        if (int32_t samples_index = grid[i * num_grids + j]; samples_index >= 0)
-          if (glm::distance(samples_2d[samples_index], coord) < radius)
-            return true;
+std::vector<glm::vec2> PoissonDiskGenerator::GenerateTiled2D(glm::vec2 extent,
+                                                             float radius) {
+  glm::uvec2 key(engine_(), engine_());
+  Grid<2> grid(extent, radius);
+  glm::ivec2 num_tiles = (grid.size() + int32_t(TILE_SIZE - 1)) /
+                         int32_t(TILE_SIZE);
+  std::vector<std::vector<glm::vec2>> tile_points(num_tiles.x * num_tiles.y);
+
+  for (int32_t phase = 0; phase < 4; phase++) {
+    std::vector<glm::ivec2> tiles;
+    for (int32_t x = 0; x < num_tiles.x; x++) {
+      for (int32_t y = 0; y < num_tiles.y; y++) {
+        if ((x & 1) * 2 + (y & 1) == phase) tiles.emplace_back(x, y);
       }
-    return false;
-  };
+    }
+    ParallelFor(tiles.size(), [&](uint32_t i) {
+      glm::ivec2 tile = tiles[i];
+      glm::ivec2 cell_min = tile * int32_t(TILE_SIZE);
+      glm::ivec2 cell_max =
+          glm::min(cell_min + int32_t(TILE_SIZE), grid.size());
+      std::vector<glm::vec2> *points =
+          &tile_points[tile.x * num_tiles.y + tile.y];
 
-  auto dis = std::uniform_real_distribution<float>(0, 1);
-
-  samples_2d.resize(1, glm::vec2(0.5, 0.5));
-  grid.resize(num_grids * num_grids, -1);
-  set_grid(samples_2d[0], 0);
-
-  uint32_t head = 0;
-  while (head < samples_2d.size() && head < num_points) {
-    glm::vec2 coord = samples_2d[head];
-    head += 1;
-
-    for (int i = 0; i < 100; i++) {
-      float theta = dis(engine_) * 2 * glm::pi<float>();
-      glm::vec2 offset =
-          glm::vec2(cos(theta), sin(theta)) * (1 + dis(engine_)) * radius;
-      glm::vec2 new_coord = coord + offset;
-
-      if (0 <= new_coord[0] && new_coord[0] < 1 && 0 <= new_coord[1] &&
-          new_coord[1] < 1) {
-        bool collision = check_collision(new_coord);
-        if (!collision && samples_2d.size() < num_points) {
-          samples_2d.push_back(new_coord);
-          set_grid(new_coord, samples_2d.size() - 1);
+      // the points of the earlier phases that are within 2 radii of the
+      // tile, 2 * sqrt(2) cells
+      constexpr int32_t kReach = 3;
+      std::vector<glm::vec2> active;
+      glm::ivec2 reach_min = glm::max(cell_min - kReach, glm::ivec2(0));
+      glm::ivec2 reach_max = glm::min(cell_max + kReach, grid.size());
+      for (int32_t x = reach_min.x; x < reach_max.x; x++) {
+        for (int32_t y = reach_min.y; y < reach_max.y; y++) {
+          size_t index = grid.Index(glm::ivec2(x, y));
+          if (!grid.empty(index)) active.push_back(grid.at(index));
         }
       }
-    }
+
+      // a seed of its own if it has no neighbours yet
+      glm::uvec2 stream(tile);
+      uint32_t draw = 0;
+      glm::vec2 min = glm::vec2(cell_min) * grid.cell_size();
+      glm::vec2 max =
+          glm::min(glm::vec2(cell_max) * grid.cell_size(), extent);
+      while (active.empty() && draw < kNumSeedDarts) {
+        glm::uvec4 words = Philox4x32(glm::uvec4(stream, draw++, 1), key);
+        glm::vec2 seed = glm::mix(min, max,
+                                  glm::vec2(PhiloxUnitFloat(words.x),
+                                            PhiloxUnitFloat(words.y)));
+        if (!grid.Contains(seed)) continue;
+        glm::ivec2 cell = grid.Cell(seed);
+        if (!InCells<2>(cell, cell_min, cell_max)) continue;
+        size_t index = grid.Index(cell);
+        if (!grid.Fits(seed, index)) continue;
+        grid.Insert(seed, index);
+        points->push_back(seed);
+        active.push_back(seed);
+      }
+      Grow<2>(&grid, std::move(active), cell_min, cell_max,
+              std::numeric_limits<size_t>::max(), key, stream, points);
+    });
   }
 
-  return samples_2d;
-}
\ No newline at end of file
+  // in the order of the tiles
+  size_t num_points = 0;
+  for (const auto &points : tile_points) num_points += points.size();
+  std::vector<glm::vec2> points;
+  points.reserve(num_points);
+  for (const auto &tile : tile_points) {
+    points.insert(points.end(), tile.begin(), tile.end());
+  }
+  return points;
+}
+
+const std::vector<glm::vec2> &PoissonDiskGenerator::ShadowKernel2D() {
+  static const std::vector<glm::vec2> kernel = []() {
+    std::vector<glm::vec2> points =
+        PoissonDiskGenerator(kShadowKernelSeed).Generate2D(128, 16);
+    std::shuffle(points.begin(), points.end(), std::default_random_engine{});
+    return points;
+  }();
+  return kernel;
+}
+
+const std::vector<glm::vec4> &PoissonDiskGenerator::ShadowKernel3D() {
+  static const std::vector<glm::vec4> kernel = []() {
+    std::vector<glm::vec3> points =
+        PoissonDiskGenerator(kShadowKernelSeed).Generate3D(128, 8);
+    std::shuffle(points.begin(), points.end(), std::default_random_engine{});
+    std::vector<glm::vec4> padded;
+    for (glm::vec3 p : points) padded.emplace_back(p, 0);
+    return padded;
+  }();
+  return kernel;
+}
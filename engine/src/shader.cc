@@ -179,6 +179,14 @@ void Shader::SetUniform<glm::vec2>(const std::string &identifier,
   glUniform2fv(location, 1, glm::value_ptr(value));
 }
 
+template <>
+void Shader::SetUniform<glm::ivec2>(const std::string &identifier,
+                                    const glm::ivec2 &value) const {
+  auto location = glGetUniformLocation(id_, identifier.c_str());
+  if (location < 0) throw ShaderSettingError(identifier, GetUniformVariables());
+  glUniform2iv(location, 1, glm::value_ptr(value));
+}
+
 template <>
 void Shader::SetUniform<glm::vec3>(const std::string &identifier,
                                    const glm::vec3 &value) const {
@@ -0,0 +1,202 @@
+#include "shadows/cascade_fitting.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+
+int32_t FloorDiv(int32_t a, int32_t b) {
+  return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+int32_t Mod(int32_t a, int32_t b) { return a - FloorDiv(a, b) * b; }
+
+}  // namespace
+
+CascadeFitter::CascadeFitter(uint32_t width, uint32_t height,
+                             const Options &options)
+    : size_(width, height), options_(options) {}
+
+void CascadeFitter::set_light_direction(glm::vec3 direction) {
+  auto up = glm::vec3(0, 1, 0);
+  if (std::abs(std::abs(glm::dot(up, glm::normalize(direction))) - 1) <
+      1e-8f) {
+    up = glm::vec3(0, 0, 1);
+  }
+  light_rotation_ = glm::mat3(glm::lookAt(glm::vec3(0), direction, up));
+  Reset();
+}
+
+CascadeFitter::Result CascadeFitter::Fit(
+    const std::vector<glm::vec3> &slice_corners, float caster_distance,
+    bool force_refit) {
+  glm::vec3 center = glm::vec3(0);
+  for (auto corner : slice_corners) center += corner;
+  center /= slice_corners.size();
+  float radius = 0;
+  for (auto corner : slice_corners) {
+    radius = std::max(radius, glm::distance(corner, center));
+  }
+  // the radius only changes by rounding errors when the camera turns
+  radius = std::ceil(radius * 64) / 64;
+  center = light_rotation_ * center;
+
+  // follows a speed up at once and a slow down slowly
+  if (fitted_) {
+    float motion = glm::length(glm::vec2(center - previous_center_));
+    speed_ = std::max(motion, glm::mix(speed_, motion, 0.05f));
+  }
+  previous_center_ = center;
+  float margin = std::clamp(speed_ * options_.margin_frames,
+                            options_.min_margin * radius,
+                            options_.max_margin * radius);
+  float half_extent = radius + margin;
+
+  Result result;
+  if (!fitted_ || force_refit) {
+    Refit(center, half_extent, caster_distance);
+    result.update = Update::kRefit;
+    return result;
+  }
+
+  // e.g. the field of view has grown
+  bool undersized = radius * (1 + 0.5f * options_.min_margin) > half_extent_;
+  // e.g. the camera has stopped, the resolution is worth a redraw
+  bool oversized = half_extent < 0.6f * half_extent_;
+  bool contains = Contains(center, radius);
+  if (contains && !undersized && !oversized) return result;
+
+  if (options_.scrolling && !undersized && !oversized) {
+    glm::ivec2 grid_min =
+        glm::ivec2(glm::round(glm::vec2(center) / texel_size_)) - size_ / 2;
+    glm::ivec2 delta = grid_min - grid_min_;
+    if (std::abs(delta.x) < size_.x && std::abs(delta.y) < size_.y &&
+        ContainsDepth(center, radius)) {
+      // the strip along y over the whole height, then the rest along x
+      glm::ivec2 kept_min = grid_min, kept_size = size_;
+      if (delta.x > 0) {
+        result.exposed.push_back(
+            {glm::ivec2(grid_min_.x + size_.x, grid_min.y),
+             glm::ivec2(delta.x, size_.y)});
+        kept_size.x -= delta.x;
+      } else if (delta.x < 0) {
+        result.exposed.push_back({grid_min, glm::ivec2(-delta.x, size_.y)});
+        kept_min.x = grid_min_.x;
+        kept_size.x += delta.x;
+      }
+      if (delta.y > 0) {
+        result.exposed.push_back(
+            {glm::ivec2(kept_min.x, grid_min_.y + size_.y),
+             glm::ivec2(kept_size.x, delta.y)});
+      } else if (delta.y < 0) {
+        result.exposed.push_back({glm::ivec2(kept_min.x, grid_min.y),
+                                  glm::ivec2(kept_size.x, -delta.y)});
+      }
+      grid_min_ = grid_min;
+      result.update = Update::kScroll;
+      return result;
+    }
+  }
+
+  Refit(center, half_extent, caster_distance);
+  result.update = Update::kRefit;
+  return result;
+}
+
+void CascadeFitter::Refit(glm::vec3 center, float half_extent,
+                          float caster_distance) {
+  half_extent_ = half_extent;
+  texel_size_ = glm::vec2(2 * half_extent) / glm::vec2(size_);
+  grid_min_ =
+      glm::ivec2(glm::round(glm::vec2(center) / texel_size_)) - size_ / 2;
+  // the depth range does not scroll, twice as deep for the receivers
+  z_min_ = center.z - 2 * half_extent;
+  z_max_ = center.z + 2 * half_extent + caster_distance;
+  caster_distance_ = caster_distance;
+  fitted_ = true;
+}
+
+bool CascadeFitter::Contains(glm::vec3 center, float radius) const {
+  glm::vec2 min = glm::vec2(grid_min_) * texel_size_;
+  glm::vec2 max = glm::vec2(grid_min_ + size_) * texel_size_;
+  return min.x <= center.x - radius && center.x + radius <= max.x &&
+         min.y <= center.y - radius && center.y + radius <= max.y &&
+         ContainsDepth(center, radius);
+}
+
+bool CascadeFitter::ContainsDepth(glm::vec3 center, float radius) const {
+  return z_min_ <= center.z - radius &&
+         center.z + radius <= z_max_ - caster_distance_;
+}
+
+glm::mat4 CascadeFitter::projection_matrix() const {
+  return projection_matrix(rect());
+}
+
+glm::mat4 CascadeFitter::projection_matrix(const TexelRect &rect) const {
+  glm::vec2 min = glm::vec2(rect.min) * texel_size_;
+  glm::vec2 max = glm::vec2(rect.min + rect.size) * texel_size_;
+  // light space looks down -z
+  return glm::ortho(min.x, max.x, min.y, max.y, -z_max_, -z_min_);
+}
+
+glm::mat4 CascadeFitter::sampling_matrix() const {
+  // relative to a multiple of the layer size, which wraps to the same texel,
+  // to keep the precision far from the origin
+  glm::ivec2 origin = glm::ivec2(FloorDiv(grid_min_.x, size_.x) * size_.x,
+                                 FloorDiv(grid_min_.y, size_.y) * size_.y);
+  glm::vec2 extent = glm::vec2(size_) * texel_size_;
+  glm::vec2 offset = glm::vec2(origin) * texel_size_;
+  glm::mat4 m = glm::mat4(1);
+  m[0][0] = 1 / extent.x;
+  m[1][1] = 1 / extent.y;
+  m[2][2] = -1 / (z_max_ - z_min_);
+  m[3][0] = -offset.x / extent.x;
+  m[3][1] = -offset.y / extent.y;
+  m[3][2] = z_max_ / (z_max_ - z_min_);
+  return m * view_matrix();
+}
+
+OBB CascadeFitter::obb() const {
+  OBB obb;
+  obb.min = glm::vec3(glm::vec2(grid_min_) * texel_size_, z_min_);
+  obb.max = glm::vec3(glm::vec2(grid_min_ + size_) * texel_size_, z_max_);
+  obb.set_rotation(glm::transpose(light_rotation_));
+  return obb;
+}
+
+std::vector<CascadeFitter::TexelRect> CascadeFitter::Wrap(
+    const TexelRect &rect) const {
+  // the parts along each axis, split where the grid wraps
+  std::vector<std::pair<int32_t, int32_t>> parts[2];
+  for (int k = 0; k < 2; k++) {
+    int32_t begin = rect.min[k], end = rect.min[k] + rect.size[k];
+    int32_t edge = (FloorDiv(begin, size_[k]) + 1) * size_[k];
+    if (end > edge) {
+      parts[k].push_back({begin, edge - begin});
+      parts[k].push_back({edge, end - edge});
+    } else {
+      parts[k].push_back({begin, end - begin});
+    }
+  }
+  std::vector<TexelRect> ret;
+  for (auto [x, width] : parts[0]) {
+    for (auto [y, height] : parts[1]) {
+      ret.push_back({glm::ivec2(x, y), glm::ivec2(width, height)});
+    }
+  }
+  return ret;
+}
+
+glm::ivec2 CascadeFitter::TextureOffset(const TexelRect &rect) const {
+  return glm::ivec2(Mod(rect.min.x, size_.x), Mod(rect.min.y, size_.y));
+}
+
+CascadeFitter::TexelRect CascadeFitter::GridRect(glm::ivec2 texture_offset,
+                                                 glm::ivec2 size) const {
+  glm::ivec2 min =
+      grid_min_ + glm::ivec2(Mod(texture_offset.x - grid_min_.x, size_.x),
+                             Mod(texture_offset.y - grid_min_.y, size_.y));
+  return {min, size};
+}
@@ -0,0 +1,54 @@
+// clang-format off
+#include <glad/glad.h>
+// clang-format on
+
+#include "shadows/cascade_pool.h"
+
+#include <fmt/core.h>
+
+CascadePool::CascadePool(uint32_t size, uint32_t num_layers)
+    : size_(size), num_layers_(num_layers) {
+  if (size == 0 || num_layers == 0) {
+    fmt::print(stderr, "[error] invalid cascade pool size: {}, {}\n", size,
+               num_layers);
+    exit(1);
+  }
+  for (uint32_t i = 0; i < num_layers; i++) free_layers_.insert(i);
+}
+
+std::optional<std::vector<uint32_t>> CascadePool::Allocate(
+    uint32_t num_layers) {
+  if (num_layers > free_layers_.size()) return std::nullopt;
+  std::vector<uint32_t> layers;
+  for (uint32_t i = 0; i < num_layers; i++) {
+    layers.push_back(*free_layers_.begin());
+    free_layers_.erase(free_layers_.begin());
+  }
+  return layers;
+}
+
+void CascadePool::Free(const std::vector<uint32_t> &layers) {
+  free_layers_.insert(layers.begin(), layers.end());
+}
+
+void CascadePool::CreateTextures() {
+  for (auto fbo : {&fbo_, &static_cache_fbo_}) {
+    std::vector<Texture> empty;
+    // toroidally addressed, see CascadeFitter
+    Texture depth_texture(nullptr, GL_TEXTURE_2D_ARRAY, size_, size_,
+                          num_layers_, GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT,
+                          GL_FLOAT, GL_REPEAT, GL_LINEAR, GL_LINEAR, {}, false);
+    fbo->reset(new FrameBufferObject(empty, depth_texture));
+  }
+  fbo_->depth_texture().MakeResident();
+}
+
+FrameBufferObject *CascadePool::fbo() {
+  if (fbo_ == nullptr) CreateTextures();
+  return fbo_.get();
+}
+
+FrameBufferObject *CascadePool::static_cache_fbo() {
+  if (static_cache_fbo_ == nullptr) CreateTextures();
+  return static_cache_fbo_.get();
+}
@@ -2,6 +2,7 @@
 
 #include <fmt/core.h>
 
+#include <algorithm>
 #include <glm/gtc/matrix_transform.hpp>
 
 bool DirectionalShadow::enable_global_cascade() const {
@@ -12,44 +13,42 @@ uint32_t DirectionalShadow::num_cascades_in_use() const {
   return NUM_MOVING_CASCADES + (uint32_t)enable_global_cascade();
 }
 
-DirectionalShadow::DirectionalShadow(glm::vec3 direction, uint32_t fbo_width,
-                                     uint32_t fbo_height,
+DirectionalShadow::DirectionalShadow(glm::vec3 direction, CascadePool *pool,
                                      std::optional<AABB> global_cascade_aabb,
                                      const Camera *camera)
-    : fbo_width_(fbo_width),
-      fbo_height_(fbo_height),
-      global_cascade_aabb_(global_cascade_aabb),
-      camera_(camera) {
-  std::vector<Texture> empty;
-  Texture depth_texture(nullptr, GL_TEXTURE_2D_ARRAY, fbo_width, fbo_height,
-                        num_cascades_in_use(), GL_DEPTH_COMPONENT,
-                        GL_DEPTH_COMPONENT, GL_FLOAT, GL_CLAMP_TO_EDGE,
-                        GL_LINEAR, GL_LINEAR, {}, false);
-  fbo_.reset(new FrameBufferObject(empty, depth_texture));
-  fbo_->depth_texture().MakeResident();
-
+    : pool_(pool), global_cascade_aabb_(global_cascade_aabb), camera_(camera) {
+  fitters_.resize(num_cascades_in_use(),
+                  CascadeFitter(pool->size(), pool->size(), {}));
+  Allocate();
   direction_ = glm::vec3(0);
   set_direction(direction);
+}
 
-  glGetFloatv(GL_MAX_VIEWPORT_DIMS, &max_viewport_size_.x);
+DirectionalShadow::~DirectionalShadow() { pool_->Free(layers_); }
+
+bool DirectionalShadow::Allocate() {
+  if (allocated()) return true;
+  auto layers = pool_->Allocate(num_cascades_in_use());
+  if (!layers.has_value()) return false;
+  layers_ = layers.value();
+  // the layers held other cascades, e.g. of a light erased since
+  ResetStaticCache();
+  return true;
 }
 
 void DirectionalShadow::InvalidatePreviousCascades() {
-  for (int i = 0; i < NUM_MOVING_CASCADES; i++) {
-    // invalidate previous results
-    cascades_[i].ortho_param.min = glm::vec3(std::numeric_limits<float>::max());
-    cascades_[i].ortho_param.max =
-        glm::vec3(std::numeric_limits<float>::lowest());
+  for (auto &fitter : fitters_) {
+    fitter.set_light_direction(direction_);
   }
 }
 
 void DirectionalShadow::set_direction(glm::vec3 direction) {
   const float zero = 1e-5f;
   if (glm::distance(direction_, direction) > zero) {
+    direction_ = direction;
     InvalidatePreviousCascades();
     set_requires_update();
   }
-  direction_ = direction;
 }
 
 void DirectionalShadow::set_camera(Camera *camera) {
@@ -59,209 +58,95 @@ void DirectionalShadow::set_camera(Camera *camera) {
   set_requires_update();
 }
 
-std::pair<float, float> DirectionalShadow::cascade_plane_distances(
-    uint32_t index) const {
-  float dis = camera_->z_far() - camera_->z_near();
-  float z_near = camera_->z_near() + dis * CASCADE_PLANE_RATIOS[index][0];
-  float z_far = camera_->z_near() + dis * CASCADE_PLANE_RATIOS[index][1];
-  return {z_near, z_far};
-}
-
-bool DirectionalShadow::ShouldUsePreviousFrame(
-    uint32_t index,
-    const std::vector<glm::vec3> &current_frame_frustum_corners) const {
-  float min_x = std::numeric_limits<float>::max();
-  float max_x = std::numeric_limits<float>::lowest();
-  float min_y = std::numeric_limits<float>::max();
-  float max_y = std::numeric_limits<float>::lowest();
-  float min_z = std::numeric_limits<float>::max();
-  float max_z = std::numeric_limits<float>::lowest();
-
-  for (auto corner : current_frame_frustum_corners) {
-    auto corner_view_space =
-        cascades_[index].view_matrix * glm::vec4(corner, 1);
-    min_x = std::min(min_x, corner_view_space.x);
-    max_x = std::max(max_x, corner_view_space.x);
-    min_y = std::min(min_y, corner_view_space.y);
-    max_y = std::max(max_y, corner_view_space.y);
-    min_z = std::min(min_z, corner_view_space.z);
-    max_z = std::max(max_z, corner_view_space.z);
-  }
-
-  glm::vec3 previous_min = cascades_[index].ortho_param.min;
-  glm::vec3 previous_max = cascades_[index].ortho_param.max;
-  return previous_min.x <= min_x && max_x <= previous_max.x &&
-         previous_min.y <= min_y && max_y <= previous_max.y &&
-         previous_min.z <= min_z && max_z <= previous_max.z;
-}
+void DirectionalShadow::set_requires_update() { update_flag_ = true; }
 
-glm::mat4 DirectionalShadow::view_matrix(
-    const std::vector<glm::vec3> &current_frame_frustum_corners) const {
-  auto up = glm::vec3(0, 1, 0);
-  if (std::abs(std::abs(glm::dot(up, glm::normalize(direction_))) - 1) <
-      1e-8f) {
-    up = glm::vec3(0, 0, 1);
-  }
-  glm::vec3 center = glm::vec3(0);
-  for (auto corner : current_frame_frustum_corners) {
-    center += corner;
+DirectionalShadow::CascadeFitInputs DirectionalShadow::FitInputs(
+    const Camera &camera) {
+  CascadeFitInputs inputs;
+  float dis = camera.z_far() - camera.z_near();
+  for (int i = 0; i < NUM_MOVING_CASCADES; i++) {
+    for (int j = 0; j < 2; j++) {
+      inputs.cascade_plane_distances[i][j] =
+          camera.z_near() + dis * CASCADE_PLANE_RATIOS[i][j];
+    }
+    inputs.slice_corners[i] =
+        camera.frustum_corners(inputs.cascade_plane_distances[i][0],
+                               inputs.cascade_plane_distances[i][1]);
   }
-  center /= current_frame_frustum_corners.size();
-  return glm::lookAt(center - direction_, center, up);
-}
-
-AABB DirectionalShadow::ortho_param(
-    const std::vector<glm::vec3> &current_frame_frustum_corners,
-    glm::mat4 view_matrix) const {
-  float min_x = std::numeric_limits<float>::max();
-  float max_x = std::numeric_limits<float>::lowest();
-  float min_y = std::numeric_limits<float>::max();
-  float max_y = std::numeric_limits<float>::lowest();
-  float min_z = std::numeric_limits<float>::max();
-  float max_z = std::numeric_limits<float>::lowest();
 
-  glm::mat4 v = view_matrix;
-
-  for (auto corner : current_frame_frustum_corners) {
-    auto corner_view_space = v * glm::vec4(corner, 1);
-    min_x = std::min(min_x, corner_view_space.x);
-    max_x = std::max(max_x, corner_view_space.x);
-    min_y = std::min(min_y, corner_view_space.y);
-    max_y = std::max(max_y, corner_view_space.y);
-    min_z = std::min(min_z, corner_view_space.z);
-    max_z = std::max(max_z, corner_view_space.z);
+  // the casters between the light and a cascade are kept up to the size of
+  // the camera frustum
+  auto camera_frustum_corners =
+      camera.frustum_corners(camera.z_near(), camera.z_far());
+  glm::vec3 camera_frustum_center = glm::vec3(0);
+  for (auto corner : camera_frustum_corners) camera_frustum_center += corner;
+  camera_frustum_center /= camera_frustum_corners.size();
+  inputs.caster_distance = 0;
+  for (auto corner : camera_frustum_corners) {
+    inputs.caster_distance =
+        std::max(inputs.caster_distance,
+                 glm::distance(corner, camera_frustum_center));
   }
-
-  AABB aabb;
-  aabb.min = glm::vec3(min_x, min_y, min_z);
-  aabb.max = glm::vec3(max_x, max_y, max_z);
-
-  // enlarge AABB
-  auto extent = aabb.extents() * ENLARGE_FACTOR;
-  auto center = aabb.center();
-  aabb.min = center - extent;
-  aabb.max = center + extent;
-
-  return aabb;
-}
-
-glm::mat4 DirectionalShadow::projection_matrix(AABB ortho_param) const {
-  AABB aabb = ortho_param;
-  return glm::ortho(aabb.min.x, aabb.max.x, aabb.min.y, aabb.max.y, aabb.min.z,
-                    aabb.max.z);
-}
-
-OBB DirectionalShadow::obb(
-    const std::vector<glm::vec3> &current_frame_frustum_corners) const {
-  glm::mat4 v = view_matrix(current_frame_frustum_corners);
-  AABB aabb = ortho_param(current_frame_frustum_corners, v);
-
-  glm::mat4 translation = glm::mat4(1);
-  translation[3].x = v[3].x;
-  translation[3].y = v[3].y;
-  translation[3].z = v[3].z;
-
-  glm::mat4 scaling =
-      glm::scale(glm::mat4(1), glm::vec3(glm::length(glm::vec3(v[0])),
-                                         glm::length(glm::vec3(v[1])),
-                                         glm::length(glm::vec3(v[2]))));
-
-  glm::mat4 rotation = glm::mat4(1);
-  for (int i = 0; i < 3; i++)
-    for (int j = 0; j < 3; j++) {
-      rotation[i][j] = v[i][j] / scaling[i][i];
-    }
-
-  OBB obb;
-  glm::mat4 transform = glm::inverse(translation * scaling);
-  obb.min = transform * glm::vec4(aabb.min, 1);
-  obb.max = transform * glm::vec4(aabb.max, 1);
-  obb.set_rotation(glm::inverse(rotation));
-  return obb;
+  return inputs;
 }
 
-void DirectionalShadow::set_requires_update() { update_flag_ = true; }
-
 void DirectionalShadow::UpdateCascades() const {
-  auto camera_frustum_corners =
-      camera_->frustum_corners(camera_->z_near(), camera_->z_far());
-  glm::mat4 camera_frustum_view_matrix =
-      this->view_matrix(camera_frustum_corners);
-  AABB camera_ortho_param =
-      ortho_param(camera_frustum_corners, camera_frustum_view_matrix);
-
+  CascadeFitInputs inputs = FitInputs(*camera_);
   for (int i = 0; i < num_cascades_in_use(); i++) {
-    std::vector<glm::vec3> corners;
-
+    CascadeFitter::Result result;
     if (i < NUM_MOVING_CASCADES) {
-      auto [z_near, z_far] = cascade_plane_distances(i);
-      corners = camera_->frustum_corners(z_near, z_far);
-      bool should_use_previous_frame = ShouldUsePreviousFrame(i, corners);
-      cascades_[i].requires_update = update_flag_ || !should_use_previous_frame;
-      if (!cascades_[i].requires_update) continue;
-      cascades_[i].cascade_plane_distances[0] = z_near;
-      cascades_[i].cascade_plane_distances[1] = z_far;
-    } else {
-      corners = global_cascade_aabb_->corners();
-      cascades_[i].requires_update = update_flag_;
-      if (!cascades_[i].requires_update) continue;
+      result = fitters_[i].Fit(inputs.slice_corners[i], inputs.caster_distance,
+                               update_flag_);
+      cascades_[i].cascade_plane_distances[0] =
+          inputs.cascade_plane_distances[i][0];
+      cascades_[i].cascade_plane_distances[1] =
+          inputs.cascade_plane_distances[i][1];
+    } else if (update_flag_ || !fitters_[i].fitted()) {
+      result = fitters_[i].Fit(global_cascade_aabb_->corners(), 0, true);
+    }
+    cascades_[i].update = result.update;
+    cascades_[i].requires_update =
+        result.update != CascadeFitter::Update::kNone;
+
+    // no cache to keep, the layers are drawn whole once allocated
+    if (!allocated()) continue;
+    if (result.update == CascadeFitter::Update::kRefit) {
+      InvalidateStaticCache(i);
+    } else if (result.update == CascadeFitter::Update::kScroll) {
+      std::vector<LayerRegion> exposed;
+      for (const auto &strip : result.exposed) {
+        for (const auto &part : fitters_[i].Wrap(strip)) {
+          glm::ivec2 offset = fitters_[i].TextureOffset(part);
+          exposed.push_back({uint32_t(offset.x), uint32_t(offset.y),
+                             layers_[i], uint32_t(part.size.x),
+                             uint32_t(part.size.y)});
+        }
+      }
+      ScrollStaticCache(i, exposed);
     }
-
-    cascades_[i].view_matrix = camera_frustum_view_matrix;
-    AABB ortho_param = this->ortho_param(corners, camera_frustum_view_matrix);
-    cascades_[i].ortho_param =
-        AABB(glm::vec3(glm::vec2(ortho_param.min), camera_ortho_param.min.z),
-             glm::vec3(glm::vec2(ortho_param.max), camera_ortho_param.max.z));
-    cascades_[i].projection_matrix =
-        projection_matrix(cascades_[i].ortho_param);
-    cascades_[i].obb = obb(corners);
-    auto [viewport, scale_factor] =
-        this->viewport(corners, camera_ortho_param, camera_frustum_view_matrix);
-    cascades_[i].viewport = viewport;
-    cascades_[i].scale_factor = scale_factor;
   }
-}
-
-std::pair<glm::vec4, glm::vec2> DirectionalShadow::viewport(
-    const std::vector<glm::vec3> &current_frame_frustum_corners,
-    const AABB &camera_ortho_param,
-    glm::mat4 camera_frustum_view_matrix) const {
-  AABB ortho_param = this->ortho_param(current_frame_frustum_corners,
-                                       camera_frustum_view_matrix);
-  glm::vec2 cascade_size = glm::vec2(ortho_param.max.x - ortho_param.min.x,
-                                     ortho_param.max.y - ortho_param.min.y);
-  glm::vec2 camera_size =
-      glm::vec2(camera_ortho_param.max.x - camera_ortho_param.min.x,
-                camera_ortho_param.max.y - camera_ortho_param.min.y);
-  glm::vec2 ratio = glm::vec2(fbo_width_, fbo_height_) / cascade_size;
-  glm::vec2 camera_size_pixels = camera_size * ratio;
-  glm::vec2 cascade_offset =
-      glm::vec2(ortho_param.min.x - camera_ortho_param.min.x,
-                ortho_param.min.y - camera_ortho_param.min.y);
-  glm::vec2 cascade_offset_pixels = cascade_offset * ratio;
 
-  glm::vec2 scale_factor =
-      glm::min(glm::vec2(1), max_viewport_size_ / camera_size_pixels);
-
-  glm::vec4 viewport = glm::vec4(-cascade_offset_pixels * scale_factor,
-                                 camera_size_pixels * scale_factor);
-  return {viewport, scale_factor};
+  cascades_updated_ = true;
 }
 
 std::vector<OBB> DirectionalShadow::cascade_obbs() const {
   std::vector<OBB> obbs;
   obbs.reserve(num_cascades_in_use());
   for (int i = 0; i < num_cascades_in_use(); i++) {
-    obbs.push_back(cascades_[i].obb);
+    obbs.push_back(fitters_[i].obb());
   }
   return obbs;
 }
 
+bool DirectionalShadow::cascade_requires_update(uint32_t index) const {
+  return cascades_[index].requires_update;
+}
+
 DirectionalShadow::DirectionalShadowGLSL
 DirectionalShadow::directional_shadow_glsl() const {
   DirectionalShadowGLSL ret;
   ret.dir = direction_;
-  ret.shadow_map = fbo_->depth_texture().handle();
+  ret.shadow_map = pool_->depth_texture().handle();
 
   for (int i = 0; i < num_cascades_in_use(); i++) {
     if (i < NUM_MOVING_CASCADES) {
@@ -270,13 +155,10 @@ DirectionalShadow::directional_shadow_glsl() const {
       ret.cascade_plane_distances[i * 2 + 1] =
           cascades_[i].cascade_plane_distances[1];
     }
-    ret.transformation_matrices[i] =
-        glm::translate(glm::mat4(1),
-                       glm::vec3(0.5f * cascades_[i].scale_factor, 0.5f)) *
-        glm::scale(glm::mat4(1),
-                   glm::vec3(0.5f * cascades_[i].scale_factor, 0.5f)) *
-        cascades_[i].projection_matrix * cascades_[i].view_matrix;
+    // wrapped by the GL_REPEAT sampler like the layer is scrolled
+    ret.transformation_matrices[i] = fitters_[i].sampling_matrix();
     ret.requires_update[i] = cascades_[i].requires_update;
+    ret.layers[i] = i < layers_.size() ? layers_[i] : 0;
   }
 
   return ret;
@@ -287,39 +169,52 @@ void DirectionalShadow::Visualize() const {
 }
 
 void DirectionalShadow::Bind() {
-  fbo_->Bind();
-  UpdateCascades();
-  for (int i = 0; i < NUM_CASCADES; i++) {
-    glViewportIndexedfv(i, &cascades_[i].viewport.x);
+  pool_->fbo()->Bind();
+  if (!cascades_updated_) {
+    UpdateCascades();
   }
 }
 
-void DirectionalShadow::Unbind() {
-  fbo_->Unbind();
-  update_flag_ = false;
+uint32_t DirectionalShadow::num_layers() const { return layers_.size(); }
+
+Shadow::LayerRegion DirectionalShadow::layer_region(uint32_t layer) const {
+  return {0, 0, layers_[layer], pool_->size(), pool_->size()};
 }
 
-void DirectionalShadow::Clear() {
-  const float one = 1;
-  for (int i = 0; i < num_cascades_in_use(); i++) {
-    if (cascades_[i].requires_update) {
-      glClearTexSubImage(fbo_->depth_texture().id(), 0, 0, 0, i, fbo_width_,
-                         fbo_height_, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &one);
-    }
+std::vector<Shadow::LayerRegion> DirectionalShadow::draw_regions(
+    uint32_t layer) const {
+  std::vector<LayerRegion> regions;
+  for (const auto &part : fitters_[layer].Wrap(fitters_[layer].rect())) {
+    glm::ivec2 offset = fitters_[layer].TextureOffset(part);
+    regions.push_back({uint32_t(offset.x), uint32_t(offset.y), layers_[layer],
+                       uint32_t(part.size.x), uint32_t(part.size.y)});
   }
+  return regions;
+}
+
+void DirectionalShadow::BindRegion(uint32_t layer, bool static_cache,
+                                   const LayerRegion &region, Shader *shader) {
+  FrameBufferObject *fbo =
+      static_cache ? pool_->static_cache_fbo() : pool_->fbo();
+  fbo->Bind();
+  fbo->SwitchAttachmentLevelAndLayer(false, 0, 0, layers_[layer]);
+  glViewport(region.x, region.y, region.width, region.height);
+  // the part of the light space grid stored in the region
+  const CascadeFitter &fitter = fitters_[layer];
+  auto rect = fitter.GridRect(glm::ivec2(region.x, region.y),
+                              glm::ivec2(region.width, region.height));
+  shader->SetUniform<glm::mat4>("uViewMatrix", fitter.view_matrix());
+  shader->SetUniform<glm::mat4>("uProjectionMatrix",
+                                fitter.projection_matrix(rect));
+  shader->SetUniform<int32_t>("uCascade", layer);
 }
 
-void DirectionalShadow::Set(Shader *shader) {
-  auto camera_frustum_corners =
-      camera_->frustum_corners(camera_->z_near(), camera_->z_far());
-  glm::mat4 camera_frustum_view_matrix =
-      this->view_matrix(camera_frustum_corners);
-  AABB camera_ortho_param =
-      ortho_param(camera_frustum_corners, camera_frustum_view_matrix);
-  glm::mat4 camera_frustum_projection_matrix =
-      this->projection_matrix(camera_ortho_param);
+void DirectionalShadow::Unbind() {
+  pool_->fbo()->Unbind();
+  update_flag_ = false;
+  cascades_updated_ = false;
+}
 
-  shader->SetUniform<glm::mat4>("uViewMatrix", camera_frustum_view_matrix);
-  shader->SetUniform<glm::mat4>("uProjectionMatrix",
-                                camera_frustum_projection_matrix);
-}
\ No newline at end of file
+void DirectionalShadow::Set(Shader *shader) {
+  // the matrices are set per region by BindRegion()
+}
@@ -12,26 +12,149 @@
 
 #include "utils.h"
 
+std::vector<Shadow::LayerRegion> Shadow::draw_regions(uint32_t layer) const {
+  return {layer_region(layer)};
+}
+
+bool Shadow::RequiresStaticDraw(uint32_t layer,
+                                uint64_t static_casters_version) const {
+  const CachedLayer &cached_layer = cached_layers_[layer];
+  if (!cached_layer.drawn) return true;
+  if (cached_layer.static_draw_deferred) return false;
+  return !cached_layer.valid ||
+         cached_layer.static_casters_version != static_casters_version ||
+         !cached_layer.exposed_regions.empty();
+}
+
+void Shadow::set_static_draw_deferred(uint32_t layer, bool deferred) const {
+  cached_layers_[layer].static_draw_deferred = deferred;
+}
+
+bool Shadow::static_cache_drawn(uint32_t layer) const {
+  return cached_layers_[layer].drawn;
+}
+
+bool Shadow::RequiresDynamicDraw(uint32_t layer,
+                                 bool has_dynamic_casters) const {
+  // the dynamic casters drawn in the last frame must be erased too
+  return has_dynamic_casters || !cached_layers_[layer].shadow_map_is_cache;
+}
+
+std::vector<Shadow::LayerRegion> Shadow::BeginStaticDraw(
+    uint32_t layer, uint64_t static_casters_version) {
+  CachedLayer &cached_layer = cached_layers_[layer];
+  std::vector<LayerRegion> regions = cached_layer.exposed_regions;
+  if (!cached_layer.valid ||
+      cached_layer.static_casters_version != static_casters_version) {
+    regions = draw_regions(layer);
+  }
+  const float one = 1;
+  for (const auto &region : regions) {
+    glClearTexSubImage(static_cache().id(), 0, region.x, region.y, region.z,
+                       region.width, region.height, 1, GL_DEPTH_COMPONENT,
+                       GL_FLOAT, &one);
+  }
+
+  cached_layer.valid = true;
+  cached_layer.drawn = true;
+  cached_layer.static_casters_version = static_casters_version;
+  cached_layer.shadow_map_is_cache = false;
+  cached_layer.exposed_regions.clear();
+  return regions;
+}
+
+std::vector<Shadow::LayerRegion> Shadow::BeginDynamicDraw(
+    uint32_t layer, bool has_dynamic_casters) {
+  LayerRegion region = layer_region(layer);
+  const Texture &cache = static_cache();
+  const Texture &map = shadow_map();
+  glCopyImageSubData(cache.id(), cache.target(), 0, region.x, region.y,
+                     region.z, map.id(), map.target(), 0, region.x, region.y,
+                     region.z, region.width, region.height, 1);
+  cached_layers_[layer].shadow_map_is_cache = !has_dynamic_casters;
+  return draw_regions(layer);
+}
+
+void Shadow::InvalidateStaticCache() const {
+  for (uint32_t i = 0; i < cached_layers_.size(); i++) {
+    InvalidateStaticCache(i);
+  }
+}
+
+void Shadow::InvalidateStaticCache(uint32_t layer) const {
+  cached_layers_[layer].valid = false;
+}
+
+void Shadow::ScrollStaticCache(uint32_t layer,
+                               const std::vector<LayerRegion> &exposed) const {
+  CachedLayer &cached_layer = cached_layers_[layer];
+  // an invalid layer is drawn whole anyway
+  if (!cached_layer.valid) return;
+  cached_layer.exposed_regions.insert(cached_layer.exposed_regions.end(),
+                                      exposed.begin(), exposed.end());
+}
+
+void Shadow::ResetStaticCache() const {
+  cached_layers_.assign(num_layers(), CachedLayer());
+}
+
 OmnidirectionalShadow::OmnidirectionalShadow(glm::vec3 position, float radius,
-                                             uint32_t fbo_width,
-                                             uint32_t fbo_height)
-    : position_(position),
-      radius_(radius),
-      fbo_width_(fbo_width),
-      fbo_height_(fbo_height) {
-  std::vector<Texture> empty;
-  Texture depth_texture(std::vector<void *>{}, fbo_width, fbo_height,
-                        GL_DEPTH_COMPONENT, GL_DEPTH_COMPONENT, GL_FLOAT,
-                        GL_CLAMP_TO_BORDER, GL_LINEAR, GL_LINEAR, {1, 1, 1, 1},
-                        false);
-  fbo_.reset(new FrameBufferObject(empty, depth_texture));
-  fbo_->depth_texture().MakeResident();
+                                             ShadowAtlas *atlas,
+                                             uint32_t tile_size)
+    : position_(position), radius_(radius), atlas_(atlas) {
+  set_tile_size(tile_size);
+}
+
+OmnidirectionalShadow::~OmnidirectionalShadow() { FreeTiles(); }
+
+void OmnidirectionalShadow::FreeTiles() {
+  for (const auto &tile : tiles_) atlas_->Free(tile);
+  tiles_.clear();
+  tile_size_ = 0;
+}
+
+bool OmnidirectionalShadow::set_tile_size(uint32_t tile_size) {
+  uint32_t previous_tile_size = tile_size_;
+  FreeTiles();
+  bool success = true;
+  for (int i = 0; i < 6 && tile_size > 0; i++) {
+    auto tile = atlas_->Allocate(tile_size);
+    if (!tile.has_value()) {
+      success = false;
+      break;
+    }
+    tiles_.push_back(tile.value());
+  }
+  if (success) {
+    tile_size_ = tiles_.empty() ? 0 : tiles_[0].size;
+  } else {
+    // the tiles just freed are still free
+    FreeTiles();
+    for (int i = 0; i < 6 && previous_tile_size > 0; i++) {
+      tiles_.push_back(atlas_->Allocate(previous_tile_size).value());
+    }
+    tile_size_ = previous_tile_size;
+  }
+  ResetStaticCache();
+  return success;
+}
+
+Shadow::LayerRegion OmnidirectionalShadow::layer_region(uint32_t layer) const {
+  const ShadowAtlas::Tile &tile = tiles_[layer];
+  return {tile.x, tile.y, 0, tile.size, tile.size};
+}
+
+void OmnidirectionalShadow::set_position(glm::vec3 position) {
+  const float zero = 1e-5f;
+  if (glm::distance(position_, position) > zero) {
+    InvalidateStaticCache();
+  }
+  position_ = position;
 }
 
 std::vector<glm::mat4> OmnidirectionalShadow::view_projection_matrices() const {
-  float aspect = (float)fbo_width_ / fbo_height_;
   glm::mat4 projection_matrix =
-      glm::perspective(glm::radians(90.0f), aspect, z_near_, z_far_);
+      glm::perspective(glm::radians(90.0f), 1.0f, z_near_, z_far_);
 
   std::vector<glm::mat4> ret;
   ret.push_back(projection_matrix *
@@ -59,12 +182,17 @@ void OmnidirectionalShadow::Set(Shader *shader) {
   // no need to set view/projection matrix
 }
 
-void OmnidirectionalShadow::Bind() {
-  glViewport(0, 0, fbo_width_, fbo_height_);
-  fbo_->Bind();
-}
+void OmnidirectionalShadow::Bind() { atlas_->fbo()->Bind(); }
 
-void OmnidirectionalShadow::Clear() { glClear(GL_DEPTH_BUFFER_BIT); }
+void OmnidirectionalShadow::BindRegion(uint32_t layer, bool static_cache,
+                                       const LayerRegion &region,
+                                       Shader *shader) {
+  (static_cache ? atlas_->static_cache_fbo() : atlas_->fbo())->Bind();
+  glViewport(region.x, region.y, region.width, region.height);
+  // the geometry shader projects the triangles for the face, the atlas is
+  // not layered so gl_Layer is ignored
+  shader->SetUniform<int32_t>("uFaceMask", 1 << layer);
+}
 
 void OmnidirectionalShadow::Visualize() const {}
 
@@ -73,7 +201,16 @@ OmnidirectionalShadow::omnidirectional_shadow_glsl() const {
   OmnidirectionalShadowGLSL ret;
   auto vpms = view_projection_matrices();
   std::copy(vpms.begin(), vpms.end(), ret.view_projection_matrices);
-  ret.shadow_map = fbo_->depth_texture().handle();
+  float atlas_size = atlas_->size();
+  for (int i = 0; i < 6; i++) {
+    ret.atlas_rects[i] = glm::vec4(0);
+    if (i < tiles_.size()) {
+      ret.atlas_rects[i] = glm::vec4(tiles_[i].x, tiles_[i].y, tiles_[i].size,
+                                     tiles_[i].size) /
+                           atlas_size;
+    }
+  }
+  ret.shadow_map = atlas_->depth_texture().handle();
   ret.pos = position_;
   ret.radius = radius_;
   ret.far_plane = z_far_;
@@ -0,0 +1,101 @@
+// clang-format off
+#include <glad/glad.h>
+// clang-format on
+
+#include "shadows/shadow_atlas.h"
+
+#include <fmt/core.h>
+
+ShadowAtlas::ShadowAtlas(uint32_t size, uint32_t min_tile_size)
+    : size_(size), min_tile_size_(min_tile_size) {
+  if (size == 0 || (size & (size - 1)) != 0 || min_tile_size == 0 ||
+      (min_tile_size & (min_tile_size - 1)) != 0 || min_tile_size > size) {
+    fmt::print(stderr, "[error] invalid shadow atlas size: {}, {}\n", size,
+               min_tile_size);
+    exit(1);
+  }
+  num_levels_ = 1;
+  while ((size_ >> (num_levels_ - 1)) > min_tile_size_) num_levels_++;
+  free_tiles_.resize(num_levels_);
+  free_tiles_[0].insert({0, 0});
+}
+
+uint32_t ShadowAtlas::Level(uint32_t size) const {
+  uint32_t level = num_levels_ - 1;
+  while (level > 0 && TileSize(level) < size) level--;
+  return level;
+}
+
+std::optional<ShadowAtlas::Tile> ShadowAtlas::Allocate(uint32_t size) {
+  if (size > size_) return std::nullopt;
+  uint32_t level = Level(size);
+
+  // the smallest free tile that is large enough, split down to the level
+  int32_t free_level = level;
+  while (free_level >= 0 && free_tiles_[free_level].empty()) free_level--;
+  if (free_level < 0) return std::nullopt;
+  auto [y, x] = *free_tiles_[free_level].begin();
+  free_tiles_[free_level].erase(free_tiles_[free_level].begin());
+  for (uint32_t l = free_level + 1; l <= level; l++) {
+    uint32_t half = TileSize(l);
+    free_tiles_[l].insert({y, x + half});
+    free_tiles_[l].insert({y + half, x});
+    free_tiles_[l].insert({y + half, x + half});
+  }
+
+  Tile tile{x, y, TileSize(level)};
+  num_allocated_texels_ += uint64_t(tile.size) * tile.size;
+  return tile;
+}
+
+void ShadowAtlas::Free(const Tile &tile) {
+  num_allocated_texels_ -= uint64_t(tile.size) * tile.size;
+  uint32_t level = Level(tile.size);
+  uint32_t x = tile.x, y = tile.y;
+  while (level > 0) {
+    uint32_t parent_size = TileSize(level - 1);
+    uint32_t parent_x = x / parent_size * parent_size;
+    uint32_t parent_y = y / parent_size * parent_size;
+    uint32_t half = TileSize(level);
+    std::pair<uint32_t, uint32_t> siblings[4] = {
+        {parent_y, parent_x},
+        {parent_y, parent_x + half},
+        {parent_y + half, parent_x},
+        {parent_y + half, parent_x + half},
+    };
+    bool siblings_free = true;
+    for (const auto &sibling : siblings) {
+      if (sibling != std::make_pair(y, x) &&
+          free_tiles_[level].count(sibling) == 0) {
+        siblings_free = false;
+      }
+    }
+    if (!siblings_free) break;
+    for (const auto &sibling : siblings) free_tiles_[level].erase(sibling);
+    x = parent_x;
+    y = parent_y;
+    level--;
+  }
+  free_tiles_[level].insert({y, x});
+}
+
+void ShadowAtlas::CreateTextures() {
+  for (auto fbo : {&fbo_, &static_cache_fbo_}) {
+    std::vector<Texture> empty;
+    Texture depth_texture(nullptr, size_, size_, GL_DEPTH_COMPONENT,
+                          GL_DEPTH_COMPONENT, GL_FLOAT, GL_CLAMP_TO_EDGE,
+                          GL_LINEAR, GL_LINEAR, {}, false);
+    fbo->reset(new FrameBufferObject(empty, depth_texture));
+  }
+  fbo_->depth_texture().MakeResident();
+}
+
+FrameBufferObject *ShadowAtlas::fbo() {
+  if (fbo_ == nullptr) CreateTextures();
+  return fbo_.get();
+}
+
+FrameBufferObject *ShadowAtlas::static_cache_fbo() {
+  if (static_cache_fbo_ == nullptr) CreateTextures();
+  return static_cache_fbo_.get();
+}
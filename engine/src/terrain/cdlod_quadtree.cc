@@ -0,0 +1,180 @@
+#include "terrain/cdlod_quadtree.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <future>
+#include <limits>
+#include <thread>
+
+namespace {
+
+bool IntersectsSphere(const AABB &aabb, glm::vec3 center, float radius) {
+  glm::vec3 nearest = glm::clamp(center, aabb.min, aabb.max);
+  glm::vec3 d = nearest - center;
+  return glm::dot(d, d) <= radius * radius;
+}
+
+}  // namespace
+
+CDLODQuadtree::CDLODQuadtree(uint32_t size, const uint16_t *heights,
+                             float min_height, float max_height,
+                             const glm::mat4 &transform,
+                             const Options &options)
+    : size_(size), transform_(transform), options_(options) {
+  uint32_t leaf_size = options_.patch_size * 2;
+  if (options_.patch_size == 0 || options_.patch_size % 2 != 0 ||
+      size_ % leaf_size != 0) {
+    fmt::print(stderr,
+               "[error] the heightfield size {} is not a multiple of the leaf "
+               "size {} of even patches\n",
+               size_, leaf_size);
+    exit(1);
+  }
+  // as many LODs as the size allows, the roots are a grid of the coarsest
+  uint32_t num_lods = 1;
+  while (num_lods < std::min(options_.max_num_lods, MAX_NUM_LODS) &&
+         size_ % (leaf_size << num_lods) == 0) {
+    num_lods++;
+  }
+  min_max_.resize(num_lods);
+
+  // the leaves from the heights, their borders included
+  uint32_t row_size = size_ + 1;
+  uint32_t num_leaves = GridSize(0);
+  float scale = (max_height - min_height) / 65535.0f;
+  min_max_[0].resize(num_leaves * num_leaves);
+  uint32_t num_tasks = std::max(1u, std::thread::hardware_concurrency());
+  uint32_t chunk_size = (num_leaves + num_tasks - 1) / num_tasks;
+  std::vector<std::future<void>> tasks;
+  for (uint32_t begin = 0; begin < num_leaves; begin += chunk_size) {
+    uint32_t end = std::min(begin + chunk_size, num_leaves);
+    tasks.push_back(std::async(std::launch::async, [&, begin, end]() {
+      for (uint32_t x = begin; x < end; x++) {
+        for (uint32_t z = 0; z < num_leaves; z++) {
+          uint16_t min = 65535, max = 0;
+          for (uint32_t k = x * leaf_size; k <= (x + 1) * leaf_size; k++) {
+            const uint16_t *row = heights + size_t(k) * row_size;
+            for (uint32_t l = z * leaf_size; l <= (z + 1) * leaf_size; l++) {
+              min = std::min(min, row[l]);
+              max = std::max(max, row[l]);
+            }
+          }
+          min_max_[0][x * num_leaves + z] = glm::vec2(
+              min_height + min * scale, min_height + max * scale);
+        }
+      }
+    }));
+  }
+  for (auto &task : tasks) task.get();
+
+  // and each parent from its children
+  for (uint32_t lod = 1; lod < num_lods; lod++) {
+    uint32_t grid_size = GridSize(lod), child_grid_size = GridSize(lod - 1);
+    min_max_[lod].resize(grid_size * grid_size);
+    for (uint32_t x = 0; x < grid_size; x++) {
+      for (uint32_t z = 0; z < grid_size; z++) {
+        glm::vec2 bounds(std::numeric_limits<float>::max(),
+                         std::numeric_limits<float>::lowest());
+        for (uint32_t child = 0; child < 4; child++) {
+          uint32_t cx = x * 2 + (child >> 1), cz = z * 2 + (child & 1);
+          glm::vec2 child_bounds = min_max_[lod - 1][cx * child_grid_size + cz];
+          bounds.x = std::min(bounds.x, child_bounds.x);
+          bounds.y = std::max(bounds.y, child_bounds.y);
+        }
+        min_max_[lod][x * grid_size + z] = bounds;
+      }
+    }
+  }
+
+  float lod0_range = options_.lod0_range;
+  if (lod0_range <= 0) {
+    float leaf_extent = float(leaf_size) / size_;
+    float leaf_world_size =
+        std::max(glm::length(glm::vec3(transform_[0]) * leaf_extent),
+                 glm::length(glm::vec3(transform_[2]) * leaf_extent));
+    lod0_range = leaf_world_size * 4;
+  }
+  for (uint32_t lod = 0; lod < num_lods; lod++) {
+    ranges_.push_back(lod0_range * float(1 << lod));
+  }
+}
+
+AABB CDLODQuadtree::NodeBounds(uint32_t lod, uint32_t x, uint32_t z) const {
+  float node_size = float(options_.patch_size << (lod + 1)) / size_;
+  glm::vec2 bounds = min_max_[lod][x * GridSize(lod) + z];
+  return AABB(glm::vec3(x * node_size, bounds.x, z * node_size),
+              glm::vec3((x + 1) * node_size, bounds.y, (z + 1) * node_size))
+      .Transform(transform_);
+}
+
+glm::vec2 CDLODQuadtree::morph_range(uint32_t lod) const {
+  // there is no coarser grid to morph to
+  if (lod + 1 == num_lods()) {
+    float max = std::numeric_limits<float>::max();
+    return glm::vec2(max * 0.5f, max);
+  }
+  float previous = lod > 0 ? ranges_[lod - 1] : 0;
+  return glm::vec2(
+      previous + (ranges_[lod] - previous) * options_.morph_start_ratio,
+      ranges_[lod]);
+}
+
+void CDLODQuadtree::Select(glm::vec3 camera_position, const Frustum *frustum,
+                           std::vector<Patch> *patches) const {
+  patches->clear();
+  uint32_t top = num_lods() - 1;
+  uint32_t grid_size = GridSize(top);
+  for (uint32_t x = 0; x < grid_size; x++) {
+    for (uint32_t z = 0; z < grid_size; z++) {
+      // the roots beyond the coarsest range are still drawn
+      if (SelectNode(top, x, z, camera_position, frustum, patches)) continue;
+      if (frustum != nullptr && !NodeBounds(top, x, z).IsOnFrustum(*frustum)) {
+        continue;
+      }
+      for (uint32_t quarter = 0; quarter < 4; quarter++) {
+        AddQuarter(top, x, z, quarter, patches);
+      }
+    }
+  }
+}
+
+bool CDLODQuadtree::SelectNode(uint32_t lod, uint32_t x, uint32_t z,
+                               glm::vec3 camera_position,
+                               const Frustum *frustum,
+                               std::vector<Patch> *patches) const {
+  AABB bounds = NodeBounds(lod, x, z);
+  if (!IntersectsSphere(bounds, camera_position, ranges_[lod])) return false;
+  // culled, so nothing is drawn for it
+  if (frustum != nullptr && !bounds.IsOnFrustum(*frustum)) return true;
+
+  if (lod == 0 ||
+      !IntersectsSphere(bounds, camera_position, ranges_[lod - 1])) {
+    for (uint32_t quarter = 0; quarter < 4; quarter++) {
+      AddQuarter(lod, x, z, quarter, patches);
+    }
+    return true;
+  }
+  for (uint32_t quarter = 0; quarter < 4; quarter++) {
+    uint32_t cx = x * 2 + (quarter >> 1), cz = z * 2 + (quarter & 1);
+    if (SelectNode(lod - 1, cx, cz, camera_position, frustum, patches)) {
+      continue;
+    }
+    if (frustum != nullptr &&
+        !NodeBounds(lod - 1, cx, cz).IsOnFrustum(*frustum)) {
+      continue;
+    }
+    AddQuarter(lod, x, z, quarter, patches);
+  }
+  return true;
+}
+
+void CDLODQuadtree::AddQuarter(uint32_t lod, uint32_t x, uint32_t z,
+                               uint32_t quarter,
+                               std::vector<Patch> *patches) const {
+  float half_size = float(options_.patch_size << lod) / size_;
+  patches->push_back(
+      {glm::vec2((x * 2 + (quarter >> 1)) * half_size,
+                 (z * 2 + (quarter & 1)) * half_size),
+       half_size, float(lod)});
+}
@@ -0,0 +1,140 @@
+#include "terrain/cdlod_terrain.h"
+
+#include <fmt/core.h>
+#include <glad/glad.h>
+#include <imgui.h>
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+CDLODTerrain::CDLODTerrain(const std::string &heightfield_path,
+                           const CDLODQuadtree::Options &options) {
+  heightfield_.reset(new HeightfieldFile(heightfield_path));
+  const HeightfieldHeader &header = heightfield_->header();
+  quadtree_.reset(new CDLODQuadtree(header.size, heightfield_->heights(),
+                                    header.min_height, header.max_height,
+                                    heightfield_->transform(), options));
+  fmt::print(stderr, "[info] CDLOD terrain of {}^2 squares, {} LODs\n",
+             header.size, quadtree_->num_lods());
+
+  // the rows of (size + 1) unorms are not 4-byte aligned
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+  height_texture_ =
+      Texture((void *)heightfield_->heights(), header.size + 1,
+              header.size + 1, GL_R16, GL_RED, GL_UNSIGNED_SHORT,
+              GL_CLAMP_TO_EDGE, GL_LINEAR, GL_LINEAR, {}, false);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  shader_.reset(new Shader(
+      "terrain/cdlod.vert", "terrain/cdlod.frag",
+      {
+          {"NUM_CASCADES", std::any(DirectionalShadow::NUM_CASCADES)},
+          {"AMBIENT_LIGHT_BINDING", std::any(AmbientLight::GLSL_BINDING)},
+          {"DIRECTIONAL_LIGHT_BINDING",
+           std::any(DirectionalLight::GLSL_BINDING)},
+          {"POINT_LIGHT_BINDING", std::any(PointLight::GLSL_BINDING)},
+          {"IMAGE_BASED_LIGHT_BINDING",
+           std::any(ImageBasedLight::GLSL_BINDING)},
+          {"POISSON_DISK_2D_BINDING",
+           std::any(LightSources::POISSON_DISK_2D_BINDING)},
+          {"POISSON_DISK_3D_BINDING",
+           std::any(LightSources::POISSON_DISK_3D_BINDING)},
+          {"MAX_NUM_LODS", std::any(CDLODQuadtree::MAX_NUM_LODS)},
+      }));
+
+  // (patch_size + 1)^2 grid points, row-major in x
+  uint32_t patch_size = options.patch_size;
+  std::vector<glm::vec2> vertices;
+  for (uint32_t i = 0; i <= patch_size; i++) {
+    for (uint32_t j = 0; j <= patch_size; j++) vertices.emplace_back(i, j);
+  }
+  std::vector<uint32_t> indices;
+  for (uint32_t i = 0; i < patch_size; i++) {
+    for (uint32_t j = 0; j < patch_size; j++) {
+      uint32_t a = i * (patch_size + 1) + j, b = a + 1;
+      uint32_t c = a + patch_size + 1, d = c + 1;
+      indices.insert(indices.end(), {a, b, d, a, d, c});
+    }
+  }
+  num_indices_ = indices.size();
+
+  glGenVertexArrays(1, &vao_);
+  glGenBuffers(1, &vbo_);
+  glGenBuffers(1, &ebo_);
+  glGenBuffers(1, &instance_vbo_);
+  glBindVertexArray(vao_);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2),
+               vertices.data(), GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2),
+                        (void *)0);
+  glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE,
+                        sizeof(CDLODQuadtree::Patch), (void *)0);
+  glVertexAttribDivisor(1, 1);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t),
+               indices.data(), GL_STATIC_DRAW);
+  glBindVertexArray(0);
+}
+
+CDLODTerrain::~CDLODTerrain() {
+  glDeleteVertexArrays(1, &vao_);
+  glDeleteBuffers(1, &vbo_);
+  glDeleteBuffers(1, &ebo_);
+  glDeleteBuffers(1, &instance_vbo_);
+}
+
+void CDLODTerrain::Draw(Camera *camera, LightSources *light_sources) {
+  Frustum frustum = camera->frustum();
+  quadtree_->Select(camera->position(),
+                    frustum_culling_ ? &frustum : nullptr, &patches_);
+  if (patches_.empty()) return;
+  // orphaned every frame
+  glNamedBufferData(instance_vbo_,
+                    patches_.size() * sizeof(CDLODQuadtree::Patch),
+                    patches_.data(), GL_STREAM_DRAW);
+
+  const HeightfieldHeader &header = heightfield_->header();
+  std::vector<float> morph_ranges;
+  for (uint32_t lod = 0; lod < quadtree_->num_lods(); lod++) {
+    glm::vec2 range = quadtree_->morph_range(lod);
+    morph_ranges.insert(morph_ranges.end(), {range.x, range.y});
+  }
+  glm::mat4 transform = heightfield_->transform();
+
+  shader_->Use();
+  light_sources->Set(shader_.get());
+  shader_->SetUniform<glm::mat4>("uViewMatrix", camera->view_matrix());
+  shader_->SetUniform<glm::mat4>("uProjectionMatrix",
+                                 camera->projection_matrix());
+  shader_->SetUniform<glm::vec3>("uCameraPosition", camera->position());
+  shader_->SetUniform<glm::mat4>("uTransform", transform);
+  shader_->SetUniform<glm::mat4>("uNormalMatrix",
+                                 glm::mat4(glm::inverseTranspose(
+                                     glm::mat3(transform))));
+  shader_->SetUniform<float>("uHeightfieldSize", float(header.size));
+  shader_->SetUniform<glm::vec2>(
+      "uHeightRange", glm::vec2(header.min_height, header.max_height));
+  shader_->SetUniform<float>("uPatchSize",
+                             float(quadtree_->options().patch_size));
+  shader_->SetUniform<std::vector<float>>("uMorphRanges", morph_ranges);
+  shader_->SetUniformSampler("uHeightTexture", height_texture_, 0);
+
+  if (wireframe_) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+  glBindVertexArray(vao_);
+  glDrawElementsInstanced(GL_TRIANGLES, num_indices_, GL_UNSIGNED_INT,
+                          nullptr, patches_.size());
+  glBindVertexArray(0);
+  if (wireframe_) glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+}
+
+void CDLODTerrain::ImGuiWindow() {
+  ImGui::Begin("Terrain:");
+  ImGui::Text("Patches: %u, triangles: %u", num_patches(),
+              num_patches() * num_indices_ / 3);
+  ImGui::Checkbox("Frustum culling", &frustum_culling_);
+  ImGui::Checkbox("Wireframe", &wireframe_);
+  ImGui::End();
+}
@@ -0,0 +1,156 @@
+#include "terrain/heightfield.h"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <future>
+#include <glm/gtc/matrix_inverse.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <limits>
+#include <thread>
+
+// below it a batch is not worth the threads
+constexpr uint32_t kMinPointsPerTask = 1 << 14;
+
+Heightfield::Heightfield(const HeightfieldFile &file)
+    : size_(file.header().size), transform_(file.transform()) {
+  Build([&](uint32_t x, uint32_t z) { return file.height(x, z); });
+}
+
+Heightfield::Heightfield(uint32_t size, const float *heights,
+                         const glm::mat4 &transform)
+    : size_(size), transform_(transform) {
+  Build([&](uint32_t x, uint32_t z) {
+    return heights[size_t(x) * (size + 1) + z];
+  });
+}
+
+template <typename GetHeight>
+void Heightfield::Build(GetHeight get_height) {
+  if (transform_[1].x != 0 || transform_[1].z != 0) {
+    fmt::print(stderr,
+               "[error] the transform of the heightfield moves xz with the "
+               "height\n");
+    exit(1);
+  }
+  // the queries work in grid units, [0, size]^2 in xz
+  glm::mat4 grid_transform =
+      transform_ *
+      glm::scale(glm::mat4(1), glm::vec3(1.0f / size_, 1, 1.0f / size_));
+  world_to_grid_ = glm::inverse(
+      glm::mat2(glm::vec2(grid_transform[0].x, grid_transform[0].z),
+                glm::vec2(grid_transform[2].x, grid_transform[2].z)));
+  origin_xz_ = glm::vec2(grid_transform[3].x, grid_transform[3].z);
+  height_row_ = glm::vec4(grid_transform[0].y, grid_transform[1].y,
+                          grid_transform[2].y, grid_transform[3].y);
+  normal_matrix_ = glm::inverseTranspose(glm::mat3(grid_transform));
+
+  // the grid points past the far borders repeat the borders
+  constexpr uint32_t kRowSize = TILE_SIZE + 1;
+  num_tiles_ = (size_ + TILE_SIZE - 1) / TILE_SIZE;
+  tiles_.resize(size_t(num_tiles_) * num_tiles_ * kRowSize * kRowSize);
+  float min_height = std::numeric_limits<float>::max();
+  float max_height = std::numeric_limits<float>::lowest();
+  for (uint32_t tx = 0; tx < num_tiles_; tx++) {
+    for (uint32_t tz = 0; tz < num_tiles_; tz++) {
+      float *tile =
+          tiles_.data() + (size_t(tx) * num_tiles_ + tz) * kRowSize * kRowSize;
+      for (uint32_t i = 0; i < kRowSize; i++) {
+        uint32_t x = std::min(tx * TILE_SIZE + i, size_);
+        for (uint32_t j = 0; j < kRowSize; j++) {
+          uint32_t z = std::min(tz * TILE_SIZE + j, size_);
+          float height = get_height(x, z);
+          tile[i * kRowSize + j] = height;
+          min_height = std::min(min_height, height);
+          max_height = std::max(max_height, height);
+        }
+      }
+    }
+  }
+  bounds_ = AABB(glm::vec3(0, min_height, 0), glm::vec3(1, max_height, 1))
+                .Transform(transform_);
+}
+
+float Heightfield::Sample(glm::vec2 grid, Interpolation interpolation,
+                          glm::vec2 *gradient) const {
+  constexpr uint32_t kRowSize = TILE_SIZE + 1;
+  float size = float(size_);
+  float gx = std::min(std::max(grid.x, 0.0f), size);
+  float gz = std::min(std::max(grid.y, 0.0f), size);
+  uint32_t x = std::min(uint32_t(gx), size_ - 1);
+  uint32_t z = std::min(uint32_t(gz), size_ - 1);
+  float fx = gx - x, fz = gz - z;
+  const float *row =
+      tiles_.data() +
+      (size_t(x / TILE_SIZE) * num_tiles_ + z / TILE_SIZE) * kRowSize *
+          kRowSize +
+      (x % TILE_SIZE) * kRowSize + z % TILE_SIZE;
+  float h00 = row[0], h01 = row[1];
+  float h10 = row[kRowSize], h11 = row[kRowSize + 1];
+
+  float dx, dz;
+  if (interpolation == Interpolation::kBilinear) {
+    dx = h10 - h00 + (h11 - h01 - h10 + h00) * fz;
+    dz = h01 - h00 + (h11 - h01 - h10 + h00) * fx;
+    *gradient = glm::vec2(dx, dz);
+    return h00 + (h10 - h00) * fx + dz * fz;
+  }
+  // the triangle of (0, 0), (0, 1) and (1, 1) or of (0, 0), (1, 1) and
+  // (1, 0), selected without a branch
+  bool upper = fz >= fx;
+  dx = upper ? h11 - h01 : h10 - h00;
+  dz = upper ? h01 - h00 : h11 - h10;
+  *gradient = glm::vec2(dx, dz);
+  return h00 + dx * fx + dz * fz;
+}
+
+float Heightfield::Height(glm::vec2 xz, Interpolation interpolation) const {
+  glm::vec2 grid = world_to_grid_ * (xz - origin_xz_);
+  glm::vec2 gradient;
+  float height = Sample(grid, interpolation, &gradient);
+  return glm::dot(height_row_, glm::vec4(grid.x, height, grid.y, 1));
+}
+
+glm::vec3 Heightfield::Normal(glm::vec2 xz, Interpolation interpolation) const {
+  glm::vec2 grid = world_to_grid_ * (xz - origin_xz_);
+  glm::vec2 gradient;
+  Sample(grid, interpolation, &gradient);
+  return glm::normalize(normal_matrix_ *
+                        glm::vec3(-gradient.x, 1, -gradient.y));
+}
+
+void Heightfield::Query(const glm::vec2 *xzs, uint32_t n, float *heights,
+                        glm::vec3 *normals,
+                        Interpolation interpolation) const {
+  uint32_t num_tasks =
+      std::min(std::max(1u, std::thread::hardware_concurrency()),
+               std::max(1u, n / kMinPointsPerTask));
+  if (num_tasks == 1) {
+    QueryRange(xzs, 0, n, heights, normals, interpolation);
+    return;
+  }
+  uint32_t chunk_size = (n + num_tasks - 1) / num_tasks;
+  std::vector<std::future<void>> tasks;
+  for (uint32_t begin = 0; begin < n; begin += chunk_size) {
+    uint32_t end = std::min(begin + chunk_size, n);
+    tasks.push_back(std::async(std::launch::async, [&, begin, end]() {
+      QueryRange(xzs, begin, end, heights, normals, interpolation);
+    }));
+  }
+  for (auto &task : tasks) task.get();
+}
+
+void Heightfield::QueryRange(const glm::vec2 *xzs, uint32_t begin,
+                             uint32_t end, float *heights, glm::vec3 *normals,
+                             Interpolation interpolation) const {
+  for (uint32_t i = begin; i < end; i++) {
+    glm::vec2 grid = world_to_grid_ * (xzs[i] - origin_xz_);
+    glm::vec2 gradient;
+    float height = Sample(grid, interpolation, &gradient);
+    heights[i] = glm::dot(height_row_, glm::vec4(grid.x, height, grid.y, 1));
+    if (normals != nullptr) {
+      normals[i] = glm::normalize(normal_matrix_ *
+                                  glm::vec3(-gradient.x, 1, -gradient.y));
+    }
+  }
+}
@@ -0,0 +1,80 @@
+#include "terrain/heightfield_file.h"
+
+#include <fmt/core.h>
+#include <string.h>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+HeightfieldFile::HeightfieldFile(const std::string &file_path) {
+#ifdef _WIN32
+  file_ = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                      nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  LARGE_INTEGER file_size;
+  if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &file_size)) {
+    fmt::print(stderr, "[error] failed to open heightfield: {}\n", file_path);
+    exit(1);
+  }
+  file_size_ = file_size.QuadPart;
+  mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_ != nullptr) {
+    data_ = (const uint8_t *)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+  }
+#else
+  int fd = open(file_path.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0) {
+    fmt::print(stderr, "[error] failed to open heightfield: {}\n", file_path);
+    exit(1);
+  }
+  file_size_ = file_stat.st_size;
+  void *data = mmap(nullptr, file_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file open
+  close(fd);
+  if (data != MAP_FAILED) data_ = (const uint8_t *)data;
+#endif
+  if (data_ == nullptr) {
+    fmt::print(stderr, "[error] failed to map heightfield: {}\n", file_path);
+    exit(1);
+  }
+
+  const HeightfieldHeader &h = header();
+  if (file_size_ < sizeof(HeightfieldHeader) ||
+      memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION) {
+    fmt::print(stderr, "[error] not a heightfield of version {}: {}\n",
+               VERSION, file_path);
+    exit(1);
+  }
+  size_t heights_size = size_t(h.size + 1) * (h.size + 1) * sizeof(uint16_t);
+  if (h.chunk_size == 0 || h.size % h.chunk_size != 0 ||
+      h.chunks_offset + num_chunks() * num_chunks() *
+                            sizeof(HeightfieldChunk) >
+          file_size_ ||
+      h.heights_offset + heights_size > file_size_) {
+    fmt::print(stderr, "[error] truncated heightfield: {}\n", file_path);
+    exit(1);
+  }
+}
+
+HeightfieldFile::~HeightfieldFile() {
+#ifdef _WIN32
+  UnmapViewOfFile(data_);
+  CloseHandle(mapping_);
+  CloseHandle(file_);
+#else
+  munmap((void *)data_, file_size_);
+#endif
+}
+
+glm::mat4 HeightfieldFile::transform() const {
+  return glm::make_mat4(header().transform);
+}
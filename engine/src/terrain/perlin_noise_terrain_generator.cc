@@ -1,12 +1,63 @@
 #include "terrain/perlin_noise_terrain_generator.h"
 
-#include <fmt/core.h>
+#include <fmt/format.h>
 #include <glad/glad.h>
-
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <future>
+#include <glm/gtc/type_ptr.hpp>
+#include <iterator>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#include "parallel.h"
 #include "vertex.h"
 
+namespace {
+
+// formats the blocks across threads and writes them in order, a block per
+// thread at a time so that the memory does not grow with the file
+void WriteBlocks(
+    FILE *fp, uint32_t num_blocks,
+    const std::function<void(uint32_t, fmt::memory_buffer *)> &format) {
+  uint32_t num_tasks = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<fmt::memory_buffer> buffers(num_tasks);
+  for (uint32_t begin = 0; begin < num_blocks; begin += num_tasks) {
+    uint32_t end = std::min(begin + num_tasks, num_blocks);
+    std::vector<std::future<void>> tasks;
+    for (uint32_t block = begin; block < end; block++) {
+      tasks.push_back(std::async(std::launch::async, [&, block]() {
+        fmt::memory_buffer *buffer = &buffers[block - begin];
+        buffer->clear();
+        format(block, buffer);
+      }));
+    }
+    for (auto &task : tasks) task.get();
+    for (uint32_t block = begin; block < end; block++) {
+      const auto &buffer = buffers[block - begin];
+      fwrite(buffer.data(), 1, buffer.size(), fp);
+    }
+  }
+}
+
+// as "%.6f", through integers, the exact decimal expansion of the float
+// formatting otherwise dominates the export
+void AppendFixed6(fmt::memory_buffer *buffer, double value) {
+  int64_t micros = std::llround(value * 1e6);
+  if (micros < 0) {
+    buffer->push_back('-');
+    micros = -micros;
+  }
+  fmt::format_to(std::back_inserter(*buffer), "{}.{:06}", micros / 1000000,
+                 micros % 1000000);
+}
+
+}  // namespace
+
 PerlinNoiseTerrainGenerator::PerlinNoiseTerrainGenerator(int size,
                                                          int subdiv_size,
                                                          double ratio,
@@ -28,51 +79,159 @@ double PerlinNoiseTerrainGenerator::get_height(double x, double y) {
   return perlin_noise_->Noise(x * ratio_, y * ratio_, 0);
 }
 
-void PerlinNoiseTerrainGenerator::ExportToOBJ(const std::string &file_path) {
-  int32_t num_subdivs = size_ / subdiv_size_;
-
-  auto fp = fopen(file_path.c_str(), "w");
-
-  int32_t num_vertices = 0;
-  for (int i = 0; i < num_subdivs; i++)
-    for (int j = 0; j < num_subdivs; j++) {
-      fprintf(fp, "o mesh_%d_%d\n", i, j);
-      std::vector<glm::vec3> v;
-      std::vector<glm::vec2> vt;
-
-      for (int k = i * subdiv_size_; k <= (i + 1) * subdiv_size_; k++)
-        for (int l = j * subdiv_size_; l <= (j + 1) * subdiv_size_; l++) {
-          double x = 1.0 * k / size_;
-          double z = 1.0 * l / size_;
-          double y = get_height(x, z);
-          v.emplace_back(glm::vec3(transform_ * glm::vec4(x, y, z, 1)));
-          vt.emplace_back(x, z);
-        }
+const std::vector<float> &PerlinNoiseTerrainGenerator::heights() {
+  if (!heights_.empty()) return heights_;
+  uint32_t row_size = size_ + 1;
+  uint32_t num_subdivs = size_ / subdiv_size_;
+  heights_.resize(size_t(row_size) * row_size);
+
+  // each grid point is computed by the subdivision it is the min corner of,
+  // or by the last one on the far borders
+  auto range = [&](uint32_t i) {
+    uint32_t begin = i * subdiv_size_;
+    uint32_t end = begin + subdiv_size_ + (i == num_subdivs - 1 ? 1 : 0);
+    return std::make_pair(begin, end);
+  };
+  ParallelFor(num_subdivs * num_subdivs, [&](uint32_t subdiv) {
+    auto [k_begin, k_end] = range(subdiv / num_subdivs);
+    auto [l_begin, l_end] = range(subdiv % num_subdivs);
+    uint32_t n = l_end - l_begin;
+    std::vector<float> xs(n), ys(n), zs(n, 0);
+    for (uint32_t l = l_begin; l < l_end; l++) {
+      ys[l - l_begin] = 1.0 * l / size_ * ratio_;
+    }
+    for (uint32_t k = k_begin; k < k_end; k++) {
+      std::fill(xs.begin(), xs.end(), float(1.0 * k / size_ * ratio_));
+      perlin_noise_->Noise(xs.data(), ys.data(), zs.data(),
+                           heights_.data() + size_t(k) * row_size + l_begin,
+                           n);
+    }
+  });
+  return heights_;
+}
 
-      for (auto vec : v) {
-        fprintf(fp, "v %.6f %.6f %.6f\n", vec.x, vec.y, vec.z);
-      }
-      for (auto vec : vt) {
-        fprintf(fp, "vt %.6f %.6f\n", vec.x, vec.y);
+const std::vector<HeightfieldChunk> &PerlinNoiseTerrainGenerator::chunks() {
+  if (!chunks_.empty()) return chunks_;
+  const std::vector<float> &heights = this->heights();
+  uint32_t row_size = size_ + 1;
+  uint32_t num_subdivs = size_ / subdiv_size_;
+  chunks_.resize(num_subdivs * num_subdivs);
+  ParallelFor(num_subdivs * num_subdivs, [&](uint32_t subdiv) {
+    uint32_t i = subdiv / num_subdivs, j = subdiv % num_subdivs;
+    HeightfieldChunk chunk = {INFINITY, -INFINITY};
+    for (uint32_t k = i * subdiv_size_; k <= (i + 1) * subdiv_size_; k++) {
+      const float *row = heights.data() + size_t(k) * row_size;
+      for (uint32_t l = j * subdiv_size_; l <= (j + 1) * subdiv_size_; l++) {
+        chunk.min_height = std::min(chunk.min_height, row[l]);
+        chunk.max_height = std::max(chunk.max_height, row[l]);
       }
+    }
+    chunks_[subdiv] = chunk;
+  });
+  return chunks_;
+}
 
-      for (int k = 0; k < subdiv_size_; k++)
-        for (int l = 0; l < subdiv_size_; l++) {
-          int a = k * (subdiv_size_ + 1) + l;
-          int b = k * (subdiv_size_ + 1) + l + 1;
-          int c = (k + 1) * (subdiv_size_ + 1) + l;
-          int d = (k + 1) * (subdiv_size_ + 1) + l + 1;
+void PerlinNoiseTerrainGenerator::ExportHeightfield(
+    const std::string &file_path) {
+  const std::vector<float> &heights = this->heights();
+  const std::vector<HeightfieldChunk> &chunks = this->chunks();
+
+  HeightfieldHeader header;
+  memcpy(header.magic, HeightfieldFile::MAGIC, sizeof(header.magic));
+  header.version = HeightfieldFile::VERSION;
+  header.size = size_;
+  header.chunk_size = subdiv_size_;
+  memcpy(header.transform, glm::value_ptr(transform_),
+         sizeof(header.transform));
+  header.min_height = INFINITY;
+  header.max_height = -INFINITY;
+  for (const auto &chunk : chunks) {
+    header.min_height = std::min(header.min_height, chunk.min_height);
+    header.max_height = std::max(header.max_height, chunk.max_height);
+  }
+  header.chunks_offset = sizeof(HeightfieldHeader);
+  header.heights_offset =
+      header.chunks_offset + chunks.size() * sizeof(HeightfieldChunk);
+
+  float scale = header.max_height > header.min_height
+                    ? 65535.0f / (header.max_height - header.min_height)
+                    : 0.0f;
+  uint32_t row_size = size_ + 1;
+  std::vector<uint16_t> unorms(heights.size());
+  ParallelFor(row_size, [&](uint32_t k) {
+    for (size_t i = size_t(k) * row_size; i < size_t(k + 1) * row_size; i++) {
+      unorms[i] =
+          uint16_t((heights[i] - header.min_height) * scale + 0.5f);
+    }
+  });
 
-          a += num_vertices + 1;
-          b += num_vertices + 1;
-          c += num_vertices + 1;
-          d += num_vertices + 1;
+  auto fp = fopen(file_path.c_str(), "wb");
+  if (fp == nullptr) {
+    fmt::print(stderr, "[error] failed to export heightfield: {}\n",
+               file_path);
+    exit(1);
+  }
+  fwrite(&header, sizeof(header), 1, fp);
+  fwrite(chunks.data(), sizeof(HeightfieldChunk), chunks.size(), fp);
+  fwrite(unorms.data(), sizeof(uint16_t), unorms.size(), fp);
+  fclose(fp);
+}
 
-          fprintf(fp, "f %d/%d %d/%d %d/%d %d/%d\n", a, a, b, b, d, d, c, c);
-        }
+void PerlinNoiseTerrainGenerator::ExportToOBJ(const std::string &file_path) {
+  const std::vector<float> &heights = this->heights();
+  uint32_t row_size = size_ + 1;
+  uint32_t num_subdivs = size_ / subdiv_size_;
+
+  auto fp = fopen(file_path.c_str(), "w");
+  if (fp == nullptr) {
+    fmt::print(stderr, "[error] failed to export OBJ: {}\n", file_path);
+    exit(1);
+  }
 
-      num_vertices += v.size();
+  // the vertices of the whole grid, a row per block
+  WriteBlocks(fp, row_size, [&](uint32_t k, fmt::memory_buffer *buffer) {
+    for (uint32_t l = 0; l < row_size; l++) {
+      double x = 1.0 * k / size_;
+      double z = 1.0 * l / size_;
+      double y = heights[size_t(k) * row_size + l];
+      glm::vec3 v = glm::vec3(transform_ * glm::vec4(x, y, z, 1));
+      buffer->append(std::string_view("v"));
+      for (int c = 0; c < 3; c++) {
+        buffer->push_back(' ');
+        AppendFixed6(buffer, v[c]);
+      }
+      buffer->push_back('\n');
+    }
+  });
+  WriteBlocks(fp, row_size, [&](uint32_t k, fmt::memory_buffer *buffer) {
+    for (uint32_t l = 0; l < row_size; l++) {
+      buffer->append(std::string_view("vt "));
+      AppendFixed6(buffer, float(1.0 * k / size_));
+      buffer->push_back(' ');
+      AppendFixed6(buffer, float(1.0 * l / size_));
+      buffer->push_back('\n');
     }
+  });
+
+  // then the faces of each subdivision, the indices are global and 1-based
+  WriteBlocks(
+      fp, num_subdivs * num_subdivs,
+      [&](uint32_t subdiv, fmt::memory_buffer *buffer) {
+        uint32_t i = subdiv / num_subdivs, j = subdiv % num_subdivs;
+        fmt::format_to(std::back_inserter(*buffer), "o mesh_{}_{}\n", i, j);
+        for (uint32_t k = i * subdiv_size_; k < (i + 1) * subdiv_size_; k++) {
+          for (uint32_t l = j * subdiv_size_; l < (j + 1) * subdiv_size_;
+               l++) {
+            uint32_t a = k * row_size + l + 1;
+            uint32_t b = a + 1;
+            uint32_t c = a + row_size;
+            uint32_t d = c + 1;
+            fmt::format_to(std::back_inserter(*buffer),
+                           "f {}/{} {}/{} {}/{} {}/{}\n", a, a, b, b, d, d, c,
+                           c);
+          }
+        }
+      });
 
   fclose(fp);
-}
\ No newline at end of file
+}
@@ -1,11 +1,22 @@
-#version 410 core
+#version 460 core
 
 layout (location = 0) in vec3 aPosition;
 layout (location = 1) in vec2 aTexCoord;
 layout (location = 2) in vec3 aNormal;
-layout (location = 3) in mat4 aBladeTransform;
-layout (location = 7) in vec3 aBladePosition;
-layout (location = 8) in vec2 aBladeTexCoord;
+// BladeRecord: the position unorms and the leaf index, the shape unorms, and
+// the half float tex coords
+layout (location = 3) in uvec4 aBladePositionAndLeaf;
+layout (location = 4) in vec4 aBladeShape;
+layout (location = 5) in uint aBladeTexCoord;
+
+struct LeafBounds {
+    vec3 min;
+    vec3 max;
+};
+
+layout (std430, binding = LEAF_BOUNDS_BINDING) buffer leafBoundsBuffer {
+    LeafBounds leafBounds[];
+};
 
 out vec3 vPosition;
 out vec2 vTexCoord;
@@ -20,8 +31,40 @@ uniform mat4 uProjectionMatrix;
 
 #include "common/rotate.glsl"
 
+const vec2 kWidthRange = vec2(0.15, 0.3);
+const vec2 kHeightRange = vec2(0.5, 1.2);
+const vec2 kBendRange = vec2(-PI / 6, PI / 6);
+
+vec3 DecodeBladePosition() {
+    LeafBounds bounds = leafBounds[aBladePositionAndLeaf.w];
+    return mix(bounds.min, bounds.max, vec3(aBladePositionAndLeaf.xyz) / 65535.0);
+}
+
+mat4 DecodeBladeTransform() {
+    float theta = aBladeShape.x * 2 * PI;
+    float bend = mix(kBendRange.x, kBendRange.y, aBladeShape.y);
+    float width = mix(kWidthRange.x, kWidthRange.y, aBladeShape.z);
+    float height = mix(kHeightRange.x, kHeightRange.y, aBladeShape.w);
+    return mat4(
+        vec4(cos(theta), 0.0, -sin(theta), 0.0),
+        vec4(0.0, 1.0, 0.0, 0.0),
+        vec4(sin(theta), 0.0, cos(theta), 0.0),
+        vec4(0.0, 0.0, 0.0, 1.0)
+    ) * mat4(
+        vec4(1.0, 0.0, 0.0, 0.0),
+        vec4(0.0, cos(bend), sin(bend), 0.0),
+        vec4(0.0, -sin(bend), cos(bend), 0.0),
+        vec4(0.0, 0.0, 0.0, 1.0)
+    ) * mat4(
+        vec4(width, 0.0, 0.0, 0.0),
+        vec4(0.0, height, 0.0, 0.0),
+        vec4(0.0, 0.0, 1.0, 0.0),
+        vec4(0.0, 0.0, 0.0, 1.0)
+    );
+}
+
 mat4 CalcWindRotation() {
-    vec2 uv = aBladeTexCoord + uWindFrequency * uTime;
+    vec2 uv = unpackHalf2x16(aBladeTexCoord) + uWindFrequency * uTime;
     vec2 sampled = texture(uDistortionTexture, uv).xy * 2.0f - 1.0f;
     return Rotate(
         vec3(sampled.x, 0, sampled.y),
@@ -34,8 +77,8 @@ void main() {
         vec4(1.0, 0.0, 0.0, 0.0),
         vec4(0.0, 1.0, 0.0, 0.0),
         vec4(0.0, 0.0, 1.0, 0.0),
-        vec4(aBladePosition, 1.0)
-    ) * CalcWindRotation() * aBladeTransform;
+        vec4(DecodeBladePosition(), 1.0)
+    ) * CalcWindRotation() * DecodeBladeTransform();
     gl_Position = uProjectionMatrix * uViewMatrix * modelMatrix * vec4(aPosition, 1);
     vPosition = vec3(modelMatrix * vec4(aPosition, 1));
     vTexCoord = aTexCoord;
@@ -0,0 +1,48 @@
+// requires aabb.glsl
+
+// max-depth pyramid built by hi_z/build.comp
+uniform sampler2D uHiZ;
+uniform ivec2 uHiZSize;
+uniform int uHiZNumLevels;
+
+float HiZFetch(ivec2 pixel, int level) {
+    ivec2 levelSize = max(uHiZSize >> level, ivec2(1));
+    return texelFetch(uHiZ, min(pixel >> level, levelSize - 1), level).r;
+}
+
+// conservative, returns false only when the whole AABB is behind the depth in
+// the pyramid, see HiZBuffer::AABBIsVisible() for the CPU reference
+bool AABBIsVisibleInHiZ(AABB aabb, mat4 viewProjection) {
+    vec3 ndcMin = vec3(FLT_MAX);
+    vec3 ndcMax = vec3(-FLT_MAX);
+    for (int i = 0; i < 8; i++) {
+        vec3 corner = vec3(
+            (i & 1) == 0 ? aabb.coordsMin.x : aabb.coordsMax.x,
+            (i & 2) == 0 ? aabb.coordsMin.y : aabb.coordsMax.y,
+            (i & 4) == 0 ? aabb.coordsMin.z : aabb.coordsMax.z);
+        vec4 clip = viewProjection * vec4(corner, 1);
+        // the AABB crosses the near plane
+        if (clip.w <= 0) return true;
+        vec3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+
+    vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0);
+    vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0);
+    float depthMin = ndcMin.z * 0.5 + 0.5;
+    ivec2 pixelMin = min(ivec2(uvMin * vec2(uHiZSize)), uHiZSize - 1);
+    ivec2 pixelMax = min(ivec2(uvMax * vec2(uHiZSize)), uHiZSize - 1);
+
+    // the coarsest level at which the AABB covers at most 2x2 texels
+    int level = 0;
+    while (level < uHiZNumLevels - 1 &&
+           any(greaterThan((pixelMax >> level) - (pixelMin >> level), ivec2(1)))) {
+        level++;
+    }
+
+    float maxDepth = max(
+        max(HiZFetch(pixelMin, level), HiZFetch(ivec2(pixelMax.x, pixelMin.y), level)),
+        max(HiZFetch(ivec2(pixelMin.x, pixelMax.y), level), HiZFetch(pixelMax, level)));
+    return depthMin <= maxDepth;
+}
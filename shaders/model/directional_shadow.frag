@@ -7,7 +7,7 @@
 #include "common/alpha_test.glsl"
 
 layout (std430, binding = 6) buffer materialsBuffer {
-    Material materials[]; // per instance
+    Material materials[]; // deduplicated, indexed by materialID
 };
 layout (std430, binding = 7) buffer texturesBuffer {
     sampler2D textures[];
@@ -17,13 +17,15 @@ in vOutputs {
     vec3 position;
     vec2 texCoord;
     mat3 TBN;
-    flat int instanceID;
+    flat int materialID;
 } vOut;
 
 uniform uint uLightIndex;
+// the cascade, i.e. the layer of the shadow map, the draw renders into
+uniform int uCascade;
 
 void main() {
-    Material material = materials[vOut.instanceID];
+    Material material = materials[vOut.materialID];
     float alpha = 1;
     if (material.diffuseTexture >= 0) {
         vec4 sampled = texture(textures[material.diffuseTexture], vOut.texCoord);
@@ -38,9 +40,9 @@ void main() {
         0.05 * (1.0 - dot(normalize(vOut.TBN[2]), normalize(-directionalShadow.dir))),
         0.005, 0.1
     );
-    if (gl_Layer < NUM_MOVING_CASCADES) {
+    if (uCascade < NUM_MOVING_CASCADES) {
         const float biasModifier = 0.5;
-        bias *= 1 / (directionalShadow.cascadePlaneDistances[gl_Layer * 2 + 1] * biasModifier);
+        bias *= 1 / (directionalShadow.cascadePlaneDistances[uCascade * 2 + 1] * biasModifier);
     }
     gl_FragDepth = gl_FragCoord.z + (gl_FrontFacing ? bias : 0);
 }
@@ -11,7 +11,7 @@ in vOutputs {
     vec3 position;
     vec2 texCoord;
     mat3 TBN;
-    flat int instanceID;
+    flat int materialID;
 } vOut;
 
 #include "light_sources.glsl"
@@ -21,7 +21,7 @@ uniform bool uDefaultShading;
 uniform bool uForcePBR;
 
 layout (std430, binding = 6) buffer materialsBuffer {
-    Material materials[]; // per instance
+    Material materials[]; // deduplicated, indexed by materialID
 };
 layout (std430, binding = 7) buffer texturesBuffer {
     sampler2D textures[];
@@ -49,7 +49,7 @@ void SampleForGBuffer(
         return;
     }
 
-    Material material = materials[vOut.instanceID];
+    Material material = materials[vOut.materialID];
 
     if (material.metalnessTexture < 0 && !uForcePBR) {
         // for Phong
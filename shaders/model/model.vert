@@ -15,7 +15,7 @@ out vOutputs {
     vec3 position;
     vec2 texCoord;
     mat3 TBN;
-    flat int instanceID;
+    flat int materialID;
 } vOut;
 
 layout (std430, binding = 0) buffer modelMatricesBuffer {
@@ -36,12 +36,21 @@ layout (std430, binding = 4) buffer transformsBuffer {
 layout (std430, binding = 5) buffer clipPlanesBuffer {
     vec4 clipPlanes[]; // per instance
 };
+layout (std430, binding = 8) buffer instanceIDsBuffer {
+    uint instanceIDs[]; // per drawn instance, written by the culling pass
+};
+layout (std430, binding = 9) buffer instanceToMeshBuffer {
+    uint instanceToMesh[]; // per instance
+};
+layout (std430, binding = 10) buffer meshToMaterialBuffer {
+    uint meshToMaterial[]; // per mesh
+};
 
 uniform mat4 uViewMatrix;
 uniform mat4 uProjectionMatrix;
 
-mat4 CalcBoneMatrix() {
-    int offset = boneMatricesOffset[vOut.instanceID];
+mat4 CalcBoneMatrix(uint instanceID) {
+    int offset = boneMatricesOffset[instanceID];
     mat4 boneMatrix = mat4(0);
     for (int i = 0; i < 4; i++) {
         if (aBoneIDs0[i] < 0) return boneMatrix;
@@ -59,14 +68,15 @@ mat4 CalcBoneMatrix() {
 }
 
 void main() {
-    vOut.instanceID = gl_BaseInstance + gl_InstanceID;
+    uint instanceID = instanceIDs[gl_BaseInstance + gl_InstanceID];
+    vOut.materialID = int(meshToMaterial[instanceToMesh[instanceID]]);
     mat4 transform;
-    if (bool(animated[vOut.instanceID])) {
-        transform = CalcBoneMatrix();
+    if (bool(animated[instanceID])) {
+        transform = CalcBoneMatrix(instanceID);
     } else {
-        transform = transforms[vOut.instanceID];
+        transform = transforms[instanceID];
     }
-    mat4 modelMatrix = modelMatrices[vOut.instanceID];
+    mat4 modelMatrix = modelMatrices[instanceID];
     vOut.texCoord = aTexCoord;
     mat3 normalMatrix = transpose(inverse(mat3(modelMatrix * transform)));
     vec3 T = normalize(normalMatrix * aTangent);
@@ -78,5 +88,5 @@ void main() {
     gl_Position = uProjectionMatrix * uViewMatrix * modelMatrix * transform * vec4(aPosition, 1);
     vOut.position = vec3(modelMatrix * transform * vec4(aPosition, 1));
 
-    gl_ClipDistance[0] = dot(vec4(vOut.position, 1), clipPlanes[vOut.instanceID]);
+    gl_ClipDistance[0] = dot(vec4(vOut.position, 1), clipPlanes[instanceID]);
 }
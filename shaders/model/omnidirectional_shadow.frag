@@ -7,7 +7,7 @@
 #include "common/alpha_test.glsl"
 
 layout (std430, binding = 6) buffer materialsBuffer {
-    Material materials[]; // per instance
+    Material materials[]; // deduplicated, indexed by materialID
 };
 layout (std430, binding = 7) buffer texturesBuffer {
     sampler2D textures[];
@@ -15,13 +15,13 @@ layout (std430, binding = 7) buffer texturesBuffer {
 
 in vec2 gTexCoord;
 in mat3 gTBN;
-flat in int gInstanceID;
+flat in int gMaterialID;
 in vec3 gPosition;
 
 uniform uint uLightIndex;
 
 void main() {
-    Material material = materials[gInstanceID];
+    Material material = materials[gMaterialID];
     float alpha = 1;
     if (material.diffuseTexture >= 0) {
         vec4 sampled = texture(textures[material.diffuseTexture], gTexCoord);
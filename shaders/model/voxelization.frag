@@ -11,7 +11,7 @@ layout (r32ui) uniform volatile coherent uimage3D uMetallicAndRoughnessImage;
 uniform uint uVoxelResolution;
 
 layout (std430, binding = 6) buffer materialsBuffer {
-    Material materials[]; // per instance
+    Material materials[]; // deduplicated, indexed by materialID
 };
 layout (std430, binding = 7) buffer texturesBuffer {
     sampler2D textures[];
@@ -19,7 +19,7 @@ layout (std430, binding = 7) buffer texturesBuffer {
 
 in vec2 gTexCoord;
 in mat3 gTBN;
-flat in int gInstanceID;
+flat in int gMaterialID;
 flat in int gAxis;
 
 void ImageAtomicRGBA8Avg(layout (r32ui) coherent volatile uimage3D image, ivec3 coord, vec4 value) {
@@ -58,7 +58,7 @@ ivec3 GetVoxelPosition() {
 }
 
 void main() {
-    Material material = materials[gInstanceID];
+    Material material = materials[gMaterialID];
 
     float alpha = 1;
     vec3 albedo = material.albedo;
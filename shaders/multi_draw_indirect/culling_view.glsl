@@ -0,0 +1,36 @@
+#include "aabb.glsl"
+#include "obb/obb.glsl"
+
+const uint CULLING_VIEW_TYPE_ALL = 0;
+const uint CULLING_VIEW_TYPE_FRUSTUM = 1;
+const uint CULLING_VIEW_TYPE_OBB = 2;
+
+// the instances that may pass, dynamic ones are animated or moving
+const uint CULLING_VIEW_ALL_CASTERS = 0;
+const uint CULLING_VIEW_STATIC_CASTERS = 1;
+const uint CULLING_VIEW_DYNAMIC_CASTERS = 2;
+
+// at most 32 views, so that the visibility of an instance fits in a uint
+const uint MAX_CULLING_VIEWS = 32;
+
+struct CullingView {
+    OBB obb;
+    Frustum frustum;
+    uint type;
+    uint casters;
+};
+
+bool CastersPassCullingView(bool dynamic, CullingView view) {
+    return view.casters == CULLING_VIEW_ALL_CASTERS ||
+           dynamic == (view.casters == CULLING_VIEW_DYNAMIC_CASTERS);
+}
+
+bool AABBIsInCullingView(AABB aabb, CullingView view) {
+    if (view.type == CULLING_VIEW_TYPE_FRUSTUM) {
+        return AABBIsOnFrustum(aabb, view.frustum);
+    } else if (view.type == CULLING_VIEW_TYPE_OBB) {
+        OBB obb = OBB(aabb.coordsMin, aabb.coordsMax, mat3(1));
+        return IntersectsOBB(obb, view.obb, 1e-4);
+    }
+    return true;
+}
@@ -9,6 +9,8 @@ struct DirectionalShadow {
     // Cascaded Shadow Mapping
     mat4 transformationMatrices[NUM_CASCADES];
     bool requiresUpdate[NUM_CASCADES];
+    // the layer of the shadow map per cascade, shared with other lights
+    int layers[NUM_CASCADES];
     float cascadePlaneDistances[NUM_MOVING_CASCADES * 2];
     sampler2DArray shadowMap;
     vec3 dir;
@@ -16,7 +18,9 @@ struct DirectionalShadow {
 
 struct OmnidirectionalShadow {
     mat4 viewProjectionMatrices[6];
-    samplerCube shadowMap;
+    // per cube face, the offset and the size of its tile in the shadow atlas
+    vec4 atlasRects[6];
+    sampler2D shadowMap;
     vec3 pos;
     float radius;
     float farPlane;
@@ -26,6 +30,11 @@ layout (std430, binding = POISSON_DISK_2D_BINDING) buffer poissonDisk2DPointsBuf
     vec2 poissonDisk2DPoints[];
 };
 
+// xyz in [0, 1)^3, w is padding
+layout (std430, binding = POISSON_DISK_3D_BINDING) buffer poissonDisk3DPointsBuffer {
+    vec4 poissonDisk3DPoints[];
+};
+
 float CalcDirectionalShadowForSingleCascade(DirectionalShadow directionalShadow, uint layer, vec3 position) {
     vec4 homoPosition = directionalShadow.transformationMatrices[layer] * vec4(position, 1.0);
 
@@ -44,7 +53,7 @@ float CalcDirectionalShadowForSingleCascade(DirectionalShadow directionalShadow,
         vec2 delta = poissonDisk2DPoints[i] * (2 * offset) - offset;
         float closestDepth = texture(
             directionalShadow.shadowMap,
-            vec3(position.xy + delta, layer)
+            vec3(position.xy + delta, directionalShadow.layers[layer])
         ).r;
         shadow += currentDepth > closestDepth ? 1.0 : 0.0;
     }
@@ -75,29 +84,52 @@ float CalcDirectionalShadow(
     return 1;
 }
 
+// the cube faces are tiles of a shadow atlas, samples them like a cubemap
+float SampleOmnidirectionalShadow(OmnidirectionalShadow omnidirectionalShadow, vec3 dir) {
+    // +x, -x, +y, -y, +z, -z like the cubemap faces
+    vec3 absDir = abs(dir);
+    int face;
+    if (absDir.x >= absDir.y && absDir.x >= absDir.z) {
+        face = dir.x >= 0 ? 0 : 1;
+    } else if (absDir.y >= absDir.z) {
+        face = dir.y >= 0 ? 2 : 3;
+    } else {
+        face = dir.z >= 0 ? 4 : 5;
+    }
+
+    vec4 homoPosition = omnidirectionalShadow.viewProjectionMatrices[face] * vec4(omnidirectionalShadow.pos + dir, 1);
+    vec2 uv = homoPosition.xy / homoPosition.w * 0.5 + 0.5;
+
+    // keep the bilinear footprint inside the tile
+    vec4 rect = omnidirectionalShadow.atlasRects[face];
+    vec2 halfTexel = 0.5 / textureSize(omnidirectionalShadow.shadowMap, 0);
+    uv = clamp(rect.xy + uv * rect.zw, rect.xy + halfTexel, rect.xy + rect.zw - halfTexel);
+    return texture(omnidirectionalShadow.shadowMap, uv).r;
+}
+
 float CalcOmnidirectionalShadow(OmnidirectionalShadow omnidirectionalShadow, vec3 position) {
     // PCSS
     vec3 dir = position - omnidirectionalShadow.pos;
     vec3 normalizedDir = normalize(dir);
     float currentDepth = distance(position, omnidirectionalShadow.pos) / omnidirectionalShadow.farPlane;
 
+    // runs of the shuffled Poisson disk points, from a random start per
+    // fragment, rather than the regular grids of 3^3 and 4^3 samples
+    int sampleStart = int(rand(position.xz + position.y) * (poissonDisk3DPoints.length() - 32));
+
     float blockDepth = 0;
     {
         // blocker search
         int count = 0;
         float offset = 0.1;
-        const int numSamples = 3;
-        for (int x = 0; x < numSamples; x++) {
-            for (int y = 0; y < numSamples; y++) {
-                for (int z = 0; z < numSamples; z++) {
-                    vec3 delta = vec3(x, y, z) / numSamples * (2 * offset) - offset; // [-offset, offset]
-                    float depth = texture(omnidirectionalShadow.shadowMap, normalizedDir + delta).r;
-                    if (depth < currentDepth) {
-                        // is a blocker
-                        count++;
-                        blockDepth += depth;
-                    }
-                }
+        const int numSamples = 16;
+        for (int i = sampleStart; i < sampleStart + numSamples; i++) {
+            vec3 delta = poissonDisk3DPoints[i].xyz * (2 * offset) - offset; // [-offset, offset]
+            float depth = SampleOmnidirectionalShadow(omnidirectionalShadow, normalizedDir + delta);
+            if (depth < currentDepth) {
+                // is a blocker
+                count++;
+                blockDepth += depth;
             }
         }
         if (count == 0) return 0;
@@ -108,15 +140,13 @@ float CalcOmnidirectionalShadow(OmnidirectionalShadow omnidirectionalShadow, vec
     {
         // sampling
         float offset = (omnidirectionalShadow.radius / blockDepth) * (currentDepth - blockDepth);
-        const int numSamples = 4;
-        for (int x = 0; x < numSamples; x++)
-            for (int y = 0; y < numSamples; y++)
-                for (int z = 0; z < numSamples; z++) {
-                    vec3 delta = vec3(x, y, z) / numSamples * (2 * offset) - offset;
-                    float depth = texture(omnidirectionalShadow.shadowMap, dir + delta).r;
-                    shadow += int(depth < currentDepth);
-                }
-        shadow /= pow(numSamples, 3);
+        const int numSamples = 32;
+        for (int i = sampleStart; i < sampleStart + numSamples; i++) {
+            vec3 delta = poissonDisk3DPoints[i].xyz * (2 * offset) - offset;
+            float depth = SampleOmnidirectionalShadow(omnidirectionalShadow, dir + delta);
+            shadow += int(depth < currentDepth);
+        }
+        shadow /= numSamples;
     }
 
     return shadow;
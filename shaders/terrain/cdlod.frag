@@ -0,0 +1,36 @@
+#version 460 core
+
+#extension GL_ARB_bindless_texture : require
+
+const float zero = 1e-6;
+
+uniform vec3 uCameraPosition;
+uniform mat4 uViewMatrix;
+
+in vec3 vPosition;
+in vec2 vTexCoord;
+in vec3 vNormal;
+
+#include "light_sources.glsl"
+
+out vec4 fragColor;
+
+vec4 CalcFragColor() {
+    vec3 grass = vec3(86.0, 125.0, 70.0) / 255.0;
+    vec3 rock = vec3(120.0, 110.0, 100.0) / 255.0;
+    vec3 normal = normalize(vNormal);
+    // the steep slopes are bare
+    vec3 albedo = mix(rock, grass, smoothstep(0.7, 0.9, normal.y));
+
+    vec3 color = CalcPhongLighting(
+        albedo, albedo, vec3(zero), vec3(zero),
+        normal, uCameraPosition, vPosition,
+        0, uViewMatrix
+    );
+
+    return vec4(color, 1.0);
+}
+
+void main() {
+    fragColor = CalcFragColor();
+}
@@ -0,0 +1,58 @@
+#version 460 core
+
+// the grid point of the patch, in [0, uPatchSize]^2
+layout (location = 0) in vec2 aGridPosition;
+// CDLODQuadtree::Patch: the origin and the size in the heightfield
+// coordinates of [0, 1]^2, and the LOD
+layout (location = 1) in vec4 aPatch;
+
+out vec3 vPosition;
+out vec2 vTexCoord;
+out vec3 vNormal;
+
+uniform sampler2D uHeightTexture;
+uniform vec2 uHeightRange;
+uniform float uHeightfieldSize;
+uniform float uPatchSize;
+// the start and the end of the morph of each LOD
+uniform float uMorphRanges[MAX_NUM_LODS * 2];
+
+uniform mat4 uTransform;
+uniform mat4 uNormalMatrix;
+uniform vec3 uCameraPosition;
+uniform mat4 uViewMatrix;
+uniform mat4 uProjectionMatrix;
+
+float SampleHeight(vec2 xz) {
+    // the texels are the grid points, and the texture rows are along x
+    vec2 uv = (xz * uHeightfieldSize + 0.5) / (uHeightfieldSize + 1);
+    float unorm = textureLod(uHeightTexture, uv.yx, 0).r;
+    return mix(uHeightRange.x, uHeightRange.y, unorm);
+}
+
+vec3 WorldPosition(vec2 xz) {
+    return vec3(uTransform * vec4(xz.x, SampleHeight(xz), xz.y, 1));
+}
+
+void main() {
+    float spacing = aPatch.z / uPatchSize;
+    vec2 xz = aPatch.xy + aGridPosition * spacing;
+
+    // the odd grid points slide onto the grid of the next LOD as the patch
+    // gets farther, so that it meets the coarser patches around it
+    int lod = int(aPatch.w);
+    float distance = length(WorldPosition(xz) - uCameraPosition);
+    float morphStart = uMorphRanges[lod * 2], morphEnd = uMorphRanges[lod * 2 + 1];
+    float morph = clamp((distance - morphStart) / (morphEnd - morphStart), 0, 1);
+    xz -= fract(aGridPosition * 0.5) * 2.0 * spacing * morph;
+
+    // central differences over a texel, the normal of y = h(x, z)
+    float texel = 1.0 / uHeightfieldSize;
+    float dx = SampleHeight(xz + vec2(texel, 0)) - SampleHeight(xz - vec2(texel, 0));
+    float dz = SampleHeight(xz + vec2(0, texel)) - SampleHeight(xz - vec2(0, texel));
+    vNormal = normalize(mat3(uNormalMatrix) * vec3(-dx, 2 * texel, -dz));
+
+    vPosition = WorldPosition(xz);
+    vTexCoord = xz;
+    gl_Position = uProjectionMatrix * uViewMatrix * vec4(vPosition, 1);
+}